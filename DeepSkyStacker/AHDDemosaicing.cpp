@@ -46,3 +46,10 @@ void CRGBToLab::RGBToLab(double fRed, double fGreen, double fBlue, double & L, d
 };
 
 /* ------------------------------------------------------------------- */
+
+const float *	CRGBToLab::GetLUT()
+{
+	return g_vLUT.data();
+};
+
+/* ------------------------------------------------------------------- */
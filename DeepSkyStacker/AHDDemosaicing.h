@@ -1,6 +1,8 @@
 #ifndef __AHDDEMOSAICING_H__
 #define __AHDDEMOSAICING_H__
 
+#include "avx_ahd.h"
+
 /* ------------------------------------------------------------------- */
 
 class CRGBToLab
@@ -9,6 +11,9 @@ public :
 	CRGBToLab();
 
 	void	RGBToLab(double fRed, double fGreen, double fBlue, double & L, double & a, double & b);
+
+	// Cube root table used by RGBToLab (65536 entries)
+	static const float *	GetLUT();
 };
 
 /* ------------------------------------------------------------------- */
@@ -58,6 +63,7 @@ class CAHDTask : public CMultitask
 public :
 	CDSSProgress *							pProgress;
 	CRGBToLab								RGBToLab;
+	AvxAHD									avxAHD;
 	CSmartPtr<CGrayBitmapT<TType> >			pGrayBitmap;
 	CSmartPtr<CColorBitmapT<TType> >		pColorBitmap;
 	CSmartPtr<CMemoryBitmap>				pOutputBitmap;
@@ -80,7 +86,7 @@ public :
 
 	virtual bool	Process();
 	virtual void	DoSubWindow(LONG x, LONG y, CAHDTaskVariables<TType> & var);
-	virtual bool	DoTask(HANDLE hEvent);
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
 
 	virtual void	InterpolateBorders();
 };
@@ -114,7 +120,6 @@ inline bool	CAHDTask<TType>::Process()
 	LONG			lNrWindows;
 	LONG			lNrWindowsWidth,
 					lNrWindowsHeight;
-	LONG			x, y;
 
 	lNrWindowsWidth = lWidth/(AHDWS-4);
 	if (lWidth % (AHDWS-4))
@@ -132,24 +137,7 @@ inline bool	CAHDTask<TType>::Process()
 		pProgress->SetNrUsedProcessors(GetNrThreads());
 	};
 
-	lNrWindows = 0;
-
-	for (y = 0;y<lHeight;y+=AHDWS-4)
-	{
-		for (x= 0;x<lWidth;x+=AHDWS-4)
-		{
-			DWORD			dwThreadId;
-
-			dwThreadId = GetAvailableThreadId();
-			PostThreadMessage(dwThreadId, WM_MT_PROCESS, x, y);
-
-			lNrWindows++;
-			if (pProgress)
-				pProgress->Progress2(nullptr, lNrWindows);
-		};
-	};
-
-	CloseAllThreads();
+	bResult = ProcessRange(0, lNrWindows, pProgress);
 	if (pProgress)
 	{
 		pProgress->SetNrUsedProcessors();
@@ -530,6 +518,15 @@ inline void	CAHDTask<TType>::DoSubWindow(LONG x, LONG y, CAHDTaskVariables<TType
 		pVaPixel		= pVBaseaPixel + (wy-y)*AHDWS;
 		pVbPixel		= pVBasebPixel + (wy-y)*AHDWS;
 
+		if constexpr (std::is_same<TType, WORD>::value)
+		{
+			const size_t		lNrPixels = min(lWidth, x+AHDWS) - x;
+
+			if (!avxAHD.labLine(pHRedPixel, pHGreenPixel, pHBluePixel, pHLPixel, pHaPixel, pHbPixel, CRGBToLab::GetLUT(), fMultiplier, lNrPixels) &&
+				!avxAHD.labLine(pVRedPixel, pVGreenPixel, pVBluePixel, pVLPixel, pVaPixel, pVbPixel, CRGBToLab::GetLUT(), fMultiplier, lNrPixels))
+				continue;
+		};
+
 		for (wx = x;wx<lWidth && wx <x+AHDWS;wx++)
 		{
 			double				fRed, fGreen, fBlue;
@@ -588,6 +585,9 @@ inline void	CAHDTask<TType>::DoSubWindow(LONG x, LONG y, CAHDTaskVariables<TType
 		pHHomoPixel		= pHBaseHomoPixel + (wy-y)*AHDWS;
 		pVHomoPixel		= pVBaseHomoPixel + (wy-y)*AHDWS;
 
+		if (!avxAHD.homogeneityLine(pHLPixel, pHaPixel, pHbPixel, pVLPixel, pVaPixel, pVbPixel, pHHomoPixel, pVHomoPixel, AHDWS, min(lWidth, x+AHDWS) - x))
+			continue;
+
 		for (wx = x;wx<lWidth && wx <x+AHDWS;wx++)
 		{
 			LONG				i;
@@ -716,30 +716,16 @@ inline void	CAHDTask<TType>::DoSubWindow(LONG x, LONG y, CAHDTaskVariables<TType
 /* ------------------------------------------------------------------- */
 
 template <typename TType>
-inline bool	CAHDTask<TType>::DoTask(HANDLE hEvent)
+inline bool	CAHDTask<TType>::DoTask(LONG lStart, LONG lEnd)
 {
-	LONG						x, y;
-	bool						bEnd = false;
-	MSG							msg;
+	const LONG					lNrWindowsWidth = (lWidth + AHDWS-5) / (AHDWS-4);
 	CAHDTaskVariables<TType>	var;
 
 	if (var.Init())
 	{
-		// Create a message queue and signal the event
-		PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-		SetEvent(hEvent);
-		while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
-		{
-			if (msg.message == WM_MT_PROCESS)
-			{
-				x = msg.wParam;
-				y = msg.lParam;
-				DoSubWindow(x, y, var);
-				SetEvent(hEvent);
-			}
-			else if (msg.message == WM_MT_STOP)
-				bEnd = true;
-		};
+		// Each item is a sub window
+		for (LONG lWindow = lStart;lWindow<lEnd;lWindow++)
+			DoSubWindow((lWindow % lNrWindowsWidth) * (AHDWS-4), (lWindow / lNrWindowsWidth) * (AHDWS-4), var);
 	};
 
 	return true;
@@ -976,7 +962,6 @@ inline bool	AHDDemosaicing(CGrayBitmapT<TType> * pGrayBitmap, CMemoryBitmap ** p
 	bResult = AHDTask.Init(pGrayBitmap, pProgress);
 	if (bResult)
 	{
-		AHDTask.StartThreads();
 		AHDTask.Process();
 
 		AHDTask.InterpolateBorders();
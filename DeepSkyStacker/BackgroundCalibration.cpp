@@ -44,7 +44,7 @@ public :
 		m_vBlueHisto.resize((LONG)MAXWORD+1);
 	};
 
-	virtual bool	DoTask(HANDLE hEvent);
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
 	virtual bool	Process();
 };
 
@@ -64,14 +64,12 @@ void	CBackgroundCalibrationTask::AddToMainHistograms(const std::vector<LONG> & v
 
 /* ------------------------------------------------------------------- */
 
-bool	CBackgroundCalibrationTask::DoTask(HANDLE hEvent)
+bool	CBackgroundCalibrationTask::DoTask(LONG lStart, LONG lEnd)
 {
 	ZFUNCTRACE_RUNTIME();
 	bool				bResult = true;
 
 	LONG				i, j;
-	bool				bEnd = false;
-	MSG					msg;
 	LONG				lWidth = m_pBitmap->Width();
 	double				fMultiplier = m_pBackgroundCalibration->m_fMultiplier;
 	std::vector<LONG>	vRedHisto;
@@ -84,42 +82,29 @@ bool	CBackgroundCalibrationTask::DoTask(HANDLE hEvent)
 
 	AvxHistogram avxHistogram(*m_pBitmap);
 
-	// Create a message queue and signal the event
-	PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-	SetEvent(hEvent);
-	while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+	if (avxHistogram.calcHistogram(lStart, lEnd) != 0)
 	{
-		if (msg.message == WM_MT_PROCESS)
+		for (j = lStart; j < lEnd; j++)
 		{
-			if (avxHistogram.calcHistogram(msg.wParam, msg.wParam + msg.lParam) != 0)
+			for (i = 0; i < lWidth; i++)
 			{
-				for (j = msg.wParam; j < msg.wParam + msg.lParam; j++)
-				{
-					for (i = 0; i < lWidth; i++)
-					{
-						COLORREF16		crColor;
-						double			fRed, fGreen, fBlue;
-
-						m_pBitmap->GetPixel(i, j, fRed, fGreen, fBlue);
-						fRed *= fMultiplier * 256.0;
-						fGreen *= fMultiplier * 256.0;
-						fBlue *= fMultiplier * 256.0;
-
-						crColor.red = min(fRed, static_cast<double>(MAXWORD));
-						crColor.blue = min(fBlue, static_cast<double>(MAXWORD));
-						crColor.green = min(fGreen, static_cast<double>(MAXWORD));
-
-						vRedHisto[crColor.red]++;
-						vGreenHisto[crColor.green]++;
-						vBlueHisto[crColor.blue]++;
-					};
-				};
-			};
+				COLORREF16		crColor;
+				double			fRed, fGreen, fBlue;
 
-			SetEvent(hEvent);
-		}
-		else if (msg.message == WM_MT_STOP)
-			bEnd = true;
+				m_pBitmap->GetPixel(i, j, fRed, fGreen, fBlue);
+				fRed *= fMultiplier * 256.0;
+				fGreen *= fMultiplier * 256.0;
+				fBlue *= fMultiplier * 256.0;
+
+				crColor.red = min(fRed, static_cast<double>(MAXWORD));
+				crColor.blue = min(fBlue, static_cast<double>(MAXWORD));
+				crColor.green = min(fGreen, static_cast<double>(MAXWORD));
+
+				vRedHisto[crColor.red]++;
+				vGreenHisto[crColor.green]++;
+				vBlueHisto[crColor.blue]++;
+			};
+		};
 	};
 
 	int rval = 1;
@@ -142,29 +127,13 @@ bool	CBackgroundCalibrationTask::Process()
 	bool				bResult = true;
 	LONG				lHeight = m_pBitmap->Height();
 	LONG				i = 0;
-	LONG				lStep;
-	LONG				lRemaining;
+	const LONG			lNrThreads = GetNrThreads();
 
 	if (m_pProgress)
-		m_pProgress->SetNrUsedProcessors(GetNrThreads());
-	lStep		= max(1L, lHeight/50);
-	lRemaining	= lHeight;
-
-	while (i<lHeight)
-	{
-		LONG			lAdd = min(lStep, lRemaining);
-		DWORD			dwThreadId;
-
-		dwThreadId = GetAvailableThreadId();
-		PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-		i			+=lAdd;
-		lRemaining	-= lAdd;
-		if (m_pProgress)
-			m_pProgress->Progress2(nullptr, i);
-	};
-
-	CloseAllThreads();
+		m_pProgress->SetNrUsedProcessors(lNrThreads);
+	// One chunk per thread: each chunk fills its own histograms and adds
+	// them to the main ones under the lock
+	bResult = ProcessRange(0, lHeight, m_pProgress, false, (lHeight + lNrThreads - 1) / lNrThreads);
 
 	if (m_pProgress)
 		m_pProgress->SetNrUsedProcessors();
@@ -207,7 +176,6 @@ void	CBackgroundCalibration::ComputeBackgroundCalibration(CMemoryBitmap * pBitma
 		pProgress->Start2(nullptr, pBitmap->Height());
 
 	task.Init(this, pBitmap, pProgress);
-	task.StartThreads();
 	task.Process();
 
 /*
@@ -7,12 +7,17 @@
 #include "TIFFUtil.h"
 #include "FITSUtil.h"
 #include "RAWUtils.h"
-#include <set>
 #include <list>
 #include <float.h>
 #include "Multitask.h"
+#include "DSSPlatform.h"
+#include "ThreadPool.h"
+#include "RunReport.h"
 #include "Workspace.h"
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <cstdint>
 #include <zexcept.h>
 
 
@@ -332,11 +337,7 @@ bool	LoadPicture(LPCTSTR szFileName, CAllDepthBitmap & AllDepthBitmap, CDSSProgr
 	catch (std::exception & e)
 	{
 		CString errorMessage(static_cast<LPCTSTR>(CA2CT(e.what())));
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		ReportEngineMessage(errorMessage);
 		exit(1);
 	}
 #ifndef _CONSOLE
@@ -349,34 +350,14 @@ bool	LoadPicture(LPCTSTR szFileName, CAllDepthBitmap & AllDepthBitmap, CDSSProgr
 #endif
 	catch (ZException & ze)
 	{
-		CString errorMessage;
-		CString name(CA2CT(ze.name()));
-		CString fileName(CA2CT(ze.locationAtIndex(0)->fileName()));
-		CString functionName(CA2CT(ze.locationAtIndex(0)->functionName()));
-		CString text(CA2CT(ze.text(0)));
-
-		errorMessage.Format(
-			_T("Exception %s thrown from %s Function: %s() Line: %lu\n\n%s"),
-			name,
-			fileName,
-			functionName,
-			ze.locationAtIndex(0)->lineNumber(),
-			text);
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		CString errorMessage(FormatZException(ze));
+		ReportEngineMessage(errorMessage);
 		exit(1);
 	}
 	catch (...)
 	{
 		CString errorMessage(_T("Unknown exception caught"));
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		ReportEngineMessage(errorMessage);
 		exit(1);
 	}
 
@@ -1002,57 +983,477 @@ bool	ApplyGammaTransformation(C32BitsBitmap * pOutBitmap, CMemoryBitmap * pInBit
 
 /* ------------------------------------------------------------------- */
 
-static		std::set<CBitmapInfo>			g_sBitmapInfoCache;
-static		SYSTEMTIME						g_BitmapInfoTime;
+#if DSSFILEDECODING==1
+
+// Picture info of the files already probed, kept from one session to the
+// next in the local application data folder.
+// An entry is only used while the size and the last write time of its file
+// are unchanged, so there is no global expiration of the cache.
+
+const DWORD			PICTUREINFOCACHE_MAGIC		= 0x7ABC6F20L;
+const DWORD			PICTUREINFOCACHE_VERSION	= 2;
+const size_t		PICTUREINFOCACHE_MAXENTRIES	= 20000;
+
+typedef struct tagPICTUREINFOCACHEHEADER
+{
+	DWORD			dwMagic;		// Magic number (always PICTUREINFOCACHE_MAGIC)
+	DWORD			dwHeaderSize;	// Always sizeof(PICTUREINFOCACHEHEADER)
+	DWORD			dwVersion;		// Entries are discarded when the version changes
+	DWORD			dwNrEntries;
+}PICTUREINFOCACHEHEADER;
 
 /* ------------------------------------------------------------------- */
 
-bool	GetPictureInfo(LPCTSTR szFileName, CBitmapInfo & BitmapInfo)
+class CPictureInfoCacheReader
 {
-	ZFUNCTRACE_RUNTIME();
-	bool				bResult = false;
+private :
+	const BYTE *		m_pData;
+	const BYTE *		m_pEnd;
+	bool				m_bOk;
 
-#if DSSFILEDECODING==0
-	if (IsPCLPicture(szFileName, BitmapInfo))
-		bResult = true;
-#else
-	// First try to find the info in the cache
-	if (g_sBitmapInfoCache.size())
+public :
+	CPictureInfoCacheReader(const BYTE * pData, size_t lSize) :
+		m_pData(pData),
+		m_pEnd(pData + lSize),
+		m_bOk(pData != nullptr)
+	{
+	};
+
+	bool	IsOk() const
+	{
+		return m_bOk;
+	};
+
+	template <typename T>
+	void	Read(T & Value)
+	{
+		if (m_bOk && m_pEnd - m_pData >= static_cast<ptrdiff_t>(sizeof(T)))
+		{
+			memcpy(&Value, m_pData, sizeof(T));
+			m_pData += sizeof(T);
+		}
+		else
+			m_bOk = false;
+	};
+
+	void	Read(bool & bValue)
+	{
+		BYTE			bByte = 0;
+
+		Read(bByte);
+		bValue = (bByte != 0);
+	};
+
+	void	Read(CString & strValue)
+	{
+		DWORD			dwLength = 0;
+
+		Read(dwLength);
+		if (m_bOk && m_pEnd - m_pData >= static_cast<ptrdiff_t>(dwLength))
+		{
+			std::string		strUTF8(reinterpret_cast<const char *>(m_pData), dwLength);
+
+			strValue = CA2CT(strUTF8.c_str(), CP_UTF8);
+			m_pData += dwLength;
+		}
+		else
+			m_bOk = false;
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+class CPictureInfoCacheWriter
+{
+private :
+	FILE *				m_hFile;
+	bool				m_bOk;
+
+public :
+	CPictureInfoCacheWriter(FILE * hFile) :
+		m_hFile(hFile),
+		m_bOk(hFile != nullptr)
+	{
+	};
+
+	bool	IsOk() const
+	{
+		return m_bOk;
+	};
+
+	template <typename T>
+	void	Write(const T & Value)
+	{
+		if (m_bOk)
+			m_bOk = (fwrite(&Value, sizeof(T), 1, m_hFile) == 1);
+	};
+
+	void	Write(bool bValue)
+	{
+		Write(static_cast<BYTE>(bValue ? 1 : 0));
+	};
+
+	void	Write(const CString & strValue)
+	{
+		CT2CA			strUTF8(strValue, CP_UTF8);
+		DWORD			dwLength = static_cast<DWORD>(strlen(strUTF8));
+
+		Write(dwLength);
+		if (m_bOk && dwLength)
+			m_bOk = (fwrite(static_cast<LPCSTR>(strUTF8), dwLength, 1, m_hFile) == 1);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+static void	FormatPictureDateTime(CBitmapInfo & BitmapInfo)
+{
+	TCHAR			szTime[200];
+	TCHAR			szDate[200];
+
+	GetDateFormat(LOCALE_USER_DEFAULT, 0, &BitmapInfo.m_DateTime, nullptr, szDate, sizeof(szDate)/sizeof(TCHAR));
+	GetTimeFormat(LOCALE_USER_DEFAULT, 0, &BitmapInfo.m_DateTime, nullptr, szTime, sizeof(szTime)/sizeof(TCHAR));
+
+	BitmapInfo.m_strDateTime.Format(_T("%s %s"), szDate, szTime);
+};
+
+/* ------------------------------------------------------------------- */
+
+class CPictureInfoCache
+{
+private :
+	class CEntry
+	{
+	public :
+		CBitmapInfo			m_BitmapInfo;
+		std::uint64_t		m_lFileSize;
+		std::uint64_t		m_lFileTime;
+		std::uint64_t		m_lLastUse;
+		CString				m_strSettings;	// Settings used when the file was probed
+
+		CEntry() :
+			m_lFileSize(0),
+			m_lFileTime(0),
+			m_lLastUse(0)
+		{
+		};
+	};
+
+	class CFileNameLess
+	{
+	public :
+		bool operator () (const CString & strLeft, const CString & strRight) const
+		{
+			return (strLeft.CompareNoCase(strRight) < 0);
+		};
+	};
+
+	typedef std::map<CString, CEntry, CFileNameLess>	ENTRYMAP;
+
+	std::mutex				m_Mutex;
+	ENTRYMAP				m_mEntries;
+	std::uint64_t			m_lUseCounter;
+	bool					m_bLoaded;
+	bool					m_bDirty;
+
+private :
+	static CString	GetCacheFileName();
+	void	Load();
+	void	WriteEntry(CPictureInfoCacheWriter & Writer, const CString & strFileName, const CEntry & Entry);
+	bool	ReadEntry(CPictureInfoCacheReader & Reader);
+
+public :
+	CPictureInfoCache() :
+		m_lUseCounter(0),
+		m_bLoaded(false),
+		m_bDirty(false)
+	{
+	};
+
+	~CPictureInfoCache()
+	{
+		Save();
+	};
+
+	bool	Find(LPCTSTR szFileName, std::uint64_t lFileSize, std::uint64_t lFileTime, LPCTSTR szSettings, CBitmapInfo & BitmapInfo);
+	void	Add(LPCTSTR szFileName, std::uint64_t lFileSize, std::uint64_t lFileTime, LPCTSTR szSettings, const CBitmapInfo & BitmapInfo);
+	void	Save();
+};
+
+/* ------------------------------------------------------------------- */
+
+CString	CPictureInfoCache::GetCacheFileName()
+{
+	return GetUserDataFile(_T("PictureInfo.cache"));
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CPictureInfoCache::ReadEntry(CPictureInfoCacheReader & Reader)
+{
+	CString				strFileName;
+	CEntry				Entry;
+	CBitmapInfo &		bi = Entry.m_BitmapInfo;
+	LONG				lCFAType = 0;
+	DWORD				dwNrExtras = 0;
+
+	Reader.Read(strFileName);
+	Reader.Read(Entry.m_lFileSize);
+	Reader.Read(Entry.m_lFileTime);
+	Reader.Read(Entry.m_lLastUse);
+	Reader.Read(Entry.m_strSettings);
+
+	Reader.Read(bi.m_strFileType);
+	Reader.Read(bi.m_strModel);
+	Reader.Read(bi.m_lISOSpeed);
+	Reader.Read(bi.m_lGain);
+	Reader.Read(bi.m_fExposure);
+	Reader.Read(bi.m_fAperture);
+	Reader.Read(bi.m_lWidth);
+	Reader.Read(bi.m_lHeight);
+	Reader.Read(bi.m_lBitPerChannel);
+	Reader.Read(bi.m_lNrChannels);
+	Reader.Read(bi.m_bCanLoad);
+	Reader.Read(bi.m_bFloat);
+	Reader.Read(lCFAType);
+	Reader.Read(bi.m_bMaster);
+	Reader.Read(bi.m_bFITS16bit);
+	Reader.Read(bi.m_DateTime);
+	Reader.Read(bi.m_InfoTime);
+	Reader.Read(bi.m_xBayerOffset);
+	Reader.Read(bi.m_yBayerOffset);
+	Reader.Read(bi.m_filterName);
+	Reader.Read(dwNrExtras);
+	for (DWORD i = 0;i<dwNrExtras && Reader.IsOk();i++)
+	{
+		CExtraInfo			ei;
+		LONG				lType = 0;
+
+		Reader.Read(lType);
+		Reader.Read(ei.m_strName);
+		Reader.Read(ei.m_strValue);
+		Reader.Read(ei.m_lValue);
+		Reader.Read(ei.m_fValue);
+		Reader.Read(ei.m_strComment);
+		Reader.Read(ei.m_bPropagate);
+		ei.m_Type = static_cast<EXTRAINFOTYPE>(lType);
+		bi.m_ExtraInfo.AddInfo(ei);
+	};
+
+	if (Reader.IsOk())
+	{
+		bi.m_strFileName = strFileName;
+		bi.m_CFAType	 = static_cast<CFATYPE>(lCFAType);
+		FormatPictureDateTime(bi);
+		m_lUseCounter = max(m_lUseCounter, Entry.m_lLastUse);
+		m_mEntries[strFileName] = Entry;
+	};
+
+	return Reader.IsOk();
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CPictureInfoCache::WriteEntry(CPictureInfoCacheWriter & Writer, const CString & strFileName, const CEntry & Entry)
+{
+	const CBitmapInfo &	bi = Entry.m_BitmapInfo;
+
+	Writer.Write(strFileName);
+	Writer.Write(Entry.m_lFileSize);
+	Writer.Write(Entry.m_lFileTime);
+	Writer.Write(Entry.m_lLastUse);
+	Writer.Write(Entry.m_strSettings);
+
+	Writer.Write(bi.m_strFileType);
+	Writer.Write(bi.m_strModel);
+	Writer.Write(bi.m_lISOSpeed);
+	Writer.Write(bi.m_lGain);
+	Writer.Write(bi.m_fExposure);
+	Writer.Write(bi.m_fAperture);
+	Writer.Write(bi.m_lWidth);
+	Writer.Write(bi.m_lHeight);
+	Writer.Write(bi.m_lBitPerChannel);
+	Writer.Write(bi.m_lNrChannels);
+	Writer.Write(bi.m_bCanLoad);
+	Writer.Write(bi.m_bFloat);
+	Writer.Write(static_cast<LONG>(bi.m_CFAType));
+	Writer.Write(bi.m_bMaster);
+	Writer.Write(bi.m_bFITS16bit);
+	Writer.Write(bi.m_DateTime);
+	Writer.Write(bi.m_InfoTime);
+	Writer.Write(bi.m_xBayerOffset);
+	Writer.Write(bi.m_yBayerOffset);
+	Writer.Write(bi.m_filterName);
+	Writer.Write(static_cast<DWORD>(bi.m_ExtraInfo.m_vExtras.size()));
+	for (const CExtraInfo & ei : bi.m_ExtraInfo.m_vExtras)
+	{
+		Writer.Write(static_cast<LONG>(ei.m_Type));
+		Writer.Write(ei.m_strName);
+		Writer.Write(ei.m_strValue);
+		Writer.Write(ei.m_lValue);
+		Writer.Write(ei.m_fValue);
+		Writer.Write(ei.m_strComment);
+		Writer.Write(ei.m_bPropagate);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CPictureInfoCache::Load()
+{
+	// Called with the mutex locked
+	if (!m_bLoaded)
+	{
+		CString				strCacheFile = GetCacheFileName();
+		CMappedFile			File;
+
+		m_bLoaded = true;
+		if (strCacheFile.GetLength() && File.Open(strCacheFile, false) && File.GetSize() >= sizeof(PICTUREINFOCACHEHEADER))
+		{
+			CPictureInfoCacheReader		Reader(File.GetData(), File.GetSize());
+			PICTUREINFOCACHEHEADER		Header;
+
+			Reader.Read(Header);
+			if (Header.dwMagic == PICTUREINFOCACHE_MAGIC &&
+				Header.dwHeaderSize == sizeof(PICTUREINFOCACHEHEADER) &&
+				Header.dwVersion == PICTUREINFOCACHE_VERSION)
+			{
+				for (DWORD i = 0;i<Header.dwNrEntries && ReadEntry(Reader);i++);
+			};
+			ZTRACE_RUNTIME("Picture info cache: %zu entries loaded", m_mEntries.size());
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CPictureInfoCache::Save()
+{
+	std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+	if (m_bDirty)
 	{
-		// Check that the cache is not old (more than 5 minutes)
-		SYSTEMTIME			st;
-		FILETIME			ft1, ft2;
-		ULARGE_INTEGER		ulft1, ulft2;
+		CString				strCacheFile = GetCacheFileName();
 
-		GetSystemTime(&st);
+		m_bDirty = false;
+		if (strCacheFile.GetLength())
+		{
+			std::vector<ENTRYMAP::const_iterator>	vEntries;
+
+			// Only the most recently used entries are kept
+			for (auto it = m_mEntries.cbegin();it != m_mEntries.cend();it++)
+				vEntries.push_back(it);
+			if (vEntries.size() > PICTUREINFOCACHE_MAXENTRIES)
+			{
+				std::nth_element(vEntries.begin(), vEntries.begin() + PICTUREINFOCACHE_MAXENTRIES, vEntries.end(),
+					[](const ENTRYMAP::const_iterator & it1, const ENTRYMAP::const_iterator & it2)
+					{
+						return it1->second.m_lLastUse > it2->second.m_lLastUse;
+					});
+				vEntries.resize(PICTUREINFOCACHE_MAXENTRIES);
+			};
 
-		SystemTimeToFileTime(&g_BitmapInfoTime, &ft1);
-		SystemTimeToFileTime(&st, &ft2);
+			// Write a temporary file first so that another instance never reads
+			// a partial cache (the name is unique to this process so that two
+			// instances saving at the same time don't write the same file)
+			CString					strTempFile;
 
-		__int64				diff;
+			strTempFile.Format(_T("%s.%lu.tmp"), (LPCTSTR)strCacheFile, GetProcessIdentifier());
 
-		ulft1.LowPart = ft1.dwLowDateTime;
-		ulft1.HighPart = ft1.dwHighDateTime;
+			FILE *					hFile = _tfopen(strTempFile, _T("wb"));
+
+			if (hFile)
+			{
+				CPictureInfoCacheWriter		Writer(hFile);
+				PICTUREINFOCACHEHEADER		Header;
+
+				Header.dwMagic		= PICTUREINFOCACHE_MAGIC;
+				Header.dwHeaderSize = sizeof(PICTUREINFOCACHEHEADER);
+				Header.dwVersion	= PICTUREINFOCACHE_VERSION;
+				Header.dwNrEntries	= static_cast<DWORD>(vEntries.size());
+				Writer.Write(Header);
+				for (const auto & it : vEntries)
+					WriteEntry(Writer, it->first, it->second);
+
+				fclose(hFile);
+				if (!Writer.IsOk() || !ReplaceFileWith(strTempFile, strCacheFile))
+					DeleteFile(strTempFile);
+			};
+		};
+	};
+};
 
-		ulft2.LowPart = ft2.dwLowDateTime;
-		ulft2.HighPart = ft2.dwHighDateTime;
+/* ------------------------------------------------------------------- */
 
-		diff = ulft2.QuadPart-ulft1.QuadPart;
+bool	CPictureInfoCache::Find(LPCTSTR szFileName, std::uint64_t lFileSize, std::uint64_t lFileTime, LPCTSTR szSettings, CBitmapInfo & BitmapInfo)
+{
+	bool							bResult = false;
+	std::lock_guard<std::mutex>		Lock(m_Mutex);
 
-		// diff is in 100 of nanoseconds (1e6 millisecond = 1 nanosecond)
-		if (diff > 10000.0*1000.0*60.0*5.0)
-			g_sBitmapInfoCache.clear();
+	Load();
 
-		std::set<CBitmapInfo>::iterator		it;
+	ENTRYMAP::iterator				it = m_mEntries.find(szFileName);
 
-		it = g_sBitmapInfoCache.find(CBitmapInfo(szFileName));
-		if (it != g_sBitmapInfoCache.end())
+	if (it != m_mEntries.end())
+	{
+		if (it->second.m_lFileSize == lFileSize && it->second.m_lFileTime == lFileTime &&
+			it->second.m_strSettings == szSettings)
 		{
-			BitmapInfo = *it;
+			BitmapInfo = it->second.m_BitmapInfo;
+			it->second.m_lLastUse = ++m_lUseCounter;
 			bResult = true;
+		}
+		else
+		{
+			// The file has been modified (or the settings changed) since
+			// it was probed
+			m_mEntries.erase(it);
+			m_bDirty = true;
 		};
 	};
 
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CPictureInfoCache::Add(LPCTSTR szFileName, std::uint64_t lFileSize, std::uint64_t lFileTime, LPCTSTR szSettings, const CBitmapInfo & BitmapInfo)
+{
+	std::lock_guard<std::mutex>		Lock(m_Mutex);
+	CEntry &						Entry = m_mEntries[szFileName];
+
+	Entry.m_BitmapInfo	= BitmapInfo;
+	Entry.m_lFileSize	= lFileSize;
+	Entry.m_lFileTime	= lFileTime;
+	Entry.m_lLastUse	= ++m_lUseCounter;
+	Entry.m_strSettings	= szSettings;
+	m_bDirty = true;
+};
+
+/* ------------------------------------------------------------------- */
+
+static		CPictureInfoCache				g_PictureInfoCache;
+
+#endif // DSSFILEDECODING
+
+/* ------------------------------------------------------------------- */
+
+#if DSSFILEDECODING==1
+// strSettings is the result of GetFITSInfoSettings() (read once by the
+// callers probing many files)
+static bool	GetCachedPictureInfo(LPCTSTR szFileName, CBitmapInfo & BitmapInfo, const CString & strSettings)
+{
+	bool				bResult = false;
+	std::uint64_t		lFileSize = 0,
+						lFileTime = 0;
+	bool				bStamped;
+
+	// First try to find the info in the cache (the stamp is taken before
+	// probing the file so that a file modified meanwhile is probed again)
+	bStamped = GetFileStamp(szFileName, lFileSize, lFileTime);
+	if (bStamped)
+		bResult = g_PictureInfoCache.Find(szFileName, lFileSize, lFileTime, strSettings, BitmapInfo);
+
 	if (!bResult)
 	{
 		if (IsRAWPicture(szFileName, BitmapInfo))
@@ -1066,9 +1467,6 @@ bool	GetPictureInfo(LPCTSTR szFileName, CBitmapInfo & BitmapInfo)
 
 		if (bResult)
 		{
-			TCHAR			szTime[200];
-			TCHAR			szDate[200];
-
 			if (!BitmapInfo.m_DateTime.wYear)
 			{
 				// use the file creation time instead of the EXIF info
@@ -1084,16 +1482,30 @@ bool	GetPictureInfo(LPCTSTR szFileName, CBitmapInfo & BitmapInfo)
 
 			GetSystemTime(&BitmapInfo.m_InfoTime);
 
-			GetDateFormat(LOCALE_USER_DEFAULT, 0, &BitmapInfo.m_DateTime, nullptr, szDate, sizeof(szDate)/sizeof(TCHAR));
-			GetTimeFormat(LOCALE_USER_DEFAULT, 0, &BitmapInfo.m_DateTime, nullptr, szTime, sizeof(szTime)/sizeof(TCHAR));
+			FormatPictureDateTime(BitmapInfo);
 
-			BitmapInfo.m_strDateTime.Format(_T("%s %s"), szDate, szTime);
-
-			if (!g_sBitmapInfoCache.size())
-				GetSystemTime(&g_BitmapInfoTime);
-			g_sBitmapInfoCache.insert(BitmapInfo);
+			if (bStamped)
+				g_PictureInfoCache.Add(szFileName, lFileSize, lFileTime, strSettings, BitmapInfo);
 		};
 	};
+
+	return bResult;
+};
+
+#endif // DSSFILEDECODING
+
+/* ------------------------------------------------------------------- */
+
+bool	GetPictureInfo(LPCTSTR szFileName, CBitmapInfo & BitmapInfo)
+{
+	ZFUNCTRACE_RUNTIME();
+	bool				bResult = false;
+
+#if DSSFILEDECODING==0
+	if (IsPCLPicture(szFileName, BitmapInfo))
+		bResult = true;
+#else
+	bResult = GetCachedPictureInfo(szFileName, BitmapInfo, GetFITSInfoSettings());
 #endif
 
 	return bResult;
@@ -1101,9 +1513,36 @@ bool	GetPictureInfo(LPCTSTR szFileName, CBitmapInfo & BitmapInfo)
 
 /* ------------------------------------------------------------------- */
 
+void	ScanPicturesInfo(const std::vector<CString> & vFiles)
+{
+	ZFUNCTRACE_RUNTIME();
+
+#if DSSFILEDECODING==1
+	// The headers are probed concurrently and land in the cache, so that
+	// the following calls to GetPictureInfo for these files are immediate
+	const CString		strSettings = GetFITSInfoSettings();
+
+	CThreadPool::GetInstance().ParallelFor(0, static_cast<long>(vFiles.size()), 1,
+		[&vFiles, &strSettings](long lStart, long lEnd)
+		{
+			for (long i = lStart;i<lEnd;i++)
+			{
+				CBitmapInfo		BitmapInfo;
+
+				GetCachedPictureInfo(vFiles[i], BitmapInfo, strSettings);
+			};
+		});
+
+	g_PictureInfoCache.Save();
+#endif
+};
+
+/* ------------------------------------------------------------------- */
+
 bool	LoadPicture(LPCTSTR szFileName, CMemoryBitmap ** ppBitmap, CDSSProgress * pProgress)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope		ReportScope("LoadPicture");
 	bool				bResult = false;
 
 	if (ppBitmap)
@@ -1165,7 +1604,16 @@ bool	LoadPicture(LPCTSTR szFileName, CMemoryBitmap ** ppBitmap, CDSSProgress * p
 #endif
 
 		if (bResult)
+		{
+			std::uint64_t		lFileSize,
+								lFileTime;
+
+			if (CRunReport::GetInstance().IsEnabled() && GetFileStamp(szFileName, lFileSize, lFileTime))
+				CRunReport::AddBytesRead(lFileSize);
+			CRunReport::AddFramesDecoded(1);
+
 			pBitmap.CopyTo(ppBitmap);
+		};
 	};
 
 	return bResult;
@@ -1325,17 +1773,15 @@ public :
 	};
 
 	virtual bool	Process();
-	virtual bool	DoTask(HANDLE hEvent);
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
 };
 
 /* ------------------------------------------------------------------- */
 
-bool	CSubtractTask::DoTask(HANDLE hEvent)
+bool	CSubtractTask::DoTask(LONG lStart, LONG lEnd)
 {
 	ZFUNCTRACE_RUNTIME();
 	LONG			i, j;
-	bool			bEnd = false;
-	MSG				msg;
 	LONG			lWidth = m_pTarget->RealWidth();
 	LONG			lExtraWidth = 0;
 
@@ -1351,94 +1797,82 @@ bool	CSubtractTask::DoTask(HANDLE hEvent)
 		lWidth -= lExtraWidth;
 	};
 
-	// Create a message queue and signal the event
-	PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-	SetEvent(hEvent);
-	while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+	LONG			lTgtStartX = 0,
+					lTgtStartY = lStart,
+					lSrcStartX = 0,
+					lSrcStartY = lStart;
+
+	if (m_fXShift>0)
 	{
-		if (msg.message == WM_MT_PROCESS)
-		{
-			LONG			lTgtStartX = 0,
-							lTgtStartY = msg.wParam,
-							lSrcStartX = 0,
-							lSrcStartY = msg.wParam;
+		// Target is moved
+		lTgtStartX += m_fXShift+0.5;
+	}
+	else if (m_fXShift<0)
+	{
+		// Source is moved
+		lSrcStartX += fabs(m_fXShift)+0.5;
+	};
+	if (m_fYShift>0)
+	{
+		// Target is moved
+		lTgtStartY += m_fYShift+0.5;
+	}
+	else
+	{
+		// Source is moved
+		lSrcStartY += fabs(m_fYShift)+0.5;
+	};
 
-			if (m_fXShift>0)
-			{
-				// Target is moved
-				lTgtStartX += m_fXShift+0.5;
-			}
-			else if (m_fXShift<0)
-			{
-				// Source is moved
-				lSrcStartX += fabs(m_fXShift)+0.5;
-			};
-			if (m_fYShift>0)
+	PixelItTgt->Reset(lTgtStartX, lTgtStartY);
+	PixelItSrc->Reset(lSrcStartX, lSrcStartY);
+
+	for (j = 0;j<lEnd-lStart;j++)
+	{
+		for (i = 0;i<lWidth;i++)
+		{
+			if (m_bMonochrome)
 			{
-				// Target is moved
-				lTgtStartY += m_fYShift+0.5;
+				double			fSrcGray,
+								fTgtGray;
+
+				PixelItTgt->GetPixel(fTgtGray);
+				PixelItSrc->GetPixel(fSrcGray);
+
+				if (m_bAddMode)
+					fTgtGray = min(max(0.0, fTgtGray+fSrcGray * m_fGrayFactor), 256.0);
+				else
+					fTgtGray = max(m_fMinimum, fTgtGray-fSrcGray * m_fGrayFactor);
+				PixelItTgt->SetPixel(fTgtGray);
 			}
 			else
 			{
-				// Source is moved
-				lSrcStartY += fabs(m_fYShift)+0.5;
-			};
+				double			fSrcRed, fSrcGreen, fSrcBlue;
+				double			fTgtRed, fTgtGreen, fTgtBlue;
 
-			PixelItTgt->Reset(lTgtStartX, lTgtStartY);
-			PixelItSrc->Reset(lSrcStartX, lSrcStartY);
-
-			for (j = 0;j<msg.lParam;j++)
-			{
-				for (i = 0;i<lWidth;i++)
+				PixelItTgt->GetPixel(fTgtRed, fTgtGreen, fTgtBlue);
+				PixelItSrc->GetPixel(fSrcRed, fSrcGreen, fSrcBlue);
+				if (m_bAddMode)
 				{
-					if (m_bMonochrome)
-					{
-						double			fSrcGray,
-										fTgtGray;
-
-						PixelItTgt->GetPixel(fTgtGray);
-						PixelItSrc->GetPixel(fSrcGray);
-
-						if (m_bAddMode)
-							fTgtGray = min(max(0.0, fTgtGray+fSrcGray * m_fGrayFactor), 256.0);
-						else
-							fTgtGray = max(m_fMinimum, fTgtGray-fSrcGray * m_fGrayFactor);
-						PixelItTgt->SetPixel(fTgtGray);
-					}
-					else
-					{
-						double			fSrcRed, fSrcGreen, fSrcBlue;
-						double			fTgtRed, fTgtGreen, fTgtBlue;
-
-						PixelItTgt->GetPixel(fTgtRed, fTgtGreen, fTgtBlue);
-						PixelItSrc->GetPixel(fSrcRed, fSrcGreen, fSrcBlue);
-						if (m_bAddMode)
-						{
-							fTgtRed		= min(max(0.0, fTgtRed + fSrcRed * m_fRedFactor), 256.0);
-							fTgtGreen	= min(max(0.0, fTgtGreen + fSrcGreen * m_fGreenFactor), 256.0);
-							fTgtBlue	= min(max(0.0, fTgtBlue + fSrcBlue * m_fBlueFactor), 256.0);
-						}
-						else
-						{
-							fTgtRed		= max(m_fMinimum, fTgtRed - fSrcRed * m_fRedFactor);
-							fTgtGreen	= max(m_fMinimum, fTgtGreen - fSrcGreen * m_fGreenFactor);
-							fTgtBlue	= max(m_fMinimum, fTgtBlue - fSrcBlue * m_fBlueFactor);
-						};
-						PixelItTgt->SetPixel(fTgtRed, fTgtGreen, fTgtBlue);
-					};
+					fTgtRed		= min(max(0.0, fTgtRed + fSrcRed * m_fRedFactor), 256.0);
+					fTgtGreen	= min(max(0.0, fTgtGreen + fSrcGreen * m_fGreenFactor), 256.0);
+					fTgtBlue	= min(max(0.0, fTgtBlue + fSrcBlue * m_fBlueFactor), 256.0);
+				}
+				else
+				{
+					fTgtRed		= max(m_fMinimum, fTgtRed - fSrcRed * m_fRedFactor);
+					fTgtGreen	= max(m_fMinimum, fTgtGreen - fSrcGreen * m_fGreenFactor);
+					fTgtBlue	= max(m_fMinimum, fTgtBlue - fSrcBlue * m_fBlueFactor);
+				};
+				PixelItTgt->SetPixel(fTgtRed, fTgtGreen, fTgtBlue);
+			};
 
-					(*PixelItTgt)++;
+			(*PixelItTgt)++;
 
-					(*PixelItSrc)++;
-				};
-				(*PixelItTgt)+=lExtraWidth;
+			(*PixelItSrc)++;
+		};
+		(*PixelItTgt)+=lExtraWidth;
 
-				(*PixelItSrc) += lExtraWidth;				
-			};
-			SetEvent(hEvent);
-		}
-		else if (msg.message == WM_MT_STOP)
-			bEnd = true;
+		(*PixelItSrc) += lExtraWidth;				
 	};
 
 	return true;
@@ -1451,9 +1885,6 @@ bool CSubtractTask::Process()
 	ZFUNCTRACE_RUNTIME();
 	bool			bResult = true;
 	LONG			lHeight = m_pTarget->RealHeight();
-	LONG			lStep;
-	LONG			lRemaining;
-	LONG			i = 0;
 
 	if (m_fYShift)
 		lHeight -= fabs(m_fYShift)+0.5;
@@ -1464,26 +1895,7 @@ bool CSubtractTask::Process()
 		m_pProgress->SetNrUsedProcessors(GetNrThreads());
 	};
 
-	bResult = true;
-	lStep = max(1L, lHeight/50);
-	lRemaining = lHeight;
-
-	while (i<lHeight)
-	{
-		DWORD			dwThreadId;
-		LONG			lAdd = min(lStep, lRemaining);
-
-		dwThreadId = GetAvailableThreadId();
-		PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-		i			+= lAdd;
-		lRemaining	-= lAdd;
-
-		if (m_pProgress)
-			m_pProgress->Progress2(nullptr, i);
-	};
-
-	CloseAllThreads();
+	bResult = ProcessRange(0, lHeight, m_pProgress);
 	if (m_pProgress)
 	{
 		m_pProgress->SetNrUsedProcessors();
@@ -1523,7 +1935,6 @@ bool Subtract(CMemoryBitmap * pTarget, CMemoryBitmap * pSource, CDSSProgress * p
 			CSubtractTask			SubtractTask;
 
 			SubtractTask.Init(pTarget, pSource, pProgress, fRedFactor, fGreenFactor, fBlueFactor);
-			SubtractTask.StartThreads();
 			SubtractTask.Process();
 		}
 		else
@@ -1558,7 +1969,6 @@ bool ShiftAndSubtract(CMemoryBitmap * pTarget, CMemoryBitmap * pSource, CDSSProg
 			SubtractTask.Init(pTarget, pSource, pProgress, 1.0, 1.0, 1.0);
 			SubtractTask.SetShift(fXShift, fYShift);
 			SubtractTask.SetMinimumValue(1.0);
-			SubtractTask.StartThreads();
 			SubtractTask.Process();
 		};
 	};
@@ -1584,7 +1994,6 @@ bool Add(CMemoryBitmap * pTarget, CMemoryBitmap * pSource, CDSSProgress * pProgr
 
 			AddTask.SetAddMode(true);
 			AddTask.Init(pTarget, pSource, pProgress, 1.0, 1.0, 1.0);
-			AddTask.StartThreads();
 			AddTask.Process();
 		};
 	};
@@ -1646,61 +2055,47 @@ public :
 	};
 
 	virtual bool	Process();
-	virtual bool	DoTask(HANDLE hEvent);
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
 };
 
 /* ------------------------------------------------------------------- */
 
-bool	CMultiplyTask::DoTask(HANDLE hEvent)
+bool	CMultiplyTask::DoTask(LONG lStart, LONG lEnd)
 {
 	ZFUNCTRACE_RUNTIME();
 	LONG			i, j;
-	bool			bEnd = false;
-	MSG				msg;
 	LONG			lWidth = m_pTarget->RealWidth();
 
 	PixelIterator	PixelItTgt;
 
 	m_pTarget->GetIterator(&PixelItTgt);
 
-	// Create a message queue and signal the event
-	PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-	SetEvent(hEvent);
-	while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+	PixelItTgt->Reset(0, lStart);
+	for (j = lStart;j<lEnd;j++)
 	{
-		if (msg.message == WM_MT_PROCESS)
+		for (i = 0;i<lWidth;i++)
 		{
-			PixelItTgt->Reset(0, msg.wParam);
-			for (j = msg.wParam;j<msg.wParam+msg.lParam;j++)
+			if (m_bMonochrome)
 			{
-				for (i = 0;i<lWidth;i++)
-				{
-					if (m_bMonochrome)
-					{
-						double			fTgtGray;
+				double			fTgtGray;
 
-						PixelItTgt->GetPixel(fTgtGray);
-						fTgtGray = min(256.0, max(0.0, fTgtGray * m_fGrayFactor));
-						PixelItTgt->SetPixel(fTgtGray);
-					}
-					else
-					{
-						double			fTgtRed, fTgtGreen, fTgtBlue;
-
-						PixelItTgt->GetPixel(fTgtRed, fTgtGreen, fTgtBlue);
-						fTgtRed		= min(256.0, max(0.0, fTgtRed * m_fRedFactor));
-						fTgtGreen	= min(256.0, max(0.0, fTgtGreen * m_fGreenFactor));
-						fTgtBlue	= min(256.0, max(0.0, fTgtBlue * m_fBlueFactor));
-						PixelItTgt->SetPixel(fTgtRed, fTgtGreen, fTgtBlue);
-					};
+				PixelItTgt->GetPixel(fTgtGray);
+				fTgtGray = min(256.0, max(0.0, fTgtGray * m_fGrayFactor));
+				PixelItTgt->SetPixel(fTgtGray);
+			}
+			else
+			{
+				double			fTgtRed, fTgtGreen, fTgtBlue;
 
-					(*PixelItTgt)++;
-				};
+				PixelItTgt->GetPixel(fTgtRed, fTgtGreen, fTgtBlue);
+				fTgtRed		= min(256.0, max(0.0, fTgtRed * m_fRedFactor));
+				fTgtGreen	= min(256.0, max(0.0, fTgtGreen * m_fGreenFactor));
+				fTgtBlue	= min(256.0, max(0.0, fTgtBlue * m_fBlueFactor));
+				PixelItTgt->SetPixel(fTgtRed, fTgtGreen, fTgtBlue);
 			};
-			SetEvent(hEvent);
-		}
-		else if (msg.message == WM_MT_STOP)
-			bEnd = true;
+
+			(*PixelItTgt)++;
+		};
 	};
 
 	return true;
@@ -1713,9 +2108,6 @@ bool CMultiplyTask::Process()
 	ZFUNCTRACE_RUNTIME();
 	bool			bResult = true;
 	LONG			lHeight = m_pTarget->RealHeight();
-	LONG			lStep;
-	LONG			lRemaining;
-	LONG			i = 0;
 
 	if (m_pProgress)
 	{
@@ -1723,26 +2115,7 @@ bool CMultiplyTask::Process()
 		m_pProgress->SetNrUsedProcessors(GetNrThreads());
 	};
 
-	bResult = true;
-	lStep = max(1L, lHeight/50);
-	lRemaining = lHeight;
-
-	while (i<lHeight)
-	{
-		DWORD			dwThreadId;
-		LONG			lAdd = min(lStep, lRemaining);
-
-		dwThreadId = GetAvailableThreadId();
-		PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-		i			+= lAdd;
-		lRemaining	-= lAdd;
-
-		if (m_pProgress)
-			m_pProgress->Progress2(nullptr, i);
-	};
-
-	CloseAllThreads();
+	bResult = ProcessRange(0, lHeight, m_pProgress);
 	if (m_pProgress)
 	{
 		m_pProgress->SetNrUsedProcessors();
@@ -1765,7 +2138,6 @@ bool Multiply(CMemoryBitmap * pTarget, double fRedFactor, double fGreenFactor, d
 		CMultiplyTask			MultiplyTask;
 
 		MultiplyTask.Init(pTarget, pProgress, fRedFactor, fGreenFactor, fBlueFactor);
-		MultiplyTask.StartThreads();
 		MultiplyTask.Process();
 	};
 
@@ -3,6 +3,7 @@
 
 #include <QCoreApplication> 
 #include <QString>
+#include <functional>
 
 #include "Multitask.h"
 #include <zexcept.h>
@@ -441,10 +442,16 @@ protected :
 	bool						m_bHomogenization;
 	double						m_fMaxWeight;
 	std::vector<LONG>			m_vImageOrder;
+	bool						m_bMappedFiles;
+	bool						m_bInMemory;
+	LONG						m_lNrMappedBitmaps;
+	std::vector<BYTE>			m_vInMemoryBuffer;
 
 private :
 	void	DestroyTempFiles();
 	void	InitParts();
+	bool	InitMappedParts();
+	bool	AddBitmapToMappedParts(CMemoryBitmap * pBitmap, CDSSProgress * pProgress);
 	void	SmoothOut(CMemoryBitmap * pBitmap, CMemoryBitmap ** ppOutBitmap);
 
 public :
@@ -463,6 +470,9 @@ public :
         m_Method = MULTIBITMAPPROCESSMETHOD(0);
         m_fKappa = 0.0f;
         m_lNrIterations = 0;
+		m_bMappedFiles	  = false;
+		m_bInMemory		  = false;
+		m_lNrMappedBitmaps = 0;
 	};
 
 	virtual ~CMultiBitmap()
@@ -1657,56 +1667,41 @@ public :
 			m_pProgress = pProgress;
 		};
 
-		virtual bool	DoTask(HANDLE hEvent)
+		virtual bool	DoTask(LONG lStart, LONG lEnd)
 		{
 			bool				bResult = true;
 
 			LONG					i, j;
-			bool					bEnd = false;
-			MSG						msg;
 			LONG					lWidth = m_pBitmap->Width();
 			std::vector<size_t>		vHotOffsets;
 
-			// Create a message queue and signal the event
-			PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-			SetEvent(hEvent);
-			while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+			for (j = lStart;j<lEnd;j++)
 			{
-				if (msg.message == WM_MT_PROCESS)
+				for (i = 2;i<lWidth-2;i++)
 				{
-					for (j = msg.wParam;j<msg.wParam+msg.lParam;j++)
+					size_t				lOffset = m_pBitmap->GetOffset(i, j);
+					size_t				vOffsets[4];
+
+					vOffsets[0] = m_pBitmap->GetOffset(i-1, j);
+					vOffsets[1] = m_pBitmap->GetOffset(i+1, j);
+					vOffsets[2] = m_pBitmap->GetOffset(i, j+1);
+					vOffsets[3] = m_pBitmap->GetOffset(i, j-1);
+
+					TType				fValue = m_pBitmap->m_vPixels[lOffset];
+					bool				bHot = true;
+
+					for (LONG k = 0;k<4 && bHot;k++)
 					{
-						for (i = 2;i<lWidth-2;i++)
-						{
-							size_t				lOffset = m_pBitmap->GetOffset(i, j);
-							size_t				vOffsets[4];
-
-							vOffsets[0] = m_pBitmap->GetOffset(i-1, j);
-							vOffsets[1] = m_pBitmap->GetOffset(i+1, j);
-							vOffsets[2] = m_pBitmap->GetOffset(i, j+1);
-							vOffsets[3] = m_pBitmap->GetOffset(i, j-1);
-
-							TType				fValue = m_pBitmap->m_vPixels[lOffset];
-							bool				bHot = true;
-
-							for (LONG k = 0;k<4 && bHot;k++)
-							{
-								if (fValue <= 4.0 * m_pBitmap->m_vPixels[vOffsets[k]])
-									bHot = false;
-							};
-
-							if (bHot)
-							{
-								vHotOffsets.push_back(lOffset);
-								i++; // The next one cannot be a hot pixel
-							};
-						};
+						if (fValue <= 4.0 * m_pBitmap->m_vPixels[vOffsets[k]])
+							bHot = false;
 					};
 
-					SetEvent(hEvent);
-				}
-				else if (msg.message == WM_MT_STOP)
-					bEnd = true;
+					if (bHot)
+					{
+						vHotOffsets.push_back(lOffset);
+						i++; // The next one cannot be a hot pixel
+					};
+				};
 			};
 
 			// Add the vHotOffsets vector to the main one
@@ -1720,31 +1715,12 @@ public :
 		virtual bool	Process()
 		{
 			bool				bResult = true;
-			LONG				lHeight = m_pBitmap->Height()-4;
-			LONG				i = 2;
-			LONG				lStep;
-			LONG				lRemaining;
+			LONG				lHeight = m_pBitmap->Height();
 
 			if (m_pProgress)
 				m_pProgress->SetNrUsedProcessors(GetNrThreads());
-			lStep		= max(1L, lHeight/50);
-			lRemaining	= lHeight;
-
-			while (i<lHeight)
-			{
-				LONG			lAdd = min(lStep, lRemaining);
-				DWORD			dwThreadId;
-
-				dwThreadId = GetAvailableThreadId();
-				PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-				i			+=lAdd;
-				lRemaining	-= lAdd;
-				if (m_pProgress)
-					m_pProgress->Progress2(nullptr, i);
-			};
-
-			CloseAllThreads();
+			// Skip the two pixels border
+			bResult = ProcessRange(2, lHeight-2, m_pProgress);
 
 			if (m_pProgress)
 				m_pProgress->SetNrUsedProcessors();
@@ -2346,7 +2322,6 @@ public :
 		CHotPixelTask<TType>	HotPixelTask;
 
 		HotPixelTask.Init(this, pProgress);
-		HotPixelTask.StartThreads();
 		HotPixelTask.Process();
 
 		if (pProgress)
@@ -3446,6 +3421,74 @@ typedef CColorBitmapT<float>		C96BitFloatColorBitmap;
 
 /* ------------------------------------------------------------------- */
 
+// Planes of a gray (the same plane three times) or color bitmap of TType
+// pixels, used by the readers to write whole lines at once.
+// Return false if the bitmap does not store TType pixels.
+template <typename TType>
+inline bool	GetBitmapPlanes(CMemoryBitmap * pBitmap, TType * (&pPlanes)[3], double & fMultiplier)
+{
+	CGrayBitmapT<TType> *		pGrayBitmap = dynamic_cast<CGrayBitmapT<TType> *>(pBitmap);
+	CColorBitmapT<TType> *		pColorBitmap = dynamic_cast<CColorBitmapT<TType> *>(pBitmap);
+
+	if (pGrayBitmap)
+	{
+		pPlanes[0] = pPlanes[1] = pPlanes[2] = pGrayBitmap->GetGrayPixel(0, 0);
+		fMultiplier = pGrayBitmap->GetMultiplier();
+	}
+	else if (pColorBitmap)
+	{
+		pPlanes[0] = pColorBitmap->GetRedPixel(0, 0);
+		pPlanes[1] = pColorBitmap->GetGreenPixel(0, 0);
+		pPlanes[2] = pColorBitmap->GetBluePixel(0, 0);
+		fMultiplier = pColorBitmap->GetMultiplier();
+	};
+
+	return pGrayBitmap || pColorBitmap;
+};
+
+/* ------------------------------------------------------------------- */
+
+// Function converting the row lRow of the plane lPlane of a bitmap to the
+// samples of a file, used by the writers to export whole lines at once:
+// pTarget[i * lStride] = (plane value / bitmap multiplier) * fScale + fOffset
+template <typename TOut>
+using PLANEEXPORTER = std::function<void(LONG lRow, LONG lPlane, TOut * pTarget, LONG lStride)>;
+
+template <typename TType, typename TOut>
+inline bool	GetPlanesExporter(CMemoryBitmap * pBitmap, double fScale, double fOffset, PLANEEXPORTER<TOut> & Exporter)
+{
+	TType *				pPlanes[3];
+	double				fMultiplier = 1.0;
+
+	// Not with super pixels (the bitmap is smaller than its planes)
+	if ((pBitmap->Width() != pBitmap->RealWidth()) || !GetBitmapPlanes(pBitmap, pPlanes, fMultiplier))
+		return false;
+
+	const LONG			lWidth = pBitmap->RealWidth();
+	const double		fFactor = fScale / fMultiplier;
+
+	Exporter = [=](LONG lRow, LONG lPlane, TOut * pTarget, LONG lStride)
+	{
+		const TType *	pSource = pPlanes[lPlane] + static_cast<size_t>(lRow) * lWidth;
+
+		for (LONG i = 0;i<lWidth;i++)
+			pTarget[i * lStride] = static_cast<TOut>(pSource[i] * fFactor + fOffset);
+	};
+
+	return true;
+};
+
+template <typename TOut>
+inline bool	GetPlanesExporter(CMemoryBitmap * pBitmap, double fScale, double fOffset, PLANEEXPORTER<TOut> & Exporter)
+{
+	return GetPlanesExporter<BYTE, TOut>(pBitmap, fScale, fOffset, Exporter) ||
+		   GetPlanesExporter<WORD, TOut>(pBitmap, fScale, fOffset, Exporter) ||
+		   GetPlanesExporter<DWORD, TOut>(pBitmap, fScale, fOffset, Exporter) ||
+		   GetPlanesExporter<float, TOut>(pBitmap, fScale, fOffset, Exporter);
+};
+
+/* ------------------------------------------------------------------- */
+
 #include "MedianFilterEngine.h"
 
 /* ------------------------------------------------------------------- */
@@ -3675,6 +3718,9 @@ bool	DebayerPicture(CMemoryBitmap * pInBitmap, CMemoryBitmap ** ppOutBitmap, CDS
 bool	LoadPicture(LPCTSTR szFileName, CMemoryBitmap ** ppBitmap, CDSSProgress * pProgress);
 
 bool	GetPictureInfo(LPCTSTR szFileName, CBitmapInfo & BitmapInfo);
+// Probes the headers of the files in parallel so that GetPictureInfo doesn't
+// have to read them one by one afterwards
+void	ScanPicturesInfo(const std::vector<CString> & vFiles);
 
 bool	GetFilteredImage(CMemoryBitmap * pInBitmap, CMemoryBitmap ** ppOutBitmap, LONG lFilterSize, CDSSProgress * pProgress = nullptr);
 
@@ -118,72 +118,57 @@ public :
 		m_pProgress		= pProgress;
 	};
 
-	virtual bool	DoTask(HANDLE hEvent)
+	virtual bool	DoTask(LONG lStart, LONG lEnd)
 	{
 		ZFUNCTRACE_RUNTIME();
 		bool					bResult = true;
 		LONG					i, j;
-		bool					bEnd = false;
-		MSG						msg;
 		LONG					lWidth  = m_pBitmap->RealWidth(),
 								lHeight = m_pBitmap->RealHeight();
 		bool					bMonochrome = m_pBitmap->IsMonochrome();
 		LONG					lNrHotPixels = 0,
 								lNrColdPixels = 0;
 
-		// Create a message queue and signal the event
-		PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-		SetEvent(hEvent);
-		while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+		for (j = lStart;j<lEnd;j++)
 		{
-			if (msg.message == WM_MT_PROCESS)
+			for (i = 0;i<lWidth;i++)
 			{
-				for (j = msg.wParam;j<msg.wParam+msg.lParam;j++)
+				bool				bChanged = false;
+
+				if (bMonochrome)
 				{
-					for (i = 0;i<lWidth;i++)
-					{
-						bool				bChanged = false;
-
-						if (bMonochrome)
-						{
-							double			fGray,
-											fMedianGray;
-
-							m_pBitmap->GetPixel(i, j, fGray);
-							m_pMedian->GetPixel(i, j, fMedianGray);
-
-							bChanged = AdjustPixel(fGray, fMedianGray);
-						}
-						else
-						{
-							double			fRed, fGreen, fBlue,
-											fMedianRed, fMedianGreen, fMedianBlue;
-
-							m_pBitmap->GetPixel(i, j, fRed, fGreen, fBlue);
-							m_pMedian->GetPixel(i, j, fMedianRed, fMedianGreen, fMedianBlue);
-
-							bChanged = AdjustPixel(fRed, fMedianRed);
-							bChanged = AdjustPixel(fGreen, fMedianGreen) || bChanged;
-							bChanged = AdjustPixel(fBlue, fMedianBlue) || bChanged;
-						};
-
-						if (bChanged)
-						{
-							if (m_bHot)
-								lNrHotPixels++;
-							else
-								lNrColdPixels++;
-						};
-
-						if (m_pDelta && (bChanged || m_bInitDelta))
-							m_pDelta->SetPixel(i, j, bChanged ? (m_bHot ? 255 : 50) : 128);
-					};
+					double			fGray,
+									fMedianGray;
+
+					m_pBitmap->GetPixel(i, j, fGray);
+					m_pMedian->GetPixel(i, j, fMedianGray);
+
+					bChanged = AdjustPixel(fGray, fMedianGray);
+				}
+				else
+				{
+					double			fRed, fGreen, fBlue,
+									fMedianRed, fMedianGreen, fMedianBlue;
+
+					m_pBitmap->GetPixel(i, j, fRed, fGreen, fBlue);
+					m_pMedian->GetPixel(i, j, fMedianRed, fMedianGreen, fMedianBlue);
+
+					bChanged = AdjustPixel(fRed, fMedianRed);
+					bChanged = AdjustPixel(fGreen, fMedianGreen) || bChanged;
+					bChanged = AdjustPixel(fBlue, fMedianBlue) || bChanged;
 				};
 
-				SetEvent(hEvent);
-			}
-			else if (msg.message == WM_MT_STOP)
-				bEnd = true;
+				if (bChanged)
+				{
+					if (m_bHot)
+						lNrHotPixels++;
+					else
+						lNrColdPixels++;
+				};
+
+				if (m_pDelta && (bChanged || m_bInitDelta))
+					m_pDelta->SetPixel(i, j, bChanged ? (m_bHot ? 255 : 50) : 128);
+			};
 		};
 
 		m_CriticalSection.Lock();
@@ -198,30 +183,10 @@ public :
 		ZFUNCTRACE_RUNTIME();
 		bool				bResult = true;
 		LONG				lHeight = m_pBitmap->RealHeight();
-		LONG				i = 0;
-		LONG				lStep;
-		LONG				lRemaining;
 
 		if (m_pProgress)
 			m_pProgress->SetNrUsedProcessors(GetNrThreads());
-		lStep		= max(1L, lHeight/50);
-		lRemaining	= lHeight;
-
-		while (i<lHeight)
-		{
-			LONG			lAdd = min(lStep, lRemaining);
-			DWORD			dwThreadId;
-
-			dwThreadId = GetAvailableThreadId();
-			PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-			i			+=lAdd;
-			lRemaining	-= lAdd;
-			if (m_pProgress)
-				m_pProgress->Progress2(nullptr, i);
-		};
-
-		CloseAllThreads();
+		bResult = ProcessRange(0, lHeight, m_pProgress);
 
 		if (m_pProgress)
 			m_pProgress->SetNrUsedProcessors();
@@ -332,49 +297,34 @@ public :
 		};
 	};
 
-	virtual bool	DoTask(HANDLE hEvent)
+	virtual bool	DoTask(LONG lStart, LONG lEnd)
 	{
 		ZFUNCTRACE_RUNTIME();
 		bool					bResult = true;
 		LONG					i, j;
-		bool					bEnd = false;
-		MSG						msg;
 		bool					bMonochrome = m_pOutBitmap->IsMonochrome();
 		bool					bCFA = m_pOutBitmap->IsCFA();
 
-		// Create a message queue and signal the event
-		PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-		SetEvent(hEvent);
-		while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+		for (j = lStart;j<lEnd;j++)
 		{
-			if (msg.message == WM_MT_PROCESS)
+			for (i = 0;i<m_lWidth;i++)
 			{
-				for (j = msg.wParam;j<msg.wParam+msg.lParam;j++)
+				bool				bChanged = false;
+				double				fDelta;
+
+				m_pDelta->GetPixel(i, j, fDelta);
+
+				if (fDelta > 200)
 				{
-					for (i = 0;i<m_lWidth;i++)
-					{
-						bool				bChanged = false;
-						double				fDelta;
-
-						m_pDelta->GetPixel(i, j, fDelta);
-
-						if (fDelta > 200)
-						{
-							// Hot pixel to fix
-							FixHotPixel(i, j);
-						}
-						else if (fDelta < 100)
-						{
-							// Cold pixel to fix
-							FixColdPixel(i, j);
-						};
-					};
+					// Hot pixel to fix
+					FixHotPixel(i, j);
+				}
+				else if (fDelta < 100)
+				{
+					// Cold pixel to fix
+					FixColdPixel(i, j);
 				};
-
-				SetEvent(hEvent);
-			}
-			else if (msg.message == WM_MT_STOP)
-				bEnd = true;
+			};
 		};
 
 		return true;
@@ -384,30 +334,10 @@ public :
 	{
 		ZFUNCTRACE_RUNTIME();
 		bool				bResult = true;
-		LONG				i = 0;
-		LONG				lStep;
-		LONG				lRemaining;
 
 		if (m_pProgress)
 			m_pProgress->SetNrUsedProcessors(GetNrThreads());
-		lStep		= max(1L, m_lHeight/50);
-		lRemaining	= m_lHeight;
-
-		while (i<m_lHeight)
-		{
-			LONG			lAdd = min(lStep, lRemaining);
-			DWORD			dwThreadId;
-
-			dwThreadId = GetAvailableThreadId();
-			PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-			i			+=lAdd;
-			lRemaining	-= lAdd;
-			if (m_pProgress)
-				m_pProgress->Progress2(nullptr, i);
-		};
-
-		CloseAllThreads();
+		bResult = ProcessRange(0, m_lHeight, m_pProgress);
 
 		if (m_pProgress)
 			m_pProgress->SetNrUsedProcessors();
@@ -666,7 +596,6 @@ bool	ApplyCosmetic(CMemoryBitmap * pBitmap, CMemoryBitmap ** ppDeltaBitmap, cons
 
 				CosmeticTask.SetInitDelta(true);
 				CosmeticTask.Init(pBitmap, pMedian, pDelta, true, pcs.m_fHotDetection/100.0, pProgress);
-				CosmeticTask.StartThreads();
 				CosmeticTask.Process();
 
 				CosmeticTask.FillStats(Stats);
@@ -699,7 +628,6 @@ bool	ApplyCosmetic(CMemoryBitmap * pBitmap, CMemoryBitmap ** ppDeltaBitmap, cons
 
 				CosmeticTask.SetInitDelta(!pcs.m_bHot);
 				CosmeticTask.Init(pBitmap, pMedian, pDelta, false, pcs.m_fColdDetection/100.0, pProgress);
-				CosmeticTask.StartThreads();
 				CosmeticTask.Process();
 
 				CosmeticTask.FillStats(Stats);
@@ -720,7 +648,6 @@ bool	ApplyCosmetic(CMemoryBitmap * pBitmap, CMemoryBitmap ** ppDeltaBitmap, cons
 					pProgress->Start2(nullptr, lHeight);
 
 				CosmeticTask.Init(pBitmap, pCloneBitmap, pDelta, pcs, pProgress);
-				CosmeticTask.StartThreads();
 				CosmeticTask.Process();
 
 				if (pProgress)
@@ -774,7 +701,6 @@ bool	SimulateCosmetic(CMemoryBitmap * pBitmap, const CPostCalibrationSettings &
 
 				CosmeticTask.SetSimulate(true);
 				CosmeticTask.Init(pBitmap, pMedian, nullptr, true, pcs.m_fHotDetection/100.0, pProgress);
-				CosmeticTask.StartThreads();
 				CosmeticTask.Process();
 
 				if (pProgress)
@@ -807,7 +733,6 @@ bool	SimulateCosmetic(CMemoryBitmap * pBitmap, const CPostCalibrationSettings &
 
 				CosmeticTask.SetSimulate(true);
 				CosmeticTask.Init(pBitmap, pMedian, nullptr, false, pcs.m_fColdDetection/100.0, pProgress);
-				CosmeticTask.StartThreads();
 				CosmeticTask.Process();
 
 				if (pProgress)
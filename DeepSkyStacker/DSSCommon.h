@@ -27,6 +27,14 @@ typedef enum tagCOMETSTACKINGMODE
 	CSM_COMETSTAR = 2
 }COMETSTACKINGMODE;
 
+typedef enum tagRESAMPLINGMODE
+{
+	RSM_PIXELDISPATCH = 0,		// Each light frame pixel is spread on the output pixels
+	RSM_BILINEAR = 1,			// Each output pixel is sampled from the light frame
+	RSM_BICUBIC = 2,
+	RSM_LANCZOS3 = 3
+}RESAMPLINGMODE;
+
 enum BACKGROUNDCALIBRATIONMODE : short
 {
 	BCM_NONE = 0,
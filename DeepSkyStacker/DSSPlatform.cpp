@@ -0,0 +1,276 @@
+#include <stdafx.h>
+#include "DSSPlatform.h"
+#include <zexcept.h>
+#include <QSettings>
+#include <shlobj.h>
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+
+/* ------------------------------------------------------------------- */
+
+void	ReportEngineMessage(LPCTSTR szMessage, bool bWarning)
+{
+#if defined(_CONSOLE)
+	_ftprintf(stderr, _T("%s\n"), szMessage);
+#else
+	AfxMessageBox(szMessage, MB_OK | (bWarning ? MB_ICONWARNING : MB_ICONSTOP));
+#endif
+};
+
+/* ------------------------------------------------------------------- */
+
+CString	FormatZException(const ZException & ze)
+{
+	CString errorMessage;
+	CString name(CA2CT(ze.name()));
+	CString fileName(CA2CT(ze.locationAtIndex(0)->fileName()));
+	CString functionName(CA2CT(ze.locationAtIndex(0)->functionName()));
+	CString text(CA2CT(ze.text(0)));
+
+	errorMessage.Format(
+		_T("Exception %s thrown from %s Function: %s() Line: %lu\n\n%s"),
+		name,
+		fileName,
+		functionName,
+		ze.locationAtIndex(0)->lineNumber(),
+		text);
+
+	return errorMessage;
+};
+
+/* ------------------------------------------------------------------- */
+
+LONG	GetNrLogicalProcessors()
+{
+	SYSTEM_INFO			SysInfo;
+
+	GetSystemInfo(&SysInfo);
+
+	return static_cast<LONG>(SysInfo.dwNumberOfProcessors);
+};
+
+/* ------------------------------------------------------------------- */
+
+std::uint64_t	GetAvailablePhysicalMemory()
+{
+	MEMORYSTATUSEX		MemoryStatus;
+
+	MemoryStatus.dwLength = sizeof(MemoryStatus);
+	if (GlobalMemoryStatusEx(&MemoryStatus))
+		return static_cast<std::uint64_t>(MemoryStatus.ullAvailPhys);
+
+	return 0;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	ReduceCurrentThreadPriority()
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+};
+
+/* ------------------------------------------------------------------- */
+
+double	GetProcessCPUTime()
+{
+	double				fResult = 0;
+
+	FILETIME			ftCreation,
+						ftExit,
+						ftKernel,
+						ftUser;
+
+	if (GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser))
+	{
+		const auto		toSeconds = [](const FILETIME & ft) -> double
+		{
+			// 100 nanoseconds units
+			return static_cast<double>((static_cast<std::uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) / 10000000.0;
+		};
+
+		fResult = toSeconds(ftKernel) + toSeconds(ftUser);
+	};
+
+	return fResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+std::uint64_t	GetPeakProcessMemory()
+{
+	std::uint64_t		lResult = 0;
+
+	PROCESS_MEMORY_COUNTERS		pmc;
+
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		lResult = pmc.PeakWorkingSetSize;
+
+	return lResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+unsigned long	GetProcessIdentifier()
+{
+	return GetCurrentProcessId();
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	GetEngineSetting(const char * szName, bool bDefault)
+{
+	return QSettings{}.value(szName, bDefault).toBool();
+};
+
+/* ------------------------------------------------------------------- */
+
+unsigned int	GetEngineSetting(const char * szName, unsigned int lDefault)
+{
+	return QSettings{}.value(szName, lDefault).toUInt();
+};
+
+/* ------------------------------------------------------------------- */
+
+void	SetEngineSetting(const char * szName, bool bValue)
+{
+	QSettings{}.setValue(szName, bValue);
+};
+
+/* ------------------------------------------------------------------- */
+
+void	SetEngineSetting(const char * szName, unsigned int lValue)
+{
+	QSettings{}.setValue(szName, lValue);
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	GetFileStamp(LPCTSTR szFile, std::uint64_t & lFileSize, std::uint64_t & lFileTime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA	FileData;
+
+	if (GetFileAttributesEx(szFile, GetFileExInfoStandard, &FileData) &&
+		!(FileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		lFileSize = (static_cast<std::uint64_t>(FileData.nFileSizeHigh) << 32) | FileData.nFileSizeLow;
+		lFileTime = (static_cast<std::uint64_t>(FileData.ftLastWriteTime.dwHighDateTime) << 32) | FileData.ftLastWriteTime.dwLowDateTime;
+		return true;
+	};
+
+	return false;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CanOpenFileExclusively(LPCTSTR szFile)
+{
+	HANDLE				hFile;
+
+	hFile = CreateFile(szFile, GENERIC_READ, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hFile);
+		return true;
+	};
+
+	return false;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	ReplaceFileWith(LPCTSTR szSourceFile, LPCTSTR szDestFile)
+{
+	return !!MoveFileEx(szSourceFile, szDestFile, MOVEFILE_REPLACE_EXISTING);
+};
+
+/* ------------------------------------------------------------------- */
+
+CString	GetUserDataFile(LPCTSTR szName)
+{
+	CString				strFile;
+
+	TCHAR				szPath[1+_MAX_PATH];
+
+	if (SUCCEEDED(SHGetFolderPath(nullptr, CSIDL_LOCAL_APPDATA, nullptr, SHGFP_TYPE_CURRENT, szPath)))
+	{
+		strFile = szPath;
+		strFile += _T("\\DeepSkyStacker");
+		CreateDirectory(strFile, nullptr);
+		strFile += _T("\\");
+		strFile += szName;
+	};
+
+	return strFile;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	PreallocateFile(LPCTSTR szFile, size_t lSize)
+{
+	bool				bResult = false;
+
+	HANDLE				hFile;
+
+	hFile = CreateFile(szFile, GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_TEMPORARY, nullptr);
+	if (hFile != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER	liSize;
+
+		liSize.QuadPart = static_cast<LONGLONG>(lSize);
+		bResult = SetFilePointerEx(hFile, liSize, nullptr, FILE_BEGIN) && SetEndOfFile(hFile);
+		CloseHandle(hFile);
+	};
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+CMappedFile::CMappedFile()
+{
+	m_hFile		= INVALID_HANDLE_VALUE;
+	m_hMapping	= nullptr;
+	m_lSize		= 0;
+	m_pView		= nullptr;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CMappedFile::Open(LPCTSTR szFile, bool bWrite)
+{
+	Close();
+
+	m_hFile = CreateFile(szFile, bWrite ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, 0, nullptr, OPEN_EXISTING,
+						 FILE_ATTRIBUTE_TEMPORARY | (bWrite ? 0 : FILE_FLAG_SEQUENTIAL_SCAN), nullptr);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER	liSize;
+
+		if (GetFileSizeEx(m_hFile, &liSize))
+			m_lSize = static_cast<size_t>(liSize.QuadPart);
+		m_hMapping = CreateFileMapping(m_hFile, nullptr, bWrite ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+	};
+	if (m_hMapping)
+		m_pView = static_cast<BYTE *>(MapViewOfFile(m_hMapping, bWrite ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+
+	return (m_pView != nullptr);
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CMappedFile::Close()
+{
+	if (m_pView)
+		UnmapViewOfFile(m_pView);
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+	m_hMapping	= nullptr;
+	m_hFile		= INVALID_HANDLE_VALUE;
+	m_lSize		= 0;
+	m_pView		= nullptr;
+};
+
+/* ------------------------------------------------------------------- */
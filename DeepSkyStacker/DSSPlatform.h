@@ -0,0 +1,141 @@
+#ifndef __DSSPLATFORM_H__
+#define __DSSPLATFORM_H__
+
+#include <cstdint>
+#include <mutex>
+
+class ZException;
+
+/* ------------------------------------------------------------------- */
+
+// Platform layer of the engine.
+// The registering, calibration and stacking code must only go through
+// these functions and classes for the services that depend on the
+// operating system or on the user interface (message boxes, memory
+// mapped files, synchronization, threads priority, system and process
+// information, settings, file stamps).
+// Only the Win32 implementation exists: this is the single place where
+// the implementations for another platform will have to be added.
+
+/* ------------------------------------------------------------------- */
+
+// Shows an error (or a warning) to the user: message box in the GUI,
+// standard error output in the command line tools
+void	ReportEngineMessage(LPCTSTR szMessage, bool bWarning = false);
+
+// Builds the message shown when a ZException is caught
+CString	FormatZException(const ZException & ze);
+
+/* ------------------------------------------------------------------- */
+
+// Drop-in replacement of CComAutoCriticalSection (same Lock/Unlock
+// interface and recursive too)
+class CDSSCriticalSection : public std::recursive_mutex
+{
+public :
+	void	Lock()
+	{
+		lock();
+	};
+
+	void	Unlock()
+	{
+		unlock();
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+// Number of logical processors of the computer
+LONG	GetNrLogicalProcessors();
+
+// Physical memory that is currently available (0 if unknown)
+std::uint64_t	GetAvailablePhysicalMemory();
+
+// Lowers the priority of the calling thread below the user interface
+void	ReduceCurrentThreadPriority();
+
+// CPU time (user and kernel) used so far by all the threads of the process
+double	GetProcessCPUTime();
+
+// Peak physical memory used so far by the process (0 if unknown)
+std::uint64_t	GetPeakProcessMemory();
+
+// Identifier of the process (unique among the running processes)
+unsigned long	GetProcessIdentifier();
+
+/* ------------------------------------------------------------------- */
+
+// Engine settings shared with the user interface
+bool	GetEngineSetting(const char * szName, bool bDefault);
+unsigned int	GetEngineSetting(const char * szName, unsigned int lDefault);
+void	SetEngineSetting(const char * szName, bool bValue);
+void	SetEngineSetting(const char * szName, unsigned int lValue);
+
+/* ------------------------------------------------------------------- */
+
+// Size and last write time (in an OS dependent unit) of a file
+bool	GetFileStamp(LPCTSTR szFile, std::uint64_t & lFileSize, std::uint64_t & lFileTime);
+
+// False while another process has the file open (being written)
+bool	CanOpenFileExclusively(LPCTSTR szFile);
+
+// Renames szSourceFile to szDestFile, replacing szDestFile if it exists
+bool	ReplaceFileWith(LPCTSTR szSourceFile, LPCTSTR szDestFile);
+
+// Full name of a file in the DeepSkyStacker folder of the user's local
+// data (created if needed) - empty if there is no such folder
+CString	GetUserDataFile(LPCTSTR szName);
+
+/* ------------------------------------------------------------------- */
+
+// Sets the size of an existing file (the content is undefined)
+bool	PreallocateFile(LPCTSTR szFile, size_t lSize);
+
+/* ------------------------------------------------------------------- */
+
+// Whole file mapped in memory
+class CMappedFile
+{
+private :
+	HANDLE						m_hFile;
+	HANDLE						m_hMapping;
+	size_t						m_lSize;
+	BYTE *						m_pView;
+
+public :
+	CMappedFile();
+	~CMappedFile()
+	{
+		Close();
+	};
+
+	CMappedFile(const CMappedFile &) = delete;
+	CMappedFile & operator = (const CMappedFile &) = delete;
+
+	bool	Open(LPCTSTR szFile, bool bWrite);
+	void	Close();
+
+	BYTE *	GetData() const
+	{
+		return m_pView;
+	};
+
+	size_t	GetSize() const
+	{
+		return m_lSize;
+	};
+
+	void	Touch(size_t lSize) const
+	{
+		// Fault every page in so that the data is in memory when it is used
+		volatile BYTE		bValue = 0;
+
+		for (size_t i = 0;m_pView && i<lSize;i += 4096)
+			bValue = m_pView[i];
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+#endif // __DSSPLATFORM_H__
@@ -1719,14 +1719,12 @@ public :
 		m_RGBHistogram.SetSize(256.0, (LONG)65535);
 	};
 
-	virtual bool	DoTask(HANDLE hEvent)
+	virtual bool	DoTask(LONG lStart, LONG lEnd)
 	{
 		ZFUNCTRACE_RUNTIME();
 		bool				bResult = true;
 
 		LONG				i, j;
-		bool				bEnd = false;
-		MSG					msg;
 		LONG				lWidth = m_pBitmap->RealWidth();
 
 		CRGBHistogram		RGBHistogram;
@@ -1736,40 +1734,27 @@ public :
 
 		m_pBitmap->GetIterator(&PixelIt);
 
-		// Create a message queue and signal the event
-		PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-		SetEvent(hEvent);
-		while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+		PixelIt->Reset(0, lStart);
+		for (j = lStart;j<lEnd;j++)
 		{
-			if (msg.message == WM_MT_PROCESS)
+			for (i = 0;i<lWidth;i++)
 			{
-				PixelIt->Reset(0, msg.wParam);
-				for (j = msg.wParam;j<msg.wParam+msg.lParam;j++)
-				{
-					for (i = 0;i<lWidth;i++)
-					{
-						double			fRed, fGreen, fBlue, fGray;
+				double			fRed, fGreen, fBlue, fGray;
 
-						if (m_bMonochrome)
-						{
-							PixelIt->GetPixel(fGray);
-							//m_pBitmap->GetPixel(i, j, fGray);
-							RGBHistogram.AddValues(fGray, fGray, fGray);
-						}
-						else
-						{
-							PixelIt->GetPixel(fRed, fGreen, fBlue);
-							//m_pBitmap->GetPixel(i, j, fRed, fGreen, fBlue);
-							RGBHistogram.AddValues(fRed, fGreen, fBlue);
-						};
-						(*PixelIt)++;
-					};
+				if (m_bMonochrome)
+				{
+					PixelIt->GetPixel(fGray);
+					//m_pBitmap->GetPixel(i, j, fGray);
+					RGBHistogram.AddValues(fGray, fGray, fGray);
+				}
+				else
+				{
+					PixelIt->GetPixel(fRed, fGreen, fBlue);
+					//m_pBitmap->GetPixel(i, j, fRed, fGreen, fBlue);
+					RGBHistogram.AddValues(fRed, fGreen, fBlue);
 				};
-
-				SetEvent(hEvent);
-			}
-			else if (msg.message == WM_MT_STOP)
-				bEnd = true;
+				(*PixelIt)++;
+			};
 		};
 
 		m_CriticalSection.Lock();
@@ -1783,30 +1768,13 @@ public :
 		ZFUNCTRACE_RUNTIME();
 		bool				bResult = true;
 		LONG				lHeight = m_pBitmap->RealHeight();
-		LONG				i = 0;
-		LONG				lStep;
-		LONG				lRemaining;
+		const LONG			lNrThreads = GetNrThreads();
 
 		if (m_pProgress)
-			m_pProgress->SetNrUsedProcessors(GetNrThreads());
-		lStep		= max(1L, lHeight/50);
-		lRemaining	= lHeight;
-
-		while (i<lHeight)
-		{
-			LONG			lAdd = min(lStep, lRemaining);
-			DWORD			dwThreadId;
-
-			dwThreadId = GetAvailableThreadId();
-			PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-			i			+=lAdd;
-			lRemaining	-= lAdd;
-			if (m_pProgress)
-				m_pProgress->Progress2(nullptr, i);
-		};
-
-		CloseAllThreads();
+			m_pProgress->SetNrUsedProcessors(lNrThreads);
+		// One chunk per thread: each chunk fills its own histogram and adds
+		// it to the main one under the lock
+		bResult = ProcessRange(0, lHeight, m_pProgress, false, (lHeight + lNrThreads - 1) / lNrThreads);
 
 		if (m_pProgress)
 			m_pProgress->SetNrUsedProcessors();
@@ -1879,7 +1847,6 @@ void	CDarkFrame::FindHotPixels(CDSSProgress * pProgress)
 		CFindHotPixelTask1	HotPixelTask1;
 
 		HotPixelTask1.Init(m_pMasterDark, pProgress);
-		HotPixelTask1.StartThreads();
 		HotPixelTask1.Process();
 
 		/*
@@ -2098,19 +2065,15 @@ void	CDarkFrame::InterpolateHotPixels(CMemoryBitmap * pBitmap, CDSSProgress * pP
 
 /* ------------------------------------------------------------------- */
 
-bool	CDarkFrame::Subtract(CMemoryBitmap * pTarget, CDSSProgress * pProgress)
+void	CDarkFrame::PrepareSubtraction(CMemoryBitmap * pTarget, SUBTRACTEDFRAMEVECTOR & vFrames, CDSSProgress * pProgress)
 {
 	ZFUNCTRACE_RUNTIME();
-	bool				bResult = true;
 
+	vFrames.clear();
 	if (m_pMasterDark && m_pMasterDark->IsOk())
 	{
 		CString			strText;
 
-		double			fRedDarkFactor = 1.0,
-						fGreenDarkFactor = 1.0,
-						fBlueDarkFactor = 1.0;
-
 		if ((m_bHotPixelsDetection || m_bBadLinesDetection) && !m_bHotPixelDetected)
 		{
 			if (m_bHotPixelsDetection)
@@ -2139,13 +2102,8 @@ bool	CDarkFrame::Subtract(CMemoryBitmap * pTarget, CDSSProgress * pProgress)
 			pAmpGlow.Attach(m_pAmpGlow->Clone());
 			Multiply(pAmpGlow, fAmpGlow, fAmpGlow, fAmpGlow, pProgress);*/
 
-			if (pProgress)
-			{
-				strText.LoadString(IDS_SUBSTRACTINGDARK);
-				pProgress->Start2(strText, 0);
-			};
-			::Subtract(pTarget, m_pAmpGlow, pProgress, fAmpGlow, fAmpGlow, fAmpGlow);
-			::Subtract(pTarget, m_pDarkCurrent, pProgress, fHotDark, fHotDark, fHotDark);
+			vFrames.emplace_back(m_pAmpGlow, fAmpGlow);
+			vFrames.emplace_back(m_pDarkCurrent, fHotDark);
 
 			// Now check that if modified dark current is removed from
 			// the target - there is no more negative pixels
@@ -2155,24 +2113,30 @@ bool	CDarkFrame::Subtract(CMemoryBitmap * pTarget, CDSSProgress * pProgress)
 			ComputeOptimalDistributionRatio(pTarget, pDarkCurrent, fHotDark, pProgress);
 			::Subtract(pTarget, pDarkCurrent, pProgress, fHotDark, fHotDark, fHotDark);*/
 		}
-		else if (m_fDarkFactor != 1.0)
-		{
-			if (pProgress)
-			{
-				strText.LoadString(IDS_SUBSTRACTINGDARK);
-				pProgress->Start2(strText, 0);
-			};
-			::Subtract(pTarget, m_pMasterDark, pProgress, m_fDarkFactor, m_fDarkFactor, m_fDarkFactor);
-		}
 		else
+			vFrames.emplace_back(m_pMasterDark, m_fDarkFactor);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CDarkFrame::Subtract(CMemoryBitmap * pTarget, CDSSProgress * pProgress)
+{
+	ZFUNCTRACE_RUNTIME();
+	bool					bResult = true;
+	SUBTRACTEDFRAMEVECTOR	vFrames;
+
+	PrepareSubtraction(pTarget, vFrames, pProgress);
+	for (const auto & Frame : vFrames)
+	{
+		if (pProgress)
 		{
-			if (pProgress)
-			{
-				strText.LoadString(IDS_SUBSTRACTINGDARK);
-				pProgress->Start2(strText, 0);
-			};
-			::Subtract(pTarget, m_pMasterDark, pProgress);
+			CString			strText;
+
+			strText.LoadString(IDS_SUBSTRACTINGDARK);
+			pProgress->Start2(strText, 0);
 		};
+		::Subtract(pTarget, Frame.m_pBitmap, pProgress, Frame.m_fFactor, Frame.m_fFactor, Frame.m_fFactor);
 	};
 
 	return bResult;
@@ -258,6 +258,25 @@ public :
 
 /* ------------------------------------------------------------------- */
 
+// A frame subtracted from the light frames with its factor
+class CSubtractedFrame
+{
+public :
+	CSmartPtr<CMemoryBitmap>	m_pBitmap;
+	double						m_fFactor;
+
+public :
+	CSubtractedFrame(CMemoryBitmap * pBitmap, double fFactor = 1.0)
+	{
+		m_pBitmap	= pBitmap;
+		m_fFactor	= fFactor;
+	};
+};
+
+typedef std::vector<CSubtractedFrame>		SUBTRACTEDFRAMEVECTOR;
+
+/* ------------------------------------------------------------------- */
+
 class CDarkFrame
 {
 private :
@@ -317,6 +336,10 @@ public :
 		m_pMasterDark = pMasterDark;
 	};
 
+	// Detects the hot pixels if needed and computes the frames (with their factors)
+	// to subtract from pTarget - pTarget must not be modified before the subtraction
+	// when the dark optimization is used.
+	void	PrepareSubtraction(CMemoryBitmap * pTarget, SUBTRACTEDFRAMEVECTOR & vFrames, CDSSProgress * pProgress = nullptr);
 	bool	Subtract(CMemoryBitmap * pTarget, CDSSProgress * pProgress = nullptr);
 
 	void	InterpolateHotPixels(CMemoryBitmap * pBitmap, CDSSProgress * pProgress = nullptr);
@@ -325,6 +348,11 @@ public :
 	{
 		return (m_pMasterDark != nullptr);
 	};
+
+	bool	UseDarkOptimization()
+	{
+		return m_bDarkOptimization;
+	};
 };
 
 #endif // __DARKFRAME_H__
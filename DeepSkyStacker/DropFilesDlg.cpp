@@ -100,11 +100,12 @@ BOOL CDropFilesDlg::OnInitDialog()
 
 	if (m_hDropInfo)
 	{
+		std::vector<CString>	vDroppedFiles;
+
 		lNrFiles = DragQueryFile(m_hDropInfo, 0xFFFFFFFF, nullptr, 0);
 		for (LONG i = 0;i<lNrFiles;i++)
 		{
 			TCHAR			szFile[1+_MAX_PATH];
-			CString			strFile;
 
 			DragQueryFile(m_hDropInfo, i, szFile, sizeof(szFile)/sizeof(TCHAR));
 
@@ -114,26 +115,20 @@ BOOL CDropFilesDlg::OnInitDialog()
 			dwAttributes = GetFileAttributes(szFile);
 
 			if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY)
-			{
-				std::vector<CString>	vFiles;
-
-				GetFilesInFolder(szFile, vFiles);
-				for (LONG j = 0;j<vFiles.size();j++)
-				{
-					if (IsMasterFile(vFiles[j]))
-						vMasters.push_back(vFiles[j]);
-					else
-						m_vFiles.push_back(vFiles[j]);
-				};
-			}
+				GetFilesInFolder(szFile, vDroppedFiles);
+			else
+				vDroppedFiles.push_back(szFile);
+		};
+
+		// Read the headers of all the files at once
+		ScanPicturesInfo(vDroppedFiles);
+
+		for (LONG i = 0;i<vDroppedFiles.size();i++)
+		{
+			if (IsMasterFile(vDroppedFiles[i]))
+				vMasters.push_back(vDroppedFiles[i]);
 			else
-			{
-				strFile = szFile;
-				if (IsMasterFile(strFile))
-					vMasters.push_back(strFile);
-				else
-					m_vFiles.push_back(strFile);
-			};
+				m_vFiles.push_back(vDroppedFiles[i]);
 		};
 
 		DragFinish(m_hDropInfo);
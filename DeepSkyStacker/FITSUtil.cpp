@@ -1,10 +1,13 @@
 #include <stdafx.h>
 #include "FITSUtil.h"
+#include "DSSPlatform.h"
 #include <float.h>
+#include <atomic>
 #include <cmath>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <type_traits>
 #include <map>
 
 #include "Workspace.h"
@@ -15,7 +18,42 @@
 
 /* ------------------------------------------------------------------- */
 
-static	CComAutoCriticalSection			g_FITSCritical;
+// cfitsio only protects its shared state (table of the opened files,
+// stack of the error messages) when it is built with -D_REENTRANT
+// (USE_PTHREADS in its CMakeLists.txt).
+// With such a build each reader/writer only works on its own fitsfile
+// handle and several files are loaded at the same time without any lock.
+// With a non reentrant build the calls to cfitsio are serialized, but not
+// the decoding of the pixels nor the whole lifetime of the reader/writer.
+class CFITSLibraryLock
+{
+private :
+	static CDSSCriticalSection	m_CriticalSection;
+	static const bool			m_bReentrant;
+	bool						m_bLocked;
+
+public :
+	CFITSLibraryLock()
+	{
+		m_bLocked = !m_bReentrant;
+		if (m_bLocked)
+			m_CriticalSection.Lock();
+	};
+
+	~CFITSLibraryLock()
+	{
+		if (m_bLocked)
+			m_CriticalSection.Unlock();
+	};
+
+	CFITSLibraryLock(const CFITSLibraryLock &) = delete;
+	CFITSLibraryLock & operator = (const CFITSLibraryLock &) = delete;
+};
+
+CDSSCriticalSection	CFITSLibraryLock::m_CriticalSection;
+const bool			CFITSLibraryLock::m_bReentrant = (fits_is_reentrant() != 0);
+
+/* ------------------------------------------------------------------- */
 
 CFITSHeader::CFITSHeader()
 {
@@ -27,7 +65,6 @@ CFITSHeader::CFITSHeader()
 	m_Format		= FF_UNKNOWN;
 	m_bSigned		= false;
 	m_DateTime.wYear= 0;
-	g_FITSCritical.Lock();
     m_lWidth = 0;
     m_lHeight = 0;
 	m_lBitsPerPixel = 0;
@@ -43,7 +80,6 @@ CFITSHeader::CFITSHeader()
 
 CFITSHeader::~CFITSHeader()
 {
-	g_FITSCritical.Unlock();
 };
 
 /* ------------------------------------------------------------------- */
@@ -80,6 +116,22 @@ CFATYPE GetFITSCFATYPE()
 
 /* ------------------------------------------------------------------- */
 
+// Settings that change the info returned by IsFITSPicture: the CFA type
+// and Bayer offsets (overridden when the FITS files are RAW files) and
+// the propagated keywords
+CString	GetFITSInfoSettings()
+{
+	QSettings			settings;
+	CString				strResult;
+
+	strResult.Format(_T("%d;%ld;"), IsFITSRaw() ? 1 : 0, static_cast<LONG>(GetFITSCFATYPE()));
+	strResult += (LPCTSTR)settings.value("FitsDDP/Propagated", "").toString().utf16();
+
+	return strResult;
+};
+
+/* ------------------------------------------------------------------- */
+
 bool	IsFITSRawBayer()
 {
 	CWorkspace			workspace;
@@ -163,6 +215,8 @@ bool CFITSReader::ReadKey(LPCSTR szKey, double & fValue, CString & strComment)
 	{
 		CHAR			szComment[500];
 
+		CFITSLibraryLock	Lock;
+
 		fits_read_key(m_fits, TDOUBLE, szKey, &fValue, szComment, &nStatus);
 		if (!nStatus)
 		{
@@ -181,6 +235,8 @@ bool CFITSReader::ReadKey(LPCSTR szKey, double & fValue)
 
 	if (m_fits)
 	{
+		CFITSLibraryLock	Lock;
+
 		fits_read_key(m_fits, TDOUBLE, szKey, &fValue, nullptr, &nStatus);
 		if (!nStatus)
 			bResult = true;
@@ -196,6 +252,8 @@ bool CFITSReader::ReadKey(LPCSTR szKey, LONG & lValue)
 
 	if (m_fits)
 	{
+		CFITSLibraryLock	Lock;
+
 		fits_read_key(m_fits, TLONG, szKey, &lValue, nullptr, &nStatus);
 		if (!nStatus)
 			bResult = true;
@@ -212,6 +270,8 @@ bool CFITSReader::ReadKey(LPCSTR szKey, CString & strValue)
 
 	if (m_fits)
 	{
+		CFITSLibraryLock	Lock;
+
 		fits_read_key(m_fits, TSTRING, szKey, szValue, nullptr, &nStatus);
 		if (!nStatus)
 		{
@@ -238,6 +298,7 @@ void CFITSReader::ReadAllKeys()
 		if ("" == strPropagated)
 			strPropagated = "[CRVAL1][CRVAL2][CRTYPE1][CRTYPE2][DEC][RA][OBJCTDEC][OBJCTRA][OBJCTALT][OBJCTAZ][OBJCTHA][SITELAT][SITELONG][TELESCOP][INSTRUME][OBSERVER][RADECSYS]";
 
+		CFITSLibraryLock	Lock;
 
 		fits_get_hdrspace(m_fits, &nKeywords, nullptr, &nStatus);
 		for (LONG i = 1;i<=nKeywords;i++)
@@ -275,7 +336,11 @@ bool CFITSReader::Open()
 	int					status = 0;
 	char error_text[31] = "";			// Error text for FITS errors.
 
-	fits_open_diskfile(&m_fits, CT2CA(m_strFileName, CP_ACP), READONLY, &status);
+	{
+		CFITSLibraryLock	Lock;
+
+		fits_open_diskfile(&m_fits, CT2CA(m_strFileName, CP_ACP), READONLY, &status);
+	};
 	if (0 != status)
 	{
 		fits_get_errstatus(status, error_text);
@@ -287,11 +352,7 @@ bool CFITSReader::Open()
 
 		ZTRACE_RUNTIME(CT2CA(errorMessage));
 
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONWARNING);
-#endif
+		ReportEngineMessage(errorMessage, true);
 
 
 	}
@@ -378,11 +439,13 @@ bool CFITSReader::Open()
 
 			//
 			// One time action to create a mapping between the character name of the CFA
-			// pattern and our internal CFA type 
+			// pattern and our internal CFA type (the initialization of the static is
+			// thread safe, the map is then only read)
 			// 
-			static std::map<CString, CFATYPE> bayerMap;
-			if (bayerMap.empty())
+			static const std::map<CString, CFATYPE> bayerMap = []()
 			{
+				std::map<CString, CFATYPE> bayerMap;
+
 				bayerMap.emplace("BGGR", CFATYPE_BGGR);
 				bayerMap.emplace("GRBG", CFATYPE_GRBG);
 				bayerMap.emplace("GBRG", CFATYPE_GBRG);
@@ -432,7 +495,9 @@ bool CFITSReader::Open()
 				bayerMap.emplace("YCMGCYMG", CFATYPE_YCMGCYMG);
 				bayerMap.emplace("MGCYMGYC", CFATYPE_MGCYMGYC);
 				bayerMap.emplace("CYMGYCMG", CFATYPE_CYMGYCMG);
-			}
+
+				return bayerMap;
+			}();
 
 			//
 			// Attempt to determine the correct CFA (aka Bayer matrix) from keywords in the FITS header.
@@ -628,6 +693,8 @@ bool CFITSReader::Open()
 		{
 			if (m_fits)
 			{
+				CFITSLibraryLock	Lock;
+
 				fits_close_file(m_fits, &status);
 				m_fits = nullptr;
 			};
@@ -639,6 +706,294 @@ bool CFITSReader::Open()
 
 /* ------------------------------------------------------------------- */
 
+double	CFITSReader::GetRatio(LONG lX, LONG lY)
+{
+	if (m_lNrChannels != 1)
+		return 1.0;
+	else if (m_CFAType == CFATYPE_NONE)
+		return m_fBrightnessRatio;
+
+	switch (::GetBayerColor(lX, lY, m_CFAType, m_xBayerOffset, m_yBayerOffset))
+	{
+	case BAYER_BLUE :
+		return m_fBlueRatio;
+	case BAYER_GREEN :
+		return m_fGreenRatio;
+	case BAYER_RED :
+		return m_fRedRatio;
+	};
+
+	return 1.0;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CFITSReader::AdjustFloatRange(double & fMin, double & fMax)
+{
+	double		fZero, fScale;
+
+	if (ReadKey("BZERO", fZero) && ReadKey("BSCALE", fScale))
+	{
+		fMax = (fMax + fZero) / fScale;
+		fMin = fZero / fScale;
+	}
+	else if (fMin >= 0 && fMin <= 1 && fMax >= 0 && fMax <= 1)
+	{
+		fMin = 0;
+		fMax = 1;
+	}
+	if (m_bDSI && (fMax > 1))
+	{
+		fMin = min(0.0, fMin);
+		fMax = max(fMax, 65535.0);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+// Ratios applied to the pixels of the rows y & 3 (the Bayer patterns are
+// at most 2 pixels wide and 4 pixels high)
+void	CFITSReader::GetRatioLines(std::vector<double> & vRatios)
+{
+	vRatios.resize(4 * static_cast<size_t>(m_lWidth));
+	for (LONG j = 0;j<4;j++)
+		for (LONG i = 0;i<m_lWidth;i++)
+			vRatios[j * static_cast<size_t>(m_lWidth) + i] = GetRatio(i, j);
+};
+
+/* ------------------------------------------------------------------- */
+
+// Same result as AdjustColor, OnRead and SetPixel for a whole line, in a
+// loop simple enough to be vectorized by the compiler.
+// pSource and pTarget may point to the same line.
+template <typename TType, typename TBand>
+static void	ConvertLine(const TBand * pSource, TType * pTarget, const double * pRatios, double fScale, double fOffset, double fMultiplier, LONG lWidth)
+{
+	for (LONG i = 0;i<lWidth;i++)
+	{
+		double			fValue = pSource[i] * fScale + fOffset;
+
+		// NaN and infinite values are set to 0 like in AdjustColor
+		fValue = (fValue > 0.0 && fValue < HUGE_VAL) ? min(fValue, 255.0) : 0.0;
+		pTarget[i] = static_cast<TType>(min(fValue * pRatios[i], 255.0) * fMultiplier);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+static LONG	GetBandHeight(LONG lWidth, LONG lHeight, size_t lPixelSize)
+{
+	// Around 4 MB read from the file at once
+	const size_t		lBandSize = 4 * 1024 * 1024;
+
+	return static_cast<LONG>(std::clamp(lBandSize / (static_cast<size_t>(lWidth) * lPixelSize), size_t{ 1 }, static_cast<size_t>(lHeight)));
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CFITSReader::ReadInBands()
+{
+	ZFUNCTRACE_RUNTIME();
+	CMemoryBitmap *		pBitmap = GetTargetBitmap();
+
+	if (!m_fits || !pBitmap || (m_lNrChannels != 1 && m_lNrChannels != 3))
+		return false;
+
+	BYTE *				pBYTEPlanes[3];
+	WORD *				pWORDPlanes[3];
+	DWORD *				pDWORDPlanes[3];
+	float *				pFLOATPlanes[3];
+	double				fMultiplier = 1.0;
+	// 8 and 16 bit integers are exact in float, larger ones need double
+	const bool			bFloatBand = (m_bitPix == BYTE_IMG) || (m_bitPix == SHORT_IMG);
+
+	if (GetBitmapPlanes(pBitmap, pFLOATPlanes, fMultiplier))
+		return m_bFloat && ReadFloatInBands(pFLOATPlanes, fMultiplier);
+	else if (m_bFloat)
+		return false;
+	else if (GetBitmapPlanes(pBitmap, pWORDPlanes, fMultiplier))
+		return bFloatBand ? ReadIntegerInBands<WORD, float>(pWORDPlanes, fMultiplier) : ReadIntegerInBands<WORD, double>(pWORDPlanes, fMultiplier);
+	else if (GetBitmapPlanes(pBitmap, pDWORDPlanes, fMultiplier))
+		return bFloatBand ? ReadIntegerInBands<DWORD, float>(pDWORDPlanes, fMultiplier) : ReadIntegerInBands<DWORD, double>(pDWORDPlanes, fMultiplier);
+	else if (GetBitmapPlanes(pBitmap, pBYTEPlanes, fMultiplier))
+		return bFloatBand ? ReadIntegerInBands<BYTE, float>(pBYTEPlanes, fMultiplier) : ReadIntegerInBands<BYTE, double>(pBYTEPlanes, fMultiplier);
+
+	return false;
+};
+
+/* ------------------------------------------------------------------- */
+
+template <typename TType, typename TBand>
+bool CFITSReader::ReadIntegerInBands(TType * const (&pPlanes)[3], double fMultiplier)
+{
+	ZFUNCTRACE_RUNTIME();
+	constexpr int		nDataType = std::is_same_v<TBand, float> ? TFLOAT : TDOUBLE;
+	const int			colours = (m_lNrChannels >= 3) ? 3 : 1;
+	const int			nrProcessors = CMultitask::GetNrProcessors(false);
+	const LONG			lBandHeight = GetBandHeight(m_lWidth, m_lHeight, colours * sizeof(TBand));
+	const size_t		lBandElements = static_cast<size_t>(m_lWidth) * lBandHeight;
+	double				fScale = 1.0;
+	std::vector<double>	vRatios;
+	std::vector<TBand>	vBand(lBandElements * colours);
+
+	switch (m_bitPix)
+	{
+	case SHORT_IMG:
+	case USHORT_IMG:
+		fScale = 1.0 / (1 + UCHAR_MAX);
+		break;
+	case LONG_IMG:
+	case ULONG_IMG:
+	case LONGLONG_IMG:
+		fScale = 1.0 / ((1 + UCHAR_MAX) * double{ 1 + USHORT_MAX });
+		break;
+	};
+
+	GetRatioLines(vRatios);
+
+	if (m_pProgress)
+		m_pProgress->Start2(nullptr, m_lHeight);
+
+	for (LONG lStartRow = 0;lStartRow<m_lHeight;lStartRow += lBandHeight)
+	{
+		const LONG		lNrRows = min(lBandHeight, m_lHeight - lStartRow);
+		const LONGLONG	nElements = LONGLONG{ m_lWidth } * lNrRows;
+		int				status = 0;
+
+		// The values are converted and BZERO/BSCALE applied by cfitsio
+		{
+			CFITSLibraryLock	Lock;
+
+			for (int c = 0;c<colours && !status;c++)
+			{
+				LONGLONG		fPixel[3] = { 1, lStartRow + 1, c + 1 };
+				TBand			nullValue = 0;
+
+				fits_read_pixll(m_fits, nDataType, fPixel, nElements, &nullValue, vBand.data() + c * lBandElements, nullptr, &status);
+			};
+		};
+		if (status)
+		{
+			ZTRACE_RUNTIME("fits_read_pixll returned a status of %d, reading the whole image instead", status);
+			return false;
+		};
+
+#pragma omp parallel for if(nrProcessors - 1)
+		for (LONG row = 0;row<lNrRows;row++)
+		{
+			const LONG		lRow = lStartRow + row;
+
+			for (int c = 0;c<colours;c++)
+				ConvertLine(vBand.data() + c * lBandElements + static_cast<size_t>(row) * m_lWidth,
+							pPlanes[c] + static_cast<size_t>(lRow) * m_lWidth,
+							vRatios.data() + static_cast<size_t>(lRow & 3) * m_lWidth,
+							fScale, 0.0, fMultiplier, m_lWidth);
+		};
+
+		if (m_pProgress)
+			m_pProgress->Progress2(nullptr, lStartRow + lNrRows);
+	};
+
+	return true;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CFITSReader::ReadFloatInBands(float * const (&pPlanes)[3], double fMultiplier)
+{
+	ZFUNCTRACE_RUNTIME();
+	const int			colours = (m_lNrChannels >= 3) ? 3 : 1;
+	const int			nrProcessors = CMultitask::GetNrProcessors(false);
+	const LONG			lBandHeight = GetBandHeight(m_lWidth, m_lHeight, colours * sizeof(float));
+	double				fMin = 0.0, fMax = 0.0;
+	std::vector<double>	vRatios;
+
+	if (m_pProgress)
+		m_pProgress->Start2(nullptr, m_lHeight);
+
+	// The normalization needs the range of the whole image: the values
+	// are read straight in the bitmap and normalized in place afterwards
+	for (LONG lStartRow = 0;lStartRow<m_lHeight;lStartRow += lBandHeight)
+	{
+		const LONG		lNrRows = min(lBandHeight, m_lHeight - lStartRow);
+		const LONGLONG	nElements = LONGLONG{ m_lWidth } * lNrRows;
+		int				status = 0;
+
+		{
+			CFITSLibraryLock	Lock;
+
+			for (int c = 0;c<colours && !status;c++)
+			{
+				LONGLONG		fPixel[3] = { 1, lStartRow + 1, c + 1 };
+				float			nullValue = 0;
+
+				fits_read_pixll(m_fits, TFLOAT, fPixel, nElements, &nullValue, pPlanes[c] + static_cast<size_t>(lStartRow) * m_lWidth, nullptr, &status);
+			};
+		};
+		if (status)
+		{
+			// For example a 64 bit image with values out of the float range
+			ZTRACE_RUNTIME("fits_read_pixll returned a status of %d, reading the whole image instead", status);
+			return false;
+		};
+
+		if (m_pProgress)
+			m_pProgress->Progress2(nullptr, (lStartRow + lNrRows) / 2);
+	};
+
+	double localMin = 0, localMax = 0;
+#pragma omp parallel shared(fMin, fMax) firstprivate(localMin, localMax) if(nrProcessors - 1)
+	{
+#pragma omp for schedule(dynamic, 10)
+		for (LONG row = 0;row<m_lHeight;row++)
+		{
+			for (int c = 0;c<colours;c++)
+			{
+				const float *	pValue = pPlanes[c] + static_cast<size_t>(row) * m_lWidth;
+
+				for (LONG col = 0;col<m_lWidth;col++)
+				{
+					if (!std::isnan(pValue[col]))
+					{
+						localMin = std::min(localMin, double{ pValue[col] });
+						localMax = std::max(localMax, double{ pValue[col] });
+					};
+				};
+			};
+		};
+#pragma omp critical
+		{
+			fMin = std::min(localMin, fMin);
+			fMax = std::max(localMax, fMax);
+		}
+	}
+
+	AdjustFloatRange(fMin, fMax);
+
+	constexpr double	scaleFactor = double{ USHORT_MAX } / 256.0;
+	const double		fScale = scaleFactor / (fMax - fMin);
+
+	GetRatioLines(vRatios);
+
+#pragma omp parallel for schedule(dynamic, 10) if(nrProcessors - 1)
+	for (LONG row = 0;row<m_lHeight;row++)
+	{
+		for (int c = 0;c<colours;c++)
+		{
+			float *		pLine = pPlanes[c] + static_cast<size_t>(row) * m_lWidth;
+
+			ConvertLine(pLine, pLine, vRatios.data() + static_cast<size_t>(row & 3) * m_lWidth, fScale, -fMin * fScale, fMultiplier, m_lWidth);
+		};
+	};
+
+	if (m_pProgress)
+		m_pProgress->Progress2(nullptr, m_lHeight);
+
+	return true;
+};
+
+/* ------------------------------------------------------------------- */
+
 bool CFITSReader::Read()
 {
 	constexpr double scaleFactorInt16 = double{ 1 + UCHAR_MAX };
@@ -647,6 +1002,9 @@ bool CFITSReader::Read()
 	ZFUNCTRACE_RUNTIME();
 	bool			bResult = true;
 	char error_text[31] = "";			// Error text for FITS errors.
+
+	if (ReadInBands())
+		return true;
 	
 	const int colours = (m_lNrChannels >= 3) ? 3 : 1;		// 3 ==> RGB, 1 ==> Mono
 
@@ -674,7 +1032,11 @@ bool CFITSReader::Read()
 		//
 		// Inhale the entire image (either single colour or RGB) as an array of doubles
 		//
-		fits_read_pixll(m_fits, TDOUBLE, fPixel, nElements, &dNULL, doubleBuff, nullptr, &status);
+		{
+			CFITSLibraryLock	Lock;
+
+			fits_read_pixll(m_fits, TDOUBLE, fPixel, nElements, &dNULL, doubleBuff, nullptr, &status);
+		};
 		if (0 != status)
 		{
 			fits_get_errstatus(status, error_text);
@@ -718,24 +1080,7 @@ bool CFITSReader::Read()
 #if defined(_OPENMP)
 			}
 #endif
-			double		fZero, fScale;
-
-			if (ReadKey("BZERO", fZero) && ReadKey("BSCALE", fScale))
-			{
-				fMax = (fMax + fZero) / fScale;
-				fMin = fZero / fScale;
-			}
-			else if (fMin >= 0 && fMin <= 1 && fMax >= 0 && fMax <= 1)
-			{
-				fMin = 0;
-				fMax = 1;
-			}
-			if (m_bDSI && (fMax > 1))
-			{
-				fMin = min(0.0, fMin);
-				fMax = max(fMax, 65535.0);
-			};
-
+			AdjustFloatRange(fMin, fMax);
 		}
 		else
 		{
@@ -837,6 +1182,8 @@ bool CFITSReader::Close()
 		bResult = OnClose();
 		if (bResult)
 		{
+			CFITSLibraryLock	Lock;
+
 			fits_close_file(m_fits, &nStatus);
 			m_fits = nullptr;
 		};
@@ -869,6 +1216,12 @@ public :
 	virtual bool	OnOpen();
 	virtual bool	OnRead(LONG lX, LONG lY, double fRed, double fGreen, double fBlue);
 	virtual bool	OnClose();
+
+protected :
+	virtual CMemoryBitmap *	GetTargetBitmap()
+	{
+		return m_pBitmap;
+	};
 };
 
 /* ------------------------------------------------------------------- */
@@ -951,18 +1304,14 @@ bool CFITSReadInMemoryBitmap::OnOpen()
 			//
 			m_CFAType = CFATYPE_NONE;
 
-			static bool eightBitWarningIssued = false;
-			if (!eightBitWarningIssued)
+			// Remember we already said we won't do that (only one of the files
+			// loaded at the same time shows the warning)!
+			static std::atomic<bool> eightBitWarningIssued = false;
+			if (!eightBitWarningIssued.exchange(true))
 			{
 				CString errorMessage;
 				errorMessage.Format(IDS_8BIT_FITS_NODEBAYER);
-#if defined(_CONSOLE)
-				std::cerr << errorMessage;
-#else
-				AfxMessageBox(errorMessage, MB_OK | MB_ICONWARNING);
-#endif
-				// Remember we already said we won't do that!
-				eightBitWarningIssued = true;
+				ReportEngineMessage(errorMessage, true);
 			}
 		}
 
@@ -1035,27 +1384,8 @@ bool CFITSReadInMemoryBitmap::OnRead(LONG lX, LONG lY, double fRed, double fGree
 		{
 			if (m_lNrChannels == 1)
 			{
-				if (m_CFAType != CFATYPE_NONE)
-				{
-					switch (::GetBayerColor(lX, lY, m_CFAType, m_xBayerOffset, m_yBayerOffset))
-					{
-					case BAYER_BLUE:
-						fRed = min(maxValue, fRed * m_fBlueRatio);
-						break;
-					case BAYER_GREEN:
-						fRed = min(maxValue, fRed * m_fGreenRatio);
-						break;
-					case BAYER_RED:
-						fRed = min(maxValue, fRed * m_fRedRatio);
-						break;
-					};
-				}
-				else
-				{
-					fRed = min(maxValue, fRed * m_fBrightnessRatio);
-					fGreen = min(maxValue, fGreen * m_fBrightnessRatio);
-					fBlue = min(maxValue, fBlue * m_fBrightnessRatio);
-				};
+				// Ratio of the CFA color or brightness ratio
+				fRed = min(maxValue, fRed * GetRatio(lX, lY));
 				m_pBitmap->SetPixel(lX, lY, fRed);
 			}
 			else
@@ -1064,24 +1394,8 @@ bool CFITSReadInMemoryBitmap::OnRead(LONG lX, LONG lY, double fRed, double fGree
 	}
 	catch (ZException e)
 	{
-		CString errorMessage;
-		CString name(CA2CT(e.name()));
-		CString fileName(CA2CT(e.locationAtIndex(0)->fileName()));
-		CString functionName(CA2CT(e.locationAtIndex(0)->functionName()));
-		CString text(CA2CT(e.text(0)));
-
-		errorMessage.Format(
-			_T("Exception %s thrown from %s Function: %s() Line: %lu\n\n%s"),
-			name,
-			fileName,
-			functionName,
-			e.locationAtIndex(0)->lineNumber(),
-			text);
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		CString errorMessage(FormatZException(e));
+		ReportEngineMessage(errorMessage);
 		exit(1);
 
 	}
@@ -1189,6 +1503,8 @@ bool	CFITSWriter::WriteKey(LPCSTR szKey, double fValue, LPCSTR szComment)
 
 	if (m_fits)
 	{
+		CFITSLibraryLock	Lock;
+
 		fits_write_key(m_fits, TDOUBLE, szKey, &fValue, szComment, &nStatus);
 		if (!nStatus)
 			bResult = true;
@@ -1206,6 +1522,8 @@ bool	CFITSWriter::WriteKey(LPCSTR szKey, LONG lValue, LPCSTR szComment)
 
 	if (m_fits)
 	{
+		CFITSLibraryLock	Lock;
+
 		fits_write_key(m_fits, TLONG, szKey, &lValue, szComment, &nStatus);
 		if (!nStatus)
 			bResult = true;
@@ -1223,6 +1541,8 @@ bool	CFITSWriter::WriteKey(LPCSTR szKey, LPCTSTR szValue, LPCSTR szComment)
 
 	if (m_fits)
 	{
+		CFITSLibraryLock	Lock;
+
 		fits_write_key(m_fits, TSTRING, szKey, (void*)szValue, szComment, &nStatus);
 		if (!nStatus)
 			bResult = true;
@@ -1262,6 +1582,7 @@ void	CFITSWriter::WriteAllKeys()
 	{
 		int				nStatus = 0;
 
+		CFITSLibraryLock	Lock;
 
 		for (LONG i = 0;i<m_ExtraInfo.m_vExtras.size();i++)
 		{
@@ -1351,6 +1672,8 @@ bool CFITSWriter::Open()
 	// Create a new fits file
 	int				nStatus = 0;
 
+	CFITSLibraryLock	Lock;
+
 	DeleteFile((LPCTSTR)strFileName);
 	fits_create_diskfile(&m_fits, (LPCSTR)CT2A(strFileName, CP_ACP), &nStatus);
 	if (m_fits && !nStatus)
@@ -1422,10 +1745,106 @@ bool CFITSWriter::Open()
 
 /* ------------------------------------------------------------------- */
 
+template <typename TOut>
+bool CFITSWriter::WriteInBands(CMemoryBitmap * pBitmap, int datatype, double fScale, bool & bResult)
+{
+	ZFUNCTRACE_RUNTIME();
+	PLANEEXPORTER<TOut>		Exporter;
+
+	if (!GetPlanesExporter(pBitmap, fScale, 0.0, Exporter))
+		return false;
+
+	const int			colours = (m_lNrChannels >= 3) ? 3 : 1;
+	const int			nrProcessors = CMultitask::GetNrProcessors(false);
+	const LONG			lBandHeight = GetBandHeight(m_lWidth, m_lHeight, colours * sizeof(TOut));
+	const size_t		lBandElements = static_cast<size_t>(m_lWidth) * lBandHeight;
+	std::vector<TOut>	vBand(lBandElements * colours);
+	int					status = 0;
+
+	if (m_pProgress)
+		m_pProgress->Start2(nullptr, m_lHeight);
+
+	// The planes of the bitmap are converted on all the threads and
+	// written by cfitsio one band at a time
+	for (LONG lStartRow = 0;lStartRow<m_lHeight && !status;lStartRow += lBandHeight)
+	{
+		const LONG		lNrRows = min(lBandHeight, m_lHeight - lStartRow);
+		const LONGLONG	nElements = LONGLONG{ m_lWidth } * lNrRows;
+
+#pragma omp parallel for schedule(dynamic, 10) if(nrProcessors - 1)
+		for (LONG row = 0;row<lNrRows;row++)
+		{
+			for (int c = 0;c<colours;c++)
+				Exporter(lStartRow + row, c, vBand.data() + c * lBandElements + static_cast<size_t>(row) * m_lWidth, 1);
+		};
+
+		{
+			CFITSLibraryLock	Lock;
+
+			for (int c = 0;c<colours && !status;c++)
+			{
+				LONGLONG		fPixel[3] = { 1, lStartRow + 1, c + 1 };
+
+				fits_write_pixll(m_fits, datatype, fPixel, nElements, vBand.data() + c * lBandElements, &status);
+			};
+		};
+
+		if (m_pProgress)
+			m_pProgress->Progress2(nullptr, lStartRow + lNrRows);
+	};
+
+	if (status)
+		ZTRACE_RUNTIME("fits_write_pixll returned a status of %d", status);
+
+	if (m_pProgress)
+		m_pProgress->End2();
+
+	bResult = !status;
+
+	return true;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CFITSWriter::WriteInBands(bool & bResult)
+{
+	//
+	// Same values as the OnWrite loop of Write(), straight from the planes
+	// of the bitmap when it is gray (written as gray) or color (written as RGB).
+	// Returns false when the bitmap can't be written this way, else bResult
+	// is false if cfitsio failed to write the pixels
+	//
+	CMemoryBitmap *		pBitmap = GetSourceBitmap();
+
+	if (!m_fits || !pBitmap || (pBitmap->Width() != m_lWidth) || (pBitmap->Height() != m_lHeight) ||
+		((m_lNrChannels == 1) != pBitmap->IsMonochrome()) || ((m_lNrChannels != 1) && (m_lNrChannels != 3)))
+		return false;
+
+	switch (m_lBitsPerPixel)
+	{
+	case 8 :
+		return WriteInBands<BYTE>(pBitmap, TBYTE, 1.0, bResult);
+	case 16 :
+		return WriteInBands<WORD>(pBitmap, TUSHORT, UCHAR_MAX, bResult);
+	case 32 :
+		if (m_bFloat)
+			return WriteInBands<float>(pBitmap, TFLOAT, 1.0 / (1.0 + UCHAR_MAX), bResult);
+		else
+			return WriteInBands<DWORD>(pBitmap, TULONG, static_cast<double>(UCHAR_MAX) * USHRT_MAX, bResult);
+	};
+
+	return false;
+};
+
+/* ------------------------------------------------------------------- */
+
 bool CFITSWriter::Write()
 {
 	bool			bResult = false;
 
+	if (WriteInBands(bResult))
+		return bResult;
+
 	//
 	// Multipliers of 256.0 and 65536.0 were not correct and resulted in a fully saturated
 	// pixel being written with a value of zero because the value overflowed the data type 
@@ -1540,6 +1959,8 @@ bool CFITSWriter::Write()
 					pfPixel[1] = j+1;
 					pfPixel[2] = 1;
 
+					CFITSLibraryLock	Lock;
+
 					fits_write_pix(m_fits, datatype, pfPixel, m_lWidth, pScanLine, &nStatus);
 				}
 				else
@@ -1607,6 +2028,9 @@ bool CFITSWriter::Write()
 					pfPixel[0] = 1;
 					pfPixel[1] = j+1;
 					pfPixel[2] = 1;
+
+					CFITSLibraryLock	Lock;
+
 					fits_write_pix(m_fits, datatype, pfPixel, m_lWidth, pScanLineRed, &nStatus);
 					pfPixel[2] = 2;
 					fits_write_pix(m_fits, datatype, pfPixel, m_lWidth, pScanLineGreen, &nStatus);
@@ -1646,6 +2070,8 @@ bool CFITSWriter::Close()
 		bResult = OnClose();
 		if (bResult)
 		{
+			CFITSLibraryLock	Lock;
+
 			fits_close_file(m_fits, &nStatus);
 			m_fits = nullptr;
 		};
@@ -1682,6 +2108,11 @@ public :
 	virtual bool	OnOpen();
 	virtual bool	OnWrite(LONG lX, LONG lY, double & fRed, double & fGreen, double & fBlue);
 	virtual bool	OnClose();
+protected :
+	virtual CMemoryBitmap *	GetSourceBitmap()
+	{
+		return m_pMemoryBitmap;
+	};
 };
 
 /* ------------------------------------------------------------------- */
@@ -1778,24 +2209,8 @@ bool CFITSWriteFromMemoryBitmap::OnWrite(LONG lX, LONG lY, double & fRed, double
 	}
 	catch (ZException e)
 	{
-		CString errorMessage;
-		CString name(CA2CT(e.name()));
-		CString fileName(CA2CT(e.locationAtIndex(0)->fileName()));
-		CString functionName(CA2CT(e.locationAtIndex(0)->functionName()));
-		CString text(CA2CT(e.text(0)));
-
-		errorMessage.Format(
-			_T("Exception %s thrown from %s Function: %s() Line: %lu\n\n%s"),
-			name,
-			fileName,
-			functionName,
-			e.locationAtIndex(0)->lineNumber(),
-			text);
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		CString errorMessage(FormatZException(e));
+		ReportEngineMessage(errorMessage);
 		exit(1);
 	}
 
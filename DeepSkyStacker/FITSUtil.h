@@ -129,6 +129,20 @@ private :
 	bool	ReadKey(LPCSTR szKey, CString & strValue);
 	void	ReadAllKeys();
 
+	void	AdjustFloatRange(double & fMin, double & fMax);
+	void	GetRatioLines(std::vector<double> & vRatios);
+	bool	ReadInBands();
+	bool	ReadFloatInBands(float * const (&pPlanes)[3], double fMultiplier);
+	template <typename TType, typename TBand>
+	bool	ReadIntegerInBands(TType * const (&pPlanes)[3], double fMultiplier);
+
+protected :
+	double	GetRatio(LONG lX, LONG lY);
+
+	// Bitmap in which Read() decodes the pixels directly, row band by row
+	// band in the type of the file (nullptr to get one OnRead call per pixel)
+	virtual CMemoryBitmap *	GetTargetBitmap() { return nullptr; };
+
 public :
 	CFITSReader(LPCTSTR szFileName, CDSSProgress *	pProgress)
 	{
@@ -171,10 +185,17 @@ private :
 	bool	WriteKey(LPCSTR szKey, LONG lValue, LPCSTR szComment = nullptr);
 	bool	WriteKey(LPCSTR szKey, LPCTSTR szValue, LPCSTR szComment = nullptr);
 	void	WriteAllKeys();
+	bool	WriteInBands(bool & bResult);
+	template <typename TOut>
+	bool	WriteInBands(CMemoryBitmap * pBitmap, int datatype, double fScale, bool & bResult);
 
 protected :
 	void	SetFormat(LONG lWidth, LONG lHeight, FITSFORMAT FITSFormat, CFATYPE CFAType);
 
+	// Bitmap from which Write() takes the pixels directly, row band by row
+	// band (nullptr to get one OnWrite call per pixel)
+	virtual CMemoryBitmap *	GetSourceBitmap() { return nullptr; };
+
 public :
 	CFITSWriter(LPCTSTR szFileName, CDSSProgress *	pProgress)
 	{
@@ -211,6 +232,7 @@ public :
 /* ------------------------------------------------------------------- */
 
 CFATYPE GetFITSCFATYPE();
+CString	GetFITSInfoSettings();
 bool	GetFITSInfo(LPCTSTR szFileName, CBitmapInfo & BitmapInfo);
 bool	ReadFITS(LPCTSTR szFileName, CMemoryBitmap ** ppBitmap, CDSSProgress *	pProgress);
 bool	WriteFITS(LPCTSTR szFileName, CMemoryBitmap * pBitmap, CDSSProgress * pProgress, FITSFORMAT FITSFormat, LPCTSTR szDescription,
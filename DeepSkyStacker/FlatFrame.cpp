@@ -48,61 +48,47 @@ public :
 	};
 
 	virtual bool	Process();
-	virtual bool	DoTask(HANDLE hEvent);
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
 };
 
 /* ------------------------------------------------------------------- */
 
-bool	CFlatDivideTask::DoTask(HANDLE hEvent)
+bool	CFlatDivideTask::DoTask(LONG lStart, LONG lEnd)
 {
 	ZFUNCTRACE_RUNTIME();
 	bool			bResult = true;
 
 	LONG			i, j;
-	bool			bEnd = false;
-	MSG				msg;
 	LONG			lWidth = m_pTarget->RealWidth();
 
-	// Create a message queue and signal the event
-	PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-	SetEvent(hEvent);
-	while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+	for (j = lStart;j<lEnd;j++)
 	{
-		if (msg.message == WM_MT_PROCESS)
+		for (i = 0;i<lWidth;i++)
 		{
-			for (j = msg.wParam;j<msg.wParam+msg.lParam;j++)
+			if (m_bUseGray)
 			{
-				for (i = 0;i<lWidth;i++)
-				{
-					if (m_bUseGray)
-					{
-						double			fSrcGray;
-						double			fTgtGray;
+				double			fSrcGray;
+				double			fTgtGray;
 
-						m_pTarget->GetPixel(i, j, fTgtGray);
-						m_pFlatFrame->m_pFlatFrame->GetPixel(i, j, fSrcGray);
-						if (m_bUseCFA)
-							m_pFlatFrame->m_FlatNormalization.Normalize(fTgtGray, fSrcGray, m_pFlatFrame->m_pFlatFrame->GetBayerColor(i, j));
-						else
-							m_pFlatFrame->m_FlatNormalization.Normalize(fTgtGray, fSrcGray);
-						m_pTarget->SetPixel(i, j, fTgtGray);
-					}
-					else
-					{
-						double			fSrcRed, fSrcGreen, fSrcBlue;
-						double			fTgtRed, fTgtGreen, fTgtBlue;
+				m_pTarget->GetPixel(i, j, fTgtGray);
+				m_pFlatFrame->m_pFlatFrame->GetPixel(i, j, fSrcGray);
+				if (m_bUseCFA)
+					m_pFlatFrame->m_FlatNormalization.Normalize(fTgtGray, fSrcGray, m_pFlatFrame->m_pFlatFrame->GetBayerColor(i, j));
+				else
+					m_pFlatFrame->m_FlatNormalization.Normalize(fTgtGray, fSrcGray);
+				m_pTarget->SetPixel(i, j, fTgtGray);
+			}
+			else
+			{
+				double			fSrcRed, fSrcGreen, fSrcBlue;
+				double			fTgtRed, fTgtGreen, fTgtBlue;
 
-						m_pTarget->GetPixel(i, j, fTgtRed, fTgtGreen, fTgtBlue);
-						m_pFlatFrame->m_pFlatFrame->GetPixel(i, j, fSrcRed, fSrcGreen, fSrcBlue);
-						m_pFlatFrame->m_FlatNormalization.Normalize(fTgtRed, fTgtGreen, fTgtBlue, fSrcRed, fSrcGreen, fSrcBlue);
-						m_pTarget->SetPixel(i, j, fTgtRed, fTgtGreen, fTgtBlue);
-					};
-				};
+				m_pTarget->GetPixel(i, j, fTgtRed, fTgtGreen, fTgtBlue);
+				m_pFlatFrame->m_pFlatFrame->GetPixel(i, j, fSrcRed, fSrcGreen, fSrcBlue);
+				m_pFlatFrame->m_FlatNormalization.Normalize(fTgtRed, fTgtGreen, fTgtBlue, fSrcRed, fSrcGreen, fSrcBlue);
+				m_pTarget->SetPixel(i, j, fTgtRed, fTgtGreen, fTgtBlue);
 			};
-			SetEvent(hEvent);
-		}
-		else if (msg.message == WM_MT_STOP)
-			bEnd = true;
+		};
 	};
 
 	return true;
@@ -115,9 +101,6 @@ bool	CFlatDivideTask::Process()
 	ZFUNCTRACE_RUNTIME();
 	bool			bResult = true;
 	LONG			lHeight = m_pTarget->RealHeight();
-	LONG			lStep;
-	LONG			lRemaining;
-	LONG			i = 0;
 
 	if (m_pProgress)
 	{
@@ -125,26 +108,7 @@ bool	CFlatDivideTask::Process()
 		m_pProgress->SetNrUsedProcessors(GetNrThreads());
 	};
 
-	lStep		= max(1L, lHeight/50);
-	lRemaining	= lHeight;
-
-	bResult = true;
-	while (i<lHeight)
-	{
-		LONG			lAdd = min(lStep, lRemaining);
-		DWORD			dwThreadId;
-
-		dwThreadId = GetAvailableThreadId();
-		PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-		i			+= lAdd;
-		lRemaining	-= lAdd;
-
-		if (m_pProgress)
-			m_pProgress->Progress2(nullptr, i);
-	};
-
-	CloseAllThreads();
+	bResult = ProcessRange(0, lHeight, m_pProgress);
 	if (m_pProgress)
 	{
 		m_pProgress->SetNrUsedProcessors();
@@ -189,7 +153,6 @@ bool CFlatFrame::ApplyFlat(CMemoryBitmap * pTarget, CDSSProgress * pProgress)
 			CFlatDivideTask			DivideTask;
 
 			DivideTask.Init(pTarget, pProgress, this);
-			DivideTask.StartThreads();
 			DivideTask.Process();
 			*/
 
@@ -65,6 +65,30 @@ public :
 		return m_bUseGray;
 	};
 
+	// Mean value used to normalize the pixels of the color
+	// (BAYER_UNKNOWN is the gray, BAYER_RED/GREEN/BLUE the channels of a color flat)
+	double	GetMeanValue(BAYERCOLOR BayerColor)
+	{
+		switch (BayerColor)
+		{
+		case BAYER_RED :
+			return m_fMeanRed;
+		case BAYER_GREEN :
+			return m_fMeanGreen;
+		case BAYER_BLUE :
+			return m_fMeanBlue;
+		case BAYER_CYAN :
+			return m_fMeanCyan;
+		case BAYER_YELLOW :
+			return m_fMeanYellow;
+		case BAYER_MAGENTA :
+			return m_fMeanMagenta;
+		case BAYER_GREEN2 :
+			return m_fMeanGreen2;
+		};
+		return m_fMeanGray;
+	};
+
 	void	Normalize(double & fAdjustGray, double fFlatGray, BAYERCOLOR BayerColor = BAYER_UNKNOWN)
 	{
 		switch (BayerColor)
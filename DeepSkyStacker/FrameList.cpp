@@ -295,6 +295,19 @@ static bool	IsChangeGroupLine(LPCTSTR szLine, DWORD & dwGroupID)
 
 /* ------------------------------------------------------------------- */
 
+// File read from a file list, added once the headers of all the files are read
+class CListedFile
+{
+public :
+	CString				m_strFile;
+	PICTURETYPE			m_Type;
+	DWORD				m_dwGroupID;
+	LONG				m_lChecked;
+	bool				m_bUseAsStarting;
+};
+
+/* ------------------------------------------------------------------- */
+
 void CFrameList::LoadFilesFromList(LPCTSTR szFileList)
 {
 	FILE *				hFile;
@@ -350,6 +363,8 @@ void CFrameList::LoadFilesFromList(LPCTSTR szFileList)
 			// Read the file info
 			CWorkspace			workspace;
 			CHAR				szLine[10000];
+			std::vector<CListedFile>	vListedFiles;
+			std::vector<CString>		vAbsoluteFiles;
 
 			while (fgets(szLine, sizeof(szLine), hFile))
 			{
@@ -409,40 +424,56 @@ void CFrameList::LoadFilesFromList(LPCTSTR szFileList)
 						{
 							fclose(hTemp);
 
-							CListBitmap			lb;
+							CListedFile			lf;
 
-							if (lb.InitFromFile(pszAbsoluteFile, Type))
-							{
-								lb.m_dwGroupID = dwGroupID;
-								if (!AddFile(pszAbsoluteFile, dwGroupID, dwJobID, Type, lChecked))
-								{
-									// Add to the list
-									lb.m_bChecked = lChecked;
-									if (lb.m_PictureType == PICTURETYPE_LIGHTFRAME)
-									{
-										lb.m_bUseAsStarting = bUseAsStarting;
-										CLightFrameInfo			bmpInfo;
-
-										bmpInfo.SetBitmap(pszAbsoluteFile, false);
-										if (bmpInfo.m_bInfoOk)
-										{
-											lb.m_bRegistered = true;
-											lb.m_fOverallQuality = bmpInfo.m_fOverallQuality;
-											lb.m_fFWHM			 = bmpInfo.m_fFWHM;
-											lb.m_lNrStars		 = (DWORD)bmpInfo.m_vStars.size();
-											lb.m_bComet			 = bmpInfo.m_bComet;
-											lb.m_SkyBackground	 = bmpInfo.m_SkyBackground;
-										}
-									};
-									m_vFiles.push_back(lb);
-								};
-							};
+							lf.m_strFile		= pszAbsoluteFile;
+							lf.m_Type			= Type;
+							lf.m_dwGroupID		= dwGroupID;
+							lf.m_lChecked		= lChecked;
+							lf.m_bUseAsStarting = bUseAsStarting;
+							vListedFiles.push_back(lf);
+							vAbsoluteFiles.push_back(lf.m_strFile);
 						};
 						delete [] pszAbsoluteFile;
 					};
 				};
 			};
 
+			// Read the headers of all the files at once
+			ScanPicturesInfo(vAbsoluteFiles);
+
+			for (const CListedFile & lf : vListedFiles)
+			{
+				CListBitmap			lb;
+
+				if (lb.InitFromFile(lf.m_strFile, lf.m_Type))
+				{
+					lb.m_dwGroupID = lf.m_dwGroupID;
+					if (!AddFile(lf.m_strFile, lf.m_dwGroupID, dwJobID, lf.m_Type, lf.m_lChecked))
+					{
+						// Add to the list
+						lb.m_bChecked = lf.m_lChecked;
+						if (lb.m_PictureType == PICTURETYPE_LIGHTFRAME)
+						{
+							lb.m_bUseAsStarting = lf.m_bUseAsStarting;
+							CLightFrameInfo			bmpInfo;
+
+							bmpInfo.SetBitmap(lf.m_strFile, false, false, false);
+							if (bmpInfo.m_bInfoOk)
+							{
+								lb.m_bRegistered = true;
+								lb.m_fOverallQuality = bmpInfo.m_fOverallQuality;
+								lb.m_fFWHM			 = bmpInfo.m_fFWHM;
+								lb.m_lNrStars		 = (DWORD)bmpInfo.GetNrStars();
+								lb.m_bComet			 = bmpInfo.m_bComet;
+								lb.m_SkyBackground	 = bmpInfo.m_SkyBackground;
+							}
+						};
+						m_vFiles.push_back(lb);
+					};
+				};
+			};
+
 			workspace.setDirty();
 		};
 
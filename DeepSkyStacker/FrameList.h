@@ -173,7 +173,7 @@ public :
 		DeleteFile(m_strFileName);
 		if (IsLightFrame())
 		{
-			// Remove the Info.txt file if it exists
+			// Remove the Info.txt and Info.bin files if they exist
 			TCHAR				szDrive[1+_MAX_DRIVE];
 			TCHAR				szDir[1+_MAX_DIR];
 			TCHAR				szFile[1+_MAX_FNAME];
@@ -183,6 +183,9 @@ public :
 			_tsplitpath(m_strFileName, szDrive, szDir, szFile, szExt);
 			_tmakepath(szInfoName, szDrive, szDir, szFile, _T(".Info.txt"));
 
+			DeleteFile(szInfoName);
+			_tmakepath(szInfoName, szDrive, szDir, szFile, _T(".Info.bin"));
+
 			DeleteFile(szInfoName);
 		};
 	};
@@ -2,6 +2,10 @@
 #include "MasterFrames.h"
 #include "DSSProgress.h"
 #include "DeBloom.h"
+#include "RunReport.h"
+#include "Multitask.h"
+#include "avx_calibration.h"
+#include <float.h>
 
 /* ------------------------------------------------------------------- */
 
@@ -96,20 +100,374 @@ void	CMasterFrames::ApplyHotPixelInterpolation(CMemoryBitmap * pBitmap, CDSSProg
 		m_MasterDark.InterpolateHotPixels(pBitmap, pProgress);
 };
 
+/* ------------------------------------------------------------------- */
+/* ------------------------------------------------------------------- */
+
+template <typename TType>
+static TType *	GetCalibrationLine(CMemoryBitmap * pBitmap, LONG lChannel, LONG lLine)
+{
+	CGrayBitmapT<TType> *		pGrayBitmap = dynamic_cast<CGrayBitmapT<TType> *>(pBitmap);
+	CColorBitmapT<TType> *		pColorBitmap = dynamic_cast<CColorBitmapT<TType> *>(pBitmap);
+
+	if (pGrayBitmap)
+		return pGrayBitmap->GetGrayPixel(0, lLine);
+	else if (pColorBitmap)
+	{
+		if (lChannel == 0)
+			return pColorBitmap->GetRedPixel(0, lLine);
+		else if (lChannel == 1)
+			return pColorBitmap->GetGreenPixel(0, lLine);
+		else
+			return pColorBitmap->GetBluePixel(0, lLine);
+	};
+
+	return nullptr;
+};
+
+/* ------------------------------------------------------------------- */
+
+template <typename TType>
+static double	GetCalibrationMultiplier(CMemoryBitmap * pBitmap)
+{
+	CGrayBitmapT<TType> *		pGrayBitmap = dynamic_cast<CGrayBitmapT<TType> *>(pBitmap);
+	CColorBitmapT<TType> *		pColorBitmap = dynamic_cast<CColorBitmapT<TType> *>(pBitmap);
+
+	if (pGrayBitmap)
+		return pGrayBitmap->GetMultiplier();
+	else if (pColorBitmap)
+		return pColorBitmap->GetMultiplier();
+
+	return 1.0;
+};
+
+/* ------------------------------------------------------------------- */
+
+template <typename TType>
+static bool	AddCalibrationLine(CMemoryBitmap * pBitmap, LONG lChannel, LONG lLine, double fScale, float * pLine, LONG lWidth)
+{
+	const TType *		pValues = GetCalibrationLine<TType>(pBitmap, lChannel, lLine);
+
+	if (pValues)
+	{
+		const double	fFactor = fScale / GetCalibrationMultiplier<TType>(pBitmap);
+
+		for (LONG i = 0;i<lWidth;i++)
+			pLine[i] += fFactor * pValues[i];
+	};
+
+	return (pValues != nullptr);
+};
+
+/* ------------------------------------------------------------------- */
+
+// Adds fScale times the line of the bitmap (in the [0, 256[ range) to pLine
+static void	AddCalibrationLine(CMemoryBitmap * pBitmap, LONG lChannel, LONG lLine, double fScale, float * pLine, LONG lWidth)
+{
+	if (!AddCalibrationLine<WORD>(pBitmap, lChannel, lLine, fScale, pLine, lWidth) &&
+		!AddCalibrationLine<float>(pBitmap, lChannel, lLine, fScale, pLine, lWidth) &&
+		!AddCalibrationLine<DWORD>(pBitmap, lChannel, lLine, fScale, pLine, lWidth) &&
+		!AddCalibrationLine<double>(pBitmap, lChannel, lLine, fScale, pLine, lWidth) &&
+		!AddCalibrationLine<BYTE>(pBitmap, lChannel, lLine, fScale, pLine, lWidth))
+	{
+		// Other bitmaps through the generic interface
+		const bool		bMonochrome = pBitmap->IsMonochrome();
+
+		for (LONG i = 0;i<lWidth;i++)
+		{
+			double			fValue[3];
+
+			if (bMonochrome)
+				pBitmap->GetPixel(i, lLine, fValue[0]);
+			else
+				pBitmap->GetPixel(i, lLine, fValue[0], fValue[1], fValue[2]);
+			pLine[i] += fScale * fValue[bMonochrome ? 0 : lChannel];
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+static bool	AvxCalibrateLine(const AvxCalibration & Avx, WORD * pLine, const float * pSubtract, const float * pGain, double fMaxValue, LONG lWidth)
+{
+	return !Avx.calibrateLine(pLine, pSubtract, pGain, static_cast<float>(fMaxValue), lWidth);
+};
+
+static bool	AvxCalibrateLine(const AvxCalibration & Avx, float * pLine, const float * pSubtract, const float * pGain, double fMaxValue, LONG lWidth)
+{
+	return !Avx.calibrateLine(pLine, pSubtract, pGain, static_cast<float>(fMaxValue), lWidth);
+};
+
+template <typename TType>
+static bool	AvxCalibrateLine(const AvxCalibration &, TType *, const float *, const float *, double, LONG)
+{
+	return false;
+};
+
+/* ------------------------------------------------------------------- */
+
+// Subtracts the offset and the dark(s) and divides by the flat in one pass,
+// each pixel of the light frame being read and written only once.
+class CCalibrateTask : public CMultitask
+{
+private :
+	CMemoryBitmap *				m_pBitmap;
+	SUBTRACTEDFRAMEVECTOR		m_vSubtractedFrames;
+	CMemoryBitmap *				m_pFlatBitmap;
+	CFlatNormalization			m_FlatNormalization;
+	bool						m_bFlatCFA;
+	CDSSProgress *				m_pProgress;
+	AvxCalibration				m_AvxCalibration;
+
+private :
+	void	GetGainLine(LONG lChannel, LONG lLine, float * pGain, LONG lWidth);
+
+	template <typename TType>
+	bool	CalibrateLines(LONG lStart, LONG lEnd);
+
+public :
+	CCalibrateTask()
+	{
+		m_pBitmap		= nullptr;
+		m_pFlatBitmap	= nullptr;
+		m_bFlatCFA		= false;
+		m_pProgress		= nullptr;
+	};
+
+	virtual ~CCalibrateTask()
+	{
+	};
+
+	void	Init(CMemoryBitmap * pBitmap, const SUBTRACTEDFRAMEVECTOR & vSubtractedFrames, CFlatFrame * pFlatFrame, CDSSProgress * pProgress)
+	{
+		m_pBitmap			= pBitmap;
+		m_vSubtractedFrames	= vSubtractedFrames;
+		m_pProgress			= pProgress;
+		if (pFlatFrame)
+		{
+			m_pFlatBitmap		= pFlatFrame->m_pFlatFrame;
+			m_FlatNormalization = pFlatFrame->m_FlatNormalization;
+			m_bFlatCFA			= pFlatFrame->IsCFA();
+		};
+	};
+
+	bool	IsSupported();
+
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
+	virtual bool	Process();
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CCalibrateTask::IsSupported()
+{
+	bool				bResult;
+	const LONG			lWidth = m_pBitmap->RealWidth();
+	const LONG			lHeight = m_pBitmap->RealHeight();
+	const bool			bMonochrome = m_pBitmap->IsMonochrome();
+
+	// The light frame is accessed directly, the masters may be of any type
+	bResult = GetCalibrationLine<WORD>(m_pBitmap, 0, 0) || GetCalibrationLine<float>(m_pBitmap, 0, 0) ||
+			  GetCalibrationLine<DWORD>(m_pBitmap, 0, 0) || GetCalibrationLine<double>(m_pBitmap, 0, 0);
+
+	for (const auto & Frame : m_vSubtractedFrames)
+	{
+		bResult = bResult && Frame.m_pBitmap && Frame.m_pBitmap->IsOk() &&
+				  (Frame.m_pBitmap->RealWidth() == lWidth) && (Frame.m_pBitmap->RealHeight() == lHeight) &&
+				  (Frame.m_pBitmap->IsMonochrome() == bMonochrome);
+	};
+
+	if (m_pFlatBitmap)
+		bResult = bResult && (m_pFlatBitmap->RealWidth() == lWidth) && (m_pFlatBitmap->RealHeight() == lHeight) &&
+				  (m_pFlatBitmap->IsMonochrome() == bMonochrome) && (m_FlatNormalization.UseGray() == bMonochrome);
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CCalibrateTask::GetGainLine(LONG lChannel, LONG lLine, float * pGain, LONG lWidth)
+{
+	if (m_pFlatBitmap)
+	{
+		double			fMeans[2];
+
+		// The CFA patterns are repeated every 2 columns
+		for (LONG i = 0;i<2;i++)
+		{
+			if (!m_pBitmap->IsMonochrome())
+				fMeans[i] = m_FlatNormalization.GetMeanValue(lChannel == 0 ? BAYER_RED : (lChannel == 1 ? BAYER_GREEN : BAYER_BLUE));
+			else if (m_bFlatCFA)
+				fMeans[i] = m_FlatNormalization.GetMeanValue(m_pFlatBitmap->GetBayerColor(i, lLine));
+			else
+				fMeans[i] = m_FlatNormalization.GetMeanValue(BAYER_UNKNOWN);
+		};
+
+		std::fill(pGain, pGain + lWidth, 0.0f);
+		AddCalibrationLine(m_pFlatBitmap, lChannel, lLine, 1.0, pGain, lWidth);
+		for (LONG i = 0;i<lWidth;i++)
+			pGain[i] = fMeans[i & 1] / max(1.0, static_cast<double>(pGain[i]));
+	}
+	else
+		std::fill(pGain, pGain + lWidth, 1.0f);
+};
+
+/* ------------------------------------------------------------------- */
+
+template <typename TType>
+bool	CCalibrateTask::CalibrateLines(LONG lStart, LONG lEnd)
+{
+	if (!GetCalibrationLine<TType>(m_pBitmap, 0, lStart))
+		return false;
+
+	const LONG			lWidth = m_pBitmap->RealWidth();
+	const LONG			lNrChannels = m_pBitmap->IsMonochrome() ? 1 : 3;
+	const double		fMultiplier = GetCalibrationMultiplier<TType>(m_pBitmap);
+	// The flat division is limited to 255 (like in CFlatNormalization)
+	const double		fMaxValue = m_pFlatBitmap ? 255.0 * fMultiplier : DBL_MAX;
+	std::vector<float>	vSubtract(lWidth);
+	std::vector<float>	vGain(lWidth);
+
+	for (LONG j = lStart;j<lEnd;j++)
+	{
+		for (LONG lChannel = 0;lChannel<lNrChannels;lChannel++)
+		{
+			TType *			pLine = GetCalibrationLine<TType>(m_pBitmap, lChannel, j);
+
+			// All the subtracted frames are combined (in the range of the light frame)
+			std::fill(vSubtract.begin(), vSubtract.end(), 0.0f);
+			for (const auto & Frame : m_vSubtractedFrames)
+				AddCalibrationLine(Frame.m_pBitmap, lChannel, j, Frame.m_fFactor * fMultiplier, vSubtract.data(), lWidth);
+
+			GetGainLine(lChannel, j, vGain.data(), lWidth);
+
+			if (!AvxCalibrateLine(m_AvxCalibration, pLine, vSubtract.data(), vGain.data(), fMaxValue, lWidth))
+			{
+				for (LONG i = 0;i<lWidth;i++)
+				{
+					const double	fValue = max(0.0, static_cast<double>(pLine[i]) - vSubtract[i]) * vGain[i];
+
+					pLine[i] = static_cast<TType>(min(fValue, fMaxValue));
+				};
+			};
+		};
+	};
+
+	return true;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CCalibrateTask::DoTask(LONG lStart, LONG lEnd)
+{
+	return CalibrateLines<WORD>(lStart, lEnd) || CalibrateLines<float>(lStart, lEnd) ||
+		   CalibrateLines<DWORD>(lStart, lEnd) || CalibrateLines<double>(lStart, lEnd);
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CCalibrateTask::Process()
+{
+	ZFUNCTRACE_RUNTIME();
+	bool			bResult = true;
+	LONG			lHeight = m_pBitmap->RealHeight();
+
+	if (m_pProgress)
+	{
+		m_pProgress->Start2(nullptr, lHeight);
+		m_pProgress->SetNrUsedProcessors(GetNrThreads());
+	};
+
+	bResult = ProcessRange(0, lHeight, m_pProgress);
+
+	if (m_pProgress)
+	{
+		m_pProgress->SetNrUsedProcessors();
+		m_pProgress->End2();
+	};
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CMasterFrames::ApplyFusedCalibration(CMemoryBitmap * pBitmap, CDSSProgress * pProgress)
+{
+	ZFUNCTRACE_RUNTIME();
+	bool					bResult = false;
+	SUBTRACTEDFRAMEVECTOR	vSubtractedFrames;
+	CCalibrateTask			CalibrateTask;
+	CString					strText;
+
+	// The dark optimization is computed from the light frame with the offset
+	// removed: in this case the offset is subtracted first
+	const bool				bFuseOffset = !m_MasterDark.IsOk() || !m_MasterDark.UseDarkOptimization();
+
+	if (!bFuseOffset)
+		ApplyMasterOffset(pBitmap, pProgress);
+	else if (m_pMasterOffset && m_pMasterOffset->IsOk())
+		vSubtractedFrames.emplace_back(m_pMasterOffset);
+
+	if (m_MasterDark.IsOk())
+	{
+		SUBTRACTEDFRAMEVECTOR	vDarkFrames;
+
+		m_MasterDark.PrepareSubtraction(pBitmap, vDarkFrames, pProgress);
+		vSubtractedFrames.insert(vSubtractedFrames.end(), vDarkFrames.begin(), vDarkFrames.end());
+	};
+
+	if (m_MasterFlat.IsOk())
+		m_MasterFlat.ComputeFlatNormalization(pProgress);
+
+	CalibrateTask.Init(pBitmap, vSubtractedFrames, m_MasterFlat.IsOk() ? &m_MasterFlat : nullptr, pProgress);
+	if (CalibrateTask.IsSupported())
+	{
+		ZTRACE_RUNTIME("Fused calibration of the light frame");
+		if (pProgress)
+		{
+			if (m_MasterDark.IsOk())
+				strText.LoadString(IDS_SUBSTRACTINGDARK);
+			else if (bFuseOffset && m_pMasterOffset && m_pMasterOffset->IsOk())
+				strText.LoadString(IDS_SUBSTRACTINGOFFSET);
+			else
+				strText.LoadString(IDS_APPLYINGFLAT);
+			pProgress->Start2(strText, 0);
+		};
+		CalibrateTask.Process();
+		bResult = true;
+	}
+	else
+	{
+		// Calibrate the light frame step by step
+		for (const auto & Frame : vSubtractedFrames)
+		{
+			if (pProgress)
+			{
+				strText.LoadString(Frame.m_pBitmap == m_pMasterOffset ? IDS_SUBSTRACTINGOFFSET : IDS_SUBSTRACTINGDARK);
+				pProgress->Start2(strText, 0);
+			};
+			Subtract(pBitmap, Frame.m_pBitmap, pProgress, Frame.m_fFactor, Frame.m_fFactor, Frame.m_fFactor);
+		};
+		ApplyMasterFlat(pBitmap, pProgress);
+	};
+
+	return bResult;
+};
+
 /* ------------------------------------------------------------------- */
 
 void	CMasterFrames::ApplyAllMasters(CMemoryBitmap * pBitmap, STARVECTOR * pStars, CDSSProgress * pProgress)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope		ReportScope("ApplyAllMasters");
 	CDeBloom			debloom;
 	bool				bDebloom = false;
 
 	if (m_fDebloom)
 		bDebloom = debloom.CreateBloomMask(pBitmap, pProgress);
 
-	ApplyMasterOffset(pBitmap, pProgress);
-	ApplyMasterDark(pBitmap, pStars, pProgress);
-	ApplyMasterFlat(pBitmap, pProgress);
+	// Offset, dark and flat in a single pass over the light frame,
+	// the hot pixels are interpolated from the calibrated neighbors
+	ApplyFusedCalibration(pBitmap, pProgress);
 	ApplyHotPixelInterpolation(pBitmap, pProgress);
 
 	if (bDebloom)
@@ -1,7 +1,9 @@
 #include <stdafx.h>
 #include "MatchingStars.h"
 #include <algorithm>
+#include <tuple>
 #include "Workspace.h"
+#include "DSSPlatform.h"
 
 #define _NO_EXCEPTION
 //#define _NO_TEMPLATE
@@ -158,7 +160,7 @@ void	CMatchingStars::InitVotingGrid(VOTINGPAIRVECTOR & vVotingPairs)
 
 /* ------------------------------------------------------------------- */
 
-inline void	AddVote(BYTE RefStar, BYTE TgtStar, VOTINGPAIRVECTOR & vVotingPairs, LONG lNrTgtStars)
+inline void	AddVote(LONG RefStar, LONG TgtStar, VOTINGPAIRVECTOR & vVotingPairs, LONG lNrTgtStars)
 {
 	LONG				lOffset = RefStar * lNrTgtStars + TgtStar;
 
@@ -1038,12 +1040,70 @@ bool	CMatchingStars::ComputeMatchingTriangleTransformation(CBilinearParameters &
 	return bResult;
 };
 
+/* ------------------------------------------------------------------- */
+
+bool	CMatchingStars::ComputeIndexedTriangleTransformation(CBilinearParameters & BilinearParameters)
+{
+	ZFUNCTRACE_RUNTIME();
+	bool						bResult = false;
+	VOTINGPAIRVECTOR			vVotingPairs;
+
+	// The triangles of the target are looked up in the reference index
+	// instead of being merged with all the reference triangles
+	CStarPatternIndex::ComputeTriangles(m_vTgtStars, m_vTgtTriangles);
+
+	InitVotingGrid(vVotingPairs);
+
+	for (const CStarTriangle & TgtTriangle : m_vTgtTriangles)
+	{
+		m_pRefIndex->ForEachSimilarTriangle(TgtTriangle, TRIANGLETOLERANCE,
+			[&](const CStarTriangle & RefTriangle)
+			{
+				// The stars of both triangles are in the same order
+				AddVote(RefTriangle.m_Star1, TgtTriangle.m_Star1, vVotingPairs, (LONG)m_vTgtStars.size());
+				AddVote(RefTriangle.m_Star2, TgtTriangle.m_Star2, vVotingPairs, (LONG)m_vTgtStars.size());
+				AddVote(RefTriangle.m_Star3, TgtTriangle.m_Star3, vVotingPairs, (LONG)m_vTgtStars.size());
+			});
+	};
+
+	std::sort(vVotingPairs.begin(), vVotingPairs.end());
+
+	// At this point voting pairs are ordered descending
+	// Then eliminate false matches and get transformations parameters
+	if (vVotingPairs.size() >= m_vTgtStars.size()*2)
+	{
+		LONG				lMinNrVotes;
+		LONG				lCut = 0;
+		TRANSFORMATIONTYPE	TType = TT_BILINEAR;
+
+		lMinNrVotes = vVotingPairs[m_vTgtStars.size()*2-1].m_lNrVotes;
+		if (lMinNrVotes == 0)
+			lMinNrVotes = 1;
+		while (lCut<vVotingPairs.size() && vVotingPairs[lCut].m_lNrVotes >= lMinNrVotes)
+			lCut++;
+		vVotingPairs.resize(lCut);
+
+		TType = GetTransformationType((LONG)vVotingPairs.size());
+
+		bResult = ComputeSigmaClippingTransformation(vVotingPairs, BilinearParameters, TType);
+
+		if (bResult && (TType == TT_LINEAR))
+		{
+			// This is a pure linear function -- Alter coefficients
+			BilinearParameters.a3 = 0;
+			BilinearParameters.b3 = 0;
+		};
+	};
+
+	return bResult;
+};
+
 /* ------------------------------------------------------------------- */
 /* ------------------------------------------------------------------- */
 
 const double			MAXSTARDISTANCEDELTA = 2.0;
 
-CComAutoCriticalSection	g_StarDistSection;
+CDSSCriticalSection		g_StarDistSection;
 STARDISTVECTOR *		g_pvDists = nullptr;
 
 inline bool CompareStarDistances (LONG lDist1, LONG lDist2)
@@ -1247,6 +1307,28 @@ void	CMatchingStars::AdjustSize()
 
 /* ------------------------------------------------------------------- */
 
+void	CMatchingStars::KeepBrightestStars(LONG lNrStars)
+{
+	const POINTEXTVECTOR::size_type		lMaxStars = lNrStars;
+
+	if (m_vRefStars.size() > lMaxStars)
+		m_vRefStars.resize(lMaxStars);
+	if (m_vTgtStars.size() > lMaxStars)
+		m_vTgtStars.resize(lMaxStars);
+
+	// The index and everything computed from the longer lists no longer
+	// match the stars
+	m_pRefIndex = nullptr;
+	m_vRefTriangles.clear();
+	m_vTgtTriangles.clear();
+	m_vRefStarDistances.clear();
+	m_vTgtStarDistances.clear();
+	m_vRefStarIndices.clear();
+	m_vTgtStarIndices.clear();
+};
+
+/* ------------------------------------------------------------------- */
+
 bool	CMatchingStars::ComputeCoordinateTransformation(CBilinearParameters & BilinearParameters)
 {
 	bool					bResult = false;
@@ -1256,9 +1338,18 @@ bool	CMatchingStars::ComputeCoordinateTransformation(CBilinearParameters & Bilin
 		//AdjustSize();
 		if (m_vRefStars.size()>=8 && m_vTgtStars.size()>=8)
 		{
-			bResult = ComputeLargeTriangleTransformation(BilinearParameters);
+			if (m_pRefIndex)
+				bResult = ComputeIndexedTriangleTransformation(BilinearParameters);
 			if (!bResult)
-				bResult = ComputeMatchingTriangleTransformation(BilinearParameters);
+			{
+				// The cubic methods only use the brightest stars (the stars
+				// are sorted by decreasing luminancy)
+				if (m_vRefStars.size()>MAXCUBICSTARS || m_vTgtStars.size()>MAXCUBICSTARS)
+					KeepBrightestStars(MAXCUBICSTARS);
+				bResult = ComputeLargeTriangleTransformation(BilinearParameters);
+				if (!bResult)
+					bResult = ComputeMatchingTriangleTransformation(BilinearParameters);
+			};
 		};
 	}
 	else
@@ -1271,3 +1362,128 @@ bool	CMatchingStars::ComputeCoordinateTransformation(CBilinearParameters & Bilin
 
 /* ------------------------------------------------------------------- */
 
+/* ------------------------------------------------------------------- */
+/* ------------------------------------------------------------------- */
+
+const	LONG			NRPATTERNNEIGHBOURS = 8;
+
+LONG	CStarPatternIndex::GetCell(float fX, float fY)
+{
+	const LONG			lX = min(max(static_cast<LONG>(fX * PATTERNGRIDSIZE), 0L), PATTERNGRIDSIZE-1);
+	const LONG			lY = min(max(static_cast<LONG>(fY * PATTERNGRIDSIZE), 0L), PATTERNGRIDSIZE-1);
+
+	return lY * PATTERNGRIDSIZE + lX;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CStarPatternIndex::ComputeTriangles(const POINTEXTVECTOR & vStars, STARTRIANGLEVECTOR & vTriangles)
+{
+	ZFUNCTRACE_RUNTIME();
+	// Only the triangles made by a star and two of its nearest neighbours
+	// are used: n * k * (k-1) / 2 triangles instead of n^3 / 6.
+	// The stars of each triangle are ordered by the length of the
+	// opposite side (longest first) so that the matching triangles
+	// give the matching stars directly.
+	const LONG					lNrStars = (LONG)vStars.size();
+	const LONG					lNrNeighbours = min(NRPATTERNNEIGHBOURS, lNrStars-1);
+	std::vector<std::tuple<WORD, WORD, WORD>>	vStarTriplets;
+	std::vector<std::pair<double, LONG>>		vDistances;
+
+	vTriangles.clear();
+	if (lNrNeighbours < 2)
+		return;
+
+	vStarTriplets.reserve(lNrStars * lNrNeighbours * (lNrNeighbours-1) / 2);
+	vDistances.reserve(lNrStars);
+	for (LONG i = 0;i<lNrStars;i++)
+	{
+		vDistances.clear();
+		for (LONG j = 0;j<lNrStars;j++)
+		{
+			if (j != i)
+				vDistances.emplace_back(Distance(vStars[i], vStars[j]), j);
+		};
+		std::partial_sort(vDistances.begin(), vDistances.begin()+lNrNeighbours, vDistances.end());
+
+		for (LONG j = 0;j<lNrNeighbours;j++)
+		{
+			for (LONG k = j+1;k<lNrNeighbours;k++)
+			{
+				WORD		Stars[3] = { static_cast<WORD>(i), static_cast<WORD>(vDistances[j].second), static_cast<WORD>(vDistances[k].second) };
+
+				std::sort(Stars, Stars+3);
+				vStarTriplets.emplace_back(Stars[0], Stars[1], Stars[2]);
+			};
+		};
+	};
+
+	// The same triangle is found from each of its stars
+	std::sort(vStarTriplets.begin(), vStarTriplets.end());
+	vStarTriplets.erase(std::unique(vStarTriplets.begin(), vStarTriplets.end()), vStarTriplets.end());
+
+	vTriangles.reserve(vStarTriplets.size());
+	for (const auto & Triplet : vStarTriplets)
+	{
+		const WORD		Star1 = std::get<0>(Triplet),
+						Star2 = std::get<1>(Triplet),
+						Star3 = std::get<2>(Triplet);
+		// Length of each side with the opposite star
+		std::pair<double, WORD>		Sides[3] =
+		{
+			{ Distance(vStars[Star2], vStars[Star3]), Star1 },
+			{ Distance(vStars[Star1], vStars[Star3]), Star2 },
+			{ Distance(vStars[Star1], vStars[Star2]), Star3 }
+		};
+
+		std::sort(Sides, Sides+3);
+		if (Sides[0].first > 0)
+		{
+			const float		fX = static_cast<float>(Sides[1].first/Sides[2].first);
+			const float		fY = static_cast<float>(Sides[0].first/Sides[2].first);
+
+			// Same filter as CMatchingStars::ComputeTriangles: the longest
+			// side must be clearly identified
+			if (fX < 0.9)
+				vTriangles.emplace_back(Sides[2].second, Sides[1].second, Sides[0].second, fX, fY);
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CStarPatternIndex::Build(const POINTEXTVECTOR & vStars)
+{
+	ZFUNCTRACE_RUNTIME();
+
+	Clear();
+	m_vStars = vStars;
+	if (m_vStars.size() > MAXINDEXEDSTARS)
+		m_vStars.resize(MAXINDEXEDSTARS);
+
+	ComputeTriangles(m_vStars, m_vTriangles);
+
+	// Counting sort of the triangles on the cells of the grid
+	std::vector<LONG>			vCells;
+	STARTRIANGLEVECTOR			vTriangles(m_vTriangles.size());
+
+	vCells.reserve(m_vTriangles.size());
+	m_vCellStarts.resize(PATTERNGRIDSIZE * PATTERNGRIDSIZE + 1, 0);
+	for (const CStarTriangle & Triangle : m_vTriangles)
+	{
+		vCells.push_back(GetCell(Triangle.m_fX, Triangle.m_fY));
+		m_vCellStarts[vCells.back()+1]++;
+	};
+
+	for (size_t i = 1;i<m_vCellStarts.size();i++)
+		m_vCellStarts[i] += m_vCellStarts[i-1];
+
+	std::vector<LONG>			vPositions(m_vCellStarts.begin(), m_vCellStarts.end()-1);
+
+	for (size_t i = 0;i<m_vTriangles.size();i++)
+		vTriangles[vPositions[vCells[i]]++] = m_vTriangles[i];
+
+	m_vTriangles.swap(vTriangles);
+};
+
+/* ------------------------------------------------------------------- */
@@ -12,7 +12,7 @@ class CStarTriangle
 public :
 	float			m_fX,
 					m_fY;
-	BYTE			m_Star1,
+	WORD			m_Star1,
 					m_Star2,
 					m_Star3;
 
@@ -36,7 +36,7 @@ public :
         m_Star3 = 0;
     }
 
-	CStarTriangle(BYTE Star1, BYTE Star2, BYTE Star3, float fX, float fY)
+	CStarTriangle(WORD Star1, WORD Star2, WORD Star3, float fX, float fY)
 	{
 		m_Star1 = Star1;
 		m_Star2 = Star2;
@@ -130,7 +130,7 @@ typedef std::vector<CStarCornerDist>			STARCORNERDISTVECTOR;
 class CStarDist
 {
 public :
-	BYTE			m_Star1,
+	WORD			m_Star1,
 					m_Star2;
 	float			m_fDistance;
 
@@ -143,7 +143,7 @@ private :
 	};
 
 public :
-	CStarDist(BYTE Star1, BYTE Star2, float fDistance = 0.0)
+	CStarDist(WORD Star1, WORD Star2, float fDistance = 0.0)
 	{
 		if (Star1 < Star2)
 		{
@@ -203,7 +203,7 @@ const	LONG			VPFLAG_POSSIBLE			  = 0x00000400;
 class CVotingPair
 {
 public :
-	__int8					m_RefStar,
+	WORD					m_RefStar,
 							m_TgtStar;
 	LONG					m_lNrVotes;
 	LONG					m_Flags;
@@ -218,7 +218,7 @@ private :
 	};
 
 public :
-	CVotingPair(BYTE RefStar = 0, BYTE TgtStar = 0)
+	CVotingPair(WORD RefStar = 0, WORD TgtStar = 0)
 	{
 		m_RefStar	= RefStar;
 		m_TgtStar	= TgtStar;
@@ -309,6 +309,93 @@ typedef VOTINGPAIRVECTOR::iterator		VOTINGPAIRITERATOR;
 
 /* ------------------------------------------------------------------- */
 
+// Maximum number of stars used with a reference index (the other
+// methods are cubic in the number of stars and are limited to 100)
+const	LONG			MAXINDEXEDSTARS		= 300;
+const	LONG			MAXCUBICSTARS		= 100;
+
+// Number of cells of the triangle shape grid along each axis
+const	LONG			PATTERNGRIDSIZE		= 500;
+
+// Triangles of the stars with their nearest neighbours, indexed on a
+// grid of their shape (ratios of the sides) so that a similar triangle
+// is found without scanning the whole list.
+// The index of the reference frame is built once and is only read
+// afterwards, so it can be shared by all the threads computing offsets.
+class CStarPatternIndex
+{
+private :
+	POINTEXTVECTOR			m_vStars;
+	STARTRIANGLEVECTOR		m_vTriangles;		// Sorted by grid cell
+	std::vector<LONG>		m_vCellStarts;		// First triangle of each cell (+ end)
+
+public :
+	CStarPatternIndex()
+	{
+	};
+
+	virtual ~CStarPatternIndex()
+	{
+	};
+
+	static	LONG	GetCell(float fX, float fY);
+	static	void	ComputeTriangles(const POINTEXTVECTOR & vStars, STARTRIANGLEVECTOR & vTriangles);
+
+	void	Build(const POINTEXTVECTOR & vStars);
+	void	Clear()
+	{
+		m_vStars.clear();
+		m_vTriangles.clear();
+		m_vCellStarts.clear();
+	};
+
+	bool	IsValid() const
+	{
+		return m_vStars.size() >= 8;
+	};
+
+	const POINTEXTVECTOR &	GetStars() const
+	{
+		return m_vStars;
+	};
+
+	// Calls Func(const CStarTriangle &) for each triangle whose shape is
+	// within the tolerance of the given one
+	template <typename TFunc>
+	void	ForEachSimilarTriangle(const CStarTriangle & Triangle, float fTolerance, TFunc Func) const;
+};
+
+/* ------------------------------------------------------------------- */
+
+template <typename TFunc>
+void	CStarPatternIndex::ForEachSimilarTriangle(const CStarTriangle & Triangle, float fTolerance, TFunc Func) const
+{
+	// The tolerance is at most one cell so only the neighbour cells are searched
+	const LONG			lX = GetCell(Triangle.m_fX, 0) % PATTERNGRIDSIZE;
+	const LONG			lY = GetCell(0, Triangle.m_fY) / PATTERNGRIDSIZE;
+
+	if (m_vCellStarts.empty())
+		return;
+
+	for (LONG j = max(0L, lY-1);j<=min(PATTERNGRIDSIZE-1, lY+1);j++)
+	{
+		for (LONG i = max(0L, lX-1);i<=min(PATTERNGRIDSIZE-1, lX+1);i++)
+		{
+			const LONG		lCell = j * PATTERNGRIDSIZE + i;
+
+			for (LONG k = m_vCellStarts[lCell];k<m_vCellStarts[lCell+1];k++)
+			{
+				const CStarTriangle &	RefTriangle = m_vTriangles[k];
+
+				if (Distance(RefTriangle.m_fX, RefTriangle.m_fY, Triangle.m_fX, Triangle.m_fY) <= fTolerance)
+					Func(RefTriangle);
+			};
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
 class CMatchingStars
 {
 private :
@@ -331,6 +418,8 @@ private :
 	POINTEXTVECTOR			m_vRefCorners;
 	POINTEXTVECTOR			m_vTgtCorners;
 
+	const CStarPatternIndex *	m_pRefIndex;
+
 private :
 	CPointExt & RefStar(const CVotingPair & vp)
 	{
@@ -361,14 +450,17 @@ private :
 
 	bool	ComputeMatchingTriangleTransformation(CBilinearParameters & BilinearParameters);
 	bool	ComputeLargeTriangleTransformation(CBilinearParameters & BilinearParameters);
+	bool	ComputeIndexedTriangleTransformation(CBilinearParameters & BilinearParameters);
 
 	void	AdjustSize();
+	void	KeepBrightestStars(LONG lNrStars);
 
 public :
 	CMatchingStars()
 	{
 		m_lWidth = 0;
 		m_lHeight = 0;
+		m_pRefIndex = nullptr;
 	};
 
 	virtual ~CMatchingStars()
@@ -390,8 +482,19 @@ public :
 		return (m_vRefStars.size() > 0);
 	};
 
+	// The reference stars are the ones of the index, which must live
+	// longer than this object
+	void	SetReferenceIndex(const CStarPatternIndex * pRefIndex)
+	{
+		ClearReference();
+		m_pRefIndex = pRefIndex;
+		if (m_pRefIndex)
+			m_vRefStars = m_pRefIndex->GetStars();
+	};
+
 	void	ClearReference()
 	{
+		m_pRefIndex = nullptr;
 		m_vRefStars.clear();
 		m_vRefTriangles.clear();
 		m_vRefCorners.clear();
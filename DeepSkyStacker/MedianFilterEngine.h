@@ -5,6 +5,107 @@
 
 /* ------------------------------------------------------------------- */
 
+// Running median of integer samples (8 or 16 bits) kept in a two level
+// histogram. The median is moved from its previous position when the
+// values are added and removed, skipping the empty blocks of 256 bins,
+// so it costs a few steps instead of a sort of the whole window.
+template <typename TType>
+class CHistogramMedianT
+{
+private :
+	std::vector<LONG>			m_vFine;
+	std::vector<LONG>			m_vCoarse;
+	LONG						m_lCount;
+	LONG						m_lMedian;		// Current median bin
+	LONG						m_lBelow;		// Number of values below m_lMedian
+
+public :
+	CHistogramMedianT() :
+		m_vFine(static_cast<size_t>(1) << (8 * sizeof(TType)), 0),
+		m_vCoarse(max(static_cast<size_t>(1), m_vFine.size() >> 8), 0)
+	{
+		m_lCount	= 0;
+		m_lMedian	= 0;
+		m_lBelow	= 0;
+	};
+
+	void	Add(TType Value)
+	{
+		m_vFine[Value]++;
+		m_vCoarse[Value >> 8]++;
+		m_lCount++;
+		if (Value < m_lMedian)
+			m_lBelow++;
+	};
+
+	void	Remove(TType Value)
+	{
+		m_vFine[Value]--;
+		m_vCoarse[Value >> 8]--;
+		m_lCount--;
+		if (Value < m_lMedian)
+			m_lBelow--;
+	};
+
+	// Largest value below the current median bin (there must be one)
+	LONG	GetPreviousValue() const
+	{
+		LONG				lValue = m_lMedian - 1;
+
+		while (!m_vFine[lValue])
+		{
+			if ((lValue & 0xFF) == 0xFF && !m_vCoarse[lValue >> 8])
+				lValue -= 256;
+			else
+				lValue--;
+		};
+
+		return lValue;
+	};
+
+	// Value of rank Count/2, or the average of the values of rank
+	// Count/2-1 and Count/2 for an even count (same as Median() on the values)
+	TType	GetMedian()
+	{
+		const LONG			lRank = m_lCount/2;
+
+		while (m_lBelow > lRank)
+		{
+			if (!(m_lMedian & 0xFF) && (m_lBelow - m_vCoarse[(m_lMedian >> 8)-1] > lRank))
+			{
+				m_lBelow  -= m_vCoarse[(m_lMedian >> 8)-1];
+				m_lMedian -= 256;
+			}
+			else
+			{
+				m_lMedian--;
+				m_lBelow -= m_vFine[m_lMedian];
+			};
+		};
+
+		while (m_lBelow + m_vFine[m_lMedian] <= lRank)
+		{
+			if (!(m_lMedian & 0xFF) && (m_lBelow + m_vCoarse[m_lMedian >> 8] <= lRank))
+			{
+				m_lBelow  += m_vCoarse[m_lMedian >> 8];
+				m_lMedian += 256;
+			}
+			else
+			{
+				m_lBelow += m_vFine[m_lMedian];
+				m_lMedian++;
+			};
+		};
+
+		if (!(m_lCount & 1) && m_lCount && m_lBelow > lRank - 1)
+			return static_cast<TType>((GetPreviousValue() + m_lMedian) / 2);
+
+		return static_cast<TType>(m_lMedian);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
 template <typename TType>
 class CInternalMedianFilterEngineT
 {
@@ -39,12 +140,92 @@ public :
 			m_pProgress = pProgress;
 		};
 
-		virtual bool	DoTask(HANDLE hEvent)
+		// Median of one plane (or one CFA sub-plane) for the rows lStart to lEnd.
+		// The window slides along each row: only one column of values is
+		// removed and added for each pixel.
+		void	FilterPlane(const TType * pInValues, TType * pOutValues, LONG lWidth, LONG lHeight, LONG lXStep, LONG lRowStride, LONG lFilterSize, LONG lStart, LONG lEnd)
+		{
+			CHistogramMedianT<TType>	Histogram;
+
+			for (LONG j = lStart;j<lEnd;j++)
+			{
+				const LONG			lYMin = max(0L, j - lFilterSize);
+				const LONG			lYMax = min(j + lFilterSize, lHeight - 1);
+				LONG				lXMin = 0,
+									lXMax = -1;
+
+				const auto			AddColumn = [&](LONG i)
+				{
+					for (LONG k = lYMin;k<=lYMax;k++)
+						Histogram.Add(pInValues[k * lRowStride + i * lXStep]);
+				};
+				const auto			RemoveColumn = [&](LONG i)
+				{
+					for (LONG k = lYMin;k<=lYMax;k++)
+						Histogram.Remove(pInValues[k * lRowStride + i * lXStep]);
+				};
+
+				while (lXMax < min(lFilterSize, lWidth - 1))
+					AddColumn(++lXMax);
+
+				for (LONG i = 0;i<lWidth;i++)
+				{
+					pOutValues[j * lRowStride + i * lXStep] = Histogram.GetMedian();
+
+					if (i - lFilterSize >= 0)
+						RemoveColumn(lXMin++);
+					if (i + lFilterSize + 1 < lWidth)
+						AddColumn(++lXMax);
+				};
+
+				while (lXMin <= lXMax)
+					RemoveColumn(lXMin++);
+			};
+		};
+
+		bool	HistogramFilter(LONG lStart, LONG lEnd)
+		{
+			// 8 and 16 bits values with no CFA or a 2x2 CFA pattern
+			if constexpr (std::is_same<TType, BYTE>::value || std::is_same<TType, WORD>::value)
+			{
+				const LONG			lWidth  = m_pEngine->m_lWidth,
+									lHeight = m_pEngine->m_lHeight;
+				const CFATYPE		CFAType = m_pEngine->m_CFAType;
+
+				if (CFAType == CFATYPE_NONE)
+				{
+					FilterPlane(m_pEngine->m_pvInValues, m_pEngine->m_pvOutValues, lWidth, lHeight, 1, lWidth, m_pEngine->m_lFilterSize, lStart, lEnd);
+					return true;
+				}
+				else if (CFAType <= CFATYPE_RGGB || IsSimpleCYMG(CFAType))
+				{
+					// Each of the four sub-planes of the CFA pattern is filtered
+					// on its own with half the size (the size was doubled to
+					// skip the pixels of the other colors).
+					// The two green sub-planes of a Bayer matrix are not mixed.
+					for (LONG lYOffset = 0;lYOffset<2;lYOffset++)
+					{
+						for (LONG lXOffset = 0;lXOffset<2;lXOffset++)
+						{
+							const LONG		lOffset = lYOffset * lWidth + lXOffset;
+
+							FilterPlane(m_pEngine->m_pvInValues + lOffset, m_pEngine->m_pvOutValues + lOffset,
+										(lWidth - lXOffset + 1)/2, (lHeight - lYOffset + 1)/2, 2, lWidth * 2,
+										m_pEngine->m_lFilterSize/2,
+										(lStart - lYOffset + 1)/2, (lEnd - lYOffset + 1)/2);
+						};
+					};
+					return true;
+				};
+			};
+
+			return false;
+		};
+
+		virtual bool	DoTask(LONG lStart, LONG lEnd)
 		{
 			bool					bResult = true;
 			LONG					i, j;
-			bool					bEnd = false;
-			MSG						msg;
 			LONG					lWidth  = m_pEngine->m_lWidth,
 									lHeight = m_pEngine->m_lHeight,
 									lFilterSize = m_pEngine->m_lFilterSize;
@@ -52,107 +233,97 @@ public :
 
 			std::vector<TType>		vValues;
 
+			if (HistogramFilter(lStart, lEnd))
+				return true;
+
 			vValues.reserve((m_pEngine->m_lFilterSize*2+1)*(m_pEngine->m_lFilterSize*2+1));
 			AvxImageFilter avxFilter(m_pEngine);
 
-			// Create a message queue and signal the event
-			PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-			SetEvent(hEvent);
-			while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+			if (avxFilter.filter(lStart, lEnd) != 0)
 			{
-				if (msg.message == WM_MT_PROCESS)
+				if (CFAType != CFATYPE_NONE)
 				{
-					if (avxFilter.filter(msg.wParam, msg.wParam + msg.lParam) != 0)
-					{
-						if (CFAType != CFATYPE_NONE)
-						{
-							TType* pOutValues = m_pEngine->m_pvOutValues;
+					TType* pOutValues = m_pEngine->m_pvOutValues;
 
-							pOutValues += msg.wParam * lWidth;
+					pOutValues += lStart * lWidth;
 
-							for (j = msg.wParam; j < msg.wParam + msg.lParam; j++)
+					for (j = lStart; j < lEnd; j++)
+					{
+						for (i = 0; i < lWidth; i++)
+						{
+							// Compute the min and max values in X and Y
+							LONG			lXMin, lXMax,
+								lYMin, lYMax;
+							BAYERCOLOR		BayerColor = GetBayerColor(i, j, CFAType);
+
+							lXMin = max(0L, i - lFilterSize);
+							lXMax = min(i + lFilterSize, lWidth - 1);
+							lYMin = max(0L, j - lFilterSize);
+							lYMax = min(j + lFilterSize, lHeight - 1);
+
+							// Fill the array with the values
+							TType* pInLine = m_pEngine->m_pvInValues;
+							pInLine += lXMin + (lYMin * lWidth);
+							vValues.resize(0);
+							for (LONG k = lYMin; k <= lYMax; k++)
 							{
-								for (i = 0; i < lWidth; i++)
+								TType* pInValues = pInLine;
+
+								for (LONG l = lXMin; l <= lXMax; l++)
 								{
-									// Compute the min and max values in X and Y
-									LONG			lXMin, lXMax,
-										lYMin, lYMax;
-									BAYERCOLOR		BayerColor = GetBayerColor(i, j, CFAType);
-
-									lXMin = max(0L, i - lFilterSize);
-									lXMax = min(i + lFilterSize, lWidth - 1);
-									lYMin = max(0L, j - lFilterSize);
-									lYMax = min(j + lFilterSize, lHeight - 1);
-
-									// Fill the array with the values
-									TType* pInLine = m_pEngine->m_pvInValues;
-									pInLine += lXMin + (lYMin * lWidth);
-									vValues.resize(0);
-									for (LONG k = lYMin; k <= lYMax; k++)
-									{
-										TType* pInValues = pInLine;
-
-										for (LONG l = lXMin; l <= lXMax; l++)
-										{
-											if (GetBayerColor(l, k, CFAType) == BayerColor)
-												vValues.push_back(*pInValues);
-											pInValues++;
-										};
-										pInLine += lWidth;
-									};
-
-									TType			fMedian = Median(vValues);
-
-									*pOutValues = fMedian;
-									pOutValues++;
+									if (GetBayerColor(l, k, CFAType) == BayerColor)
+										vValues.push_back(*pInValues);
+									pInValues++;
 								};
+								pInLine += lWidth;
 							};
-						}
-						else
+
+							TType			fMedian = Median(vValues);
+
+							*pOutValues = fMedian;
+							pOutValues++;
+						};
+					};
+				}
+				else
+				{
+					TType* pOutValues = m_pEngine->m_pvOutValues;
+
+					pOutValues += lStart * lWidth;
+
+					for (j = lStart; j < lEnd; j++)
+					{
+						for (i = 0; i < lWidth; i++)
 						{
-							TType* pOutValues = m_pEngine->m_pvOutValues;
+							// Compute the min and max values in X and Y
+							LONG			lXMin, lXMax,
+								lYMin, lYMax;
+
+							lXMin = max(0L, i - lFilterSize);
+							lXMax = min(i + lFilterSize, lWidth - 1);
+							lYMin = max(0L, j - lFilterSize);
+							lYMax = min(j + lFilterSize, lHeight - 1);
 
-							pOutValues += msg.wParam * lWidth;
+							vValues.resize((lXMax - lXMin + 1) * (lYMax - lYMin + 1));
 
-							for (j = msg.wParam; j < msg.wParam + msg.lParam; j++)
+							// Fill the array with the values
+							TType* pInValues = m_pEngine->m_pvInValues;
+							TType* pAreaValues = &(vValues[0]);
+							pInValues += lXMin + (lYMin * lWidth);
+							for (LONG k = lYMin; k <= lYMax; k++)
 							{
-								for (i = 0; i < lWidth; i++)
-								{
-									// Compute the min and max values in X and Y
-									LONG			lXMin, lXMax,
-										lYMin, lYMax;
-
-									lXMin = max(0L, i - lFilterSize);
-									lXMax = min(i + lFilterSize, lWidth - 1);
-									lYMin = max(0L, j - lFilterSize);
-									lYMax = min(j + lFilterSize, lHeight - 1);
-
-									vValues.resize((lXMax - lXMin + 1) * (lYMax - lYMin + 1));
-
-									// Fill the array with the values
-									TType* pInValues = m_pEngine->m_pvInValues;
-									TType* pAreaValues = &(vValues[0]);
-									pInValues += lXMin + (lYMin * lWidth);
-									for (LONG k = lYMin; k <= lYMax; k++)
-									{
-										memcpy(pAreaValues, pInValues, sizeof(TType) * (lXMax - lXMin + 1));
-										pInValues += lWidth;
-										pAreaValues += lXMax - lXMin + 1;
-									};
-
-									TType			fMedian = Median(vValues);
-
-									*pOutValues = fMedian;
-									pOutValues++;
-								};
+								memcpy(pAreaValues, pInValues, sizeof(TType) * (lXMax - lXMin + 1));
+								pInValues += lWidth;
+								pAreaValues += lXMax - lXMin + 1;
 							};
+
+							TType			fMedian = Median(vValues);
+
+							*pOutValues = fMedian;
+							pOutValues++;
 						};
 					};
-
-					SetEvent(hEvent);
-				}
-				else if (msg.message == WM_MT_STOP)
-					bEnd = true;
+				};
 			};
 
 			return true;
@@ -162,30 +333,10 @@ public :
 		{
 			bool				bResult = true;
 			LONG				lHeight = m_pEngine->m_lHeight;
-			LONG				i = 0;
-			LONG				lStep;
-			LONG				lRemaining;
 
 			if (m_pProgress)
 				m_pProgress->SetNrUsedProcessors(GetNrThreads());
-			lStep		= max(1L, lHeight/50);
-			lRemaining	= lHeight;
-
-			while (i<lHeight)
-			{
-				LONG			lAdd = min(lStep, lRemaining);
-				DWORD			dwThreadId;
-
-				dwThreadId = GetAvailableThreadId();
-				PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-				i			+=lAdd;
-				lRemaining	-= lAdd;
-				if (m_pProgress)
-					m_pProgress->Progress2(nullptr, i);
-			};
-
-			CloseAllThreads();
+			bResult = ProcessRange(0, lHeight, m_pProgress);
 
 			if (m_pProgress)
 				m_pProgress->SetNrUsedProcessors();
@@ -221,7 +372,6 @@ inline bool CInternalMedianFilterEngineT<TType>::ApplyFilter(CDSSProgress * pPro
 	CFilterTask<TType>		FilterTask;
 
 	FilterTask.Init(this, pProgress);
-	FilterTask.StartThreads();
 	FilterTask.Process();
 
 	if (pProgress)
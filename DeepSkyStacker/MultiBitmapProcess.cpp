@@ -6,7 +6,11 @@
 #include "DSSProgress.h"
 #include <algorithm>
 #include <iostream>
+#include <future>
+#include <memory>
 #include "Multitask.h"
+#include "DSSPlatform.h"
+#include "RunReport.h"
 #include "avx_output.h"
 
 /* ------------------------------------------------------------------- */
@@ -21,6 +25,104 @@ static void GetTempFileName(CString & strFile)
 	strFile = szTempFileName;
 };
 
+/* ------------------------------------------------------------------- */
+
+class CBitmapPartReader
+{
+private :
+	const BITMAPPARTFILEVECTOR &		m_vFiles;
+	size_t								m_lLineSize;
+	bool								m_bMapped;
+	std::unique_ptr<BYTE[]>				m_pBuffers[2];
+	size_t								m_lBufferSizes[2];
+	std::unique_ptr<CMappedFile>	m_pMappedParts[2];
+	std::future<bool>					m_NextPart;
+
+private :
+	size_t	GetPartSize(size_t lPart) const
+	{
+		return m_lLineSize * (m_vFiles[lPart].m_lEndRow - m_vFiles[lPart].m_lStartRow + 1);
+	};
+
+	bool	ReadPart(size_t lPart)
+	{
+		// Each part alternates between two slots: one is combined while the other is read
+		const size_t		lSlot = lPart % 2;
+		const size_t		lPartSize = GetPartSize(lPart);
+		bool				bResult = false;
+
+		if (m_bMapped)
+		{
+			m_pMappedParts[lSlot] = std::make_unique<CMappedFile>();
+			bResult = m_pMappedParts[lSlot]->Open(m_vFiles[lPart].m_strFile, false);
+			if (bResult)
+				m_pMappedParts[lSlot]->Touch(lPartSize);
+		}
+		else
+		{
+			FILE *			hFile;
+
+			if (lPartSize > m_lBufferSizes[lSlot])
+			{
+				m_pBuffers[lSlot].reset(new BYTE[lPartSize]);
+				m_lBufferSizes[lSlot] = lPartSize;
+			};
+
+			hFile = _tfopen(m_vFiles[lPart].m_strFile, _T("rb"));
+			if (hFile)
+			{
+				bResult = (fread(m_pBuffers[lSlot].get(), 1, lPartSize, hFile) == lPartSize);
+				fclose(hFile);
+			};
+		};
+
+		return bResult;
+	};
+
+	void	StartReading(size_t lPart)
+	{
+		if (lPart < m_vFiles.size())
+			m_NextPart = std::async(std::launch::async, &CBitmapPartReader::ReadPart, this, lPart);
+	};
+
+public :
+	CBitmapPartReader(const BITMAPPARTFILEVECTOR & vFiles, size_t lLineSize, bool bMapped) :
+		m_vFiles(vFiles),
+		m_lLineSize(lLineSize),
+		m_bMapped(bMapped),
+		m_lBufferSizes{ 0, 0 }
+	{
+		StartReading(0);
+	};
+
+	~CBitmapPartReader()
+	{
+		if (m_NextPart.valid())
+			m_NextPart.wait();
+	};
+
+	// Parts must be requested in order. The returned data is valid until the part after
+	// the next one is requested.
+	void *	GetPart(size_t lPart)
+	{
+		void *			pResult = nullptr;
+
+		if (m_NextPart.valid() && m_NextPart.get())
+		{
+			const size_t	lSlot = lPart % 2;
+
+			if (m_bMapped)
+				pResult = m_pMappedParts[lSlot]->GetData();
+			else
+				pResult = m_pBuffers[lSlot].get();
+		};
+
+		StartReading(lPart + 1);
+
+		return pResult;
+	};
+};
+
 /* ------------------------------------------------------------------- */
 /* ------------------------------------------------------------------- */
 
@@ -40,6 +142,67 @@ void CMultiBitmap::DestroyTempFiles()
 		m_vFiles[i].m_strFile.Empty();
 	};
 	m_vFiles.clear();
+	std::vector<BYTE>().swap(m_vInMemoryBuffer);
+	m_bInMemory = false;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CMultiBitmap::InitMappedParts()
+{
+	ZFUNCTRACE_RUNTIME();
+	bool				bResult = true;
+	const size_t		lLineSize = static_cast<size_t>(GetNrBytesPerChannel()) * GetNrChannels() * m_lWidth;
+	const size_t		lNrBitmaps = max(1L, m_lNrBitmaps);
+	const size_t		lStackSize = lLineSize * lNrBitmaps * m_lHeight;
+	const size_t		lAvailableMemory = static_cast<size_t>(GetAvailablePhysicalMemory());
+
+	m_vFiles.clear();
+	m_lNrMappedBitmaps = static_cast<LONG>(lNrBitmaps);
+	m_bInMemory = false;
+
+	if (lStackSize <= lAvailableMemory/2)
+	{
+		// The whole stack fits in memory: a single band and no temporary file
+		try
+		{
+			m_vInMemoryBuffer.resize(lStackSize);
+			m_vFiles.emplace_back(_T(""), 0, m_lHeight-1);
+			m_bInMemory = true;
+		}
+		catch (std::bad_alloc &)
+		{
+			std::vector<BYTE>().swap(m_vInMemoryBuffer);
+		};
+	};
+
+	if (!m_bInMemory)
+	{
+		// Two bands are in memory while combining: the current one and the one read ahead
+		const size_t	lBandSize = max(static_cast<size_t>(50000000), lAvailableMemory/4);
+		const LONG		lNrLines = static_cast<LONG>(min(static_cast<size_t>(m_lHeight), max(static_cast<size_t>(1), lBandSize / (lLineSize * lNrBitmaps))));
+
+		for (LONG lStartRow = 0;lStartRow<m_lHeight && bResult;lStartRow += lNrLines)
+		{
+			CString			strFile;
+			const LONG		lEndRow = min(lStartRow + lNrLines, m_lHeight) - 1;
+
+			GetTempFileName(strFile);
+			m_vFiles.emplace_back(strFile, lStartRow, lEndRow);
+
+			// Preallocate the file so that each bitmap is written at its final place
+			bResult = PreallocateFile(strFile, lLineSize * lNrBitmaps * (lEndRow - lStartRow + 1));
+		};
+	};
+
+	if (bResult)
+		m_bInitDone = true;
+	else
+		DestroyTempFiles();
+
+	ZTRACE_RUNTIME("Multi bitmap: %s, %d band(s)", m_bInMemory ? "in memory" : "mapped files", (int)m_vFiles.size());
+
+	return bResult;
 };
 
 /* ------------------------------------------------------------------- */
@@ -54,6 +217,15 @@ void CMultiBitmap::InitParts()
 	LONG				lNrRemainingLines;
 	LONG				lNrOffsetLine = 0;
 
+	m_bMappedFiles = CAllStackingTasks::GetUseMappedTempFiles();
+	if (m_bMappedFiles)
+	{
+		if (InitMappedParts())
+			return;
+		// Fall back to the appended temporary files
+		m_bMappedFiles = false;
+	};
+
 	// make files a maximum of 50 Mb
 
 	lLineSize = (GetNrBytesPerChannel() * GetNrChannels() * m_lWidth);
@@ -113,6 +285,9 @@ bool CMultiBitmap::AddBitmap(CMemoryBitmap * pBitmap, CDSSProgress * pProgress)
 		m_lNrAddedBitmaps = 0;
 	};
 
+	if (m_bMappedFiles)
+		return AddBitmapToMappedParts(pBitmap, pProgress);
+
 	{
 		// Save the bitmap to the file
 		void *				pScanLine = nullptr;
@@ -159,6 +334,51 @@ bool CMultiBitmap::AddBitmap(CMemoryBitmap * pBitmap, CDSSProgress * pProgress)
 	return bResult;
 };
 
+/* ------------------------------------------------------------------- */
+
+bool CMultiBitmap::AddBitmapToMappedParts(CMemoryBitmap * pBitmap, CDSSProgress * pProgress)
+{
+	ZFUNCTRACE_RUNTIME();
+	bool					bResult = (m_lNrAddedBitmaps < m_lNrMappedBitmaps);
+	const size_t			lScanLineSize = static_cast<size_t>(pBitmap->BitPerSample()) * (pBitmap->IsMonochrome() ? 1 : 3) * m_lWidth / 8;
+
+	if (pProgress)
+		pProgress->Start2(nullptr, m_lHeight);
+
+	for (size_t k = 0;k<m_vFiles.size() && bResult;k++)
+	{
+		const CBitmapPartFile &	bp = m_vFiles[k];
+		const size_t			lNrLines = bp.m_lEndRow - bp.m_lStartRow + 1;
+		CMappedFile		MappedPart;
+		BYTE *					pBand = nullptr;
+
+		if (m_bInMemory)
+			pBand = m_vInMemoryBuffer.data();
+		else if (MappedPart.Open(bp.m_strFile, true))
+			pBand = MappedPart.GetData();
+
+		bResult = (pBand != nullptr);
+		if (bResult)
+		{
+			// Same layout as the appended files: all the lines of the band for each bitmap
+			pBand += m_lNrAddedBitmaps * lNrLines * lScanLineSize;
+			for (LONG j = bp.m_lStartRow;j<=bp.m_lEndRow;j++)
+			{
+				pBitmap->GetScanLine(j, pBand + (j - bp.m_lStartRow) * lScanLineSize);
+				if (pProgress)
+					pProgress->Progress2(nullptr, j+1);
+			};
+		};
+	};
+
+	if (pProgress)
+		pProgress->End2();
+	if (bResult)
+		m_lNrAddedBitmaps++;
+
+	return bResult;
+};
+
 /* ------------------------------------------------------------------- */
 /* ------------------------------------------------------------------- */
 
@@ -189,132 +409,57 @@ public :
 	{
 	};
 
-	void	Init(LONG lStartRow, LONG lEndRow, LONG lScanLineSize, void * pBuffer, CDSSProgress * pProgress, CMultiBitmap * pMultiBitmap, CMemoryBitmap * pBitmap, CMemoryBitmap * pHomBitmap = nullptr)
+	void	Init(LONG lScanLineSize, CDSSProgress * pProgress, CMultiBitmap * pMultiBitmap, CMemoryBitmap * pBitmap, CMemoryBitmap * pHomBitmap = nullptr)
 	{
-		m_lStartRow		= lStartRow;
-		m_lEndRow		= lEndRow;
 		m_lScanLineSize	= lScanLineSize;
 		m_pProgress		= pProgress;
 		m_pMultiBitmap	= pMultiBitmap;
-		m_pBuffer		= pBuffer;
 		m_pBitmap		= pBitmap;
 		m_pHomBitmap	= pHomBitmap;
 	};
 
-	virtual bool	DoTask(HANDLE hEvent);
+	// Must only be called between two calls to Process
+	void	SetPart(LONG lStartRow, LONG lEndRow, void * pBuffer)
+	{
+		m_lStartRow		= lStartRow;
+		m_lEndRow		= lEndRow;
+		m_pBuffer		= pBuffer;
+	};
+
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
 	virtual bool	Process();
 };
 
 /* ------------------------------------------------------------------- */
 
-bool	CCombineTask::DoTask(HANDLE hEvent)
+bool	CCombineTask::DoTask(LONG lStart, LONG lEnd)
 {
 	ZFUNCTRACE_RUNTIME();
-	bool				bResult = true;
-
-	LONG				i;
-	bool				bEnd = false;
-	MSG					msg;
 	LONG				lNrBitmaps = m_pMultiBitmap->GetNrAddedBitmaps();
 	std::vector<void *>	vScanLines;
+	AvxOutputComposition avxOutputComposition(*m_pMultiBitmap, *m_pBitmap);
 
 	vScanLines.reserve(lNrBitmaps);
-	// Create a message queue and signal the event
-	PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-	SetEvent(hEvent);
-	try
+	for (LONG i = lStart;i<lEnd;i++)
 	{
-		AvxOutputComposition avxOutputComposition(*m_pMultiBitmap, *m_pBitmap);
+		vScanLines.resize(0);
 
-		while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+		for (LONG k = 0; k < lNrBitmaps; k++)
 		{
-			if (msg.message == WM_MT_PROCESS)
-			{
-				for (i = msg.wParam; i < msg.wParam + msg.lParam && !bEnd; i++)
-				{
-					void *				pScanLine;
-
-					vScanLines.resize(0);
-
-					for (LONG k = 0; k < lNrBitmaps && !bEnd; k++)
-					{
-						LONG			lOffset;
-
-						lOffset = k * (m_lEndRow - m_lStartRow + 1) * m_lScanLineSize
-							+ (i - m_lStartRow) * m_lScanLineSize;
-						pScanLine = (void*)(((BYTE*)m_pBuffer) + lOffset);
-
-						vScanLines.push_back(pScanLine);
-						if (m_pProgress)
-							bEnd = m_pProgress->IsCanceled();
-					};
-
-					if (!bEnd)
-					{
-						// First try AVX accelerated code, if not supported -> run conventional code.
-						if (avxOutputComposition.compose(i, vScanLines) != 0)
-						{
-							m_pMultiBitmap->SetScanLines(m_pBitmap, i, vScanLines);
-						}
-					}
-				};
-
-				SetEvent(hEvent);
-			}
-			else if (msg.message == WM_MT_STOP)
-				bEnd = true;
+			size_t			lOffset;
+
+			lOffset = static_cast<size_t>(k) * (m_lEndRow - m_lStartRow + 1) * m_lScanLineSize
+				+ static_cast<size_t>(i - m_lStartRow) * m_lScanLineSize;
+			vScanLines.push_back(((BYTE*)m_pBuffer) + lOffset);
 		};
-	}
-	catch (std::exception & e)
-	{
-		CString errorMessage(static_cast<LPCTSTR>(CA2CT(e.what())));
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
-		exit(1);
-	}
-#ifndef _CONSOLE
-	catch (CException & e)
-	{
-		e.ReportError();
-		e.Delete();
-		exit(1);
-	}
-#endif
-	catch (ZException & ze)
-	{
-		CString errorMessage;
-		CString name(CA2CT(ze.name()));
-		CString fileName(CA2CT(ze.locationAtIndex(0)->fileName()));
-		CString functionName(CA2CT(ze.locationAtIndex(0)->functionName()));
-		CString text(CA2CT(ze.text(0)));
-
-		errorMessage.Format(
-			_T("Exception %s thrown from %s Function: %s() Line: %lu\n\n%s"),
-			name,
-			fileName,
-			functionName,
-			ze.locationAtIndex(0)->lineNumber(),
-			text);
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
-		exit(1);
-	}
-	catch (...)
-	{
-		CString errorMessage(_T("Unknown exception caught"));
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
-		exit(1);
-	}
+
+		// First try AVX accelerated code, if not supported -> run conventional code.
+		if (avxOutputComposition.compose(i, vScanLines) != 0)
+		{
+			m_pMultiBitmap->SetScanLines(m_pBitmap, i, vScanLines);
+		}
+	};
+
 	return true;
 };
 
@@ -324,35 +469,11 @@ bool	CCombineTask::Process()
 {
 	ZFUNCTRACE_RUNTIME();
 	bool			bResult = true;
-	LONG			i = m_lStartRow;
-	LONG			lStep;
-	LONG			lRemaining;
 
 	if (m_pProgress)
 		m_pProgress->SetNrUsedProcessors(GetNrThreads());
-	lStep		= max(1L, (m_lEndRow-m_lStartRow+1)/50);
-	lRemaining	= m_lEndRow-m_lStartRow+1;
-
-	while (i<=m_lEndRow && bResult)
-	{
-		DWORD			dwThreadId;
-		LONG			lAdd = min(lStep, lRemaining);
-
-		dwThreadId = GetAvailableThreadId();
-
-		PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-		i			+= lAdd;
-		lRemaining	-= lAdd;
 
-		if (m_pProgress)
-		{
-			m_pProgress->Progress2(nullptr, i);
-			bResult = !m_pProgress->IsCanceled();
-		}
-	};
-
-	CloseAllThreads();
+	bResult = ProcessRange(m_lStartRow, m_lEndRow+1, m_pProgress, true);
 
 	if (m_pProgress)
 		m_pProgress->SetNrUsedProcessors();
@@ -457,11 +578,11 @@ void	CMultiBitmap::SmoothOut(CMemoryBitmap * pBitmap, CMemoryBitmap ** ppOutBitm
 bool CMultiBitmap::GetResult(CMemoryBitmap ** ppBitmap, CDSSProgress * pProgress)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope				ReportScope("GetResult");
 	bool						bResult = false;
 	LONG						lScanLineSize;
 	LONG						/*i, k, */l;
 	CSmartPtr<CMemoryBitmap>	pBitmap;
-	LONG						lBufferSize = 0;
 	void *						pBuffer = nullptr;
 
 	if (m_bInitDone && m_vFiles.size())
@@ -491,52 +612,39 @@ bool CMultiBitmap::GetResult(CMemoryBitmap ** ppBitmap, CDSSProgress * pProgress
 		lScanLineSize = (GetNrBytesPerChannel() * GetNrChannels() * m_lWidth);
 
 		//lScanLineSize = m_lWidth * GetNrChannels() * GetNrBytesPerChannel();
-		for (l = 0;l<m_vFiles.size() && bResult;l++)
-		{
-			// Read the full bitmap in memory
-			LONG					lFileSize;
-			FILE *					hFile;
+		// The next band is read while the current one is combined
+		std::unique_ptr<CBitmapPartReader>	pReader;
+		CCombineTask						CombineTask;
 
-			lFileSize = lScanLineSize * m_lNrAddedBitmaps*
-						(m_vFiles[l].m_lEndRow - m_vFiles[l].m_lStartRow+1);
+		if (!m_bInMemory)
+			pReader = std::make_unique<CBitmapPartReader>(m_vFiles, static_cast<size_t>(lScanLineSize) * m_lNrAddedBitmaps, m_bMappedFiles);
 
-			if (lFileSize > lBufferSize)
-			{
-				if (pBuffer)
-					free(pBuffer);
-				pBuffer = (void *)malloc(lFileSize);
-				lBufferSize = lFileSize;
-			};
-			hFile = _tfopen(m_vFiles[l].m_strFile, _T("rb"));
-			if (hFile)
-			{
-				bResult = (fread(pBuffer, 1, lFileSize, hFile) == lFileSize);
-				fclose(hFile);
-			}
+		if (bResult)
+			CombineTask.Init(lScanLineSize, pProgress, this, pBitmap);
+
+		for (l = 0;l<m_vFiles.size() && bResult;l++)
+		{
+			if (m_bInMemory)
+				pBuffer = m_vInMemoryBuffer.data();
 			else
-				bResult = false;
+				pBuffer = pReader->GetPart(l);
 
+			bResult = (pBuffer != nullptr);
+			if (bResult)
 			{
-				CCombineTask		CombineTask;
-
-				CombineTask.Init(m_vFiles[l].m_lStartRow, m_vFiles[l].m_lEndRow, lScanLineSize,
-								 pBuffer, pProgress, this, pBitmap);
-				CombineTask.StartThreads();
-				CombineTask.Process();
+				CombineTask.SetPart(m_vFiles[l].m_lStartRow, m_vFiles[l].m_lEndRow, pBuffer);
+				bResult = CombineTask.Process();
 			};
 
 			if (pProgress)
 			{
 				pProgress->End2();
-				bResult = !pProgress->IsCanceled();
+				bResult = bResult && !pProgress->IsCanceled();
 			}
 		};
 
-		if (pBuffer)
-		{
-			free(pBuffer);
-			pBuffer = nullptr;
-		};
+		pReader.reset();
+		pBuffer = nullptr;
 
 		if (bResult)
 		{
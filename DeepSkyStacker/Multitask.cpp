@@ -1,22 +1,34 @@
 #include <stdafx.h>
 
 #include "Multitask.h"
+#include "ThreadPool.h"
+#include "DSSProgress.h"
+#include <atomic>
+
+/* ------------------------------------------------------------------- */
+
+// The settings are read once and then kept up to date by the Set functions:
+// the thread pool checks them before each loop (-1 = not read yet)
+static std::atomic<long>	g_lMaxProcessors(-1);
+static std::atomic<int>		g_nReducedPriority(-1);
+static std::atomic<int>		g_nUseSimd(-1);
 
-#include <QSettings>
 /* ------------------------------------------------------------------- */
 
 LONG	CMultitask::GetNrProcessors(bool bReal)
 {
-	LONG				lResult = 1;
-	QSettings			settings;
-	SYSTEM_INFO			SysInfo;
-	
-	DWORD dwMaxProcessors = settings.value("MaxProcessors", (uint)0).toUInt();
+	static const LONG	lNrLogicalProcessors = GetNrLogicalProcessors();
+	LONG				lResult = lNrLogicalProcessors;
+	long				lMaxProcessors = g_lMaxProcessors;
+
+	if (lMaxProcessors < 0)
+	{
+		lMaxProcessors = static_cast<long>(GetEngineSetting("MaxProcessors", 0u));
+		g_lMaxProcessors = lMaxProcessors;
+	};
 
-	GetSystemInfo(&SysInfo);
-	lResult		= SysInfo.dwNumberOfProcessors;
-	if (!bReal && dwMaxProcessors)
-		lResult = min(static_cast<long>(dwMaxProcessors), lResult);
+	if (!bReal && lMaxProcessors)
+		lResult = min(static_cast<LONG>(lMaxProcessors), lResult);
 
 	return lResult;
 };
@@ -25,159 +37,89 @@ LONG	CMultitask::GetNrProcessors(bool bReal)
 
 void	CMultitask::SetUseAllProcessors(bool bUseAll)
 {
-	QSettings			settings;
-
-	if (bUseAll)
-		settings.setValue("MaxProcessors", (uint)0);
-	else
-		settings.setValue("MaxProcessors", (uint)1);
+	SetEngineSetting("MaxProcessors", bUseAll ? 0u : 1u);
+	g_lMaxProcessors = bUseAll ? 0 : 1;
 };
 
 /* ------------------------------------------------------------------- */
 
 bool	CMultitask::GetReducedThreadsPriority()
 {
-	QSettings			settings;
+	int					nReduced = g_nReducedPriority;
 
-	return settings.value("ReducedThreadPriority", true).toBool();
+	if (nReduced < 0)
+	{
+		nReduced = GetEngineSetting("ReducedThreadPriority", true) ? 1 : 0;
+		g_nReducedPriority = nReduced;
+	};
 
+	return nReduced != 0;
 };
 
 /* ------------------------------------------------------------------- */
 
 void	CMultitask::SetReducedThreadsPriority(bool bReduced)
 {
-	QSettings			settings;
-
-	settings.setValue("ReducedThreadPriority", bReduced);
-};
-
-bool CMultitask::GetUseSimd()
-{
-	return QSettings{}.value("UseSimd", true).toBool();
-}
-
-void CMultitask::SetUseSimd(const bool bUseSimd)
-{
-	QSettings{}.setValue("UseSimd", bUseSimd);
-}
-
-/* ------------------------------------------------------------------- */
-
-DWORD	WINAPI	StartThreadProc(LPVOID lpParameter)
-{
-	DWORD				dwResult = 0;
-	CMultitask *		pMultitask = reinterpret_cast<CMultitask *>(lpParameter);
-
-	if (pMultitask)
-		pMultitask->DoTask(pMultitask->GetThreadEvent(GetCurrentThreadId()));
-
-	return dwResult;
+	SetEngineSetting("ReducedThreadPriority", bReduced);
+	g_nReducedPriority = bReduced ? 1 : 0;
 };
 
 /* ------------------------------------------------------------------- */
 
-HANDLE	CMultitask::GetAvailableThread()
+bool CMultitask::GetUseSimd()
 {
-	HANDLE				hResult = nullptr;
-	DWORD				dwResult;
+	int nUseSimd = g_nUseSimd;
 
-	dwResult = WaitForMultipleObjects((DWORD)m_vEvents.size(), &(m_vEvents[0]), false, INFINITE);
-	if ((dwResult >= WAIT_OBJECT_0) && (dwResult < WAIT_OBJECT_0+(DWORD)m_vEvents.size()))
+	if (nUseSimd < 0)
 	{
-		// An event was triggered
-		LONG			lIndice = dwResult-WAIT_OBJECT_0;
+		nUseSimd = GetEngineSetting("UseSimd", true) ? 1 : 0;
+		g_nUseSimd = nUseSimd;
+	}
 
-		ResetEvent(m_vEvents[lIndice]);
-		hResult = m_vThreads[lIndice];
-	};
-
-	return hResult;
-};
-/* ------------------------------------------------------------------- */
+	return nUseSimd != 0;
+}
 
-DWORD	CMultitask::GetAvailableThreadId()
+void CMultitask::SetUseSimd(const bool bUseSimd)
 {
-	DWORD				hResult = 0;
-	DWORD				dwResult;
-
-	dwResult = WaitForMultipleObjects((DWORD)m_vEvents.size(), &(m_vEvents[0]), false, INFINITE);
-	if ((dwResult >= WAIT_OBJECT_0) && (dwResult < WAIT_OBJECT_0+m_vEvents.size()))
-	{
-		// An event was triggered
-		LONG			lIndice = dwResult-WAIT_OBJECT_0;
-
-		ResetEvent(m_vEvents[lIndice]);
-		hResult = m_vThreadIds[lIndice];
-	};
-
-	return hResult;
-};
+	SetEngineSetting("UseSimd", bUseSimd);
+	g_nUseSimd = bUseSimd ? 1 : 0;
+}
 
 /* ------------------------------------------------------------------- */
 
-void	CMultitask::StartThreads(LONG lNrThreads)
+LONG	CMultitask::GetNrThreads()
 {
-	LONG				i;
-
-	if (!lNrThreads)
-		lNrThreads = GetNrProcessors();
-
-	for (i = 0;i<lNrThreads;i++)
-	{
-		// Create a thread for each task
-		DWORD			dwThreadID;
-		HANDLE			hEvent;
-		HANDLE			hThread;
-
-		hEvent	= CreateEvent(nullptr, true, false, nullptr);
-		if (hEvent)
-		{
-			m_vEvents.push_back(hEvent);
-			hThread = CreateThread(nullptr, 0, StartThreadProc, (LPVOID)this, CREATE_SUSPENDED, &dwThreadID);
-			if (hThread)
-			{
-				m_vThreads.push_back(hThread);
-				m_vThreadIds.push_back(dwThreadID);
-			};
-		};
-	};
-
-	if (GetReducedThreadsPriority())
-	{
-		for (i = 0;i<lNrThreads;i++)
-			SetThreadPriority(m_vThreads[i], THREAD_PRIORITY_BELOW_NORMAL);
-	};
-
-	for (i = 0;i<lNrThreads;i++)
-		ResumeThread(m_vThreads[i]);
+	return CThreadPool::GetInstance().GetNrThreads();
 };
 
 /* ------------------------------------------------------------------- */
 
-void	CMultitask::CloseAllThreads()
+bool	CMultitask::ProcessRange(LONG lStart, LONG lEnd, CDSSProgress * pProgress, bool bCancelable, LONG lChunkSize)
 {
-	if (m_vThreads.size())
-	{
-		WaitForMultipleObjects((DWORD)m_vEvents.size(), &(m_vEvents[0]), true, INFINITE);
+	ZFUNCTRACE_RUNTIME();
+	std::atomic<bool>	bFailed(false);
 
-		for (LONG i = 0;i<m_vThreads.size();i++)
+	const bool			bResult = CThreadPool::GetInstance().ParallelFor(lStart, lEnd, lChunkSize,
+		[this, &bFailed](long lChunkStart, long lChunkEnd)
 		{
-			PostThreadMessage(m_vThreadIds[i], WM_MT_STOP, 0, 0);
-		};
+			if (!DoTask(lChunkStart, lChunkEnd))
+				bFailed = true;
+		},
+		[pProgress, lStart, bCancelable](long lNrProcessed) -> bool
+		{
+			bool			bResult = true;
 
-		WaitForMultipleObjects((DWORD)m_vThreads.size(), &(m_vThreads[0]), true, INFINITE);
+			if (pProgress)
+			{
+				pProgress->Progress2(nullptr, lStart + lNrProcessed);
+				if (bCancelable)
+					bResult = !pProgress->IsCanceled();
+			};
 
-		for (LONG i = 0;i<m_vThreads.size();i++)
-		{
-			CloseHandle(m_vThreads[i]);
-			CloseHandle(m_vEvents[i]);
-		};
+			return bResult;
+		});
 
-		m_vThreads.clear();
-		m_vThreadIds.clear();
-		m_vEvents.clear();
-	};
+	return bResult && !bFailed;
 };
 
 /* ------------------------------------------------------------------- */
@@ -1,22 +1,22 @@
 #ifndef __MULTITASK_H__
 #define __MULTITASK_H__
 
-const DWORD				WM_MT_PROCESS	= WM_USER+1;
-const DWORD				WM_MT_STOP		= WM_USER+2;
+#include "DSSPlatform.h"
+
+class CDSSProgress;
 
 class CMultitask
 {
 protected :
-	CComAutoCriticalSection	m_CriticalSection;
-	std::vector<HANDLE>		m_vThreads;
-	std::vector<DWORD>		m_vThreadIds;
-	std::vector<HANDLE>		m_vEvents;
+	CDSSCriticalSection		m_CriticalSection;
 
 protected :
-	LONG	GetNrThreads()
-	{
-		return (LONG)m_vThreads.size();
-	};
+	LONG	GetNrThreads();
+
+	// Calls DoTask on chunks of [lStart, lEnd[ using the thread pool.
+	// The progress (Progress2) is updated from the calling thread.
+	// Returns false if the loop was canceled or if a DoTask call failed.
+	bool	ProcessRange(LONG lStart, LONG lEnd, CDSSProgress * pProgress, bool bCancelable = false, LONG lChunkSize = 0);
 
 public :
 	CMultitask()
@@ -25,7 +25,6 @@ public :
 
 	virtual ~CMultitask()
 	{
-		CloseAllThreads();
 	};
 
 	static LONG	GetNrProcessors(bool bReal = false);
@@ -35,25 +34,7 @@ public :
 	static bool GetUseSimd();
 	static void SetUseSimd(const bool bUseSimd);
 
-	HANDLE	GetThreadEvent(DWORD dwThreadId)
-	{
-		HANDLE			hResult = nullptr;
-
-		for (size_t i = 0;(i<m_vThreadIds.size()) && !hResult;i++)
-		{
-			if (dwThreadId == m_vThreadIds[i])
-				hResult = m_vEvents[i];
-		};
-
-		return hResult;
-	};
-
-	void	CloseAllThreads();
-	void	StartThreads(LONG lNrThreads = 0);
-	HANDLE	GetAvailableThread();
-	DWORD	GetAvailableThreadId();
-
-	virtual bool	DoTask(HANDLE hEvent)   = 0;
+	virtual bool	DoTask(LONG lStart, LONG lEnd) = 0;
 	virtual bool	Process() = 0;
 };
 
@@ -636,13 +636,13 @@ void CPictureListCtrl::AddFileToList(LPCTSTR szFile, DWORD dwGroupID, GUID const
 			{
 				CLightFrameInfo			bmpInfo;
 
-				bmpInfo.SetBitmap(szFile, false);
+				bmpInfo.SetBitmap(szFile, false, false, false);
 				if (bmpInfo.m_bInfoOk)
 				{
 					lb.m_bRegistered = true;
 					lb.m_fOverallQuality = bmpInfo.m_fOverallQuality;
 					lb.m_fFWHM			 = bmpInfo.m_fFWHM;
-					lb.m_lNrStars		 = (LONG)bmpInfo.m_vStars.size();
+					lb.m_lNrStars		 = (LONG)bmpInfo.GetNrStars();
 					lb.m_bComet			 = bmpInfo.m_bComet;
 					lb.m_SkyBackground	 = bmpInfo.m_SkyBackground;
 					lb.m_bUseAsStarting	 = (PictureType == PICTURETYPE_REFLIGHTFRAME);
@@ -1610,7 +1610,7 @@ void CPictureListCtrl::UpdateItemScores(LPCTSTR szFileName)
 		{
 			CLightFrameInfo		bmpInfo;
 
-			bmpInfo.SetBitmap(m_vFiles[lIndice].m_strFileName, false, false);
+			bmpInfo.SetBitmap(m_vFiles[lIndice].m_strFileName, false, false, false);
 
 			// Update list info
 			if (bmpInfo.m_bInfoOk)
@@ -1618,7 +1618,7 @@ void CPictureListCtrl::UpdateItemScores(LPCTSTR szFileName)
 				m_vFiles[lIndice].m_bRegistered = true;
 				m_vFiles[lIndice].m_fOverallQuality	= bmpInfo.m_fOverallQuality;
 				m_vFiles[lIndice].m_fFWHM			= bmpInfo.m_fFWHM;
-				m_vFiles[lIndice].m_lNrStars		= (LONG)bmpInfo.m_vStars.size();
+				m_vFiles[lIndice].m_lNrStars		= (LONG)bmpInfo.GetNrStars();
 				m_vFiles[lIndice].m_bComet			= bmpInfo.m_bComet;
 				m_vFiles[lIndice].m_SkyBackground	= bmpInfo.m_SkyBackground;
 			}
@@ -1644,7 +1644,7 @@ void CPictureListCtrl::UpdateCheckedItemScores()
 		{
 			CLightFrameInfo		bmpInfo;
 
-			bmpInfo.SetBitmap(m_vFiles[i].m_strFileName, false, false);
+			bmpInfo.SetBitmap(m_vFiles[i].m_strFileName, false, false, false);
 
 			// Update list info
 			if (bmpInfo.m_bInfoOk)
@@ -1652,7 +1652,7 @@ void CPictureListCtrl::UpdateCheckedItemScores()
 				m_vFiles[i].m_bRegistered = true;
 				m_vFiles[i].m_fOverallQuality	= bmpInfo.m_fOverallQuality;
 				m_vFiles[i].m_fFWHM				= bmpInfo.m_fFWHM;
-				m_vFiles[i].m_lNrStars			= (LONG)bmpInfo.m_vStars.size();
+				m_vFiles[i].m_lNrStars			= (LONG)bmpInfo.GetNrStars();
 				m_vFiles[i].m_bComet			= bmpInfo.m_bComet;
 				m_vFiles[i].m_SkyBackground		= bmpInfo.m_SkyBackground;
 			}
@@ -100,12 +100,125 @@ public :
 
 		return ppResult;
 	};
+
+	// Finds the light frame point that Transform sends on ptOut.
+	// The transformation is a polynomial (bilinear, bisquared or bicubic)
+	// so it is solved with Newton iterations starting from ptIn
+	// (the solution of a neighbour output pixel is a good start).
+	bool	InverseTransform(const CPointExt & ptOut, CPointExt & ptIn) const
+	{
+		const double	fEpsilon = 1e-4;
+		const LONG		lMaxIterations = 20;
+		bool			bResult = false;
+
+		for (LONG i = 0;i<lMaxIterations && !bResult;i++)
+		{
+			CPointExt	pt   = Transform(ptIn);
+			CPointExt	ptDX = Transform(CPointExt(ptIn.X+1.0, ptIn.Y));
+			CPointExt	ptDY = Transform(CPointExt(ptIn.X, ptIn.Y+1.0));
+
+			// Jacobian computed with finite differences
+			double		fJ11 = ptDX.X - pt.X,
+						fJ12 = ptDY.X - pt.X,
+						fJ21 = ptDX.Y - pt.Y,
+						fJ22 = ptDY.Y - pt.Y;
+			double		fDet = fJ11 * fJ22 - fJ12 * fJ21;
+
+			if (fabs(fDet) < 1e-12)
+				break;
+
+			double		fErrorX = ptOut.X - pt.X,
+						fErrorY = ptOut.Y - pt.Y;
+			double		fDX = (fJ22 * fErrorX - fJ12 * fErrorY) / fDet,
+						fDY = (fJ11 * fErrorY - fJ21 * fErrorX) / fDet;
+
+			ptIn.X += fDX;
+			ptIn.Y += fDY;
+			bResult = (fabs(fDX) < fEpsilon) && (fabs(fDY) < fEpsilon);
+		};
+
+		return bResult;
+	};
 };
 
 typedef std::vector<CPixelTransform>		PIXELTRANSFORMVECTOR;
 
 /* ------------------------------------------------------------------- */
 
+// Kernels used when the output pixels are sampled from the light frame
+// (see RESAMPLINGMODE)
+
+inline LONG GetResamplingRadius(RESAMPLINGMODE Mode)
+{
+	switch (Mode)
+	{
+	case RSM_BICUBIC :
+		return 2;
+	case RSM_LANCZOS3 :
+		return 3;
+	};
+	return 1;
+};
+
+inline double ResamplingKernel(RESAMPLINGMODE Mode, double fX)
+{
+	double			fResult = 0;
+
+	fX = fabs(fX);
+	switch (Mode)
+	{
+	case RSM_BICUBIC :
+		// Keys cubic convolution (a = -0.5)
+		if (fX < 1.0)
+			fResult = (1.5 * fX - 2.5) * fX * fX + 1.0;
+		else if (fX < 2.0)
+			fResult = ((-0.5 * fX + 2.5) * fX - 4.0) * fX + 2.0;
+		break;
+	case RSM_LANCZOS3 :
+		if (fX < 1e-8)
+			fResult = 1.0;
+		else if (fX < 3.0)
+		{
+			const double	fPIX = M_PI * fX;
+
+			fResult = 3.0 * sin(fPIX) * sin(fPIX / 3.0) / (fPIX * fPIX);
+		};
+		break;
+	default :
+		if (fX < 1.0)
+			fResult = 1.0 - fX;
+		break;
+	};
+
+	return fResult;
+};
+
+// Weights of the 2*radius taps starting at lFirst = floor(fX) - radius + 1
+// The weights are normalized so that a flat area stays flat.
+inline void ComputeResamplingWeights(RESAMPLINGMODE Mode, double fX, LONG & lFirst, float * pWeights)
+{
+	const LONG		lRadius = GetResamplingRadius(Mode);
+	const LONG		lBase = static_cast<LONG>(floor(fX));
+	double			fSum = 0;
+
+	lFirst = lBase - lRadius + 1;
+	for (LONG i = 0;i<2*lRadius;i++)
+	{
+		const double	fWeight = ResamplingKernel(Mode, fX - (lFirst + i));
+
+		pWeights[i] = static_cast<float>(fWeight);
+		fSum += fWeight;
+	};
+
+	if (fSum != 0)
+	{
+		for (LONG i = 0;i<2*lRadius;i++)
+			pWeights[i] = static_cast<float>(pWeights[i] / fSum);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
 class CPixelDispatch
 {
 public :
@@ -9,15 +9,20 @@
 #include <iostream>
 #include <locale>
 #include <map>
+#include <numeric>
 #include <stdexcept>
 #include <utility>
+#include <memory>
+#include <mutex>
 #include <float.h>
 #include "Multitask.h"
+#include "DSSPlatform.h"
 #include "Workspace.h"
 #include "zexcept.h"
 #include "ztrace.h"
 
 #include "libraw/libraw.h"
+#include <omp.h>
 
 LARGE_INTEGER start;
 void timerstart(void) { QueryPerformanceCounter(&start); }
@@ -65,7 +70,9 @@ public :
 
 typedef std::list<CRAWSettings>		RAWSETTINGSSTACK;
 
-RAWSETTINGSSTACK		g_RawSettingsStack;
+// Per thread: the masters may be loaded (with the raw Bayer override) while
+// light frames are loaded on other threads
+thread_local RAWSETTINGSSTACK		g_RawSettingsStack;
 
 /* ------------------------------------------------------------------- */
 
@@ -529,9 +536,6 @@ private:
 
 #define Thread   __declspec( thread )
 
-// Thread DSSLibRaw	rawProcessor;
-DSSLibRaw rawProcessor;
-
 /* ------------------------------------------------------------------- */
 
 //static CString			g_strInputFileName;
@@ -542,6 +546,9 @@ static Thread CDSSProgress *	g_Progress;
 class CRawDecod
 {
 private :
+	// Each object has its own LibRaw processor so that the pictures can be
+	// probed and loaded by several threads at the same time
+	std::unique_ptr<DSSLibRaw>	m_pRawProcessor;
 	CString			m_strFileName;
 	CString			m_strModel;
 	CString			m_strMake;
@@ -555,27 +562,28 @@ private :
 	SYSTEMTIME		m_DateTime;
     bool            m_isRawFile;
 
-#define P1		rawProcessor.imgdata.idata
-#define P2		rawProcessor.imgdata.other
+#define P1		m_pRawProcessor->imgdata.idata
+#define P2		m_pRawProcessor->imgdata.other
 
-#define mnLens rawProcessor.imgdata.lens.makernotes
-#define exifLens rawProcessor.imgdata.lens
-#define ShootingInfo rawProcessor.imgdata.shootinginfo
+#define mnLens m_pRawProcessor->imgdata.lens.makernotes
+#define exifLens m_pRawProcessor->imgdata.lens
+#define ShootingInfo m_pRawProcessor->imgdata.shootinginfo
 
-#define S		rawProcessor.imgdata.sizes
-#define O		rawProcessor.imgdata.params
-#define C		rawProcessor.imgdata.color
-#define T		rawProcessor.imgdata.thumbnail
+#define S		m_pRawProcessor->imgdata.sizes
+#define O		m_pRawProcessor->imgdata.params
+#define C		m_pRawProcessor->imgdata.color
+#define T		m_pRawProcessor->imgdata.thumbnail
 
-#define Canon	rawProcessor.imgdata.makernotes.canon
-#define Fuji	rawProcessor.imgdata.makernotes.fuji
-#define Oly		rawProcessor.imgdata.makernotes.olympus
+#define Canon	m_pRawProcessor->imgdata.makernotes.canon
+#define Fuji	m_pRawProcessor->imgdata.makernotes.fuji
+#define Oly		m_pRawProcessor->imgdata.makernotes.olympus
 
-#define RawData	rawProcessor.imgdata.rawdata
-#define IOParams	rawProcessor.imgdata.rawdata.ioparams
+#define RawData	m_pRawProcessor->imgdata.rawdata
+#define IOParams	m_pRawProcessor->imgdata.rawdata.ioparams
 
 public :
     CRawDecod(LPCTSTR szFile) noexcept :
+		m_pRawProcessor(std::make_unique<DSSLibRaw>()),
 		m_strFileName(szFile)
     {
         ZFUNCTRACE_RUNTIME();
@@ -588,7 +596,7 @@ public :
         m_lHeight = 0;
         m_lWidth = 0;
 
-        m_isRawFile = rawProcessor.open_file(szFile) == LIBRAW_SUCCESS;
+        m_isRawFile = m_pRawProcessor->open_file(szFile) == LIBRAW_SUCCESS;
 
         if (m_isRawFile)
         {
@@ -647,7 +655,7 @@ public :
 	virtual ~CRawDecod()
 	{
 		ZFUNCTRACE_RUNTIME();
-		rawProcessor.recycle();
+		m_pRawProcessor->recycle();
 	};
 
 	bool	IsRawFile() const;
@@ -756,8 +764,14 @@ void CRawDecod::checkCameraSupport(const CString& strModel)
 	CStringA strModelA(strModel);
 	const char * camera = static_cast<LPCSTR>(strModelA);
 
+	static std::mutex camerasMutex;
 	static std::set<std::string> checkedCameras;
 
+	//
+	// The pictures can be loaded by several threads
+	//
+	std::unique_lock<std::mutex> lock(camerasMutex);
+
 	//
 	// If we've already checked this camera type, then just bail out so
 	// complaints about unsupported cameras are only issued once.
@@ -773,8 +787,8 @@ void CRawDecod::checkCameraSupport(const CString& strModel)
 
 	if (0 == supportedCameras.size())
 	{
-		const char **cameraList = rawProcessor.cameraList();
-		const size_t count = rawProcessor.cameraCount();
+		const char **cameraList = m_pRawProcessor->cameraList();
+		const size_t count = m_pRawProcessor->cameraCount();
 		supportedCameras.reserve(count);
 
 		//
@@ -821,6 +835,7 @@ void CRawDecod::checkCameraSupport(const CString& strModel)
 	// Now we know whether this camera is supported or not, remember we've seen it before
 	//
 	checkedCameras.insert(camera);
+	lock.unlock();
 
 	//
 	// If the camera isn't supported complain, but only once
@@ -829,11 +844,7 @@ void CRawDecod::checkCameraSupport(const CString& strModel)
 	{
 		CString errorMessage;
 		errorMessage.Format(IDS_CAMERA_NOT_SUPPORTED, strModel);
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONWARNING);
-#endif
+		ReportEngineMessage(errorMessage, true);
 	}
 
 	return;
@@ -940,63 +951,47 @@ bool CRawDecod::LoadRawFile(CMemoryBitmap * pBitmap, CDSSProgress * pProgress, b
 		g_Progress = pProgress;
 
 		ZTRACE_RUNTIME("Calling LibRaw::unpack()");
-		if ((ret = rawProcessor.unpack()) != LIBRAW_SUCCESS)
+		if ((ret = m_pRawProcessor->unpack()) != LIBRAW_SUCCESS)
 		{
 			bResult = false;
 			ZTRACE_RUNTIME("Cannot unpack %s: %s", m_strFileName, libraw_strerror(ret));
 		}
 		if (!bResult) break;
 
-		//
-		// Create the class that populates the bitmap
-		//
-		pFiller = new BitMapFiller(pBitmap, pProgress);
-		pFiller->SetWhiteBalance(fRedScale, fGreenScale, fBlueScale);
-		// Get the Colour Filter Array type and set into the bitmap filler
+		// Get the Colour Filter Array type
 		m_CFAType = GetCurrentCFAType();
-		pFiller->SetCFAType(m_CFAType);
 
 #define RAW(row,col) \
 	raw_image[(row)*S.width+(col)]
 
-		//
-		// Get our endian-ness so we can swap bytes if needed (always on Windows).
-		//
-		const bool littleEndian = htons(0x55aa) != 0x55aa;
-
 		unsigned short *raw_image = nullptr;
-		void * buffer = nullptr;		// Used for debugging only (memory window)
 
 		if (!m_bColorRAW)
 		{
 			ZTRACE_RUNTIME("Processing Bayer pattern raw image data");
 			//
-			// The initial openmp changes were made by David Partridge, but it was
-			// Vitali Pelenjow who made it work without the critical sections
-			// killing the performance.
-			//
-			// Set up a temporary image array of unsigned short that will be:
+			// The black level, the linear stretch and the white balance are
+			// applied in a single pass from the image portion of
+			// RawData.raw_image (excluding the frame) straight to the bitmap.
 			//
-			// 1) Filled in from the Fujitsu Super-CCD image array in
-			//    Rawdata.raw_image, or
+			// Fujitsu Super-CCD images are first converted to a regular raw
+			// image in a temporary array of unsigned short.
 			//
-			// 2) will be copied from the image portion of Rawdata.raw_image
-			//    excluding the frame (Top margin, Left Margin).
-			//
-			raw_image =
-				(unsigned short *)calloc(static_cast<size_t>(S.height)*static_cast<size_t>(S.width), sizeof(unsigned short));
-			if (nullptr == raw_image)
-			{
-				ZOutOfMemory e("Could not allocate storage for RAW image");
-				ZTHROW(e);
-			}
-
-			const int fuji_width = rawProcessor.is_fuji_rotated();
-			const unsigned fuji_layout = rawProcessor.get_fuji_layout();
-			buffer = raw_image;		// only for memory window debugging
+			const int fuji_width = m_pRawProcessor->is_fuji_rotated();
+			const unsigned fuji_layout = m_pRawProcessor->get_fuji_layout();
+			const unsigned short *	pRawImage = RawData.raw_image + static_cast<size_t>(S.top_margin) * (S.raw_pitch / 2) + S.left_margin;
+			size_t					lRawPitch = S.raw_pitch / 2;
 
 			if (fuji_width)   // Are we processing a Fuji Super-CCD image?
 			{
+				raw_image =
+					(unsigned short *)calloc(static_cast<size_t>(S.height)*static_cast<size_t>(S.width), sizeof(unsigned short));
+				if (nullptr == raw_image)
+				{
+					ZOutOfMemory e("Could not allocate storage for RAW image");
+					ZTHROW(e);
+				}
+
 				ZTRACE_RUNTIME("Converting Fujitsu Super-CCD image to regular raw image");
 #if defined(_OPENMP)
 #pragma omp parallel for default(none)
@@ -1022,47 +1017,10 @@ bool CRawDecod::LoadRawFile(CMemoryBitmap * pBitmap, CDSSProgress * pProgress, b
 							= RawData.raw_image[(row + S.top_margin)*S.raw_pitch / 2 + (col + S.left_margin)];
 					}
 				}
-			}
-			else
-			{
-				ZTRACE_RUNTIME("Extracting real image data (excluding the frame) from RawData.raw_image");
-
-				//
-				// This is a regular RAW file so no Fuji Super-CCD stuff
-				//
-				// Just copy the "real image" portion of the data excluding
-				// the frame
-				//
-				buffer = raw_image;
-#if defined(_OPENMP)
-#pragma omp parallel for default(none)
-#endif
-				for (int row = 0; row < S.height; row++)
-				{
-					for (int col = 0; col < S.width; col++)
-					{
-						RAW(row, col)
-							= RawData.raw_image[(row + S.top_margin)*S.raw_pitch / 2 + (col + S.left_margin)];
-					}
-				}
-			}
 
-			//
-			// Now process the data that raw_image points to which is either
-			//
-			// 1) The output of post processing the Fuji Super-CCD raw,
-			//    stored in the USHORT array hung off raw_image, or
-			//
-			// 2) Normal common or garden raw Bayer matrix data that's been
-			//    copied from RawData.raw_image to raw_image (less the frame)
-			//
-			// Either way we should now be processing a regular greyscale 16-bit
-			// pixel array which has an associated Bayer Matrix
-			//
-			pFiller->setGrey(true);
-			pFiller->setWidth(S.width);
-			pFiller->setHeight(S.height);
-			pFiller->setMaxColors((1 << 16) - 1);
+				pRawImage = raw_image;
+				lRawPitch = S.width;
+			}
 
 			// Report User Black Point over-ride
 			if (0 == O.user_black)
@@ -1076,7 +1034,7 @@ bool CRawDecod::LoadRawFile(CMemoryBitmap * pBitmap, CDSSProgress * pProgress, b
 				C.cblack[0], C.cblack[1], C.cblack[2], C.cblack[3],
 				C.cblack[4], C.cblack[5],
 				C.cblack[6], C.cblack[7], C.cblack[8], C.cblack[9]);
-			rawProcessor.adjust_bl();
+			m_pRawProcessor->adjust_bl();
 
 			//
 			// This code is based on code from LibRaw Version 19.2, specifically method:
@@ -1089,9 +1047,8 @@ bool CRawDecod::LoadRawFile(CMemoryBitmap * pBitmap, CDSSProgress * pProgress, b
 			// been set (it will be zero) then use that, otherwise just use the black
 			// level for the camera.
 			//
-			// Note that this is only done on real image data, not the frame
-			//
-			// While doing so collect the largest value in the image data.
+			// Note that this is only done on real image data, not the frame.
+			// The black levels are saved here and subtracted during the single pass.
 			//
 			ZTRACE_RUNTIME("Subtracting black level of C.black = %d from raw_image data.", C.black);
 			ZTRACE_RUNTIME("First 10 C.cblack elements\n  %d, %d, %d, %d\n  %d, %d\n  %d, %d, %d, %d",
@@ -1099,90 +1056,27 @@ bool CRawDecod::LoadRawFile(CMemoryBitmap * pBitmap, CDSSProgress * pProgress, b
 				C.cblack[4], C.cblack[5],
 				C.cblack[6], C.cblack[7], C.cblack[8], C.cblack[9]);
 
-			if (!rawProcessor.is_phaseone_compressed() &&
-				(C.cblack[0] || C.cblack[1] || C.cblack[2] || C.cblack[3] || (C.cblack[4] && C.cblack[5])))
+			const bool			bSubtractBlack = !m_pRawProcessor->is_phaseone_compressed() &&
+				(C.cblack[0] || C.cblack[1] || C.cblack[2] || C.cblack[3] || (C.cblack[4] && C.cblack[5]));
+			int					cblk[4] = { 0, 0, 0, 0 };
+			int					nPatternRows = 0;
+			int					nPatternCols = 0;
+			std::vector<int>	vPattern;
+
+			if (bSubtractBlack)
 			{
-				int cblk[4], i;
-				for (i = 0; i < 4; i++)
+				for (int i = 0; i < 4; i++)
 					cblk[i] = C.cblack[i];
-
-				const int size = S.height * S.width;
-				int dmax = 0;	// Maximum value of pixels in entire image.
-				int lmax = 0;	// Local (or Loop) maximum value found in the 'for' loops below. For OMP.
 				if (C.cblack[4] && C.cblack[5])
 				{
-#if defined(_OPENMP)
-#pragma omp parallel default(none) shared(dmax) firstprivate(lmax)
-					{
-#pragma omp for
-#endif
-						for (i = 0; i < size; i++)
-						{
-							int val = raw_image[i];
-							val -= C.cblack[6 + i / S.width % C.cblack[4] * C.cblack[5] + i % S.width % C.cblack[5]];
-							val -= cblk[i & 3];
-							raw_image[i] = max(0, min(val, 65535));
-							lmax = val > lmax ? val : lmax;
-						}
-#if defined(_OPENMP)
-#pragma omp critical
-#endif
-						dmax = lmax > dmax ? lmax : dmax; // For non-OMP case this is equal to dmax = lmax.
-#if defined(_OPENMP)
-					}
-#endif
-				}
-				else
-				{
-#if defined(_OPENMP)
-#pragma omp parallel default(none) shared(dmax) firstprivate(lmax)
-					{
-#pragma omp for
-#endif
-						for (i = 0; i < size; i++)
-						{
-							int val = raw_image[i];
-							val -= cblk[i & 3];
-							raw_image[i] = max(0, min(val, 65535));
-							lmax = val > lmax ? val : lmax;
-						}
-#if defined(_OPENMP)
-#pragma omp critical
-#endif
-						dmax = lmax > dmax ? lmax : dmax; // For non-OMP case this is equal to dmax = lmax.
-#if defined(_OPENMP)
-					}
-#endif
-				}
-				C.data_maximum = dmax & 0xffff;
+					nPatternRows = C.cblack[4];
+					nPatternCols = C.cblack[5];
+					vPattern.assign(C.cblack + 6, C.cblack + 6 + nPatternRows * nPatternCols);
+				};
 				C.maximum -= C.black;
 				memset(&C.cblack, 0, sizeof(C.cblack)); // Yeah, we used cblack[6+] values too!
 				C.black = 0;
-			}
-			else
-			{
-				// Nothing to Do, maximum is already calculated, black level is 0, so no change
-				// only calculate channel maximum;
-				int dmax = 0;	// Maximum value of pixels in entire image.
-				int lmax = 0;	// Local (or Loop) maximum value found in the 'for' loop below. For OMP.
-#if defined(_OPENMP)
-#pragma omp parallel default(none) shared(dmax) firstprivate(lmax)
-				{
-#pragma omp for
-#endif
-					for (int i = 0; i < S.height * S.width; i++)
-						if (lmax < raw_image[i])
-							lmax = raw_image[i];
-#if defined(_OPENMP)
-#pragma omp critical
-#endif
-					dmax = lmax > dmax ? lmax : dmax; // For non-OMP case this is equal to dmax = lmax.
-#if defined(_OPENMP)
-				}
-#endif
-
-				C.data_maximum = dmax;
-			}
+			};
 
 			//
 			// The image data needs to be scaled to the "white balance co-efficients"
@@ -1229,48 +1123,116 @@ bool CRawDecod::LoadRawFile(CMemoryBitmap * pBitmap, CDSSProgress * pProgress, b
 
 			for (c = 0; c < 4; c++)	scale_mul[c] = (pre_mul[c] /= dmin) * (65535.0 / C.maximum);
 
-			ZTRACE_RUNTIME("Maximum value pixel has value %d", C.data_maximum);
 			ZTRACE_RUNTIME("Saturation level is %d", C.maximum);
 			ZTRACE_RUNTIME("Applying linear stretch to raw data.  Scale values %f, %f, %f, %f",
 				scale_mul[0], scale_mul[1], scale_mul[2], scale_mul[3]);
 
-#if defined(_OPENMP)
-#pragma omp parallel for default(none) schedule(dynamic, 10) // No OPENMP: 240ms, with OPENMP: 92ms, schedule static: 78ms, schedule dynamic: 35ms
-#endif
-			for (int row = 0; row < S.height; row++)
+			//
+			// The factors of a pixel only depend on its row and on its column
+			// modulo a period: 16 for the colour (Fuji Super-CCD), and a multiple
+			// of the width of the black level pattern.
+			// They are computed once per row so that the inner loop can be
+			// vectorised.
+			//
+			const int			nPeriod = nPatternCols ? std::lcm(16, nPatternCols) : 16;
+			const int			nWidth = S.width;
+			const int			nHeight = S.height;
+			C16BitGrayBitmap *	pGrayBitmap = dynamic_cast<C16BitGrayBitmap *>(pBitmap);
+			WORD *				pPlanes[3] = { nullptr, nullptr, nullptr };
+			double				fMultiplier = 1.0;
+			const int			nrProcessors = CMultitask::GetNrProcessors(false);
+			int					nDataMax = 0;	// Maximum value of pixels in entire image.
+			int					nLocalMax = 0;	// Local (or Loop) maximum value found in the 'for' loop below. For OMP.
+
+			// The 16 bit values are written straight in the plane of the bitmap
+			// (its multiplier is 256), else set pixel by pixel
+			const bool			bDirect = pGrayBitmap && GetBitmapPlanes(pBitmap, pPlanes, fMultiplier) &&
+				(pGrayBitmap->RealWidth() == nWidth) && (pGrayBitmap->RealHeight() == nHeight);
+
+			if (pGrayBitmap)
+				pGrayBitmap->SetCFAType(m_CFAType);
+			if (pProgress)
+				pProgress->Start2(nullptr, nHeight);
+
+#pragma omp parallel shared(nDataMax) firstprivate(nLocalMax) if(nrProcessors - 1)
 			{
-				for (int col = 0; col < S.width; col++)
+				std::vector<int>	vBlack(nPeriod);
+				std::vector<float>	vScale(nPeriod);
+				std::vector<double>	vBalance(nPeriod);
+				std::vector<double>	vMaximum(nPeriod);
+				std::vector<WORD>	vRow(bDirect ? 0 : nWidth);
+
+#pragma omp for schedule(dynamic, 10)
+				for (int row = 0; row < nHeight; row++)
 				{
-					// What colour will this pixel become
-					const int colour = rawProcessor.COLOR(row, col);
+					const unsigned short *	pSource = pRawImage + row * lRawPitch;
+					WORD *					pTarget = bDirect ? pPlanes[0] + static_cast<size_t>(row) * nWidth : vRow.data();
 
-					const float val = scale_mul[colour] *
-						(float)(RAW(row, col));
-					RAW(row, col) = max(0, min(int(val), 65535));
-				}
-			}
+					for (int k = 0; k < nPeriod; k++)
+					{
+						vBlack[k] = 0;
+						if (bSubtractBlack)
+						{
+							vBlack[k] = cblk[(row * nWidth + k) & 3];
+							if (nPatternCols)
+								vBlack[k] += vPattern[row % nPatternRows * nPatternCols + k % nPatternCols];
+						};
 
-			// Convert raw data to big-endian
-			if (littleEndian)
-#if defined(_OPENMP)
-#pragma omp parallel for default(none) schedule(dynamic, 1000)
-				for (int i = 0; i < S.height * S.width; i++)
-				{
-					raw_image[i] = _byteswap_ushort(raw_image[i]);
-				}
-#else
-				_swab(
-					(char*)(raw_image),
-					(char*)(raw_image),
-					S.height*S.width*sizeof(unsigned short));		// Use number of rows times row width in BYTES!!
-#endif
+						// What colour will this pixel become
+						vScale[k] = scale_mul[m_pRawProcessor->COLOR(row, k)];
 
-			for (int row = 0; row < S.height; row++)
-			{
-				buffer = &RAW(row, 0);
-				// Write raw pixel data into our private bitmap format
-				pFiller->Write(buffer, sizeof(unsigned short), S.width);
+						// White balance of DSS (only for RGB Bayer patterns)
+						vBalance[k] = 1.0;
+						vMaximum[k] = 65535.0;
+						switch (GetBayerColor(k, row, m_CFAType))
+						{
+						case BAYER_RED:
+							vBalance[k] = fRedScale;
+							vMaximum[k] = MAXWORD - 1;
+							break;
+						case BAYER_GREEN:
+							vBalance[k] = fGreenScale;
+							vMaximum[k] = MAXWORD - 1;
+							break;
+						case BAYER_BLUE:
+							vBalance[k] = fBlueScale;
+							vMaximum[k] = MAXWORD - 1;
+							break;
+						};
+					};
+
+					for (int col0 = 0; col0 < nWidth; col0 += nPeriod)
+					{
+						const int		nCount = min(nPeriod, nWidth - col0);
+						const unsigned short *	pValue = pSource + col0;
+						WORD *			pOut = pTarget + col0;
+
+						for (int k = 0; k < nCount; k++)
+						{
+							const int		val = max(0, min(pValue[k] - vBlack[k], 65535));
+							const int		scaled = max(0, min(int(vScale[k] * (float)val), 65535));
+
+							pOut[k] = static_cast<WORD>(min(vMaximum[k], scaled * vBalance[k]));
+							nLocalMax = max(nLocalMax, val);
+						};
+					};
+
+					if (!bDirect)
+					{
+						for (int col = 0; col < nWidth; col++)
+							pBitmap->SetPixel(col, row, vRow[col] / 256.0);
+					};
+
+					if (pProgress && 0 == omp_get_thread_num())
+						pProgress->Progress2(nullptr, row + 1);
+				};
+
+#pragma omp critical
+				nDataMax = max(nDataMax, nLocalMax);
 			}
+
+			C.data_maximum = nDataMax & 0xffff;
+			ZTRACE_RUNTIME("Maximum value pixel has value %d", C.data_maximum);
 		}
 		else
 		{
@@ -1278,7 +1240,7 @@ bool CRawDecod::LoadRawFile(CMemoryBitmap * pBitmap, CDSSProgress * pProgress, b
 			// This is a "full colour" RAW file, so we can use full libraw
 			// processing and capture the PPM file output.
 			//
-			if (LIBRAW_SUCCESS != (ret = rawProcessor.dcraw_process()))
+			if (LIBRAW_SUCCESS != (ret = m_pRawProcessor->dcraw_process()))
 			{
 				ZTRACE_RUNTIME("Cannot do postprocessing on %s: %s", m_strFileName, libraw_strerror(ret));
 				if (LIBRAW_FATAL_ERROR(ret))
@@ -1287,14 +1249,22 @@ bool CRawDecod::LoadRawFile(CMemoryBitmap * pBitmap, CDSSProgress * pProgress, b
 			if (!bResult) break;
 
 			ZTRACE_RUNTIME("Processing Foveon or Fuji X-Trans raw image data");
+
+			//
+			// Create the class that populates the bitmap
+			//
+			pFiller = new BitMapFiller(pBitmap, pProgress);
+			pFiller->SetWhiteBalance(fRedScale, fGreenScale, fBlueScale);
+			pFiller->SetCFAType(m_CFAType);
+
 			//
 			// Now capture the output using our over-ridden methods
 			//
 			// Set up the intercept code to write the image data to our bitmap instead of
 			// to an external file, and invoke the overridden dcraw_ppm_tiff_writer()
 			//
-			rawProcessor.setBitMapFiller(pFiller);
-			if (LIBRAW_SUCCESS != (ret = rawProcessor.dcraw_ppm_tiff_writer("")))
+			m_pRawProcessor->setBitMapFiller(pFiller);
+			if (LIBRAW_SUCCESS != (ret = m_pRawProcessor->dcraw_ppm_tiff_writer("")))
 			{
 				bResult = false;
 				ZTRACE_RUNTIME("Cannot write image data to bitmap %s", libraw_strerror(ret));
@@ -1362,13 +1332,15 @@ bool	IsRAWPicture(LPCTSTR szFileName, CBitmapInfo & BitmapInfo)
 	// 
 	// .tiff .tif		TIFF files
 	// .jpg .jpeg .jpe	JPEG files
+	// .fit .fits .fts	FITS files
 	//
 	_tsplitpath(szFileName, nullptr, nullptr, nullptr, szExt);
 	strExt = szExt;
 	strExt.MakeUpper();
 
 	if ((strExt != _T(".TIF")) && (strExt != _T(".TIFF")) && 
-		strExt != _T(".JPG") && strExt != _T(".JPEG") && strExt != _T(".JPE"))
+		strExt != _T(".JPG") && strExt != _T(".JPEG") && strExt != _T(".JPE") &&
+		strExt != _T(".FIT") && strExt != _T(".FITS") && strExt != _T(".FTS"))
 	{
 		CRawDecod		dcr(szFileName);
 
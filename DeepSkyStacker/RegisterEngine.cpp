@@ -9,11 +9,19 @@
 #include "FITSUtil.h"
 #include "Filters.h"
 #include "avx_luminance.h"
+#include "DSSPlatform.h"
+#include "RunReport.h"
 
 #define _USE_MATH_DEFINES
 #include <math.h>
 
 #include <omp.h>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+#include <exception>
 
 /* ------------------------------------------------------------------- */
 
@@ -626,7 +634,7 @@ size_t CRegisteredFrame::RegisterSubRect(CMemoryBitmap* pBitmap, const CRect& rc
 
 /* ------------------------------------------------------------------- */
 
-bool	CRegisteredFrame::SaveRegisteringInfo(LPCTSTR szInfoFileName)
+bool	CRegisteredFrame::SaveTextRegisteringInfo(LPCTSTR szInfoFileName)
 {
 	bool				bResult = false;
 	FILE *				hFile;
@@ -704,9 +712,8 @@ static bool GetNextValue(FILE * hFile, CString & strVariable, CString & strValue
 
 /* ------------------------------------------------------------------- */
 
-bool	CRegisteredFrame::LoadRegisteringInfo(LPCTSTR szInfoFileName)
+bool	CRegisteredFrame::LoadTextRegisteringInfo(LPCTSTR szInfoFileName)
 {
-	ZFUNCTRACE_RUNTIME();
 	bool				bResult = false;
 	FILE *				hFile;
 
@@ -907,6 +914,257 @@ bool	CRegisteredFrame::LoadRegisteringInfo(LPCTSTR szInfoFileName)
 	return bResult;
 };
 
+/* ------------------------------------------------------------------- */
+
+// Binary copy of the registering info (.Info.bin next to the .Info.txt file).
+// The text file remains the exchange format and is authoritative: it is
+// always written, the binary file is always built from the values parsed
+// from the text file and is only used when it was written for the current
+// version of the text file, otherwise the text file is parsed and imported
+// again.
+// The stars are stored as a packed array read directly from the mapped file.
+
+static const char		REGISTERINGINFO_MAGIC[8] = { 'D', 'S', 'S', 'R', 'E', 'G', 'I', 'N' };
+static const DWORD		REGISTERINGINFO_VERSION = 2;	// 2: values rounded like in the text file
+static const DWORD		REGISTERINGINFO_COMET	= 0x00000001;
+
+struct REGISTERINGINFOHEADER
+{
+	char				szMagic[8];
+	DWORD				dwVersion;
+	DWORD				dwHeaderSize;		// Offset of the star array
+	DWORD				dwStarSize;			// Size of each star record
+	DWORD				dwFlags;
+	std::uint64_t		lTextFileTime;		// Last write time of the matching .Info.txt file
+	std::uint64_t		lNrStars;
+	double				fOverallQuality;
+	double				fFWHM;
+	double				fXComet,
+						fYComet;
+	double				fSkyBackground;
+};
+
+struct REGISTERINGINFOSTAR
+{
+	double				fIntensity;
+	double				fQuality;
+	double				fMeanRadius;
+	double				fX, fY;
+	double				fMajorAxisAngle;
+	double				fLargeMajorAxis;
+	double				fSmallMajorAxis;
+	double				fLargeMinorAxis;
+	double				fSmallMinorAxis;
+	std::int32_t		lLeft, lTop,
+						lRight, lBottom;
+};
+
+static_assert(sizeof(REGISTERINGINFOHEADER) == 80, "The registering info header must not be padded");
+static_assert(sizeof(REGISTERINGINFOSTAR) == 96, "The registering info star must not be padded");
+
+/* ------------------------------------------------------------------- */
+
+static CString GetBinaryInfoFileName(LPCTSTR szInfoFileName)
+{
+	TCHAR				szDrive[1+_MAX_DRIVE];
+	TCHAR				szDir[1+_MAX_DIR];
+	TCHAR				szFile[1+_MAX_FNAME];
+	TCHAR				szBinaryName[1+_MAX_PATH];
+
+	// xxx.Info.txt -> xxx.Info.bin
+	_tsplitpath(szInfoFileName, szDrive, szDir, szFile, nullptr);
+	_tmakepath(szBinaryName, szDrive, szDir, szFile, _T(".bin"));
+
+	return CString(szBinaryName);
+};
+
+/* ------------------------------------------------------------------- */
+
+static bool GetTextFileTime(LPCTSTR szInfoFileName, std::uint64_t & lFileTime)
+{
+	FILETIME			FileTime;
+
+	if (GetFileCreationDateTime(szInfoFileName, FileTime))
+	{
+		lFileTime = (static_cast<std::uint64_t>(FileTime.dwHighDateTime) << 32) | FileTime.dwLowDateTime;
+		return true;
+	};
+
+	return false;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CRegisteredFrame::SaveBinaryRegisteringInfo(LPCTSTR szInfoFileName)
+{
+	bool					bResult = false;
+	REGISTERINGINFOHEADER	Header;
+
+	memset(&Header, 0, sizeof(Header));
+	if (GetTextFileTime(szInfoFileName, Header.lTextFileTime))
+	{
+		std::vector<REGISTERINGINFOSTAR>	vStars(m_vStars.size());
+		FILE *								hFile;
+
+		memcpy(Header.szMagic, REGISTERINGINFO_MAGIC, sizeof(Header.szMagic));
+		Header.dwVersion		= REGISTERINGINFO_VERSION;
+		Header.dwHeaderSize		= sizeof(REGISTERINGINFOHEADER);
+		Header.dwStarSize		= sizeof(REGISTERINGINFOSTAR);
+		Header.dwFlags			= m_bComet ? REGISTERINGINFO_COMET : 0;
+		Header.lNrStars			= m_vStars.size();
+		Header.fOverallQuality	= m_fOverallQuality;
+		Header.fFWHM			= m_fFWHM;
+		Header.fXComet			= m_fXComet;
+		Header.fYComet			= m_fYComet;
+		Header.fSkyBackground	= m_SkyBackground.m_fLight;
+
+		for (size_t i = 0;i<m_vStars.size();i++)
+		{
+			const CStar &			ms = m_vStars[i];
+			REGISTERINGINFOSTAR &	rs = vStars[i];
+
+			rs.fIntensity		= ms.m_fIntensity;
+			rs.fQuality			= ms.m_fQuality;
+			rs.fMeanRadius		= ms.m_fMeanRadius;
+			rs.fX				= ms.m_fX;
+			rs.fY				= ms.m_fY;
+			rs.fMajorAxisAngle	= ms.m_fMajorAxisAngle;
+			rs.fLargeMajorAxis	= ms.m_fLargeMajorAxis;
+			rs.fSmallMajorAxis	= ms.m_fSmallMajorAxis;
+			rs.fLargeMinorAxis	= ms.m_fLargeMinorAxis;
+			rs.fSmallMinorAxis	= ms.m_fSmallMinorAxis;
+			rs.lLeft			= ms.m_rcStar.left;
+			rs.lTop				= ms.m_rcStar.top;
+			rs.lRight			= ms.m_rcStar.right;
+			rs.lBottom			= ms.m_rcStar.bottom;
+		};
+
+		hFile = _tfopen(GetBinaryInfoFileName(szInfoFileName), _T("wb"));
+		if (hFile)
+		{
+			bResult = (fwrite(&Header, sizeof(Header), 1, hFile) == 1) &&
+					  (vStars.empty() || fwrite(vStars.data(), sizeof(REGISTERINGINFOSTAR), vStars.size(), hFile) == vStars.size());
+			fclose(hFile);
+		};
+	};
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CRegisteredFrame::LoadBinaryRegisteringInfo(LPCTSTR szInfoFileName, bool bLoadStars)
+{
+	bool				bResult = false;
+	std::uint64_t		lTextFileTime;
+	CMappedFile			File;
+
+	if (GetTextFileTime(szInfoFileName, lTextFileTime) &&
+		File.Open(GetBinaryInfoFileName(szInfoFileName), false) &&
+		File.GetSize() >= sizeof(REGISTERINGINFOHEADER))
+	{
+		REGISTERINGINFOHEADER	Header;
+
+		memcpy(&Header, File.GetData(), sizeof(Header));
+
+		// Later versions may only append fields to the header and to the star records
+		if (!memcmp(Header.szMagic, REGISTERINGINFO_MAGIC, sizeof(Header.szMagic)) &&
+			Header.dwVersion >= REGISTERINGINFO_VERSION &&
+			Header.dwHeaderSize >= sizeof(REGISTERINGINFOHEADER) &&
+			Header.dwStarSize >= sizeof(REGISTERINGINFOSTAR) &&
+			Header.lTextFileTime == lTextFileTime &&
+			Header.lNrStars <= (File.GetSize() - Header.dwHeaderSize) / Header.dwStarSize)
+		{
+			m_fOverallQuality			= Header.fOverallQuality;
+			m_fFWHM						= Header.fFWHM;
+			m_bComet					= (Header.dwFlags & REGISTERINGINFO_COMET) != 0;
+			if (m_bComet)
+			{
+				m_fXComet				= Header.fXComet;
+				m_fYComet				= Header.fYComet;
+			};
+			m_SkyBackground.m_fLight	= Header.fSkyBackground;
+
+			m_vStars.clear();
+			m_lNrStoredStars = static_cast<size_t>(Header.lNrStars);
+			if (bLoadStars)
+			{
+				const BYTE *		pStar = File.GetData() + Header.dwHeaderSize;
+
+				m_vStars.reserve(m_lNrStoredStars);
+				for (size_t i = 0;i<m_lNrStoredStars;i++, pStar += Header.dwStarSize)
+				{
+					REGISTERINGINFOSTAR		rs;
+					CStar					ms;
+
+					memcpy(&rs, pStar, sizeof(rs));
+					ms.m_fPercentage		= 0;
+					ms.m_fDeltaRadius		= 0;
+					ms.m_fIntensity			= rs.fIntensity;
+					ms.m_fQuality			= rs.fQuality;
+					ms.m_fMeanRadius		= rs.fMeanRadius;
+					ms.m_fX					= rs.fX;
+					ms.m_fY					= rs.fY;
+					ms.m_fMajorAxisAngle	= rs.fMajorAxisAngle;
+					ms.m_fLargeMajorAxis	= rs.fLargeMajorAxis;
+					ms.m_fSmallMajorAxis	= rs.fSmallMajorAxis;
+					ms.m_fLargeMinorAxis	= rs.fLargeMinorAxis;
+					ms.m_fSmallMinorAxis	= rs.fSmallMinorAxis;
+					ms.m_rcStar.SetRect(rs.lLeft, rs.lTop, rs.lRight, rs.lBottom);
+
+					if (ms.IsValid())
+						m_vStars.push_back(ms);
+				};
+			};
+
+			m_bInfoOk = true;
+			bResult = true;
+		};
+	};
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CRegisteredFrame::SaveRegisteringInfo(LPCTSTR szInfoFileName)
+{
+	bool				bResult;
+
+	// The binary file is written after the text file since it records its time.
+	// It holds the values read back from the text file (rounded like in the
+	// text file) so that both files give the same registering info
+	bResult = SaveTextRegisteringInfo(szInfoFileName);
+	if (bResult)
+	{
+		CRegisteredFrame		TextFrame;
+
+		if (TextFrame.LoadTextRegisteringInfo(szInfoFileName))
+			TextFrame.SaveBinaryRegisteringInfo(szInfoFileName);
+	};
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CRegisteredFrame::LoadRegisteringInfo(LPCTSTR szInfoFileName, bool bLoadStars)
+{
+	ZFUNCTRACE_RUNTIME();
+	bool				bResult;
+
+	bResult = LoadBinaryRegisteringInfo(szInfoFileName, bLoadStars);
+	if (!bResult)
+	{
+		// Missing or out of date binary file: import the text file
+		bResult = LoadTextRegisteringInfo(szInfoFileName);
+		if (bResult)
+			SaveBinaryRegisteringInfo(szInfoFileName);
+	};
+
+	return bResult;
+};
+
 /* ------------------------------------------------------------------- */
 /* ------------------------------------------------------------------- */
 
@@ -958,15 +1216,80 @@ void	CLightFrameInfo::RegisterPicture(CGrayBitmap & Bitmap)
 	constexpr int rectSize = 5 * StarMaxSize;
 	constexpr int stepSize = rectSize / 2;
 	constexpr int Separation = 3;
+	constexpr int seedMargin = 2 * rectSize;
 	const int calcHeight = Bitmap.Height() - 2 * StarMaxSize;
 	const int nrSubrectsY = (calcHeight - 1) / stepSize + 1;
 	const int calcWidth = Bitmap.Width() - 2 * StarMaxSize;
 	const int nrSubrectsX = (calcWidth - 1) / stepSize + 1;
 	const int nrEnabledThreads = CMultitask::GetNrProcessors(false); // Returns 1 if multithreading disabled by user, otherwise # HW threads
 
-	STARSET stars1, stars2, stars3, stars4;
+	STARSET stars;
+	std::mutex starsMutex;
 	std::atomic<int> nrSubrects{ 0 };
 	std::atomic<size_t> nStars{ 0 };
+	const int nrCells = std::max(nrSubrectsX, 0) * std::max(nrSubrectsY, 0);
+
+	// Order of the sub-rectangles in the previous single threaded version: the four
+	// quadrants (independent of each other), then the vertical middle band, then the
+	// left and right parts of the horizontal middle band. Each area is scanned row by row.
+	// Which of two overlapping candidate stars is kept depends on this order.
+	std::vector<int> rank(nrCells, 0);
+	{
+		const int midX = std::max((nrSubrectsX - Separation) / 2, 0);
+		const int midY = std::max((nrSubrectsY - Separation) / 2, 0);
+		const int endX = std::min(midX + Separation, nrSubrectsX);
+		const int endY = std::min(midY + Separation, nrSubrectsY);
+		const int areas[7][4] = {	{ 0, midY, 0, midX }, { 0, midY, endX, nrSubrectsX },
+									{ endY, nrSubrectsY, 0, midX }, { endY, nrSubrectsY, endX, nrSubrectsX },
+									{ 0, nrSubrectsY, midX, endX },
+									{ midY, endY, 0, midX }, { midY, endY, endX, nrSubrectsX } };
+		int nextRank = 0;
+
+		for (const auto& area : areas)
+			for (int rowNdx = area[0]; rowNdx < area[1]; ++rowNdx)
+				for (int colNdx = area[2]; colNdx < area[3]; ++colNdx)
+					rank[rowNdx * nrSubrectsX + colNdx] = nextRank++;
+	}
+
+	// A sub-rectangle only interacts with the sub-rectangles less than Separation+1 steps
+	// away, so it must wait for these neighbours when they come first in the order above.
+	// Processing everything else concurrently gives exactly the stars of the serial order.
+	const auto forEachPredecessor = [nrSubrectsX, nrSubrectsY, Separation, &rank](const int cellNdx, auto&& function) -> bool
+	{
+		const int rowNdx = cellNdx / nrSubrectsX;
+		const int colNdx = cellNdx % nrSubrectsX;
+
+		for (int y = std::max(rowNdx - Separation, 0); y <= std::min(rowNdx + Separation, nrSubrectsY - 1); ++y)
+			for (int x = std::max(colNdx - Separation, 0); x <= std::min(colNdx + Separation, nrSubrectsX - 1); ++x)
+				if (rank[y * nrSubrectsX + x] < rank[cellNdx] && !function(y * nrSubrectsX + x))
+					return false;
+		return true;
+	};
+
+	// The sub-rectangles are handed out by depth in the dependency graph (then in serial
+	// order), which is a topological order: the predecessors of a sub-rectangle have always
+	// been handed out before it, so a thread never waits for a sub-rectangle nobody is processing.
+	std::vector<int> schedule(nrCells);
+	{
+		std::vector<int> byRank(nrCells);
+		std::vector<int> depth(nrCells, 0);
+
+		for (int cellNdx = 0; cellNdx < nrCells; ++cellNdx)
+			byRank[rank[cellNdx]] = cellNdx;
+		for (const int cellNdx : byRank)
+			forEachPredecessor(cellNdx, [&depth, cellNdx](const int predNdx) -> bool
+			{
+				depth[cellNdx] = std::max(depth[cellNdx], depth[predNdx] + 1);
+				return true;
+			});
+
+		schedule = byRank;
+		std::stable_sort(schedule.begin(), schedule.end(), [&depth](const int lhs, const int rhs) { return depth[lhs] < depth[rhs]; });
+	}
+
+	std::vector<char> cellDone(nrCells, 0);
+	std::mutex cellMutex;
+	std::condition_variable cellCondition;
 
 	int masterCount{ 0 };
 	const auto progress = [this, &nrSubrects, &nStars, &masterCount]() -> void
@@ -982,68 +1305,70 @@ void	CLightFrameInfo::RegisterPicture(CGrayBitmap & Bitmap)
 		}
 	};
 
-	const auto processDisjointArea = [this, StarMaxSize, &Bitmap, stepSize, rectSize, &progress, &nStars](const int yStart, const int yEnd, const int xStart, const int xEnd, STARSET& stars) -> void
+	const auto processSubRect = [this, &Bitmap, &stars, &starsMutex, &nStars](const CRect& rc) -> void
 	{
-		const int rightmostColumn = static_cast<int>(Bitmap.Width()) - StarMaxSize;
+		STARSET localStars;
 
-		for (int rowNdx = yStart; rowNdx < yEnd; ++rowNdx)
 		{
-			const int top = StarMaxSize + rowNdx * stepSize;
-			const int bottom = std::min(static_cast<int>(Bitmap.Height()) - StarMaxSize, top + rectSize);
+			// Only the stars close to the sub-rectangle can interfere with the new ones
+			std::lock_guard<std::mutex> lock(starsMutex);
+			for (auto it = stars.lower_bound(CStar(rc.left - seedMargin, 0)); it != stars.end() && it->m_fX <= rc.right + seedMargin; ++it)
+			{
+				if (it->m_fY >= rc.top - seedMargin && it->m_fY <= rc.bottom + seedMargin)
+					localStars.insert(localStars.end(), *it);
+			}
+		}
 
-			for (int colNdx = xStart; colNdx < xEnd; ++colNdx, progress())
-				nStars += RegisterSubRect(&Bitmap, CRect(StarMaxSize + colNdx * stepSize, top, min(rightmostColumn, StarMaxSize + colNdx * stepSize + rectSize), bottom), stars);
+		const size_t nNewStars = RegisterSubRect(&Bitmap, rc, localStars);
+
+		if (nNewStars != 0)
+		{
+			// Stars already known are not inserted twice
+			std::lock_guard<std::mutex> lock(starsMutex);
+			stars.insert(localStars.cbegin(), localStars.cend());
 		}
+		nStars += nNewStars;
 	};
 
-#pragma omp parallel default(none) shared(stars1, stars2, stars3, stars4) if(nrEnabledThreads - 1)
-{
-#pragma omp sections
+	const auto processCell = [StarMaxSize, &Bitmap, stepSize, rectSize, nrSubrectsX, &forEachPredecessor, &cellDone, &cellMutex, &cellCondition, &processSubRect](const int cellNdx) -> void
 	{
-		// Upper left area
-#pragma omp section
-		processDisjointArea(0, (nrSubrectsY - Separation) / 2, 0, (nrSubrectsX - Separation) / 2, stars1);
-		// Upper right area
-#pragma omp section
-		processDisjointArea(0, (nrSubrectsY - Separation) / 2, (nrSubrectsX - Separation) / 2 + Separation, nrSubrectsX, stars2);
-		// Lower left area
-#pragma omp section
-		processDisjointArea((nrSubrectsY - Separation) / 2 + Separation, nrSubrectsY, 0, (nrSubrectsX - Separation) / 2, stars3);
-		// Lower right area
-#pragma omp section
-		processDisjointArea((nrSubrectsY - Separation) / 2 + Separation, nrSubrectsY, (nrSubrectsX - Separation) / 2 + Separation, nrSubrectsX, stars4);
-	}
+		const int rowNdx = cellNdx / nrSubrectsX;
+		const int colNdx = cellNdx % nrSubrectsX;
+		const int rightmostColumn = static_cast<int>(Bitmap.Width()) - StarMaxSize;
+		const int top = StarMaxSize + rowNdx * stepSize;
+		const int bottom = std::min(static_cast<int>(Bitmap.Height()) - StarMaxSize, top + rectSize);
+
+		{
+			// Blocking wait: the threads don't spin when the machine is oversubscribed
+			std::unique_lock<std::mutex> lock(cellMutex);
+			cellCondition.wait(lock, [&]() { return forEachPredecessor(cellNdx, [&cellDone](const int predNdx) -> bool { return cellDone[predNdx] != 0; }); });
+		}
+
+		processSubRect(CRect(StarMaxSize + colNdx * stepSize, top, min(rightmostColumn, StarMaxSize + colNdx * stepSize + rectSize), bottom));
+
+		{
+			std::lock_guard<std::mutex> lock(cellMutex);
+			cellDone[cellNdx] = 1;
+		}
+		cellCondition.notify_all();
+	};
 
-#pragma omp sections
+	// Sub-rectangles are handed out in the schedule order.
+#pragma omp parallel for schedule(dynamic, 1) if(nrEnabledThreads - 1)
+	for (int n = 0; n < nrCells; ++n)
 	{
-#pragma omp section
-		stars1.merge(stars2);
-#pragma omp section
-		stars3.merge(stars4);
+		processCell(schedule[n]);
+		progress();
 	}
 
-#pragma omp single
-{
-	stars1.merge(stars3);
-	// Remaining areas, all are overlapping with at least one other.
-	// Vertically middle band, full height
-	processDisjointArea(0, nrSubrectsY, (nrSubrectsX - Separation) / 2, (nrSubrectsX - Separation) / 2 + Separation, stars1);
-	// Middle left
-	processDisjointArea((nrSubrectsY - Separation) / 2, (nrSubrectsY - Separation) / 2 + Separation, 0, (nrSubrectsX - Separation) / 2, stars1);
-	// Middle right
-	processDisjointArea((nrSubrectsY - Separation) / 2, (nrSubrectsY - Separation) / 2 + Separation, (nrSubrectsX - Separation) / 2 + Separation, nrSubrectsX, stars1);
-
-	m_vStars.assign(stars1.cbegin(), stars1.cend());
-}
+	m_vStars.assign(stars.cbegin(), stars.cend());
 
-#pragma omp sections
+#pragma omp parallel sections if(nrEnabledThreads - 1)
 {
 #pragma omp section
 	ComputeOverallQuality();
 #pragma omp section
 	ComputeFWHM();
-}
-
 }
 
 	if (m_pProgress)
@@ -1077,50 +1402,35 @@ public :
 		m_pProgress				 = pProgress;
 	};
 
-	virtual bool	DoTask(HANDLE hEvent);
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
 	virtual bool	Process();
 };
 
 /* ------------------------------------------------------------------- */
 
-bool	CComputeLuminanceTask::DoTask(HANDLE hEvent)
+bool	CComputeLuminanceTask::DoTask(LONG lStart, LONG lEnd)
 {
 	ZFUNCTRACE_RUNTIME();
 	bool				bResult = true;
 
 	LONG				i, j;
-	bool				bEnd = false;
-	MSG					msg;
 	LONG				lWidth = m_pBitmap->Width();
 
 	AvxLuminance avxLuminance{ *m_pBitmap, *m_pGrayBitmap };
 
-	// Create a message queue and signal the event
-	PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-	SetEvent(hEvent);
-	while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+	if (avxLuminance.computeLuminanceBitmap(lStart, lEnd) != 0)
 	{
-		if (msg.message == WM_MT_PROCESS)
+		for (j = lStart; j < lEnd; j++)
 		{
-			if (avxLuminance.computeLuminanceBitmap(msg.wParam, msg.wParam + msg.lParam) != 0)
+			for (i = 0; i < lWidth; i++)
 			{
-				for (j = msg.wParam; j < msg.wParam + msg.lParam; j++)
-				{
-					for (i = 0; i < lWidth; i++)
-					{
-						COLORREF16			crColor;
+				COLORREF16			crColor;
 
-						m_pBitmap->GetPixel16(i, j, crColor);
-						m_pGrayBitmap->SetPixel(i, j, GetLuminance(crColor));
-					};
-				};
-			}
-
-			SetEvent(hEvent);
-		}
-		else if (msg.message == WM_MT_STOP)
-			bEnd = true;
-	};
+				m_pBitmap->GetPixel16(i, j, crColor);
+				m_pGrayBitmap->SetPixel(i, j, GetLuminance(crColor));
+			};
+		};
+	}
 
 	return true;
 };
@@ -1132,30 +1442,10 @@ bool	CComputeLuminanceTask::Process()
 	ZFUNCTRACE_RUNTIME();
 	bool				bResult = true;
 	LONG				lHeight = m_pBitmap->Height();
-	LONG				i = 0;
-	LONG				lStep;
-	LONG				lRemaining;
 
 	if (m_pProgress)
 		m_pProgress->SetNrUsedProcessors(GetNrThreads());
-	lStep		= max(1L, lHeight/50);
-	lRemaining	= lHeight;
-
-	while (i<lHeight)
-	{
-		LONG			lAdd = min(lStep, lRemaining);
-		DWORD			dwThreadId;
-
-		dwThreadId = GetAvailableThreadId();
-		PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-		i			+=lAdd;
-		lRemaining	-= lAdd;
-		if (m_pProgress)
-			m_pProgress->Progress2(nullptr, i);
-	};
-
-	CloseAllThreads();
+	bResult = ProcessRange(0, lHeight, m_pProgress);
 
 	if (m_pProgress)
 		m_pProgress->SetNrUsedProcessors();
@@ -1192,7 +1482,6 @@ void	CLightFrameInfo::ComputeLuminanceBitmap(CMemoryBitmap * pBitmap, CGrayBitma
 	CComputeLuminanceTask		ComputeLuminanceTask;
 
 	ComputeLuminanceTask.Init(pBitmap, pGrayBitmap, m_pProgress);
-	ComputeLuminanceTask.StartThreads();
 	ComputeLuminanceTask.Process();
 
 	if (m_bApplyMedianFilter)
@@ -1215,6 +1504,7 @@ void	CLightFrameInfo::ComputeLuminanceBitmap(CMemoryBitmap * pBitmap, CGrayBitma
 void	CLightFrameInfo::RegisterPicture(CMemoryBitmap * pBitmap)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope				ReportScope("RegisterPicture");
 	CSmartPtr<CGrayBitmap>		pGrayBitmap;
 
 	ComputeLuminanceBitmap(pBitmap, &pGrayBitmap);
@@ -1416,9 +1706,9 @@ void CLightFrameInfo::RegisterPicture(LPCTSTR szBitmap, double fMinLuminancy, bo
 
 /* ------------------------------------------------------------------- */
 
-bool CLightFrameInfo::ReadInfoFileName()
+bool CLightFrameInfo::ReadInfoFileName(bool bLoadStars)
 {
-	return LoadRegisteringInfo(m_strInfoFileName);
+	return LoadRegisteringInfo(m_strInfoFileName, bLoadStars);
 };
 
 /* ------------------------------------------------------------------- */
@@ -1430,7 +1720,7 @@ void CLightFrameInfo::SaveRegisteringInfo()
 
 /* ------------------------------------------------------------------- */
 
-void CLightFrameInfo::SetBitmap(LPCTSTR szBitmap, bool bProcessIfNecessary, bool bForceRegister)
+void CLightFrameInfo::SetBitmap(LPCTSTR szBitmap, bool bProcessIfNecessary, bool bForceRegister, bool bLoadStars)
 {
 	TCHAR				szDrive[1+_MAX_DRIVE];
 	TCHAR				szDir[1+_MAX_DIR];
@@ -1446,7 +1736,7 @@ void CLightFrameInfo::SetBitmap(LPCTSTR szBitmap, bool bProcessIfNecessary, bool
 
 	m_strInfoFileName = szInfoName;
 
-	if (bForceRegister || (!ReadInfoFileName() && bProcessIfNecessary))
+	if (bForceRegister || (!ReadInfoFileName(bLoadStars) && bProcessIfNecessary))
 	{
 		RegisterPicture();
 		SaveRegisteringInfo();
@@ -1532,9 +1822,224 @@ bool	CRegisterEngine::SaveCalibratedLightFrame(CLightFrameInfo & lfi, CMemoryBit
 
 /* ------------------------------------------------------------------- */
 
+LONG	CRegisterEngine::GetNrConcurrentFrames(CStackingInfo * pStackingInfo)
+{
+	ZFUNCTRACE_RUNTIME();
+	LONG				lNrProcessors = CMultitask::GetNrProcessors();
+	LONG				lResult;
+
+	// By default give at least 4 threads to each frame (one per quadrant)
+	if (m_lMaxConcurrentFrames)
+		lResult = m_lMaxConcurrentFrames;
+	else
+		lResult = lNrProcessors / 4;
+
+	lResult = max(1L, min(lResult, lNrProcessors));
+
+	if (lResult > 1)
+	{
+		// Each frame in flight needs the loaded bitmap, the luminance bitmap
+		// (double) and possibly its median filtered copy
+		__int64				ulFrameSize = 0;
+		__int64				ulAvailable = static_cast<__int64>(GetAvailablePhysicalMemory() / 2);
+
+		for (size_t i = 0;i<pStackingInfo->m_pLightTask->m_vBitmaps.size();i++)
+		{
+			const CFrameInfo &	fi = pStackingInfo->m_pLightTask->m_vBitmaps[i];
+			__int64				ulSize;
+
+			ulSize = (__int64)fi.m_lWidth * fi.m_lHeight * (fi.m_lNrChannels * fi.m_lBitPerChannels / 8 + 2 * sizeof(double));
+			ulFrameSize = max(ulFrameSize, ulSize);
+		};
+
+		if (ulFrameSize)
+			lResult = max(1L, min(lResult, static_cast<LONG>(ulAvailable / ulFrameSize)));
+	};
+
+	ZTRACE_RUNTIME("Registering up to %ld frames concurrently", lResult);
+
+	return lResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+void CRegisterEngine::RegisterLightFrame(CLightFrameInfo & lfi, CStackingInfo * pStackingInfo, CMasterFrames & MasterFrames, CDSSProgress * pProgress)
+{
+	ZFUNCTRACE_RUNTIME();
+	CRunReportScope				ReportScope("RegisterLightFrame");
+	CBitmapInfo					bmpInfo;
+	CSmartPtr<CMemoryBitmap>	pBitmap;
+	CString						strCalibratedFile;
+	bool						bLoaded = false;
+
+	{
+		// Loading and calibration are serialized: the progress and the
+		// master frames are shared by all the frames being registered
+		std::lock_guard<std::mutex>		Lock(m_LoadMutex);
+
+		// Load the bitmap
+		if (GetPictureInfo(lfi.m_strFileName, bmpInfo) && bmpInfo.CanLoad())
+		{
+			CString						strText;
+			CString						strDescription;
+
+			bmpInfo.GetDescription(strDescription);
+
+			if (bmpInfo.m_lNrChannels==3)
+				strText.Format(IDS_LOADRGBLIGHT, bmpInfo.m_lBitPerChannel, (LPCTSTR)strDescription, (LPCTSTR)lfi.m_strFileName);
+			else
+				strText.Format(IDS_LOADGRAYLIGHT, bmpInfo.m_lBitPerChannel, (LPCTSTR)strDescription, (LPCTSTR)lfi.m_strFileName);
+			if (pProgress)
+				pProgress->Start2(strText, 0);
+
+			bLoaded = ::LoadPicture(lfi.m_strFileName, &pBitmap, pProgress);
+			if (bLoaded)
+			{
+				// Apply offset, dark and flat to lightframe
+				MasterFrames.ApplyAllMasters(pBitmap, nullptr, pProgress);
+
+				if (m_bSaveCalibrated &&
+					(pStackingInfo->m_pDarkTask || pStackingInfo->m_pDarkFlatTask ||
+					pStackingInfo->m_pFlatTask || pStackingInfo->m_pOffsetTask))
+					SaveCalibratedLightFrame(lfi, pBitmap, pProgress, strCalibratedFile);
+			};
+		};
+	};
+
+	if (bLoaded)
+	{
+		// Then register the light frame
+		lfi.SetProgress(pProgress);
+		lfi.RegisterPicture(pBitmap);
+		lfi.SaveRegisteringInfo();
+
+		if (strCalibratedFile.GetLength())
+		{
+			CString				strInfoFileName;
+			TCHAR				szDrive[1+_MAX_DRIVE];
+			TCHAR				szDir[1+_MAX_DIR];
+			TCHAR				szFile[1+_MAX_FNAME];
+
+			_tsplitpath(strCalibratedFile, szDrive, szDir, szFile, nullptr);
+			strInfoFileName.Format(_T("%s%s%s%s"), szDrive, szDir, szFile, _T(".Info.txt"));
+			lfi.CRegisteredFrame::SaveRegisteringInfo(strInfoFileName);
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CRegisterEngine::RegisterLightFramesInParallel(std::vector<CLightFrameInfo> & vFrames, CStackingInfo * pStackingInfo, CMasterFrames & MasterFrames, LONG lNrConcurrentFrames, LONG & lNrRegistered, LONG lTotalRegistered, CDSSProgress * pProgress)
+{
+	ZFUNCTRACE_RUNTIME();
+	bool						bResult = true;
+	const int					nrThreadsPerFrame = static_cast<int>(max(1L, CMultitask::GetNrProcessors() / lNrConcurrentFrames));
+	std::vector<std::thread>	vThreads;
+	std::mutex					Mutex;
+	std::condition_variable		Condition;
+	size_t						lNextFrame = 0;
+	size_t						lNrDone = 0;
+	bool						bAbort = false;
+	std::exception_ptr			pException;
+	CString						strText;
+	const std::string			strReportPath = CRunReportScope::GetCurrentPath();
+
+	const auto registerFrames = [&]() -> void
+	{
+		CRunReportThread		ReportThread(strReportPath);
+
+		// Each frame gets its own share of the processors
+		omp_set_num_threads(nrThreadsPerFrame);
+
+		for (;;)
+		{
+			size_t			lFrame;
+
+			{
+				std::lock_guard<std::mutex>		Lock(Mutex);
+
+				if (bAbort || (lNextFrame >= vFrames.size()))
+					break;
+				lFrame = lNextFrame++;
+			};
+
+			try
+			{
+				// The progress can only be updated from the calling thread
+				RegisterLightFrame(vFrames[lFrame], pStackingInfo, MasterFrames, nullptr);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex>		Lock(Mutex);
+
+				if (!pException)
+					pException = std::current_exception();
+				bAbort = true;
+			};
+
+			{
+				std::lock_guard<std::mutex>		Lock(Mutex);
+				lNrDone++;
+			};
+			Condition.notify_all();
+		};
+	};
+
+	for (LONG i = 0;i<min(lNrConcurrentFrames, static_cast<LONG>(vFrames.size()));i++)
+		vThreads.emplace_back(registerFrames);
+
+	if (pProgress)
+		pProgress->SetNrUsedProcessors(static_cast<LONG>(vThreads.size()) * nrThreadsPerFrame);
+
+	{
+		std::unique_lock<std::mutex>	Lock(Mutex);
+		size_t							lNrReported = 0;
+
+		while (lNrDone < vFrames.size() && !bAbort)
+		{
+			Condition.wait_for(Lock, std::chrono::milliseconds(200));
+
+			size_t				lNrNewlyDone = lNrDone - lNrReported;
+
+			lNrReported = lNrDone;
+			Lock.unlock();
+			if (pProgress)
+			{
+				if (lNrNewlyDone)
+				{
+					lNrRegistered += static_cast<LONG>(lNrNewlyDone);
+					strText.Format(IDS_REGISTERINGPICTURE, lNrRegistered, lTotalRegistered);
+					pProgress->Progress1(strText, lNrRegistered);
+				};
+				bResult = !pProgress->IsCanceled();
+			};
+			Lock.lock();
+			if (!bResult)
+				bAbort = true;
+		};
+
+		lNrRegistered += static_cast<LONG>(lNrDone - lNrReported);
+	};
+
+	for (auto & Thread : vThreads)
+		Thread.join();
+
+	if (pProgress)
+		pProgress->SetNrUsedProcessors();
+
+	if (pException)
+		std::rethrow_exception(pException);
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
 bool CRegisterEngine::RegisterLightFrames(CAllStackingTasks & tasks, bool bForce, CDSSProgress * pProgress)
 {
 	ZFUNCTRACE_RUNTIME();
+	// The run report (when enabled) is written at the end of this scope
+	CRunReportScope			ReportScope("RegisterLightFrames", true);
 	bool					bResult = true;
 	LONG					i, j;
 	CString					strText;
@@ -1571,9 +2076,13 @@ bool CRegisterEngine::RegisterLightFrames(CAllStackingTasks & tasks, bool bForce
 		if (pStackingInfo)
 		{
 			CMasterFrames				MasterFrames;
+			LONG						lNrConcurrentFrames;
+			std::vector<CLightFrameInfo>	vToRegister;
 
 			MasterFrames.LoadMasters(pStackingInfo, pProgress);
 
+			lNrConcurrentFrames = GetNrConcurrentFrames(pStackingInfo);
+
 			for (j = 0;j<pStackingInfo->m_pLightTask->m_vBitmaps.size() && bResult;j++)
 			{
 				// Register this bitmap
@@ -1582,7 +2091,18 @@ bool CRegisterEngine::RegisterLightFrames(CAllStackingTasks & tasks, bool bForce
 				ZTRACE_RUNTIME("Register %s", (LPCTSTR)pStackingInfo->m_pLightTask->m_vBitmaps[j].m_strFileName);
 
 				lfi.SetProgress(pProgress);
-				lfi.SetBitmap(pStackingInfo->m_pLightTask->m_vBitmaps[j].m_strFileName, false, false);
+				lfi.SetBitmap(pStackingInfo->m_pLightTask->m_vBitmaps[j].m_strFileName, false, false, false);
+
+				if (lNrConcurrentFrames > 1)
+				{
+					// Frames are registered all together below
+					if (bForce || !lfi.IsRegistered())
+						vToRegister.push_back(lfi);
+					else
+						lNrRegistered++;
+					continue;
+				};
+
 				lNrRegistered++;
 
 				if (pProgress)
@@ -1593,61 +2113,18 @@ bool CRegisterEngine::RegisterLightFrames(CAllStackingTasks & tasks, bool bForce
 
 				if (bForce || !lfi.IsRegistered())
 				{
-					CBitmapInfo		bmpInfo;
-					// Load the bitmap
-					if (GetPictureInfo(lfi.m_strFileName, bmpInfo) && bmpInfo.CanLoad())
-					{
-						CSmartPtr<CMemoryBitmap>	pBitmap;
-						CString						strText;
-						CString						strDescription;
-
-						bmpInfo.GetDescription(strDescription);
-
-						if (bmpInfo.m_lNrChannels==3)
-							strText.Format(IDS_LOADRGBLIGHT, bmpInfo.m_lBitPerChannel, (LPCTSTR)strDescription, (LPCTSTR)lfi.m_strFileName);
-						else
-							strText.Format(IDS_LOADGRAYLIGHT, bmpInfo.m_lBitPerChannel, (LPCTSTR)strDescription, (LPCTSTR)lfi.m_strFileName);
-						if (pProgress)
-							pProgress->Start2(strText, 0);
-
-						if (::LoadPicture(lfi.m_strFileName, &pBitmap, pProgress))
-						{
-							// Apply offset, dark and flat to lightframe
-							MasterFrames.ApplyAllMasters(pBitmap, nullptr, pProgress);
-
-							CString				strCalibratedFile;
-
-							if (m_bSaveCalibrated &&
-								(pStackingInfo->m_pDarkTask || pStackingInfo->m_pDarkFlatTask ||
-								pStackingInfo->m_pFlatTask || pStackingInfo->m_pOffsetTask))
-								SaveCalibratedLightFrame(lfi, pBitmap, pProgress, strCalibratedFile);
-
-							// Then register the light frame
-							lfi.SetProgress(pProgress);
-							lfi.RegisterPicture(pBitmap);
-							lfi.SaveRegisteringInfo();
+					RegisterLightFrame(lfi, pStackingInfo, MasterFrames, pProgress);
 
-							if (strCalibratedFile.GetLength())
-							{
-								CString				strInfoFileName;
-								TCHAR				szDrive[1+_MAX_DRIVE];
-								TCHAR				szDir[1+_MAX_DIR];
-								TCHAR				szFile[1+_MAX_FNAME];
-
-								_tsplitpath(strCalibratedFile, szDrive, szDir, szFile, nullptr);
-								strInfoFileName.Format(_T("%s%s%s%s"), szDrive, szDir, szFile, _T(".Info.txt"));
-								lfi.CRegisteredFrame::SaveRegisteringInfo(strInfoFileName);
-							};
-						};
-
-						if (pProgress)
-						{
-							pProgress->End2();
-							bResult = !pProgress->IsCanceled();
-						};
+					if (pProgress)
+					{
+						pProgress->End2();
+						bResult = !pProgress->IsCanceled();
 					};
 				};
 			};
+
+			if (bResult && vToRegister.size())
+				bResult = RegisterLightFramesInParallel(vToRegister, pStackingInfo, MasterFrames, lNrConcurrentFrames, lNrRegistered, lTotalRegistered, pProgress);
 		};
 	};
 
@@ -11,9 +11,12 @@
 #include "DSSTools.h"
 #include "MatchingStars.h"
 #include <set>
+#include <mutex>
 #include "Stars.h"
 #include "Workspace.h"
 
+class CMasterFrames;
+
 /* ------------------------------------------------------------------- */
 
 class CRegisterInfo
@@ -132,10 +135,14 @@ public :
 					m_fYComet;
 	CSkyBackground	m_SkyBackground;
 
+private :
+	size_t			m_lNrStoredStars;	// Number of stars when only the header of the registering info is loaded
+
 protected :
 	void	CopyFrom(const CRegisteredFrame & rf)
 	{
 		m_vStars				= rf.m_vStars;
+		m_lNrStoredStars		= rf.m_lNrStoredStars;
 		m_fRoundnessTolerance	= rf.m_fRoundnessTolerance;
 		m_fMinLuminancy			= rf.m_fMinLuminancy;
 		m_bApplyMedianFilter	= rf.m_bApplyMedianFilter;
@@ -155,6 +162,7 @@ protected :
 		DWORD				dwThreshold = 10;
 
 		m_vStars.clear();
+		m_lNrStoredStars = 0;
 
 		m_fRoundnessTolerance = 2.0;
 		m_bInfoOk = false;
@@ -235,13 +243,24 @@ public :
 		return m_bInfoOk;
 	};
 
+	size_t	GetNrStars() const
+	{
+		return m_vStars.size() ? m_vStars.size() : m_lNrStoredStars;
+	};
+
 
 //	void	RegisterPicture(CMemoryBitmap * pBitmap);
 	bool	ComputeStarCenter(CMemoryBitmap * pBitmap, double & fX, double & fY, double & fRadius);
 	size_t	RegisterSubRect(CMemoryBitmap* pBitmap, const CRect& rc, STARSET& stars);
 
 	bool	SaveRegisteringInfo(LPCTSTR szInfoFileName);
-	bool	LoadRegisteringInfo(LPCTSTR szInfoFileName);
+	bool	LoadRegisteringInfo(LPCTSTR szInfoFileName, bool bLoadStars = true);
+
+private :
+	bool	SaveTextRegisteringInfo(LPCTSTR szInfoFileName);
+	bool	LoadTextRegisteringInfo(LPCTSTR szInfoFileName);
+	bool	SaveBinaryRegisteringInfo(LPCTSTR szInfoFileName);
+	bool	LoadBinaryRegisteringInfo(LPCTSTR szInfoFileName, bool bLoadStars);
 };
 
 /* ------------------------------------------------------------------- */
@@ -346,7 +365,7 @@ public :
 		m_pProgress = pProgress;
 	};
 
-	void	SetBitmap(LPCTSTR szBitmap, bool bProcessIfNecessary = true, bool bForceRegister = false);
+	void	SetBitmap(LPCTSTR szBitmap, bool bProcessIfNecessary = true, bool bForceRegister = false, bool bLoadStars = true);
 
 	bool operator < (const CLightFrameInfo & cbi) const
 	{
@@ -365,7 +384,7 @@ public :
 	void	SaveRegisteringInfo();
 
 private :
-	bool	ReadInfoFileName();
+	bool	ReadInfoFileName(bool bLoadStars = true);
 	void	RegisterPicture();
 	double	ComputeMedianValue(CGrayBitmap & Bitmap);
 	void	RegisterPicture(CGrayBitmap & Bitmap);
@@ -424,9 +443,14 @@ private :
 	bool						m_bSaveCalibrated;
 	INTERMEDIATEFILEFORMAT		m_IntermediateFileFormat;
 	bool						m_bSaveCalibratedDebayered;
+	LONG						m_lMaxConcurrentFrames;
+	std::mutex					m_LoadMutex;
 
 private :
 	bool	SaveCalibratedLightFrame(CLightFrameInfo & lfi, CMemoryBitmap * pBitmap, CDSSProgress * pProgress, CString & strCalibratedFile);
+	LONG	GetNrConcurrentFrames(CStackingInfo * pStackingInfo);
+	void	RegisterLightFrame(CLightFrameInfo & lfi, CStackingInfo * pStackingInfo, CMasterFrames & MasterFrames, CDSSProgress * pProgress);
+	bool	RegisterLightFramesInParallel(std::vector<CLightFrameInfo> & vFrames, CStackingInfo * pStackingInfo, CMasterFrames & MasterFrames, LONG lNrConcurrentFrames, LONG & lNrRegistered, LONG lTotalRegistered, CDSSProgress * pProgress);
 
 public :
 	CRegisterEngine()
@@ -434,6 +458,7 @@ public :
 		m_bSaveCalibrated			= CAllStackingTasks::GetSaveCalibrated();
 		m_IntermediateFileFormat	= CAllStackingTasks::GetIntermediateFileFormat();
 		m_bSaveCalibratedDebayered	= CAllStackingTasks::GetSaveCalibratedDebayered();
+		m_lMaxConcurrentFrames		= CAllStackingTasks::GetMaxConcurrentFrames();
 	};
 
 	virtual ~CRegisterEngine()
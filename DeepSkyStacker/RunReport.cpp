@@ -0,0 +1,302 @@
+#include <stdafx.h>
+#include "RunReport.h"
+#include "DSSPlatform.h"
+#include <algorithm>
+#include <map>
+
+/* ------------------------------------------------------------------- */
+
+// Innermost open scope and path of the parent scope (in another thread)
+// of the current thread
+static thread_local CRunReportScope *	g_pCurrentScope = nullptr;
+static thread_local std::string			g_strThreadPath;
+
+/* ------------------------------------------------------------------- */
+
+CRunReport::CRunReport() :
+	m_bEnabled(false)
+{
+};
+
+/* ------------------------------------------------------------------- */
+
+CRunReport & CRunReport::GetInstance()
+{
+	static CRunReport		RunReport;
+
+	return RunReport;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CRunReport::SetFileName(LPCTSTR szFileName)
+{
+	std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+	m_strFileName = szFileName ? szFileName : _T("");
+	for (auto & pBuffer : m_vBuffers)
+	{
+		std::lock_guard<std::mutex>		BufferLock(pBuffer->m_Mutex);
+		pBuffer->m_vRecords.clear();
+	};
+	m_bEnabled = (m_strFileName.GetLength() > 0);
+};
+
+/* ------------------------------------------------------------------- */
+
+CRunReport::CThreadBuffer & CRunReport::GetThreadBuffer()
+{
+	// The buffers are owned by the report so that the records of the
+	// threads that are already finished are kept
+	static thread_local std::shared_ptr<CThreadBuffer>	pThreadBuffer;
+
+	if (!pThreadBuffer)
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		pThreadBuffer = std::make_shared<CThreadBuffer>();
+		m_vBuffers.push_back(pThreadBuffer);
+	};
+
+	return *pThreadBuffer;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CRunReport::AddRecord(const CRunReportRecord & rr)
+{
+	CThreadBuffer &					Buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex>		Lock(Buffer.m_Mutex);
+
+	Buffer.m_vRecords.push_back(rr);
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CRunReport::AddBytesRead(std::uint64_t lNrBytes)
+{
+	if (g_pCurrentScope)
+		g_pCurrentScope->GetRecord().m_lBytesRead += lNrBytes;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CRunReport::AddFramesDecoded(std::uint64_t lNrFrames)
+{
+	if (g_pCurrentScope)
+		g_pCurrentScope->GetRecord().m_lNrFrames += lNrFrames;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CRunReport::AddPixelsStacked(std::uint64_t lNrPixels)
+{
+	if (g_pCurrentScope)
+		g_pCurrentScope->GetRecord().m_lNrPixels += lNrPixels;
+};
+
+/* ------------------------------------------------------------------- */
+
+typedef std::pair<std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point>	TIMEINTERVAL;
+
+// Length of the union of the intervals: the time during which at least
+// one of the calls was running
+static double	GetCoveredTime(std::vector<TIMEINTERVAL> & vIntervals)
+{
+	double				fResult = 0;
+
+	std::sort(vIntervals.begin(), vIntervals.end());
+	for (size_t i = 0;i<vIntervals.size();)
+	{
+		const auto		Start = vIntervals[i].first;
+		auto			End = vIntervals[i].second;
+
+		for (i++;i<vIntervals.size() && vIntervals[i].first <= End;i++)
+			End = max(End, vIntervals[i].second);
+		fResult += std::chrono::duration<double>(End - Start).count();
+	};
+
+	return fResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CRunReport::WriteJSON(FILE * hFile, const std::vector<CRunReportRecord> & vStages)
+{
+	fprintf(hFile, "{\n  \"stages\": [\n");
+	for (size_t i = 0;i<vStages.size();i++)
+	{
+		const CRunReportRecord &	Stage = vStages[i];
+
+		fprintf(hFile, "    { \"stage\": \"%s\", \"calls\": %llu, \"wall_seconds\": %.6f, \"busy_seconds\": %.6f, \"cpu_seconds\": %.6f, \"bytes_read\": %llu, \"frames\": %llu, \"pixels\": %llu }%s\n",
+				Stage.m_strPath.c_str(), static_cast<unsigned long long>(Stage.m_lNrCalls), Stage.m_fWallTime, Stage.m_fBusyTime, Stage.m_fCPUTime,
+				static_cast<unsigned long long>(Stage.m_lBytesRead), static_cast<unsigned long long>(Stage.m_lNrFrames),
+				static_cast<unsigned long long>(Stage.m_lNrPixels), (i + 1 < vStages.size()) ? "," : "");
+	};
+	fprintf(hFile, "  ]\n}\n");
+
+	return !ferror(hFile);
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CRunReport::WriteCSV(FILE * hFile, const std::vector<CRunReportRecord> & vStages)
+{
+	fprintf(hFile, "stage,calls,wall_seconds,busy_seconds,cpu_seconds,bytes_read,frames,pixels\n");
+	for (const auto & Stage : vStages)
+		fprintf(hFile, "%s,%llu,%.6f,%.6f,%.6f,%llu,%llu,%llu\n",
+				Stage.m_strPath.c_str(), static_cast<unsigned long long>(Stage.m_lNrCalls), Stage.m_fWallTime, Stage.m_fBusyTime, Stage.m_fCPUTime,
+				static_cast<unsigned long long>(Stage.m_lBytesRead), static_cast<unsigned long long>(Stage.m_lNrFrames),
+				static_cast<unsigned long long>(Stage.m_lNrPixels));
+
+	return !ferror(hFile);
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CRunReport::Write()
+{
+	ZFUNCTRACE_RUNTIME();
+	bool								bResult = false;
+	std::map<std::string, CRunReportRecord>	mStages;
+	std::map<std::string, std::vector<TIMEINTERVAL>>	mIntervals;
+	CString								strFileName;
+
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		strFileName = m_strFileName;
+		for (auto & pBuffer : m_vBuffers)
+		{
+			std::lock_guard<std::mutex>		BufferLock(pBuffer->m_Mutex);
+
+			// The calls of a stage are summed (sorted by path so that the
+			// children follow their parent)
+			for (const auto & rr : pBuffer->m_vRecords)
+			{
+				CRunReportRecord &		Stage = mStages[rr.m_strPath];
+
+				Stage.m_strPath		= rr.m_strPath;
+				Stage.m_lNrCalls	+= rr.m_lNrCalls;
+				Stage.m_fBusyTime	+= rr.m_fBusyTime;
+				Stage.m_fCPUTime	+= rr.m_fCPUTime;
+				Stage.AddCounters(rr);
+				mIntervals[rr.m_strPath].emplace_back(rr.m_Start, rr.m_End);
+			};
+		};
+	};
+
+	// The calls of concurrent threads overlap: they are not summed
+	for (auto & Stage : mStages)
+		Stage.second.m_fWallTime = GetCoveredTime(mIntervals[Stage.first]);
+
+	if (strFileName.GetLength())
+	{
+		std::vector<CRunReportRecord>	vStages;
+		FILE *							hFile;
+
+		// The counters of a stage include those of all its sub stages,
+		// whatever the thread they ran in: the paths of the sub stages
+		// start with the path of the stage and follow it in the map
+		for (const auto & Stage : mStages)
+		{
+			CRunReportRecord		rr = Stage.second;
+			const std::string		strPrefix = Stage.first + "/";
+
+			for (auto it = mStages.lower_bound(strPrefix);it != mStages.end() && !it->first.compare(0, strPrefix.size(), strPrefix);it++)
+				rr.AddCounters(it->second);
+			vStages.push_back(rr);
+		};
+
+		hFile = _tfopen(strFileName, _T("wt"));
+		if (hFile)
+		{
+			if (!strFileName.Right(4).CompareNoCase(_T(".csv")))
+				bResult = WriteCSV(hFile, vStages);
+			else
+				bResult = WriteJSON(hFile, vStages);
+			fclose(hFile);
+		};
+
+		if (!bResult)
+			ZTRACE_RUNTIME("The run report could not be written");
+	};
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+CRunReportScope::CRunReportScope(const char * szStage, bool bWriteReport) :
+	m_bActive(CRunReport::GetInstance().IsEnabled()),
+	m_bWriteReport(bWriteReport),
+	m_pParent(nullptr),
+	m_fCPUStart(0)
+{
+	if (m_bActive)
+	{
+		m_pParent = g_pCurrentScope;
+		if (m_pParent)
+			m_Record.m_strPath = m_pParent->m_Record.m_strPath + "/";
+		else if (!g_strThreadPath.empty())
+			m_Record.m_strPath = g_strThreadPath + "/";
+		m_Record.m_strPath += szStage;
+
+		g_pCurrentScope = this;
+		m_fCPUStart = GetProcessCPUTime();
+		m_Start = std::chrono::steady_clock::now();
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+CRunReportScope::~CRunReportScope()
+{
+	if (m_bActive)
+	{
+		m_Record.m_Start = m_Start;
+		m_Record.m_End = std::chrono::steady_clock::now();
+		m_Record.m_fWallTime = std::chrono::duration<double>(m_Record.m_End - m_Start).count();
+		m_Record.m_fBusyTime = m_Record.m_fWallTime;
+		m_Record.m_fCPUTime = GetProcessCPUTime() - m_fCPUStart;
+		m_Record.m_lNrCalls = 1;
+
+		// Only the counters of this scope: the sub stages are added when
+		// the report is written
+		g_pCurrentScope = m_pParent;
+
+		CRunReport::GetInstance().AddRecord(m_Record);
+		if (m_bWriteReport && !m_pParent)
+			CRunReport::GetInstance().Write();
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+CRunReportScope * CRunReportScope::GetCurrent()
+{
+	return g_pCurrentScope;
+};
+
+/* ------------------------------------------------------------------- */
+
+std::string	CRunReportScope::GetCurrentPath()
+{
+	return g_pCurrentScope ? g_pCurrentScope->m_Record.m_strPath : g_strThreadPath;
+};
+
+/* ------------------------------------------------------------------- */
+
+CRunReportThread::CRunReportThread(const std::string & strParentPath)
+{
+	g_strThreadPath = strParentPath;
+};
+
+/* ------------------------------------------------------------------- */
+
+CRunReportThread::~CRunReportThread()
+{
+	g_strThreadPath.clear();
+};
+
+/* ------------------------------------------------------------------- */
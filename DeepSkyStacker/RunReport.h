@@ -0,0 +1,166 @@
+#ifndef __RUNREPORT_H__
+#define __RUNREPORT_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* ------------------------------------------------------------------- */
+
+// Run report of the engine: wall time, busy time, CPU time and counters
+// (bytes read, frames decoded, pixels stacked) of the main stages of a
+// registering or stacking run, written in JSON (or in CSV when the file
+// name ends with .csv) at the end of the run.
+// The wall time of a stage is the time during which at least one of its
+// calls was running: the calls made at the same time by several threads
+// are counted once, so a sub stage never has more wall time than its
+// parent. The busy time is the sum of the durations of all the calls.
+// The stages are timed with CRunReportScope objects. The nested scopes of
+// a thread make the hierarchy ("StackLightFrames/StackAll/LoadPicture"),
+// the closed scopes are kept in a buffer per thread and only merged when
+// the report is written. The counters of a stage include those of all its
+// sub stages, also the ones run by other threads (see CRunReportThread).
+// Nothing is recorded when no report file is set.
+
+/* ------------------------------------------------------------------- */
+
+class CRunReportRecord
+{
+public :
+	std::string			m_strPath;
+	std::chrono::steady_clock::time_point	m_Start,
+											m_End;
+	double				m_fWallTime;
+	double				m_fBusyTime;		// Sum of the durations of the calls
+	double				m_fCPUTime;			// Process CPU time (all the threads)
+	std::uint64_t		m_lNrCalls;
+	std::uint64_t		m_lBytesRead;
+	std::uint64_t		m_lNrFrames;
+	std::uint64_t		m_lNrPixels;
+
+public :
+	CRunReportRecord()
+	{
+		m_fWallTime		= 0;
+		m_fBusyTime		= 0;
+		m_fCPUTime		= 0;
+		m_lNrCalls		= 0;
+		m_lBytesRead	= 0;
+		m_lNrFrames		= 0;
+		m_lNrPixels		= 0;
+	};
+
+	void	AddCounters(const CRunReportRecord & rr)
+	{
+		m_lBytesRead	+= rr.m_lBytesRead;
+		m_lNrFrames		+= rr.m_lNrFrames;
+		m_lNrPixels		+= rr.m_lNrPixels;
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+class CRunReport
+{
+private :
+	class CThreadBuffer
+	{
+	public :
+		std::mutex						m_Mutex;
+		std::vector<CRunReportRecord>	m_vRecords;
+	};
+
+	std::mutex									m_Mutex;
+	std::atomic<bool>							m_bEnabled;
+	CString										m_strFileName;
+	std::vector<std::shared_ptr<CThreadBuffer>>	m_vBuffers;
+
+private :
+	CRunReport();
+
+	CThreadBuffer &	GetThreadBuffer();
+	bool	WriteJSON(FILE * hFile, const std::vector<CRunReportRecord> & vStages);
+	bool	WriteCSV(FILE * hFile, const std::vector<CRunReportRecord> & vStages);
+
+public :
+	CRunReport(const CRunReport &) = delete;
+	CRunReport & operator = (const CRunReport &) = delete;
+
+	static CRunReport &	GetInstance();
+
+	// Enables the report (an empty name disables it) and clears the
+	// records of the previous runs
+	void	SetFileName(LPCTSTR szFileName);
+
+	bool	IsEnabled() const
+	{
+		return m_bEnabled;
+	};
+
+	void	AddRecord(const CRunReportRecord & rr);
+
+	// Merges the records of all the threads by stage and writes the file
+	bool	Write();
+
+	// Counters of the innermost scope of the calling thread
+	static void	AddBytesRead(std::uint64_t lNrBytes);
+	static void	AddFramesDecoded(std::uint64_t lNrFrames);
+	static void	AddPixelsStacked(std::uint64_t lNrPixels);
+};
+
+/* ------------------------------------------------------------------- */
+
+// Times a stage until the end of the C++ scope.
+// When bWriteReport is set and the scope is the outermost one of the
+// thread the report is written when the scope ends.
+class CRunReportScope
+{
+private :
+	bool									m_bActive;
+	bool									m_bWriteReport;
+	CRunReportScope *						m_pParent;
+	CRunReportRecord						m_Record;
+	std::chrono::steady_clock::time_point	m_Start;
+	double									m_fCPUStart;
+
+public :
+	CRunReportScope(const char * szStage, bool bWriteReport = false);
+	~CRunReportScope();
+
+	CRunReportScope(const CRunReportScope &) = delete;
+	CRunReportScope & operator = (const CRunReportScope &) = delete;
+
+	CRunReportRecord &	GetRecord()
+	{
+		return m_Record;
+	};
+
+	// Innermost scope of the calling thread (nullptr if none)
+	static CRunReportScope *	GetCurrent();
+
+	// Path of the innermost scope of the calling thread, to be given to
+	// the threads started in this scope (see CRunReportThread)
+	static std::string	GetCurrentPath();
+};
+
+/* ------------------------------------------------------------------- */
+
+// The scopes of the thread are children of the scope of the thread that
+// started it, as long as this object exists
+class CRunReportThread
+{
+public :
+	CRunReportThread(const std::string & strParentPath);
+	~CRunReportThread();
+
+	CRunReportThread(const CRunReportThread &) = delete;
+	CRunReportThread & operator = (const CRunReportThread &) = delete;
+};
+
+/* ------------------------------------------------------------------- */
+
+#endif // __RUNREPORT_H__
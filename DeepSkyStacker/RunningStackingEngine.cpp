@@ -3,7 +3,10 @@
 
 #include "MatchingStars.h"
 #include "PixelTransform.h"
+#include "ThreadPool.h"
+#include "avx.h"
 #include <math.h>
+#include <algorithm>
 
 #define _USE_MATH_DEFINES
 #include <cmath>
@@ -14,6 +17,10 @@ CRunningStackingEngine::CRunningStackingEngine()
 {
 	m_lNrStacked = 0;
 	m_fTotalExposure = 0;
+	m_StackingMode = m_NextStackingMode = RUNSM_AVERAGE;
+	m_fKappa = m_fNextKappa = 2.5;
+	m_lWindowSize = m_lNextWindowSize = 10;
+	m_lWindowPosition = 0;
 };
 
 /* ------------------------------------------------------------------- */
@@ -24,65 +31,370 @@ CRunningStackingEngine::~CRunningStackingEngine()
 
 /* ------------------------------------------------------------------- */
 
-void	CRunningStackingEngine::CreatePublicBitmap()
+bool	CRunningStackingEngine::CreateFrameBitmap(CMemoryBitmap * pBitmap, bool bColor, LONG lHeight, CMemoryBitmap ** ppFrameBitmap)
 {
-	ZFUNCTRACE_RUNTIME();
-	bool					bMonochrome;
-	LONG					lWidth,
-							lHeight;
+	// Bitmap receiving the pixels of the registered light frame.
+	// It has the same sample type than the light frame so that the
+	// AVX stacking code can be used.
+	CSmartPtr<CMemoryBitmap>	pFrameBitmap;
 
-	if (m_pStackedBitmap && m_lNrStacked)
+	if (dynamic_cast<CGrayBitmapT<float> *>(pBitmap) || dynamic_cast<CColorBitmapT<float> *>(pBitmap))
+	{
+		if (bColor)
+			pFrameBitmap.Attach(new C96BitFloatColorBitmap);
+		else
+			pFrameBitmap.Attach(new C32BitFloatGrayBitmap);
+	}
+	else if (dynamic_cast<CGrayBitmapT<DWORD> *>(pBitmap) || dynamic_cast<CColorBitmapT<DWORD> *>(pBitmap))
 	{
-		bMonochrome = m_pStackedBitmap->IsMonochrome();
-		lWidth		= m_pStackedBitmap->Width();
-		lHeight		= m_pStackedBitmap->Height();
+		if (bColor)
+			pFrameBitmap.Attach(new C96BitColorBitmap);
+		else
+			pFrameBitmap.Attach(new C32BitGrayBitmap);
+	}
+	else if (bColor)
+		pFrameBitmap.Attach(new C48BitColorBitmap);
+	else
+		pFrameBitmap.Attach(new C16BitGrayBitmap);
 
-		if (!m_pPublicBitmap)
+	pFrameBitmap->Init(pBitmap->Width(), lHeight);
+
+	return pFrameBitmap.CopyTo(ppFrameBitmap);
+};
+
+/* ------------------------------------------------------------------- */
+
+LONG	CRunningStackingEngine::GetFrameBands(const CPixelTransform & PixTransform, LONG lWidth, LONG lHeight, LONG lNrBands, FRAMEBANDVECTOR & vBands)
+{
+	// Splits the source rows in bands and finds the output rows that each
+	// band can reach. The registering transformations are smooth so these
+	// rows come from the transformed border of the band (and from a grid
+	// inside it), with a margin of one row on each side.
+	// Returns the total number of output rows of the bands.
+	LONG				lTotalRows = 0;
+
+	vBands.clear();
+	vBands.resize(lNrBands);
+	for (LONG b = 0;b<lNrBands;b++)
+	{
+		CFrameBand &	Band = vBands[b];
+
+		Band.m_lStart	= lHeight * b / lNrBands;
+		Band.m_lEnd		= lHeight * (b + 1) / lNrBands;
+		if (Band.m_lStart < Band.m_lEnd)
 		{
-			if (bMonochrome)
-				m_pPublicBitmap.Attach(new C16BitGrayBitmap);
-			else
-				m_pPublicBitmap.Attach(new C48BitColorBitmap);
+			double			fMinY = PixTransform.Transform(CPointExt(0, Band.m_lStart)).Y;
+			double			fMaxY = fMinY;
+			const auto		addPoint = [&](LONG i, LONG j)
+			{
+				const double	fY = PixTransform.Transform(CPointExt(i, j)).Y;
 
-			m_pPublicBitmap->Init(lWidth, lHeight);
+				fMinY = min(fMinY, fY);
+				fMaxY = max(fMaxY, fY);
+			};
+
+			for (LONG i = 0;i<lWidth;i++)
+			{
+				addPoint(i, Band.m_lStart);
+				addPoint(i, Band.m_lEnd-1);
+			};
+			for (LONG j = Band.m_lStart;j<Band.m_lEnd;j++)
+			{
+				addPoint(0, j);
+				addPoint(lWidth-1, j);
+			};
+			for (LONG j = Band.m_lStart;j<Band.m_lEnd;j += 16)
+				for (LONG i = 0;i<lWidth;i += 16)
+					addPoint(i, j);
+
+			// The pixels are dispatched on the rows floor(Y) and floor(Y)+1
+			fMinY = max(-2.0, min(fMinY, lHeight + 2.0));
+			fMaxY = max(-4.0, min(fMaxY, lHeight + 2.0));
+			Band.m_lFirstRow	= max(0L, static_cast<LONG>(floor(fMinY)) - 1);
+			Band.m_lEndRow		= max(Band.m_lFirstRow, min(lHeight, static_cast<LONG>(floor(fMaxY)) + 3));
 		};
+		lTotalRows += Band.m_lEndRow - Band.m_lFirstRow;
+	};
 
-		PixelIterator			itIn;
-		PixelIterator			itOut;
+	return lTotalRows;
+};
 
-		m_pPublicBitmap->GetIterator(&itOut);
-		m_pStackedBitmap->GetIterator(&itIn);
+/* ------------------------------------------------------------------- */
 
-		for (LONG j = 0;j<lHeight;j++)
-			for (LONG i = 0;i<lWidth;i++)
+void	CRunningStackingEngine::DispatchRows(CMemoryBitmap * pBitmap, CFrameBand & Band, const CPixelTransform & PixTransform)
+{
+	const LONG			lWidth = pBitmap->Width();
+	const LONG			lHeight = pBitmap->Height();
+	const LONG			lBandHeight = Band.m_lEndRow - Band.m_lFirstRow;
+	CMemoryBitmap *		pFrameBitmap = Band.m_pBitmap;
+	CPixelTransform		BandTransform(PixTransform);
+	CTaskInfo			TaskInfo;
+	CEntropyInfo		EntropyInfo;
+
+	// The first row of the band bitmap is the first output row of the band
+	BandTransform.SetShift(PixTransform.m_fXShift, PixTransform.m_fYShift - Band.m_lFirstRow);
+
+	AvxEntropy			avxEntropy(*pBitmap, EntropyInfo, nullptr);
+	AvxStacking			avxStacking(Band.m_lStart, Band.m_lEnd, *pBitmap, *pFrameBitmap, CRect(0, 0, lWidth, lBandHeight), avxEntropy);
+
+	TaskInfo.m_Method = MBP_AVERAGE;
+
+	// First try AVX accelerated code, if not supported -> run conventional code.
+	if (!avxStacking.stack(BandTransform, TaskInfo, m_BackgroundCalibration, 1))
+		return;
+
+	PIXELDISPATCHVECTOR	vPixels;
+
+	vPixels.reserve(16);
+	for (LONG j = Band.m_lStart;j<Band.m_lEnd;j++)
+	{
+		for (LONG i = 0;i<lWidth;i++)
+		{
+			double		fRed, fGreen, fBlue;
+			CPointExt	pt(i, j);
+			CPointExt	ptOut;
+
+			ptOut = BandTransform.Transform(pt);
+			pBitmap->GetPixel(i, j, fRed, fGreen, fBlue);
+
+			if (m_BackgroundCalibration.m_BackgroundCalibrationMode != BCM_NONE)
+				m_BackgroundCalibration.ApplyCalibration(fRed, fGreen, fBlue);
+
+			if ((fRed || fGreen || fBlue) && ptOut.IsInRect(0, -Band.m_lFirstRow, lWidth-1, lHeight-1-Band.m_lFirstRow))
 			{
-				if (bMonochrome)
-				{
-					double			fGray;
+				vPixels.resize(0);
+				ComputePixelDispatch(ptOut, 1.0, vPixels);
 
-					itIn->GetPixel(fGray);
-					fGray /= m_lNrStacked;
-					itOut->SetPixel(min(fGray, 255.0));
-				}
-				else
+				for (LONG k = 0;k<vPixels.size();k++)
 				{
-					double			fRed, fGreen, fBlue;
+					CPixelDispatch &		Pixel = vPixels[k];
 
-					itIn->GetPixel(fRed, fGreen, fBlue);
-					fRed	/= m_lNrStacked;
-					fGreen	/= m_lNrStacked;
-					fBlue	/= m_lNrStacked;
-					itOut->SetPixel(min(fRed, 255.0), min(fGreen, 255.0), min(fBlue, 255.0));
+					// For each plane adjust the values
+					if (Pixel.m_lX >= 0 && Pixel.m_lX < lWidth &&
+						Pixel.m_lY >= 0 && Pixel.m_lY < lBandHeight)
+					{
+						double		fPreviousRed,
+									fPreviousGreen,
+									fPreviousBlue;
+
+						pFrameBitmap->GetPixel(Pixel.m_lX, Pixel.m_lY, fPreviousRed, fPreviousGreen, fPreviousBlue);
+						fPreviousRed   += (double)fRed * Pixel.m_fPercentage;
+						fPreviousGreen += (double)fGreen * Pixel.m_fPercentage;
+						fPreviousBlue  += (double)fBlue * Pixel.m_fPercentage;
+						pFrameBitmap->SetPixel(Pixel.m_lX, Pixel.m_lY, min(fPreviousRed, 255.0), min(fPreviousGreen, 255.0), min(fPreviousBlue, 255.0));
+					};
 				};
-				(*itIn)++;
-				(*itOut)++;
 			};
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CRunningStackingEngine::InitStackingMode(LONG lWidth, LONG lHeight, bool bColor)
+{
+	// Called with the first frame of a new stacked image
+	const size_t		lNrValues = static_cast<size_t>(lWidth) * lHeight * (bColor ? 3 : 1);
+
+	m_StackingMode	= m_NextStackingMode;
+	m_fKappa		= m_fNextKappa;
+	m_lWindowSize	= m_lNextWindowSize;
+	m_lWindowPosition = 0;
+
+	m_vSquares.clear();
+	m_vCounts.clear();
+	m_vWindow.clear();
+	m_vWindowSums.clear();
+	m_vWindowExposures.clear();
+
+	if (m_StackingMode == RUNSM_SIGMACLIPPING)
+	{
+		m_vSquares.resize(lNrValues, 0.0f);
+		m_vCounts.resize(lNrValues, 0);
+	}
+	else if (m_StackingMode == RUNSM_ROLLINGWINDOW)
+	{
+		m_vWindow.resize(lNrValues * m_lWindowSize, 0);
+		m_vWindowSums.resize(lNrValues, 0);
+		m_vWindowExposures.resize(m_lWindowSize, 0.0);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+template <typename TType>
+bool	CRunningStackingEngine::AccumulateFrame(const FRAMEBANDVECTOR & vBands)
+{
+	// Adds the registered light frame (the sum of the bitmaps of its bands)
+	// to the running stack and updates the public (preview) bitmap in the
+	// same pass
+	std::vector<const CFrameBand *>	vFrameBands;
+	std::vector<TType *>	vFramePlanes;
+	float *				pStackedPlanes[3];
+	WORD *				pPublicPlanes[3];
+	double				fFrameMultiplier = 1.0,
+						fStackedMultiplier = 1.0,
+						fPublicMultiplier = 1.0;
+
+	// Bands reaching no output row have no bitmap
+	for (const CFrameBand & Band : vBands)
+	{
+		TType *			pFramePlanes[3];
+
+		if (!Band.m_pBitmap)
+			continue;
+		if (!GetBitmapPlanes(Band.m_pBitmap.m_p, pFramePlanes, fFrameMultiplier) ||
+			(Band.m_pBitmap->Width() != Band.m_pBitmap->RealWidth()))
+			return false;
+		vFrameBands.push_back(&Band);
+		vFramePlanes.insert(vFramePlanes.end(), pFramePlanes, pFramePlanes + 3);
+	};
+
+	const size_t		lNrBands = vFrameBands.size();
+
+	if (!GetBitmapPlanes(m_pStackedBitmap.m_p, pStackedPlanes, fStackedMultiplier) ||
+		!GetBitmapPlanes(m_pPublicBitmap.m_p, pPublicPlanes, fPublicMultiplier))
+		return false;
+
+	const LONG			lWidth = m_pStackedBitmap->Width();
+	const size_t		lNrPixels = static_cast<size_t>(lWidth) * m_pStackedBitmap->Height();
+	const LONG			lNrPlanes = m_pStackedBitmap->IsMonochrome() ? 1 : 3;
+	const float			fFrameFactor = static_cast<float>(fStackedMultiplier / fFrameMultiplier);
+	// Same saturation as when all the bands are dispatched in one bitmap
+	const float			fFrameMax = static_cast<float>(255.0 * fFrameMultiplier);
+	const float			fPublicMax = static_cast<float>(255.0 * fPublicMultiplier);
+	float				fPublicFactor = static_cast<float>(fPublicMultiplier / fStackedMultiplier);
+
+	// Rolling window: the samples are stored on 16 bits (1/256 of the
+	// stacked scale) so that the sums are exact integers and removing
+	// the oldest frame never drifts
+	const float			fWindowScale = static_cast<float>(256.0 / fStackedMultiplier);
+	const bool			bWindowFull = (m_lNrStacked >= m_lWindowSize);
+	WORD *				pWindowSlot = nullptr;
+
+	if (m_StackingMode == RUNSM_AVERAGE)
+		fPublicFactor /= (m_lNrStacked + 1);
+	else if (m_StackingMode == RUNSM_ROLLINGWINDOW)
+	{
+		pWindowSlot = m_vWindow.data() + lNrPixels * lNrPlanes * m_lWindowPosition;
+		fPublicFactor /= min(m_lNrStacked + 1, m_lWindowSize);
 	};
+
+	CThreadPool::GetInstance().ParallelFor(0, m_pStackedBitmap->Height(), 0,
+		[&](long lStart, long lEnd)
+		{
+			const size_t	lFirst = static_cast<size_t>(lStart) * lWidth;
+			const size_t	lLast = static_cast<size_t>(lEnd) * lWidth;
+
+			std::vector<float>	vFrame(lLast - lFirst);
+
+			for (LONG k = 0;k<lNrPlanes;k++)
+			{
+				float *			pFrame = vFrame.data();
+				float *			pStacked = pStackedPlanes[k];
+				WORD *			pPublic = pPublicPlanes[k];
+
+				// Only the bands covering these rows contribute
+				std::fill(vFrame.begin(), vFrame.end(), 0.0f);
+				for (size_t b = 0;b<lNrBands;b++)
+				{
+					const CFrameBand &	Band = *vFrameBands[b];
+					const LONG		lFirstRow = max(static_cast<LONG>(lStart), Band.m_lFirstRow);
+					const LONG		lEndRow = min(static_cast<LONG>(lEnd), Band.m_lEndRow);
+
+					for (LONG j = lFirstRow;j<lEndRow;j++)
+					{
+						const TType *	pBandRow = vFramePlanes[b * 3 + k] + static_cast<size_t>(j - Band.m_lFirstRow) * lWidth;
+						float *			pFrameRow = pFrame + static_cast<size_t>(j - lStart) * lWidth;
+
+						for (LONG i = 0;i<lWidth;i++)
+							pFrameRow[i] += static_cast<float>(pBandRow[i]);
+					};
+				};
+				for (float & fValue : vFrame)
+					fValue = min(fValue, fFrameMax);
+
+				switch (m_StackingMode)
+				{
+				case RUNSM_AVERAGE :
+					for (size_t i = lFirst;i<lLast;i++)
+					{
+						const float		fSum = pStacked[i] + pFrame[i - lFirst] * fFrameFactor;
+
+						pStacked[i] = fSum;
+						pPublic[i]  = static_cast<WORD>(min(fSum * fPublicFactor, fPublicMax));
+					};
+					break;
+				case RUNSM_SIGMACLIPPING :
+					{
+						// The stacked bitmap is the running mean of the kept values.
+						// The values are only clipped once the mean and sigma are
+						// known well enough, and sigma is never taken below one
+						// step of an 8 bits camera: identical first values (8 bits
+						// cameras, dark background) would otherwise reject every
+						// other value and freeze the pixel, slow sky brightness
+						// changes included.
+						float *			pSquares = m_vSquares.data() + lNrPixels * k;
+						WORD *			pCounts = m_vCounts.data() + lNrPixels * k;
+						const float		fKappa2 = static_cast<float>(m_fKappa * m_fKappa);
+						const float		fMinVariance = static_cast<float>(fStackedMultiplier * fStackedMultiplier);
+						const LONG		lMinCount = 5;
+
+						for (size_t i = lFirst;i<lLast;i++)
+						{
+							const float		fValue = pFrame[i - lFirst] * fFrameFactor;
+							const LONG		lCount = pCounts[i];
+
+							// Empty pixels (outside the registered frame) are not values
+							if (fValue > 0)
+							{
+								const float		fDelta = fValue - pStacked[i];
+
+								if (lCount < lMinCount || fDelta * fDelta * (lCount - 1) <= fKappa2 * max(pSquares[i], fMinVariance * (lCount - 1)))
+								{
+									// Welford update of the mean and of the sum of squares
+									const LONG		lNewCount = min(lCount + 1, 65535L);
+									const float		fMean = pStacked[i] + fDelta / lNewCount;
+
+									pSquares[i] += fDelta * (fValue - fMean);
+									pStacked[i] = fMean;
+									pCounts[i]	= static_cast<WORD>(lNewCount);
+								};
+							};
+							pPublic[i] = static_cast<WORD>(min(pStacked[i] * fPublicFactor, fPublicMax));
+						};
+					};
+					break;
+				case RUNSM_ROLLINGWINDOW :
+					{
+						WORD *			pSlot = pWindowSlot + lNrPixels * k;
+						DWORD *			pSums = m_vWindowSums.data() + lNrPixels * k;
+
+						for (size_t i = lFirst;i<lLast;i++)
+						{
+							const WORD		wValue = static_cast<WORD>(min(pFrame[i - lFirst] * fFrameFactor * fWindowScale + 0.5f, 65535.0f));
+							const DWORD		dwSum = pSums[i] - (bWindowFull ? pSlot[i] : 0) + wValue;
+
+							pSlot[i]	= wValue;
+							pSums[i]	= dwSum;
+							pStacked[i] = static_cast<float>(dwSum) / fWindowScale;
+							pPublic[i]  = static_cast<WORD>(min(pStacked[i] * fPublicFactor, fPublicMax));
+						};
+					};
+					break;
+				};
+			};
+		});
+
+	if (m_StackingMode == RUNSM_ROLLINGWINDOW)
+		m_lWindowPosition = (m_lWindowPosition + 1) % m_lWindowSize;
+
+	return true;
 };
 
 /* ------------------------------------------------------------------- */
 
-bool	CRunningStackingEngine::AddImage(CLightFrameInfo & lfi, CDSSProgress * pProgress)
+bool	CRunningStackingEngine::AddImage(CLightFrameInfo & lfi, CDSSProgress * pProgress, CMemoryBitmap * pInBitmap)
 {
 	ZFUNCTRACE_RUNTIME();
 	bool				bResult = false;
@@ -90,9 +402,9 @@ bool	CRunningStackingEngine::AddImage(CLightFrameInfo & lfi, CDSSProgress * pPro
 						lHeight;
 	bool				bColor;
 
-	// First load the input bitmap
-	CSmartPtr<CMemoryBitmap>		pBitmap;
-	if (::LoadFrame(lfi.m_strFileName,PICTURETYPE_LIGHTFRAME, pProgress, &pBitmap))
+	// First load the input bitmap (unless it is still in memory)
+	CSmartPtr<CMemoryBitmap>		pBitmap = pInBitmap;
+	if (pBitmap || ::LoadFrame(lfi.m_strFileName,PICTURETYPE_LIGHTFRAME, pProgress, &pBitmap))
 	{
 		CString			strText;
 
@@ -109,6 +421,8 @@ bool	CRunningStackingEngine::AddImage(CLightFrameInfo & lfi, CDSSProgress * pPro
 			else
 				m_pStackedBitmap.Attach(new C32BitFloatGrayBitmap);
 			m_pStackedBitmap->Init(lWidth, lHeight);
+			m_pPublicBitmap.Release();
+			InitStackingMode(lWidth, lHeight, bColor);
 		};
 
 		if (m_BackgroundCalibration.m_BackgroundCalibrationMode != BCM_NONE)
@@ -121,12 +435,10 @@ bool	CRunningStackingEngine::AddImage(CLightFrameInfo & lfi, CDSSProgress * pPro
 			m_BackgroundCalibration.ComputeBackgroundCalibration(pBitmap, !m_lNrStacked, pProgress);
 		};
 
-		// Stack it (average)
-		CPixelTransform		PixTransform(lfi.m_BilinearParameters);
-		CString				strDescription;
-		PIXELDISPATCHVECTOR	vPixels;
-
-		vPixels.reserve(16);
+		// Stack it
+		CPixelTransform				PixTransform(lfi.m_BilinearParameters);
+		CString						strDescription;
+		FRAMEBANDVECTOR				vBands;
 
 		strDescription = lfi.m_strInfos;
 		if (lfi.m_lNrChannels==3)
@@ -136,55 +448,64 @@ bool	CRunningStackingEngine::AddImage(CLightFrameInfo & lfi, CDSSProgress * pPro
 
 		if (pProgress)
 			pProgress->Start2(strText, lHeight);
-		for (LONG j = 0;j<lHeight;j++)
-		{
-			for (LONG i = 0;i<lWidth;i++)
-			{
-				double		fRed, fGreen, fBlue;
-				CPointExt	pt(i, j);
-				CPointExt	ptOut;
 
-				ptOut = PixTransform.Transform(pt);
-				pBitmap->GetPixel(i, j, fRed, fGreen, fBlue);
+		// The registered light frame is built in parallel bands of source
+		// rows. The pixels of neighbouring bands are dispatched on the same
+		// output rows, so each band has its own bitmap covering the output
+		// rows it can reach and the bands are summed when the frame is
+		// added. When the frame is strongly rotated the bands overlap a lot:
+		// there are less bands so that the bitmaps of the bands never hold
+		// more than twice the rows of the frame.
+		LONG				lNrBands = CThreadPool::GetInstance().GetNrThreads();
 
-				if (m_BackgroundCalibration.m_BackgroundCalibrationMode != BCM_NONE)
-					m_BackgroundCalibration.ApplyCalibration(fRed, fGreen, fBlue);
+		while (GetFrameBands(PixTransform, lWidth, lHeight, lNrBands, vBands) > 2 * lHeight && lNrBands > 1)
+			lNrBands = (lNrBands + 1) / 2;
 
-				if ((fRed || fGreen || fBlue) && ptOut.IsInRect(0, 0, lWidth-1, lHeight-1))
+		CThreadPool::GetInstance().ParallelFor(0, lNrBands, 1,
+			[&](long lStart, long lEnd)
+			{
+				for (long b = lStart;b<lEnd;b++)
 				{
-					vPixels.resize(0);
-					ComputePixelDispatch(ptOut, 1.0, vPixels);
-
-					for (LONG k = 0;k<vPixels.size();k++)
-					{
-						CPixelDispatch &		Pixel = vPixels[k];
+					CFrameBand &	Band = vBands[b];
 
-						// For each plane adjust the values
-						if (Pixel.m_lX >= 0 && Pixel.m_lX < lWidth &&
-							Pixel.m_lY >= 0 && Pixel.m_lY < lHeight)
-						{
-							double		fPreviousRed,
-										fPreviousGreen,
-										fPreviousBlue;
-
-							m_pStackedBitmap->GetPixel(Pixel.m_lX, Pixel.m_lY, fPreviousRed, fPreviousGreen, fPreviousBlue);
-							fPreviousRed   += (double)fRed * Pixel.m_fPercentage;
-							fPreviousGreen += (double)fGreen * Pixel.m_fPercentage;
-							fPreviousBlue  += (double)fBlue * Pixel.m_fPercentage;
-							m_pStackedBitmap->SetPixel(Pixel.m_lX, Pixel.m_lY, fPreviousRed, fPreviousGreen, fPreviousBlue);
-						};
-					};
+					if (Band.m_lEndRow > Band.m_lFirstRow &&
+						CreateFrameBitmap(pBitmap, bColor, Band.m_lEndRow - Band.m_lFirstRow, &Band.m_pBitmap))
+						DispatchRows(pBitmap, Band, PixTransform);
 				};
-			};
-			if (pProgress)
-				pProgress->Progress2(nullptr, j+1);
+			},
+			[pProgress, lHeight, lNrBands](long lNrProcessed) -> bool
+			{
+				if (pProgress)
+					pProgress->Progress2(nullptr, lHeight * lNrProcessed / lNrBands);
+				return true;
+			});
+
+		if (!m_pPublicBitmap)
+		{
+			if (bColor)
+				m_pPublicBitmap.Attach(new C48BitColorBitmap);
+			else
+				m_pPublicBitmap.Attach(new C16BitGrayBitmap);
+
+			m_pPublicBitmap->Init(lWidth, lHeight);
 		};
 
+		// Add it to the running stack and refresh the preview at once
+		// (the frame bitmap is always one of the types handled here)
+		bResult = AccumulateFrame<WORD>(vBands) ||
+				  AccumulateFrame<DWORD>(vBands) ||
+				  AccumulateFrame<float>(vBands);
+
 		if (pProgress)
 			pProgress->End2();
-		m_lNrStacked++;
-		m_fTotalExposure += lfi.m_fExposure;
-		bResult = true;
+		if (bResult)
+		{
+			m_lNrStacked++;
+			m_fTotalExposure += lfi.m_fExposure;
+			// The frame took the slot of the oldest frame of the window
+			if (m_StackingMode == RUNSM_ROLLINGWINDOW)
+				m_vWindowExposures[(m_lWindowPosition + m_lWindowSize - 1) % m_lWindowSize] = lfi.m_fExposure;
+		};
 	};
 
 	if (bResult && !m_MatchingStars.IsReferenceSet())
@@ -197,9 +518,6 @@ bool	CRunningStackingEngine::AddImage(CLightFrameInfo & lfi, CDSSProgress * pPro
 			m_MatchingStars.AddReferenceStar(vStarsOrg[i].m_fX, vStarsOrg[i].m_fY);
 	};
 
-	if (bResult)
-		CreatePublicBitmap();
-
 	return bResult;
 };
 
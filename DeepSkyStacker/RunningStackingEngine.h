@@ -7,6 +7,36 @@
 
 /* ------------------------------------------------------------------- */
 
+typedef enum tagRUNNINGSTACKINGMODE
+{
+	RUNSM_AVERAGE			= 0,	// Average of all the frames
+	RUNSM_SIGMACLIPPING		= 1,	// Average of the values within kappa sigmas of the running mean
+	RUNSM_ROLLINGWINDOW		= 2		// Average of the last frames only
+}RUNNINGSTACKINGMODE;
+
+/* ------------------------------------------------------------------- */
+
+// Part of the registered light frame built from the source rows m_lStart
+// to m_lEnd. The bitmap only covers the output rows that these rows can
+// reach (m_lFirstRow to m_lEndRow).
+class CFrameBand
+{
+public :
+	CSmartPtr<CMemoryBitmap>		m_pBitmap;
+	LONG							m_lFirstRow;
+	LONG							m_lEndRow;
+	LONG							m_lStart,
+									m_lEnd;
+
+	CFrameBand()
+	{
+		m_lFirstRow = m_lEndRow = 0;
+		m_lStart = m_lEnd = 0;
+	};
+};
+
+typedef std::vector<CFrameBand>		FRAMEBANDVECTOR;
+
 class CRunningStackingEngine
 {
 private :
@@ -17,15 +47,43 @@ private :
 	double							m_fTotalExposure;
 	CMatchingStars					m_MatchingStars;
 
+	// Mode used for the current stacked image and the one used after
+	// the next Clear
+	RUNNINGSTACKINGMODE				m_StackingMode;
+	double							m_fKappa;
+	LONG							m_lWindowSize;
+	RUNNINGSTACKINGMODE				m_NextStackingMode;
+	double							m_fNextKappa;
+	LONG							m_lNextWindowSize;
+
+	// Sigma clipping: m_pStackedBitmap is the running mean, the sums of
+	// the squared differences (Welford) and the number of values kept
+	// are stored for each pixel of each plane
+	std::vector<float>				m_vSquares;
+	std::vector<WORD>				m_vCounts;
+
+	// Rolling window: ring buffer of the last frames (16 bits samples)
+	// and exact integer sums of the frames in the window, and exposures
+	// of the frames in the window
+	std::vector<WORD>				m_vWindow;
+	std::vector<DWORD>				m_vWindowSums;
+	std::vector<double>				m_vWindowExposures;
+	LONG							m_lWindowPosition;
+
 private:
-	void	CreatePublicBitmap();
+	void	InitStackingMode(LONG lWidth, LONG lHeight, bool bColor);
+	bool	CreateFrameBitmap(CMemoryBitmap * pBitmap, bool bColor, LONG lHeight, CMemoryBitmap ** ppFrameBitmap);
+	LONG	GetFrameBands(const CPixelTransform & PixTransform, LONG lWidth, LONG lHeight, LONG lNrBands, FRAMEBANDVECTOR & vBands);
+	void	DispatchRows(CMemoryBitmap * pBitmap, CFrameBand & Band, const CPixelTransform & PixTransform);
+	template <typename TType>
+	bool	AccumulateFrame(const FRAMEBANDVECTOR & vBands);
 
 public :
 	CRunningStackingEngine();
 	~CRunningStackingEngine();
 
 	bool	ComputeOffset(CLightFrameInfo & lfi);
-	bool	AddImage(CLightFrameInfo & lfi, CDSSProgress * pProgress);
+	bool	AddImage(CLightFrameInfo & lfi, CDSSProgress * pProgress, CMemoryBitmap * pInBitmap = nullptr);
 	bool	GetStackedImage(CMemoryBitmap ** ppBitmap)
 	{
 		bool			bResult = false;
@@ -39,20 +97,62 @@ public :
 		return bResult;
 	};
 
+	// Number of frames and total exposure of the stacked image (only the
+	// frames in the window in rolling window mode)
 	LONG	GetNrStackedImages()
 	{
-		return m_lNrStacked;
+		if (m_StackingMode == RUNSM_ROLLINGWINDOW)
+			return min(m_lNrStacked, m_lWindowSize);
+		else
+			return m_lNrStacked;
 	};
 
 	double	GetTotalExposure()
 	{
-		return m_fTotalExposure;
+		if (m_StackingMode == RUNSM_ROLLINGWINDOW)
+		{
+			double			fExposure = 0;
+
+			for (double fFrameExposure : m_vWindowExposures)
+				fExposure += fFrameExposure;
+			return fExposure;
+		}
+		else
+			return m_fTotalExposure;
+	};
+
+	// The new mode is used from the next frame if nothing is stacked yet,
+	// else after the next Clear
+	void	SetStackingMode(RUNNINGSTACKINGMODE Mode, double fKappa, LONG lWindowSize)
+	{
+		switch (Mode)
+		{
+		case RUNSM_SIGMACLIPPING :
+		case RUNSM_ROLLINGWINDOW :
+			m_NextStackingMode = Mode;
+			break;
+		default :
+			m_NextStackingMode = RUNSM_AVERAGE;
+			break;
+		};
+		m_fNextKappa		= (fKappa > 0) ? fKappa : 2.5;
+		m_lNextWindowSize	= max(1L, lWindowSize);
 	};
 
 	void	Clear()
 	{
 		m_pStackedBitmap.Release();
 		m_pPublicBitmap.Release();
+		m_vSquares.clear();
+		m_vSquares.shrink_to_fit();
+		m_vCounts.clear();
+		m_vCounts.shrink_to_fit();
+		m_vWindow.clear();
+		m_vWindow.shrink_to_fit();
+		m_vWindowSums.clear();
+		m_vWindowSums.shrink_to_fit();
+		m_vWindowExposures.clear();
+		m_lWindowPosition = 0;
 		m_lNrStacked = 0;
 		m_fTotalExposure = 0;
 	};
@@ -37,6 +37,20 @@ const		DWORD					IDC_EDIT_STAR   = 2;
 const		DWORD					IDC_EDIT_COMET  = 3;
 const		DWORD					IDC_EDIT_SAVE   = 4;
 
+/* ------------------------------------------------------------------- */
+
+static void	ScanSelectedFiles(CFileDialog & dlgOpen)
+{
+	std::vector<CString>	vFiles;
+	POSITION				pos;
+
+	pos = dlgOpen.GetStartPosition();
+	while (pos)
+		vFiles.push_back(dlgOpen.GetNextPathName(pos));
+
+	ScanPicturesInfo(vFiles);
+};
+
 /* ------------------------------------------------------------------- */
 /* ------------------------------------------------------------------- */
 /////////////////////////////////////////////////////////////////////////////
@@ -600,6 +614,7 @@ void CStackingDlg::OnAdddarks()
 		POSITION		pos;
 
 		BeginWaitCursor();
+		ScanSelectedFiles(dlgOpen);
 		pos = dlgOpen.GetStartPosition();
 		while (pos)
 		{
@@ -678,6 +693,7 @@ void CStackingDlg::OnAddDarkFlats()
 		POSITION		pos;
 
 		BeginWaitCursor();
+		ScanSelectedFiles(dlgOpen);
 		pos = dlgOpen.GetStartPosition();
 		while (pos)
 		{
@@ -755,7 +771,7 @@ void CStackingDlg::OnAddFlats()
 		POSITION		pos;
 
 		BeginWaitCursor();
-
+		ScanSelectedFiles(dlgOpen);
 		pos = dlgOpen.GetStartPosition();
 		while (pos)
 		{
@@ -834,6 +850,7 @@ void CStackingDlg::OnAddOffsets()
 		POSITION		pos;
 
 		BeginWaitCursor();
+		ScanSelectedFiles(dlgOpen);
 		pos = dlgOpen.GetStartPosition();
 		while (pos)
 		{
@@ -908,6 +925,7 @@ void CStackingDlg::OnAddpictures()
 		POSITION		pos;
 
 		BeginWaitCursor();
+		ScanSelectedFiles(dlgOpen);
 		pos = dlgOpen.GetStartPosition();
 		while (pos)
 		{
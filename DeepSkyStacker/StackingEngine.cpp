@@ -9,6 +9,8 @@
 #include "TIFFUtil.h"
 #include "FITSUtil.h"
 #include "Multitask.h"
+#include "DSSPlatform.h"
+#include "ThreadPool.h"
 #include "Histogram.h"
 #include "Filters.h"
 #include "CosmeticEngine.h"
@@ -16,6 +18,12 @@
 #include <iostream>
 #include "avx.h"
 #include "avx_avg.h"
+#include "RunReport.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 
 
 #define _USE_MATH_DEFINES
@@ -447,29 +455,55 @@ bool	CStackingEngine::AddLightFramesToList(CAllStackingTasks & tasks)
 		bReferenceFrameFound = true;
 
 	m_vBitmaps.clear();
+
+	// The registering info of all the light frames are read in parallel
+	std::vector<const CFrameInfo *>		vLightFrames;
+	std::vector<CLightFrameInfo>		vRegistered;
+
 	for (i = 0;i<tasks.m_vTasks.size();i++)
 	{
 		if (tasks.m_vTasks[i].m_TaskType == PICTURETYPE_LIGHTFRAME)
 		{
 			for (j = 0;j<tasks.m_vTasks[i].m_vBitmaps.size();j++)
-			{
-				CLightFrameInfo			lfi;
+				vLightFrames.push_back(&tasks.m_vTasks[i].m_vBitmaps[j]);
+		};
+	};
 
-				lfi.SetBitmap(tasks.m_vTasks[i].m_vBitmaps[j].m_strFileName, false, false);
+	vRegistered.resize(vLightFrames.size());
+	for (i = 0;i<vLightFrames.size();i++)
+	{
+		TCHAR				szDrive[1+_MAX_DRIVE];
+		TCHAR				szDir[1+_MAX_DIR];
+		TCHAR				szFile[1+_MAX_FNAME];
+		TCHAR				szInfoName[1+_MAX_PATH];
+
+		_tsplitpath(vLightFrames[i]->m_strFileName, szDrive, szDir, szFile, nullptr);
+		_tmakepath(szInfoName, szDrive, szDir, szFile, _T(".Info.txt"));
+		vRegistered[i].m_strInfoFileName = szInfoName;
+	};
 
-				if (lfi.IsRegistered())
-				{
-					lfi = tasks.m_vTasks[i].m_vBitmaps[j];
-					lfi.RefreshSuperPixel();
+	CThreadPool::GetInstance().ParallelFor(0, static_cast<long>(vRegistered.size()), 1,
+		[&vRegistered](long lStart, long lEnd)
+		{
+			for (long k = lStart;k<lEnd;k++)
+				vRegistered[k].LoadRegisteringInfo(vRegistered[k].m_strInfoFileName);
+		});
 
-					if (!m_strReferenceFrame.CompareNoCase(lfi.m_strFileName))
-					{
-						lfi.m_bStartingFrame = true;
-						bReferenceFrameFound = true;
-					};
-					m_vBitmaps.push_back(lfi);
-				};
+	for (i = 0;i<vRegistered.size();i++)
+	{
+		CLightFrameInfo &		lfi = vRegistered[i];
+
+		if (lfi.IsRegistered())
+		{
+			lfi = *vLightFrames[i];
+			lfi.RefreshSuperPixel();
+
+			if (!m_strReferenceFrame.CompareNoCase(lfi.m_strFileName))
+			{
+				lfi.m_bStartingFrame = true;
+				bReferenceFrameFound = true;
 			};
+			m_vBitmaps.push_back(lfi);
 		};
 	};
 
@@ -533,24 +567,31 @@ bool CStackingEngine::ComputeLightFrameOffset(LONG lBitmapIndice, CMatchingStars
 		STARVECTOR &		vStarsDst = m_vBitmaps[lBitmapIndice].m_vStars;
 		LONG				i;
 		CMatchingStars		MatchingStars;
+		double				fXRatio,
+							fYRatio;
+		STARVECTOR::size_type	lNrTgtStars = MAXCUBICSTARS;
 
 		m_CriticalSection.Lock();
 		std::sort(vStarsOrg.begin(), vStarsOrg.end(), CompareStarLuminancy);
 		std::sort(vStarsDst.begin(), vStarsDst.end(), CompareStarLuminancy);
 		m_CriticalSection.Unlock();
 
-		if (!MatchingStars.IsReferenceSet())
-		{
-			double			fXRatio,
-							fYRatio;
+		fXRatio = (double)m_vBitmaps[lBitmapIndice].RenderedWidth()/(double)m_vBitmaps[0].RenderedWidth();
+		fYRatio = (double)m_vBitmaps[lBitmapIndice].RenderedHeight()/(double)m_vBitmaps[0].RenderedHeight();
 
-			fXRatio = (double)m_vBitmaps[lBitmapIndice].RenderedWidth()/(double)m_vBitmaps[0].RenderedWidth();
-			fYRatio = (double)m_vBitmaps[lBitmapIndice].RenderedHeight()/(double)m_vBitmaps[0].RenderedHeight();
-			for (i = 0; i<min(vStarsOrg.size(), static_cast<STARVECTOR::size_type>(100)); i++)
+		if (fXRatio == 1.0 && fYRatio == 1.0 && m_ReferenceIndex.IsValid())
+		{
+			// Shared reference index (built once in ComputeOffsets)
+			MatchingStars.SetReferenceIndex(&m_ReferenceIndex);
+			lNrTgtStars = MAXINDEXEDSTARS;
+		}
+		else if (!MatchingStars.IsReferenceSet())
+		{
+			for (i = 0; i<min(vStarsOrg.size(), static_cast<STARVECTOR::size_type>(MAXCUBICSTARS)); i++)
 				MatchingStars.AddReferenceStar(vStarsOrg[i].m_fX*fXRatio, vStarsOrg[i].m_fY*fYRatio);
 		};
 		MatchingStars.ClearTarget();
-		for (i = 0; i<min(vStarsDst.size(), static_cast<STARVECTOR::size_type>(100)); i++)
+		for (i = 0; i<min(vStarsDst.size(), lNrTgtStars); i++)
 			MatchingStars.AddTargetedStar(vStarsDst[i].m_fX, vStarsDst[i].m_fY);
 
 		MatchingStars.SetSizes(m_vBitmaps[lBitmapIndice].RenderedWidth(), m_vBitmaps[lBitmapIndice].RenderedHeight());
@@ -598,7 +639,7 @@ public :
 	};
 
 	virtual bool	Process();
-	virtual bool	DoTask(HANDLE hEvent);
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
 };
 
 /* ------------------------------------------------------------------- */
@@ -607,72 +648,59 @@ bool	CComputeOffsetTask::Process()
 {
 	ZFUNCTRACE_RUNTIME();
 
-	bool			bStop = false;
-	CString			strText;
+	CDSSProgress *		pProgress = m_pStackingEngine->m_pProgress;
+	CString				strText;
 
-	if (m_pStackingEngine->m_pProgress)
-		m_pStackingEngine->m_pProgress->SetNrUsedProcessors(GetNrThreads());
+	if (pProgress)
+		pProgress->SetNrUsedProcessors(GetNrThreads());
 
-	for (LONG i = 1;i<m_lLast && !bStop;i++)
-	{
-		if (m_pStackingEngine->m_pProgress)
+	// One light frame at a time: they don't all take the same time
+	CThreadPool::GetInstance().ParallelFor(1, m_lLast, 1,
+		[this](long lStart, long lEnd)
 		{
-			strText.Format(IDS_COMPUTINGSTACKINGINFO, (LPCTSTR)m_pStackingEngine->m_vBitmaps[i].m_strFileName);
-			m_pStackingEngine->m_pProgress->Progress1(strText, i+1);
-			bStop = m_pStackingEngine->m_pProgress->IsCanceled();
-		};
-
-		DWORD			dwThreadId;
+			DoTask(lStart, lEnd);
+		},
+		[this, pProgress, &strText](long lNrProcessed) -> bool
+		{
+			bool			bResult = true;
 
-		dwThreadId = GetAvailableThreadId();
-		PostThreadMessage(dwThreadId, WM_MT_PROCESS, 0, i);
-	};
+			if (pProgress && lNrProcessed+1 < m_lLast)
+			{
+				strText.Format(IDS_COMPUTINGSTACKINGINFO, (LPCTSTR)m_pStackingEngine->m_vBitmaps[lNrProcessed+1].m_strFileName);
+				pProgress->Progress1(strText, lNrProcessed+2);
+				bResult = !pProgress->IsCanceled();
+			};
 
-	CloseAllThreads();
+			return bResult;
+		});
 
-	if (m_pStackingEngine->m_pProgress)
-		m_pStackingEngine->m_pProgress->SetNrUsedProcessors();
+	if (pProgress)
+		pProgress->SetNrUsedProcessors();
 
 	return true;
 };
 
 /* ------------------------------------------------------------------- */
 
-bool	CComputeOffsetTask::DoTask(HANDLE hEvent)
+bool	CComputeOffsetTask::DoTask(LONG lStart, LONG lEnd)
 {
 	ZFUNCTRACE_RUNTIME();
 
-	bool			bResult = true;
-	bool			bEnd = false;
-	MSG				msg;
+	CMatchingStars  MatchingStars;
 
+	for (LONG i = lStart;i<lEnd;i++)
 	{
-		CMatchingStars  MatchingStars;
-
-		// Create a message queue and signal the event
-		PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-		SetEvent(hEvent);
-		while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+		if (m_pStackingEngine->ComputeLightFrameOffset(i, MatchingStars))
 		{
-			if (msg.message == WM_MT_PROCESS)
-			{
-				if (m_pStackingEngine->ComputeLightFrameOffset(msg.lParam, MatchingStars))
-				{
-					m_pStackingEngine->m_vBitmaps[msg.lParam].m_bDisabled = false;
-					m_CriticalSection.Lock();
-					m_pStackingEngine->m_lNrStackable++;
-					if (m_pStackingEngine->m_vBitmaps[msg.lParam].m_bComet)
-						m_pStackingEngine->m_lNrCometStackable++;
-					m_CriticalSection.Unlock();
-				}
-				else
-					m_pStackingEngine->m_vBitmaps[msg.lParam].m_bDisabled = true;
-
-				SetEvent(hEvent);
-			}
-			else if (msg.message == WM_MT_STOP)
-				bEnd = true;
-		};
+			m_pStackingEngine->m_vBitmaps[i].m_bDisabled = false;
+			m_CriticalSection.Lock();
+			m_pStackingEngine->m_lNrStackable++;
+			if (m_pStackingEngine->m_vBitmaps[i].m_bComet)
+				m_pStackingEngine->m_lNrCometStackable++;
+			m_CriticalSection.Unlock();
+		}
+		else
+			m_pStackingEngine->m_vBitmaps[i].m_bDisabled = true;
 	};
 
 	return true;
@@ -875,6 +903,7 @@ bool	CStackingEngine::ComputeMissingCometPositions()
 bool	CStackingEngine::ComputeOffsets()
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope		ReportScope("ComputeOffsets");
 
 	bool				bResult = false;
 	LONG				i;
@@ -911,10 +940,19 @@ bool	CStackingEngine::ComputeOffsets()
 				m_lNrCometStackable++;
 
 			m_StackingInfo.SetReferenceFrame(m_vBitmaps[0].m_strFileName);
+
+			// The triangles of the reference frame are indexed once for all the threads
+			STARVECTOR				vRefStars = m_vBitmaps[0].m_vStars;
+			POINTEXTVECTOR			vRefPoints;
+
+			std::sort(vRefStars.begin(), vRefStars.end(), CompareStarLuminancy);
+			for (i = 0;i<min(vRefStars.size(), static_cast<STARVECTOR::size_type>(MAXINDEXEDSTARS));i++)
+				vRefPoints.emplace_back(vRefStars[i].m_fX, vRefStars[i].m_fY);
+			m_ReferenceIndex.Build(vRefPoints);
+
 			CComputeOffsetTask		ComputeOffsetTask;
 
 			ComputeOffsetTask.Init(lLast, this);
-			ComputeOffsetTask.StartThreads();
 			ComputeOffsetTask.Process();
 
 			ComputeMissingCometPositions();
@@ -1478,6 +1516,199 @@ bool	CStackingEngine::AdjustBayerDrizzleCoverage()
 
 /* ------------------------------------------------------------------- */
 
+// Writes the intermediate files (calibrated and registered light frames)
+// on a background thread while the next light frames are stacked.
+// The bitmaps are kept alive until they are written, and Add blocks when
+// m_lDepth files are already waiting.
+class CIntermediateFileWriter
+{
+private :
+	class CIntermediateFile
+	{
+	public :
+		CString						m_strFileName;
+		CSmartPtr<CMemoryBitmap>	m_pBitmap;
+		bool						m_bTIFF;
+		CString						m_strDescription;
+		LONG						m_lISOSpeed;
+		LONG						m_lGain;
+		double						m_fExposure;
+		double						m_fAperture;
+	};
+
+	std::deque<CIntermediateFile>		m_qFiles;
+	size_t								m_lDepth;
+	bool								m_bWriting;
+	bool								m_bFailed;
+	bool								m_bStop;
+	std::mutex							m_Mutex;
+	std::condition_variable				m_Condition;
+	std::thread							m_Thread;
+
+private :
+	void	WriteFiles();
+
+public :
+	CIntermediateFileWriter(size_t lDepth = 2)
+	{
+		m_lDepth	= max(size_t{ 1 }, lDepth);
+		m_bWriting	= false;
+		m_bFailed	= false;
+		m_bStop		= false;
+	};
+
+	virtual ~CIntermediateFileWriter()
+	{
+		Stop();
+	};
+
+	void	Add(LPCTSTR szFileName, CMemoryBitmap * pBitmap, bool bTIFF, LPCTSTR szDescription,
+				LONG lISOSpeed, LONG lGain, double fExposure, double fAperture);
+	bool	Wait();
+	void	Stop();
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CIntermediateFileWriter::WriteFiles()
+{
+	ZFUNCTRACE_RUNTIME();
+
+	if (CMultitask::GetReducedThreadsPriority())
+		ReduceCurrentThreadPriority();
+
+	for (;;)
+	{
+		CIntermediateFile				File;
+
+		{
+			std::unique_lock<std::mutex>	Lock(m_Mutex);
+
+			m_Condition.wait(Lock, [&] { return m_bStop || !m_qFiles.empty(); });
+			if (m_qFiles.empty())
+				break;
+			File = m_qFiles.front();
+			m_qFiles.pop_front();
+			m_bWriting = true;
+		};
+
+		bool				bResult = false;
+
+		try
+		{
+			if (File.m_bTIFF)
+				bResult = WriteTIFF(File.m_strFileName, File.m_pBitmap, nullptr, File.m_strDescription, File.m_lISOSpeed, File.m_lGain, File.m_fExposure, File.m_fAperture);
+			else
+				bResult = WriteFITS(File.m_strFileName, File.m_pBitmap, nullptr, File.m_strDescription, File.m_lISOSpeed, File.m_lGain, File.m_fExposure);
+		}
+		catch (...)
+		{
+			bResult = false;
+		};
+		if (!bResult)
+			ZTRACE_RUNTIME("Failed to write %s", (LPCTSTR)File.m_strFileName);
+
+		// Release the bitmap before the stacking thread is told
+		File.m_pBitmap.Release();
+
+		{
+			std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+			m_bWriting = false;
+			m_bFailed = m_bFailed || !bResult;
+		};
+		m_Condition.notify_all();
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CIntermediateFileWriter::Add(LPCTSTR szFileName, CMemoryBitmap * pBitmap, bool bTIFF, LPCTSTR szDescription,
+									 LONG lISOSpeed, LONG lGain, double fExposure, double fAperture)
+{
+	ZFUNCTRACE_RUNTIME();
+	CIntermediateFile				File;
+
+	File.m_strFileName		= szFileName;
+	File.m_pBitmap			= pBitmap;
+	File.m_bTIFF			= bTIFF;
+	File.m_strDescription	= szDescription;
+	File.m_lISOSpeed		= lISOSpeed;
+	File.m_lGain			= lGain;
+	File.m_fExposure		= fExposure;
+	File.m_fAperture		= fAperture;
+
+	{
+		std::unique_lock<std::mutex>	Lock(m_Mutex);
+
+		if (!m_Thread.joinable())
+		{
+			m_bStop		= false;
+			m_Thread	= std::thread(&CIntermediateFileWriter::WriteFiles, this);
+		};
+
+		m_Condition.wait(Lock, [&] { return m_qFiles.size() < m_lDepth; });
+		m_qFiles.push_back(File);
+	};
+	m_Condition.notify_all();
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CIntermediateFileWriter::Wait()
+{
+	ZFUNCTRACE_RUNTIME();
+	std::unique_lock<std::mutex>	Lock(m_Mutex);
+
+	m_Condition.wait(Lock, [&] { return m_qFiles.empty() && !m_bWriting; });
+
+	return !m_bFailed;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CIntermediateFileWriter::Stop()
+{
+	ZFUNCTRACE_RUNTIME();
+
+	// The files already added are written before the thread ends
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+		m_bStop = true;
+	};
+	m_Condition.notify_all();
+
+	if (m_Thread.joinable())
+		m_Thread.join();
+};
+
+/* ------------------------------------------------------------------- */
+
+// Gives the writer to the engine until the end of the C++ scope, so that
+// the engine is never left with a destroyed writer (exceptions included)
+class CIntermediateWriterScope
+{
+private :
+	CIntermediateFileWriter *&		m_pIntermediateWriter;
+
+public :
+	CIntermediateWriterScope(CIntermediateFileWriter *& pIntermediateWriter, CIntermediateFileWriter & IntermediateWriter) :
+		m_pIntermediateWriter(pIntermediateWriter)
+	{
+		m_pIntermediateWriter = &IntermediateWriter;
+	};
+
+	~CIntermediateWriterScope()
+	{
+		m_pIntermediateWriter = nullptr;
+	};
+
+	CIntermediateWriterScope(const CIntermediateWriterScope &) = delete;
+	CIntermediateWriterScope & operator = (const CIntermediateWriterScope &) = delete;
+};
+
+/* ------------------------------------------------------------------- */
+
 bool	CStackingEngine::SaveCalibratedAndRegisteredLightFrame(CMemoryBitmap * pBitmap)
 {
 	ZFUNCTRACE_RUNTIME();
@@ -1513,7 +1744,14 @@ bool	CStackingEngine::SaveCalibratedAndRegisteredLightFrame(CMemoryBitmap * pBit
 			strText.Format(IDS_SAVINGINTERMEDIATE, strOutputFile);
 			m_pProgress->Start2(strText, 0);
 		};
-		if (m_IntermediateFileFormat == IFF_TIFF)
+		if (m_pIntermediateWriter)
+		{
+			// The bitmap is not used anymore by the stacking: written in the background
+			m_pIntermediateWriter->Add(strOutputFile, pBitmap, m_IntermediateFileFormat == IFF_TIFF, _T("Registered and Calibrated light frame"),
+									   m_pLightTask->m_lISOSpeed, m_pLightTask->m_lGain, m_pLightTask->m_fExposure, m_pLightTask->m_fAperture);
+			bResult = true;
+		}
+		else if (m_IntermediateFileFormat == IFF_TIFF)
 			bResult = WriteTIFF(strOutputFile, pBitmap, m_pProgress, _T("Registered and Calibrated light frame"), m_pLightTask->m_lISOSpeed, m_pLightTask->m_lGain, m_pLightTask->m_fExposure, m_pLightTask->m_fAperture);
 		else
 			bResult = WriteFITS(strOutputFile, pBitmap, m_pProgress, _T("Registered and Calibrated light frame"), m_pLightTask->m_lISOSpeed, m_pLightTask->m_lGain, m_pLightTask->m_fExposure);
@@ -1585,7 +1823,14 @@ bool	CStackingEngine::SaveCalibratedLightFrame(CMemoryBitmap * pBitmap)
 			if (CFATransform == CFAT_SUPERPIXEL)
 				pCFABitmapInfo->UseBilinear(true);
 		};
-		if (m_IntermediateFileFormat == IFF_TIFF)
+		if (m_pIntermediateWriter && (pOutBitmap.m_p != pBitmap) && !pCFABitmapInfo)
+		{
+			// The debayered copy is only used for the file: written in the background
+			m_pIntermediateWriter->Add(strOutputFile, pOutBitmap, m_IntermediateFileFormat == IFF_TIFF, _T("Calibrated light frame"),
+									   m_pLightTask->m_lISOSpeed, m_pLightTask->m_lGain, m_pLightTask->m_fExposure, m_pLightTask->m_fAperture);
+			bResult = true;
+		}
+		else if (m_IntermediateFileFormat == IFF_TIFF)
 			bResult = WriteTIFF(strOutputFile, pOutBitmap, m_pProgress, _T("Calibrated light frame"), m_pLightTask->m_lISOSpeed, m_pLightTask->m_lGain, m_pLightTask->m_fExposure, m_pLightTask->m_fAperture);
 		else
 			bResult = WriteFITS(strOutputFile, pOutBitmap, m_pProgress, _T("Calibrated light frame"), m_pLightTask->m_lISOSpeed, m_pLightTask->m_lGain, m_pLightTask->m_fExposure);
@@ -1743,7 +1988,6 @@ bool CStackingEngine::SaveCometlessImage(CMemoryBitmap * pBitmap)
 class CStackTask : public CMultitask
 {
 private :
-	HANDLE						m_hPixelEvent;
 	CStackingEngine *			m_pStackingEngine;
 	CDSSProgress *				m_pProgress;
 	std::vector<CPoint>			m_vLockedPixels;
@@ -1761,18 +2005,26 @@ public :
 	CSmartPtr<CMemoryBitmap>	m_pOutput;
 	CSmartPtr<CMemoryBitmap>	m_pEntropyCoverage;
 	AvxEntropy*					m_pAvxEntropy;
+	RESAMPLINGMODE				m_ResamplingMode;
+
+private :
+	std::vector<float>			m_vSourcePlanes;
+
+	bool	UseInverseMapping();
+	void	PrepareSourcePlanes(LONG lStart, LONG lEnd);
+	void	ResampleRows(LONG lStart, LONG lEnd);
+	bool	ProcessInverseMapping();
 
 public :
 	CStackTask()
 	{
 		ZFUNCTRACE_RUNTIME();
-		m_hPixelEvent = CreateEvent(nullptr, true, false, nullptr);
+		m_ResamplingMode = RSM_PIXELDISPATCH;
 	};
 
 	virtual ~CStackTask()
 	{
 		ZFUNCTRACE_RUNTIME();
-		CloseHandle(m_hPixelEvent);
 	};
 
 	void	Init(CMemoryBitmap * pBitmap, CDSSProgress * pProgress)
@@ -1782,138 +2034,200 @@ public :
 		m_pProgress = pProgress;
 	};
 
-	virtual bool	DoTask(HANDLE hEvent);
+	virtual bool	DoTask(LONG lStart, LONG lEnd);
 	virtual bool	Process();
 };
 
 /* ------------------------------------------------------------------- */
 
-bool	CStackTask::DoTask(HANDLE hEvent)
+bool	CStackTask::DoTask(LONG lStart, LONG lEnd)
 {
 	ZFUNCTRACE_RUNTIME();
 
 	bool					bResult = true;
 
 	LONG					i, j;
-	bool					bEnd = false;
-	MSG						msg;
 	LONG					lWidth = m_pBitmap->Width();
 	PIXELDISPATCHVECTOR		vPixels;
 
 	vPixels.reserve(16);
 	AvxStacking avxStacking(0, 0, *m_pBitmap, *m_pTempBitmap, m_rcResult, *m_pAvxEntropy);
 
-	// Create a message queue and signal the event
-	PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
-	SetEvent(hEvent);
-	while (!bEnd && GetMessage(&msg, nullptr, 0, 0))
+	// First try AVX accelerated code, if not supported -> run conventional code.
+	avxStacking.init(lStart, lEnd);
+	if (avxStacking.stack(m_PixTransform, *m_pLightTask, m_BackgroundCalibration, m_lPixelSizeMultiplier) != 0)
 	{
-		if (msg.message == WM_MT_PROCESS)
+		for (j = lStart; j < lEnd; j++)
 		{
-			// First try AVX accelerated code, if not supported -> run conventional code.
-			avxStacking.init(msg.wParam, msg.wParam + msg.lParam);
-			if (avxStacking.stack(m_PixTransform, *m_pLightTask, m_BackgroundCalibration, m_lPixelSizeMultiplier) != 0)
+			for (i = 0; i < lWidth; i++)
 			{
-				for (j = msg.wParam; j < msg.wParam + msg.lParam; j++)
-				{
-					for (i = 0; i < lWidth; i++)
-					{
-						CPointExt	pt(i, j);
-						CPointExt	ptOut;
+				CPointExt	pt(i, j);
+				CPointExt	ptOut;
 
-						ptOut = m_PixTransform.Transform(pt);
+				ptOut = m_PixTransform.Transform(pt);
 
-						COLORREF16		crColor;
-						float			Red,
-							Green,
-							Blue;
-						double			fRedEntropy = 1.0,
-							fGreenEntropy = 1.0,
-							fBlueEntropy = 1.0;
+				COLORREF16		crColor;
+				float			Red,
+					Green,
+					Blue;
+				double			fRedEntropy = 1.0,
+					fGreenEntropy = 1.0,
+					fBlueEntropy = 1.0;
 
-						if (m_pLightTask->m_Method == MBP_ENTROPYAVERAGE)
-							m_EntropyWindow.GetPixel(i, j, fRedEntropy, fGreenEntropy, fBlueEntropy, crColor);
-						else
-							m_pBitmap->GetPixel16(i, j, crColor);
+				if (m_pLightTask->m_Method == MBP_ENTROPYAVERAGE)
+					m_EntropyWindow.GetPixel(i, j, fRedEntropy, fGreenEntropy, fBlueEntropy, crColor);
+				else
+					m_pBitmap->GetPixel16(i, j, crColor);
 
-						Red = crColor.red;
-						Green = crColor.green;
-						Blue = crColor.blue;
+				Red = crColor.red;
+				Green = crColor.green;
+				Blue = crColor.blue;
 
-						if (m_BackgroundCalibration.m_BackgroundCalibrationMode != BCM_NONE)
-							m_BackgroundCalibration.ApplyCalibration(Red, Green, Blue);
+				if (m_BackgroundCalibration.m_BackgroundCalibrationMode != BCM_NONE)
+					m_BackgroundCalibration.ApplyCalibration(Red, Green, Blue);
 
-						if ((Red || Green || Blue) && ptOut.IsInRect(0, 0, m_rcResult.Width() - 1, m_rcResult.Height() - 1))
-						{
-							vPixels.resize(0);
-							ComputePixelDispatch(ptOut, m_lPixelSizeMultiplier, vPixels);
+				if ((Red || Green || Blue) && ptOut.IsInRect(0, 0, m_rcResult.Width() - 1, m_rcResult.Height() - 1))
+				{
+					vPixels.resize(0);
+					ComputePixelDispatch(ptOut, m_lPixelSizeMultiplier, vPixels);
 
-							for (LONG k = 0; k < vPixels.size(); k++)
-							{
-								CPixelDispatch& Pixel = vPixels[k];
+					for (LONG k = 0; k < vPixels.size(); k++)
+					{
+						CPixelDispatch& Pixel = vPixels[k];
 
-								// For each plane adjust the values
-								if (Pixel.m_lX >= 0 && Pixel.m_lX < m_rcResult.Width() &&
-									Pixel.m_lY >= 0 && Pixel.m_lY < m_rcResult.Height())
+						// For each plane adjust the values
+						if (Pixel.m_lX >= 0 && Pixel.m_lX < m_rcResult.Width() &&
+							Pixel.m_lY >= 0 && Pixel.m_lY < m_rcResult.Height())
+						{
+							// Special case for entropy average
+							if (m_pLightTask->m_Method == MBP_ENTROPYAVERAGE)
+							{
+								if (m_bColor)
+								{
+									double				fOldRed,
+										fOldGreen,
+										fOldBlue;
+
+									m_pEntropyCoverage->GetValue(Pixel.m_lX, Pixel.m_lY, fOldRed, fOldGreen, fOldBlue);
+									fOldRed += Pixel.m_fPercentage * fRedEntropy;
+									fOldGreen += Pixel.m_fPercentage * fGreenEntropy;
+									fOldBlue += Pixel.m_fPercentage * fBlueEntropy;
+									m_pEntropyCoverage->SetValue(Pixel.m_lX, Pixel.m_lY, fOldRed, fOldGreen, fOldBlue);
+
+									m_pOutput->GetValue(Pixel.m_lX, Pixel.m_lY, fOldRed, fOldGreen, fOldBlue);
+									fOldRed += Red * Pixel.m_fPercentage * fRedEntropy;
+									fOldGreen += Green * Pixel.m_fPercentage * fGreenEntropy;
+									fOldBlue += Blue * Pixel.m_fPercentage * fBlueEntropy;
+									m_pOutput->SetValue(Pixel.m_lX, Pixel.m_lY, fOldRed, fOldGreen, fOldBlue);
+								}
+								else
 								{
-									// Special case for entropy average
-									if (m_pLightTask->m_Method == MBP_ENTROPYAVERAGE)
-									{
-										if (m_bColor)
-										{
-											double				fOldRed,
-												fOldGreen,
-												fOldBlue;
-
-											m_pEntropyCoverage->GetValue(Pixel.m_lX, Pixel.m_lY, fOldRed, fOldGreen, fOldBlue);
-											fOldRed += Pixel.m_fPercentage * fRedEntropy;
-											fOldGreen += Pixel.m_fPercentage * fGreenEntropy;
-											fOldBlue += Pixel.m_fPercentage * fBlueEntropy;
-											m_pEntropyCoverage->SetValue(Pixel.m_lX, Pixel.m_lY, fOldRed, fOldGreen, fOldBlue);
-
-											m_pOutput->GetValue(Pixel.m_lX, Pixel.m_lY, fOldRed, fOldGreen, fOldBlue);
-											fOldRed += Red * Pixel.m_fPercentage * fRedEntropy;
-											fOldGreen += Green * Pixel.m_fPercentage * fGreenEntropy;
-											fOldBlue += Blue * Pixel.m_fPercentage * fBlueEntropy;
-											m_pOutput->SetValue(Pixel.m_lX, Pixel.m_lY, fOldRed, fOldGreen, fOldBlue);
-										}
-										else
-										{
-											double				fOldGray;
-
-											m_pEntropyCoverage->GetValue(Pixel.m_lX, Pixel.m_lY, fOldGray);
-											fOldGray += Pixel.m_fPercentage * fRedEntropy;
-											m_pEntropyCoverage->SetValue(Pixel.m_lX, Pixel.m_lY, fOldGray);
-
-											m_pOutput->GetValue(Pixel.m_lX, Pixel.m_lY, fOldGray);
-											fOldGray += Red * Pixel.m_fPercentage * fRedEntropy;
-											m_pOutput->SetValue(Pixel.m_lX, Pixel.m_lY, fOldGray);
-										};
-									}
-
-									double		fPreviousRed,
-										fPreviousGreen,
-										fPreviousBlue;
-
-									m_pTempBitmap->GetPixel(Pixel.m_lX, Pixel.m_lY, fPreviousRed, fPreviousGreen, fPreviousBlue);
-									fPreviousRed += (double)Red / 256.0 * Pixel.m_fPercentage;
-									fPreviousGreen += (double)Green / 256.0 * Pixel.m_fPercentage;
-									fPreviousBlue += (double)Blue / 256.0 * Pixel.m_fPercentage;
-									fPreviousRed = min(fPreviousRed, 255.0);
-									fPreviousGreen = min(fPreviousGreen, 255.0);
-									fPreviousBlue = min(fPreviousBlue, 255.0);
-									m_pTempBitmap->SetPixel(Pixel.m_lX, Pixel.m_lY, fPreviousRed, fPreviousGreen, fPreviousBlue);
+									double				fOldGray;
+
+									m_pEntropyCoverage->GetValue(Pixel.m_lX, Pixel.m_lY, fOldGray);
+									fOldGray += Pixel.m_fPercentage * fRedEntropy;
+									m_pEntropyCoverage->SetValue(Pixel.m_lX, Pixel.m_lY, fOldGray);
+
+									m_pOutput->GetValue(Pixel.m_lX, Pixel.m_lY, fOldGray);
+									fOldGray += Red * Pixel.m_fPercentage * fRedEntropy;
+									m_pOutput->SetValue(Pixel.m_lX, Pixel.m_lY, fOldGray);
 								};
-							};
+							}
+
+							double		fPreviousRed,
+								fPreviousGreen,
+								fPreviousBlue;
+
+							m_pTempBitmap->GetPixel(Pixel.m_lX, Pixel.m_lY, fPreviousRed, fPreviousGreen, fPreviousBlue);
+							fPreviousRed += (double)Red / 256.0 * Pixel.m_fPercentage;
+							fPreviousGreen += (double)Green / 256.0 * Pixel.m_fPercentage;
+							fPreviousBlue += (double)Blue / 256.0 * Pixel.m_fPercentage;
+							fPreviousRed = min(fPreviousRed, 255.0);
+							fPreviousGreen = min(fPreviousGreen, 255.0);
+							fPreviousBlue = min(fPreviousBlue, 255.0);
+							m_pTempBitmap->SetPixel(Pixel.m_lX, Pixel.m_lY, fPreviousRed, fPreviousGreen, fPreviousBlue);
 						};
 					};
 				};
 			};
+		};
+	};
+
+	return true;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CStackTask::UseInverseMapping()
+{
+	// Entropy average needs the weight of each light frame pixel and
+	// Bayer drizzle the coverage of each CFA pixel: both are only
+	// available when the light frame pixels are dispatched
+	if ((m_ResamplingMode == RSM_PIXELDISPATCH) || (m_pLightTask->m_Method == MBP_ENTROPYAVERAGE))
+		return false;
+
+	C16BitGrayBitmap *	pGrayBitmap = dynamic_cast<C16BitGrayBitmap *>(m_pBitmap.m_p);
+
+	return !pGrayBitmap || (pGrayBitmap->GetCFATransformation() != CFAT_RAWBAYER);
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CStackTask::PrepareSourcePlanes(LONG lStart, LONG lEnd)
+{
+	// Calibrated light frame in the scale of the temporary bitmap
+	const LONG			lWidth = m_pBitmap->Width();
+	const size_t		lPlaneSize = static_cast<size_t>(lWidth) * m_pBitmap->Height();
+
+	for (LONG j = lStart;j<lEnd;j++)
+	{
+		float *			pRed   = m_vSourcePlanes.data() + static_cast<size_t>(j) * lWidth;
+		float *			pGreen = m_bColor ? pRed + lPlaneSize : nullptr;
+		float *			pBlue  = m_bColor ? pGreen + lPlaneSize : nullptr;
+
+		for (LONG i = 0;i<lWidth;i++)
+		{
+			COLORREF16		crColor;
+			float			Red, Green, Blue;
+
+			m_pBitmap->GetPixel16(i, j, crColor);
+			Red		= crColor.red;
+			Green	= crColor.green;
+			Blue	= crColor.blue;
+
+			if (m_BackgroundCalibration.m_BackgroundCalibrationMode != BCM_NONE)
+				m_BackgroundCalibration.ApplyCalibration(Red, Green, Blue);
+
+			pRed[i] = Red / 256.0f;
+			if (m_bColor)
+			{
+				pGreen[i] = Green / 256.0f;
+				pBlue[i]  = Blue / 256.0f;
+			};
+		};
+	};
+};
 
-			SetEvent(hEvent);
-		}
-		else if (msg.message == WM_MT_STOP)
-			bEnd = true;
+/* ------------------------------------------------------------------- */
+
+template <typename TType>
+static bool	WriteResampledRow(CMemoryBitmap * pBitmap, LONG lRow, const float * pValues, LONG lNrPlanes)
+{
+	TType *				pPlanes[3];
+	double				fMultiplier = 1.0;
+
+	if ((pBitmap->Width() != pBitmap->RealWidth()) || !GetBitmapPlanes(pBitmap, pPlanes, fMultiplier))
+		return false;
+
+	const LONG			lWidth = pBitmap->Width();
+
+	for (LONG k = 0;k<lNrPlanes;k++)
+	{
+		TType *			pTarget = pPlanes[k] + static_cast<size_t>(lRow) * lWidth;
+		const float *	pSource = pValues + static_cast<size_t>(k) * lWidth;
+
+		for (LONG i = 0;i<lWidth;i++)
+			pTarget[i] = static_cast<TType>(pSource[i] * fMultiplier);
 	};
 
 	return true;
@@ -1921,37 +2235,181 @@ bool	CStackTask::DoTask(HANDLE hEvent)
 
 /* ------------------------------------------------------------------- */
 
+void	CStackTask::ResampleRows(LONG lStart, LONG lEnd)
+{
+	const LONG			lWidth = m_pBitmap->Width();
+	const LONG			lHeight = m_pBitmap->Height();
+	const size_t		lPlaneSize = static_cast<size_t>(lWidth) * lHeight;
+	const LONG			lOutWidth = m_rcResult.Width();
+	const LONG			lNrPlanes = m_bColor ? 3 : 1;
+	const LONG			lNrTaps = 2 * GetResamplingRadius(m_ResamplingMode);
+	// The exact inverse is computed every lStep output pixels, the
+	// transformation is interpolated linearly in between
+	const LONG			lStep = 16;
+	std::vector<LONG>		vNodesX;
+	std::vector<CPointExt>	vNodes;
+	std::vector<bool>		vValidNodes;
+	std::vector<float>		vRow(static_cast<size_t>(lOutWidth) * lNrPlanes);
+	float				fXWeights[6],
+						fYWeights[6];
+	LONG				lXTaps[6];
+	CPointExt			ptStart;
+	bool				bStartValid = false;
+
+	for (LONG i = 0;i<lOutWidth-1;i += lStep)
+		vNodesX.push_back(i);
+	vNodesX.push_back(lOutWidth-1);
+	vNodes.resize(vNodesX.size());
+	vValidNodes.resize(vNodesX.size());
+
+	const auto	InitialGuess = [this](const CPointExt & ptOut) -> CPointExt
+	{
+		return CPointExt((ptOut.X - m_PixTransform.m_fXShift) / m_lPixelSizeMultiplier,
+						 (ptOut.Y - m_PixTransform.m_fYShift) / m_lPixelSizeMultiplier);
+	};
+
+	for (LONG j = lStart;j<lEnd;j++)
+	{
+		// Each node starts from the solution of the previous one
+		for (size_t n = 0;n<vNodesX.size();n++)
+		{
+			CPointExt	ptOut(vNodesX[n], j);
+			CPointExt	ptIn;
+
+			if (!n)
+				ptIn = bStartValid ? ptStart : InitialGuess(ptOut);
+			else
+				ptIn = vValidNodes[n-1] ? vNodes[n-1] : InitialGuess(ptOut);
+
+			vValidNodes[n] = m_PixTransform.InverseTransform(ptOut, ptIn);
+			vNodes[n] = ptIn;
+		};
+		ptStart		= vNodes[0];
+		bStartValid	= vValidNodes[0];
+
+		for (size_t n = 0;n+1<vNodesX.size() || n==0;n++)
+		{
+			const LONG		lFirstX = vNodesX[n];
+			const LONG		lLastX = (n+1<vNodesX.size()) ? vNodesX[n+1] : lFirstX;
+			const bool		bValid = vValidNodes[n] && vValidNodes[min(n+1, vNodesX.size()-1)];
+			const CPointExt	&pt1 = vNodes[n];
+			const CPointExt	&pt2 = vNodes[min(n+1, vNodesX.size()-1)];
+			// The last segment includes its end
+			const LONG		lEndX = (n+2<vNodesX.size()) ? lLastX : lLastX+1;
+
+			for (LONG i = lFirstX;i<lEndX;i++)
+			{
+				const double	fRatio = (lLastX > lFirstX) ? (double)(i - lFirstX)/(double)(lLastX - lFirstX) : 0.0;
+				const double	fX = pt1.X + (pt2.X - pt1.X) * fRatio;
+				const double	fY = pt1.Y + (pt2.Y - pt1.Y) * fRatio;
+
+				if (!bValid || fX < 0 || fY < 0 || fX > lWidth-1 || fY > lHeight-1)
+				{
+					for (LONG k = 0;k<lNrPlanes;k++)
+						vRow[static_cast<size_t>(k) * lOutWidth + i] = 0;
+					continue;
+				};
+
+				LONG			lFirstTapX,
+								lFirstTapY;
+
+				ComputeResamplingWeights(m_ResamplingMode, fX, lFirstTapX, fXWeights);
+				ComputeResamplingWeights(m_ResamplingMode, fY, lFirstTapY, fYWeights);
+
+				// The taps outside the light frame are replaced by the border pixels
+				for (LONG t = 0;t<lNrTaps;t++)
+					lXTaps[t] = max(0L, min(lFirstTapX + t, lWidth-1));
+
+				for (LONG k = 0;k<lNrPlanes;k++)
+				{
+					const float *	pPlane = m_vSourcePlanes.data() + static_cast<size_t>(k) * lPlaneSize;
+					float			fValue = 0;
+
+					for (LONG u = 0;u<lNrTaps;u++)
+					{
+						const float *	pLine = pPlane + static_cast<size_t>(max(0L, min(lFirstTapY + u, lHeight-1))) * lWidth;
+						float			fLine = 0;
+
+						for (LONG t = 0;t<lNrTaps;t++)
+							fLine += fXWeights[t] * pLine[lXTaps[t]];
+						fValue += fYWeights[u] * fLine;
+					};
+
+					vRow[static_cast<size_t>(k) * lOutWidth + i] = max(0.0f, min(fValue, 255.0f));
+				};
+			};
+		};
+
+		// Write the row in the temporary bitmap
+		if (!WriteResampledRow<float>(m_pTempBitmap, j, vRow.data(), lNrPlanes) &&
+			!WriteResampledRow<WORD>(m_pTempBitmap, j, vRow.data(), lNrPlanes) &&
+			!WriteResampledRow<DWORD>(m_pTempBitmap, j, vRow.data(), lNrPlanes))
+		{
+			for (LONG i = 0;i<lOutWidth;i++)
+			{
+				if (lNrPlanes == 3)
+					m_pTempBitmap->SetPixel(i, j, vRow[i], vRow[lOutWidth + i], vRow[2 * lOutWidth + i]);
+				else
+					m_pTempBitmap->SetPixel(i, j, vRow[i]);
+			};
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CStackTask::ProcessInverseMapping()
+{
+	ZFUNCTRACE_RUNTIME();
+
+	const LONG			lHeight = m_pBitmap->Height();
+	const LONG			lOutHeight = m_rcResult.Height();
+	bool				bResult;
+
+	m_vSourcePlanes.resize(static_cast<size_t>(m_pBitmap->Width()) * lHeight * (m_bColor ? 3 : 1));
+
+	CThreadPool::GetInstance().ParallelFor(0, lHeight, 0,
+		[this](long lStart, long lEnd)
+		{
+			PrepareSourcePlanes(lStart, lEnd);
+		});
+
+	// The progress was started with the height of the light frame
+	bResult = CThreadPool::GetInstance().ParallelFor(0, lOutHeight, 0,
+		[this](long lStart, long lEnd)
+		{
+			ResampleRows(lStart, lEnd);
+		},
+		[this, lHeight, lOutHeight](long lNrProcessed) -> bool
+		{
+			if (m_pProgress)
+				m_pProgress->Progress2(nullptr, static_cast<LONG>(static_cast<double>(lNrProcessed) * lHeight / max(1L, lOutHeight)));
+
+			return true;
+		});
+
+	m_vSourcePlanes.clear();
+	m_vSourcePlanes.shrink_to_fit();
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
 bool	CStackTask::Process()
 {
 	ZFUNCTRACE_RUNTIME();
 
 	bool				bResult = true;
 	LONG				lHeight = m_pBitmap->Height();
-	LONG				i = 0;
-	LONG				lStep;
-	LONG				lRemaining;
 
 	if (m_pProgress)
 		m_pProgress->SetNrUsedProcessors(GetNrThreads());
 
-	lStep		= max(1L, lHeight/50);
-	lRemaining	= lHeight;
-
-	while (i<lHeight)
-	{
-		LONG			lAdd = min(lStep, lRemaining);
-		DWORD			dwThreadId;
-
-		dwThreadId = GetAvailableThreadId();
-		PostThreadMessage(dwThreadId, WM_MT_PROCESS, i, lAdd);
-
-		i			+=lAdd;
-		lRemaining	-= lAdd;
-		if (m_pProgress)
-			m_pProgress->Progress2(nullptr, i);
-	};
-
-	CloseAllThreads();
+	if (UseInverseMapping())
+		bResult = ProcessInverseMapping();
+	else
+		bResult = ProcessRange(0, lHeight, m_pProgress);
 
 	if (m_pProgress)
 		m_pProgress->SetNrUsedProcessors();
@@ -2010,6 +2468,7 @@ bool	CStackingEngine::CreateMasterLightMultiBitmap(CMemoryBitmap * pInBitmap, bo
 bool	CStackingEngine::StackLightFrame(CMemoryBitmap * pInBitmap, CPixelTransform & PixTransform, double fExposure, bool bComet)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope				ReportScope("StackLightFrame");
 
 	bool						bResult = false;
 	LONG						lWidth,
@@ -2052,6 +2511,7 @@ bool	CStackingEngine::StackLightFrame(CMemoryBitmap * pInBitmap, CPixelTransform
 		// Create the output bitmap
 		lWidth = pBitmap->Width();
 		lHeight = pBitmap->Height();
+		CRunReport::AddPixelsStacked(static_cast<std::uint64_t>(lWidth) * lHeight);
 
 		bColor = !pBitmap->IsMonochrome() || pBitmap->IsCFA();
 
@@ -2167,7 +2627,7 @@ bool	CStackingEngine::StackLightFrame(CMemoryBitmap * pInBitmap, CPixelTransform
 			StackTask.m_pOutput					= m_pOutput;
 			StackTask.m_pEntropyCoverage		= m_pEntropyCoverage;
 			StackTask.m_pAvxEntropy				= &avxEntropy;
-			StackTask.StartThreads();
+			StackTask.m_ResamplingMode			= m_ResamplingMode;
 			StackTask.Process();
 
 			if (m_bCreateCometImage)
@@ -2287,11 +2747,289 @@ bool	CStackingEngine::StackLightFrame(CMemoryBitmap * pInBitmap, CPixelTransform
 	return bResult;
 };
 
+/* ------------------------------------------------------------------- */
+/* ------------------------------------------------------------------- */
+
+class CPrefetchedLightFrame
+{
+public :
+	CString						m_strFileName;
+	STARVECTOR *				m_pStars;
+	CSmartPtr<CMemoryBitmap>	m_pBitmap;
+	CSmartPtr<CMemoryBitmap>	m_pDelta;
+	bool						m_bLoaded;
+	bool						m_bCalibrated;
+	bool						m_bFailed;
+	std::exception_ptr			m_pException;
+
+public :
+	CPrefetchedLightFrame(LPCTSTR szFileName = nullptr, STARVECTOR * pStars = nullptr)
+	{
+		m_strFileName	= szFileName;
+		m_pStars		= pStars;
+		m_bLoaded		= false;
+		m_bCalibrated	= false;
+		m_bFailed		= false;
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+// Loads and calibrates light frames ahead of the stacking thread.
+// One thread decodes the files (LibRaw and CFITSIO are not reentrant) and
+// a second one applies the masters and the cosmetic correction.
+// Frames are always handed back in the order they were added.
+class CLightFramePrefetcher
+{
+private :
+	CMasterFrames &						m_MasterFrames;
+	const CPostCalibrationSettings &	m_PostCalibrationSettings;
+	std::vector<CPrefetchedLightFrame>	m_vFrames;
+	LONG								m_lDepth;
+	size_t								m_lNextToConsume;
+	bool								m_bAbort;
+	bool								m_bReducedPriority;
+	std::mutex							m_Mutex;
+	std::condition_variable				m_Condition;
+	std::thread							m_LoadThread;
+	std::thread							m_CalibrateThread;
+	std::string							m_strReportPath;
+
+private :
+	void	LoadFrame(CPrefetchedLightFrame & Frame, CDSSProgress * pProgress);
+	void	CalibrateFrame(CPrefetchedLightFrame & Frame, CDSSProgress * pProgress);
+	void	LoadFrames();
+	void	CalibrateFrames();
+
+public :
+	CLightFramePrefetcher(CMasterFrames & MasterFrames, const CPostCalibrationSettings & pcs, LONG lDepth) :
+		m_MasterFrames(MasterFrames),
+		m_PostCalibrationSettings(pcs)
+	{
+		m_lDepth			= lDepth;
+		m_lNextToConsume	= 0;
+		m_bAbort			= false;
+		m_bReducedPriority	= false;
+	};
+
+	virtual ~CLightFramePrefetcher()
+	{
+		Stop();
+	};
+
+	void	AddFrame(LPCTSTR szFileName, STARVECTOR * pStars)
+	{
+		m_vFrames.emplace_back(szFileName, pStars);
+	};
+
+	void	Start();
+	void	Stop();
+	bool	GetFrame(size_t lIndex, CDSSProgress * pProgress, CMemoryBitmap ** ppBitmap, CMemoryBitmap ** ppDelta);
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLightFramePrefetcher::LoadFrame(CPrefetchedLightFrame & Frame, CDSSProgress * pProgress)
+{
+	CSmartPtr<CMemoryBitmap>	pBitmap;
+	std::exception_ptr			pException;
+	bool						bLoaded = false;
+
+	try
+	{
+		bLoaded = ::LoadFrame(Frame.m_strFileName, PICTURETYPE_LIGHTFRAME, pProgress, &pBitmap);
+	}
+	catch (...)
+	{
+		pException = std::current_exception();
+	};
+
+	std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+	Frame.m_pBitmap		= pBitmap;
+	Frame.m_pException	= pException;
+	Frame.m_bLoaded		= bLoaded;
+	Frame.m_bFailed		= !bLoaded;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLightFramePrefetcher::CalibrateFrame(CPrefetchedLightFrame & Frame, CDSSProgress * pProgress)
+{
+	CSmartPtr<CMemoryBitmap>	pBitmap;
+	CSmartPtr<CMemoryBitmap>	pDelta;
+	std::exception_ptr			pException;
+
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+		pBitmap = Frame.m_pBitmap;
+	};
+
+	try
+	{
+		m_MasterFrames.ApplyAllMasters(pBitmap, Frame.m_pStars, pProgress);
+		ApplyCosmetic(pBitmap, &pDelta, m_PostCalibrationSettings, pProgress);
+	}
+	catch (...)
+	{
+		pException = std::current_exception();
+	};
+
+	std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+	Frame.m_pDelta		= pDelta;
+	Frame.m_pException	= pException;
+	Frame.m_bCalibrated	= !pException;
+	Frame.m_bFailed		= !!pException;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLightFramePrefetcher::LoadFrames()
+{
+	ZFUNCTRACE_RUNTIME();
+	CRunReportThread			ReportThread(m_strReportPath);
+	CRunReportScope				ReportScope("PrefetchLoad");
+
+	if (m_bReducedPriority)
+		ReduceCurrentThreadPriority();
+
+	for (size_t i = 0;i<m_vFrames.size();i++)
+	{
+		{
+			std::unique_lock<std::mutex>	Lock(m_Mutex);
+
+			// Never run more than m_lDepth frames ahead of the stacking thread
+			m_Condition.wait(Lock, [&] { return m_bAbort || (i < m_lNextToConsume + m_lDepth); });
+			if (m_bAbort)
+				break;
+		};
+
+		LoadFrame(m_vFrames[i], nullptr);
+		m_Condition.notify_all();
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLightFramePrefetcher::CalibrateFrames()
+{
+	ZFUNCTRACE_RUNTIME();
+	CRunReportThread			ReportThread(m_strReportPath);
+	CRunReportScope				ReportScope("PrefetchCalibrate");
+
+	if (m_bReducedPriority)
+		ReduceCurrentThreadPriority();
+
+	for (size_t i = 0;i<m_vFrames.size();i++)
+	{
+		bool				bLoaded;
+
+		{
+			std::unique_lock<std::mutex>	Lock(m_Mutex);
+
+			m_Condition.wait(Lock, [&] { return m_bAbort || m_vFrames[i].m_bLoaded || m_vFrames[i].m_bFailed; });
+			if (m_bAbort)
+				break;
+			bLoaded = m_vFrames[i].m_bLoaded;
+		};
+
+		if (bLoaded)
+		{
+			CalibrateFrame(m_vFrames[i], nullptr);
+			m_Condition.notify_all();
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLightFramePrefetcher::Start()
+{
+	ZFUNCTRACE_RUNTIME();
+
+	if (m_lDepth && m_vFrames.size())
+	{
+		m_strReportPath		= CRunReportScope::GetCurrentPath();
+		m_bReducedPriority	= CMultitask::GetReducedThreadsPriority();
+		m_LoadThread		= std::thread(&CLightFramePrefetcher::LoadFrames, this);
+		m_CalibrateThread	= std::thread(&CLightFramePrefetcher::CalibrateFrames, this);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLightFramePrefetcher::Stop()
+{
+	ZFUNCTRACE_RUNTIME();
+
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+		m_bAbort = true;
+	};
+	m_Condition.notify_all();
+
+	if (m_LoadThread.joinable())
+		m_LoadThread.join();
+	if (m_CalibrateThread.joinable())
+		m_CalibrateThread.join();
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CLightFramePrefetcher::GetFrame(size_t lIndex, CDSSProgress * pProgress, CMemoryBitmap ** ppBitmap, CMemoryBitmap ** ppDelta)
+{
+	ZFUNCTRACE_RUNTIME();
+	bool						bResult = false;
+	CPrefetchedLightFrame &		Frame = m_vFrames[lIndex];
+	CSmartPtr<CMemoryBitmap>	pBitmap;
+	CSmartPtr<CMemoryBitmap>	pDelta;
+	std::exception_ptr			pException;
+
+	if (!m_lDepth)
+	{
+		// No prefetching - load and calibrate on the calling thread
+		LoadFrame(Frame, pProgress);
+		if (Frame.m_bLoaded)
+			CalibrateFrame(Frame, pProgress);
+	}
+	else
+	{
+		std::unique_lock<std::mutex>	Lock(m_Mutex);
+
+		m_Condition.wait(Lock, [&] { return Frame.m_bCalibrated || Frame.m_bFailed; });
+	};
+
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		bResult		= Frame.m_bCalibrated;
+		pBitmap		= Frame.m_pBitmap;
+		pDelta		= Frame.m_pDelta;
+		pException	= Frame.m_pException;
+
+		// Release the frame so that memory stays bounded by the depth
+		Frame.m_pBitmap.Release();
+		Frame.m_pDelta.Release();
+		m_lNextToConsume = lIndex+1;
+	};
+	m_Condition.notify_all();
+
+	if (pException)
+		std::rethrow_exception(pException);
+
+	pBitmap.CopyTo(ppBitmap);
+	pDelta.CopyTo(ppDelta);
+
+	return bResult;
+};
+
 /* ------------------------------------------------------------------- */
 
 bool	CStackingEngine::StackAll(CAllStackingTasks & tasks, CMemoryBitmap ** ppBitmap)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope		ReportScope("StackAll");
 	bool				bResult = false;
 	bool				bContinue = true;
 
@@ -2428,14 +3166,31 @@ bool	CStackingEngine::StackAll(CAllStackingTasks & tasks, CMemoryBitmap ** ppBit
 
 					MasterFrames.LoadMasters(pStackingInfo, m_pProgress);
 
+					// Load the masters of the next group while this one is stacked
+					for (LONG j = 0; j < tasks.m_vStacks.size(); j++)
+					{
+						CStackingInfo &		NextStackingInfo = tasks.m_vStacks[j];
+
+						if (&NextStackingInfo != pStackingInfo && NextStackingInfo.m_pLightTask && !NextStackingInfo.m_pLightTask->m_bDone)
+						{
+							PreloadTaskResults(&NextStackingInfo);
+							break;
+						};
+					};
+
 					m_pLightTask = pStackingInfo->m_pLightTask;
 
 					if ((m_pLightTask->m_Method == MBP_AVERAGE) && !m_bCreateCometImage && !m_pComet)
 						m_pLightTask->m_Method = MBP_FASTAVERAGE;
 
-					for (i = 0; i < pStackingInfo->m_pLightTask->m_vBitmaps.size() && !bStop; i++)
+					// First build the list of the light frames to stack
+					std::vector<LONG>				vIndices;
+					std::vector<CPixelTransform>	vPixTransforms;
+					CLightFramePrefetcher			Prefetcher(MasterFrames, m_PostCalibrationSettings, m_lPrefetchDepth);
+					CIntermediateFileWriter			IntermediateWriter;
+
+					for (i = 0; i < pStackingInfo->m_pLightTask->m_vBitmaps.size(); i++)
 					{
-						// Stack this bitmap
 						LONG			lIndice;
 
 						lIndice = FindBitmapIndice(pStackingInfo->m_pLightTask->m_vBitmaps[i].m_strFileName);
@@ -2443,7 +3198,6 @@ bool	CStackingEngine::StackAll(CAllStackingTasks & tasks, CMemoryBitmap ** ppBit
 						{
 							if (!m_vBitmaps[lIndice].m_bDisabled)
 							{
-								bool			bComet = m_vBitmaps[lIndice].m_bComet;
 								bool			bStack = true;
 
 
@@ -2471,61 +3225,83 @@ bool	CStackingEngine::StackAll(CAllStackingTasks & tasks, CMemoryBitmap ** ppBit
 
 								if (bStack)
 								{
-									ZTRACE_RUNTIME("Stack %s", (LPCTSTR)m_vBitmaps[lIndice].m_strFileName);
-
-									if (m_pProgress)
-									{
-										strText.Format(IDS_STACKING_PICTURE, (m_lNrStacked + 1), m_lNrCurrentStackable, m_vBitmaps[lIndice].m_fXOffset, m_vBitmaps[lIndice].m_fYOffset, m_vBitmaps[lIndice].m_fAngle * 180 / M_PI);
-										m_pProgress->Progress1(strText, m_lNrStacked + 1);
-									};
-
-									CSmartPtr<CMemoryBitmap>		pBitmap;
-
-									if (::LoadFrame(m_vBitmaps[lIndice].m_strFileName, PICTURETYPE_LIGHTFRAME, m_pProgress, &pBitmap))
-									{
-										CString				strDescription;
-
-										strDescription = m_vBitmaps[lIndice].m_strInfos;
-										if (m_vBitmaps[lIndice].m_lNrChannels == 3)
-											strText.Format(IDS_STACKRGBLIGHT, m_vBitmaps[lIndice].m_lBitPerChannels, (LPCTSTR)strDescription, (LPCTSTR)m_vBitmaps[lIndice].m_strFileName);
-										else
-											strText.Format(IDS_STACKGRAYLIGHT, m_vBitmaps[lIndice].m_lBitPerChannels, (LPCTSTR)strDescription, (LPCTSTR)m_vBitmaps[lIndice].m_strFileName);
-
-										ZTRACE_RUNTIME(CT2CA(strText, CP_UTF8));
-										// First apply transformations
-										MasterFrames.ApplyAllMasters(pBitmap, &(m_vBitmaps[lIndice].m_vStars), m_pProgress);
-
-										// Here save the calibrated light frame if needed
-										m_strCurrentLightFrame = m_vBitmaps[lIndice].m_strFileName;
-										CSmartPtr<CMemoryBitmap>		pDelta;
-
-										ApplyCosmetic(pBitmap, &pDelta, m_PostCalibrationSettings, m_pProgress);
-										if (m_bSaveCalibrated)
-											SaveCalibratedLightFrame(pBitmap);
-										if (pDelta)
-											SaveDeltaImage(pDelta);
-
-										if (m_pProgress)
-											m_pProgress->Start2(strText, 0);
-
-										// Stack
-										bStop = !StackLightFrame(pBitmap, PixTransform, m_vBitmaps[lIndice].m_fExposure, bComet);
-										m_lNrStacked++;
-
-										if (m_bCreateCometImage)
-											m_vCometShifts.emplace_back((LONG)m_vCometShifts.size(), PixTransform.m_fXCometShift, PixTransform.m_fYCometShift);
-
-										if (m_pProgress)
-										{
-											m_pProgress->End2();
-											bStop = bStop || m_pProgress->IsCanceled();
-										};
-									};
+									vIndices.push_back(lIndice);
+									vPixTransforms.push_back(PixTransform);
+									Prefetcher.AddFrame(m_vBitmaps[lIndice].m_strFileName, &(m_vBitmaps[lIndice].m_vStars));
 								};
 							};
 						};
 					};
 
+					// Then load and calibrate them ahead while stacking them in order
+					Prefetcher.Start();
+
+					CIntermediateWriterScope	IntermediateWriterScope(m_pIntermediateWriter, IntermediateWriter);
+
+					for (i = 0; i < vIndices.size() && !bStop; i++)
+					{
+						// Stack this bitmap
+						LONG				lIndice = vIndices[i];
+						bool				bComet = m_vBitmaps[lIndice].m_bComet;
+						CPixelTransform &	PixTransform = vPixTransforms[i];
+
+						ZTRACE_RUNTIME("Stack %s", (LPCTSTR)m_vBitmaps[lIndice].m_strFileName);
+
+						if (m_pProgress)
+						{
+							strText.Format(IDS_STACKING_PICTURE, (m_lNrStacked + 1), m_lNrCurrentStackable, m_vBitmaps[lIndice].m_fXOffset, m_vBitmaps[lIndice].m_fYOffset, m_vBitmaps[lIndice].m_fAngle * 180 / M_PI);
+							m_pProgress->Progress1(strText, m_lNrStacked + 1);
+						};
+
+						CSmartPtr<CMemoryBitmap>		pBitmap;
+						CSmartPtr<CMemoryBitmap>		pDelta;
+
+						// The bitmap is loaded, and the masters and cosmetic applied
+						if (Prefetcher.GetFrame(i, m_pProgress, &pBitmap, &pDelta))
+						{
+							CString				strDescription;
+
+							strDescription = m_vBitmaps[lIndice].m_strInfos;
+							if (m_vBitmaps[lIndice].m_lNrChannels == 3)
+								strText.Format(IDS_STACKRGBLIGHT, m_vBitmaps[lIndice].m_lBitPerChannels, (LPCTSTR)strDescription, (LPCTSTR)m_vBitmaps[lIndice].m_strFileName);
+							else
+								strText.Format(IDS_STACKGRAYLIGHT, m_vBitmaps[lIndice].m_lBitPerChannels, (LPCTSTR)strDescription, (LPCTSTR)m_vBitmaps[lIndice].m_strFileName);
+
+							ZTRACE_RUNTIME(CT2CA(strText, CP_UTF8));
+
+							// Here save the calibrated light frame if needed
+							m_strCurrentLightFrame = m_vBitmaps[lIndice].m_strFileName;
+
+							if (m_bSaveCalibrated)
+								SaveCalibratedLightFrame(pBitmap);
+							if (pDelta)
+								SaveDeltaImage(pDelta);
+
+							if (m_pProgress)
+								m_pProgress->Start2(strText, 0);
+
+							// Stack
+							bStop = !StackLightFrame(pBitmap, PixTransform, m_vBitmaps[lIndice].m_fExposure, bComet);
+							m_lNrStacked++;
+
+							if (m_bCreateCometImage)
+								m_vCometShifts.emplace_back((LONG)m_vCometShifts.size(), PixTransform.m_fXCometShift, PixTransform.m_fYCometShift);
+
+							if (m_pProgress)
+							{
+								m_pProgress->End2();
+								bStop = bStop || m_pProgress->IsCanceled();
+							};
+						};
+					};
+
+					Prefetcher.Stop();
+
+					// All the intermediate files are written before going on
+					m_pIntermediateWriter = nullptr;
+					if (!IntermediateWriter.Wait())
+						ZTRACE_RUNTIME("Some intermediate files could not be written");
+
 					pStackingInfo->m_pLightTask->m_bDone = true;
 
 					bEnd = bStop;
@@ -2535,6 +3311,12 @@ bool	CStackingEngine::StackAll(CAllStackingTasks & tasks, CMemoryBitmap ** ppBit
 			bResult = !bStop;
 
 			// Clear the cache
+			{
+				LONG			lNrHits = 0, lNrMisses = 0;
+
+				GetTaskCacheStatistics(lNrHits, lNrMisses);
+				ZTRACE_RUNTIME("Master frames loaded %ld times and reused %ld times", lNrMisses, lNrHits);
+			};
 			ClearTaskCache();
 
 			if (bResult)
@@ -2563,11 +3345,7 @@ bool	CStackingEngine::StackAll(CAllStackingTasks & tasks, CMemoryBitmap ** ppBit
 	catch (std::exception & e)
 	{
 		CString errorMessage(CA2CT(e.what()));
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		ReportEngineMessage(errorMessage);
 	}
 #if !defined(_CONSOLE)
 	catch (CException & e)
@@ -2578,33 +3356,13 @@ bool	CStackingEngine::StackAll(CAllStackingTasks & tasks, CMemoryBitmap ** ppBit
 #endif
 	catch (ZException & ze)
 	{
-		CString errorMessage;
-		CString name(CA2CT(ze.name()));
-		CString fileName(CA2CT(ze.locationAtIndex(0)->fileName()));
-		CString functionName(CA2CT(ze.locationAtIndex(0)->functionName()));
-		CString text(CA2CT(ze.text(0)));
-
-		errorMessage.Format(
-			_T("Exception %s thrown from %s Function: %s() Line: %lu\n\n%s"),
-			name,
-			fileName,
-			functionName,
-			ze.locationAtIndex(0)->lineNumber(),
-			text);
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		CString errorMessage(FormatZException(ze));
+		ReportEngineMessage(errorMessage);
 	}
 	catch (...)
 	{
 		CString errorMessage(_T("Unknown exception caught"));
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		ReportEngineMessage(errorMessage);
 
 	}
 
@@ -2620,6 +3378,8 @@ bool	CStackingEngine::StackAll(CAllStackingTasks & tasks, CMemoryBitmap ** ppBit
 bool	CStackingEngine::StackLightFrames(CAllStackingTasks & tasks, CDSSProgress * pProgress, CMemoryBitmap ** ppBitmap)
 {
 	ZFUNCTRACE_RUNTIME();
+	// The run report (when enabled) is written at the end of this scope
+	CRunReportScope				ReportScope("StackLightFrames", true);
 	bool						bResult = false;
 	bool						bContinue = true;
 	CString						strText;
@@ -4,8 +4,10 @@
 #include "RegisterEngine.h"
 #include "PixelTransform.h"
 #include "BackgroundCalibration.h"
+#include "DSSPlatform.h"
 
 class CComputeOffsetTask;
+class CIntermediateFileWriter;
 
 /* ------------------------------------------------------------------- */
 
@@ -168,6 +170,7 @@ private :
 	CString						m_strCurrentLightFrame;
 	CFATYPE						m_InputCFAType;
 	LONG						m_lPixelSizeMultiplier;
+	RESAMPLINGMODE				m_ResamplingMode;
 	INTERMEDIATEFILEFORMAT		m_IntermediateFileFormat;
 	bool						m_bCometStacking;
 	bool						m_bCometInterpolating;
@@ -176,8 +179,11 @@ private :
 	bool						m_bApplyFilterToCometImage;
 	CPostCalibrationSettings	m_PostCalibrationSettings;
 	bool						m_bChannelAlign;
+	LONG						m_lPrefetchDepth;
+	CIntermediateFileWriter *	m_pIntermediateWriter;
+	CStarPatternIndex			m_ReferenceIndex;
 
-	CComAutoCriticalSection		m_CriticalSection;
+	CDSSCriticalSection			m_CriticalSection;
 
 private :
 	bool	AddLightFramesToList(CAllStackingTasks & tasks);
@@ -224,12 +230,15 @@ public :
 		m_bSaveIntermediate		= CAllStackingTasks::GetCreateIntermediates();
 		m_InputCFAType			= CFATYPE_NONE;
 		m_lPixelSizeMultiplier	= CAllStackingTasks::GetPixelSizeMultiplier();
+		m_ResamplingMode		= CAllStackingTasks::GetResamplingMode();
 		m_IntermediateFileFormat= CAllStackingTasks::GetIntermediateFileFormat();
 		m_bCometStacking		= false;
 		m_bCreateCometImage		= false;
 		m_bSaveIntermediateCometImages	= CAllStackingTasks::GetSaveIntermediateCometImages();
 		m_bApplyFilterToCometImage		= CAllStackingTasks::GetApplyMedianFilterToCometImage();
 		m_bChannelAlign			= CAllStackingTasks::GetChannelAlign();
+		m_lPrefetchDepth		= CAllStackingTasks::GetPrefetchDepth();
+		m_pIntermediateWriter	= nullptr;
 		m_bCometInterpolating	= false;
 
 		CAllStackingTasks::GetPostCalibrationSettings(m_PostCalibrationSettings);
@@ -2,7 +2,14 @@
 #include "StackingTasks.h"
 
 #include "TIFFUtil.h"
+#include "RunReport.h"
 #include <set>
+#include <list>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <limits>
 #include "Settings.h"
 #include <QSettings>
 
@@ -101,38 +108,226 @@ bool	LoadFrame(LPCTSTR szFile, PICTURETYPE PictureType, CDSSProgress * pProgress
 
 /* ------------------------------------------------------------------- */
 
+// Cache of the master frames (offset, dark, dark flat and flat) shared by
+// all the groups of a stacking.
+// Several masters of each type are kept, the least recently used ones are
+// released when the total size of the cached bitmaps exceeds the budget.
+// A master requested by several threads is loaded only once, and the
+// masters of the next group can be loaded on a background thread.
 class CTaskBitmapCache
 {
-public :
-	DWORD						m_dwOffsetTaskID;
-	CSmartPtr<CMemoryBitmap>	m_pOffsetBitmap;
-	DWORD						m_dwDarkTaskID;
-	CSmartPtr<CMemoryBitmap>	m_pDarkBitmap;
-	DWORD						m_dwDarkFlatTaskID;
-	CSmartPtr<CMemoryBitmap>	m_pDarkFlatBitmap;
-	DWORD						m_dwFlatTaskID;
-	CSmartPtr<CMemoryBitmap>	m_pFlatBitmap;
+private :
+	class CCachedBitmap
+	{
+	public :
+		CString						m_strFileName;
+		CSmartPtr<CMemoryBitmap>	m_pBitmap;
+		size_t						m_lSize;
+		bool						m_bLoading;
+		std::list<DWORD>::iterator	m_itLRU;
+
+	public :
+		CCachedBitmap()
+		{
+			m_lSize		= 0;
+			m_bLoading	= false;
+		};
+	};
+
+	std::map<DWORD, CCachedBitmap>	m_mBitmaps;
+	std::list<DWORD>				m_lLRU;			// Most recently used first
+	size_t							m_lCachedSize;
+	size_t							m_lBudget;
+	std::mutex						m_Mutex;
+	std::condition_variable			m_Condition;
+	std::vector<std::thread>		m_vPreloads;
+	LONG							m_lNrHits;
+	LONG							m_lNrMisses;
+
+private :
+	static size_t	GetBitmapSize(CMemoryBitmap * pBitmap)
+	{
+		return static_cast<size_t>(pBitmap->RealWidth()) * pBitmap->RealHeight() *
+			   (pBitmap->IsMonochrome() ? 1 : 3) * (pBitmap->BitPerSample() / 8);
+	};
+
+	void	Touch(CCachedBitmap & Cached, DWORD dwTaskID)
+	{
+		m_lLRU.erase(Cached.m_itLRU);
+		m_lLRU.push_front(dwTaskID);
+		Cached.m_itLRU = m_lLRU.begin();
+	};
+
+	void	Erase(DWORD dwTaskID)
+	{
+		auto				it = m_mBitmaps.find(dwTaskID);
+
+		if (it != m_mBitmaps.end())
+		{
+			m_lCachedSize -= it->second.m_lSize;
+			m_lLRU.erase(it->second.m_itLRU);
+			m_mBitmaps.erase(it);
+		};
+	};
+
+	void	Evict(DWORD dwKeptTaskID)
+	{
+		// The bitmaps used by the calibration are kept alive by their own
+		// references, only the reference of the cache is released
+		auto				itLRU = m_lLRU.end();
+
+		while (m_lCachedSize > m_lBudget && itLRU != m_lLRU.begin())
+		{
+			--itLRU;
+
+			const DWORD			dwTaskID = *itLRU;
+			CCachedBitmap &		Cached = m_mBitmaps[dwTaskID];
+
+			if (!Cached.m_bLoading && dwTaskID != dwKeptTaskID)
+			{
+				ZTRACE_RUNTIME("Releasing cached master %s", (LPCTSTR)Cached.m_strFileName);
+				itLRU = std::next(itLRU);
+				Erase(dwTaskID);
+			};
+		};
+	};
+
+	bool	Load(DWORD dwTaskID, const CString & strFileName, PICTURETYPE TaskType, CDSSProgress * pProgress, CMemoryBitmap ** ppBitmap, bool bPreload)
+	{
+		ZFUNCTRACE_RUNTIME();
+		bool							bResult = false;
+		std::unique_lock<std::mutex>	Lock(m_Mutex);
+
+		for (;;)
+		{
+			auto			it = m_mBitmaps.find(dwTaskID);
+
+			if (it == m_mBitmaps.end())
+				break;
+			if (it->second.m_strFileName != strFileName)
+			{
+				// Same task ID for another file: from another stacking
+				if (it->second.m_bLoading)
+				{
+					m_Condition.wait(Lock);
+					continue;
+				};
+				Erase(dwTaskID);
+				break;
+			};
+			if (it->second.m_bLoading)
+			{
+				// Loaded by another thread (or preloaded)
+				if (bPreload)
+					return true;
+				m_Condition.wait(Lock);
+				continue;
+			};
+
+			if (!bPreload)
+			{
+				m_lNrHits++;
+				Touch(it->second, dwTaskID);
+				bResult = it->second.m_pBitmap.CopyTo(ppBitmap);
+			};
+			return true;
+		};
+
+		if (!bPreload)
+			m_lNrMisses++;
+
+		CCachedBitmap &			NewCached = m_mBitmaps[dwTaskID];
+
+		NewCached.m_strFileName	= strFileName;
+		NewCached.m_bLoading	= true;
+		m_lLRU.push_front(dwTaskID);
+		NewCached.m_itLRU		= m_lLRU.begin();
+
+		CSmartPtr<CMemoryBitmap>	pBitmap;
+
+		Lock.unlock();
+		try
+		{
+			bResult = LoadFrame(strFileName, TaskType, pProgress, &pBitmap);
+		}
+		catch (...)
+		{
+			Lock.lock();
+			Erase(dwTaskID);
+			m_Condition.notify_all();
+			throw;
+		};
+		Lock.lock();
+
+		if (bResult)
+		{
+			CCachedBitmap &		Cached = m_mBitmaps[dwTaskID];
+
+			Cached.m_pBitmap	= pBitmap;
+			Cached.m_lSize		= GetBitmapSize(pBitmap);
+			Cached.m_bLoading	= false;
+			m_lCachedSize += Cached.m_lSize;
+			Evict(dwTaskID);
+			if (ppBitmap)
+				bResult = pBitmap.CopyTo(ppBitmap);
+		}
+		else
+			Erase(dwTaskID);
+
+		m_Condition.notify_all();
+
+		return bResult;
+	};
+
+	void	WaitForPreloads()
+	{
+		std::vector<std::thread>		vPreloads;
+
+		{
+			std::lock_guard<std::mutex>		Lock(m_Mutex);
+			vPreloads.swap(m_vPreloads);
+		};
+		for (std::thread & Preload : vPreloads)
+			Preload.join();
+	};
 
 public :
 	CTaskBitmapCache()
 	{
-		m_dwOffsetTaskID = 0;
-		m_dwDarkTaskID   = 0;
-		m_dwDarkFlatTaskID   = 0;
-		m_dwFlatTaskID   = 0;
+		m_lCachedSize	= 0;
+		m_lBudget		= std::numeric_limits<size_t>::max();
+		m_lNrHits		= 0;
+		m_lNrMisses		= 0;
+	};
+	~CTaskBitmapCache()
+	{
+		WaitForPreloads();
 	};
-	~CTaskBitmapCache() {};
 
 	void	ClearCache()
 	{
-		m_dwOffsetTaskID = 0;
-		m_dwDarkTaskID   = 0;
-		m_dwDarkFlatTaskID   = 0;
-		m_dwFlatTaskID   = 0;
-		m_pOffsetBitmap.Release();
-		m_pDarkBitmap.Release();
-		m_pDarkFlatBitmap.Release();
-		m_pFlatBitmap.Release();
+		ZFUNCTRACE_RUNTIME();
+		const size_t		lBudget = CAllStackingTasks::GetMasterCacheSize();
+
+		WaitForPreloads();
+
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		m_lBudget		= lBudget;
+
+		m_mBitmaps.clear();
+		m_lLRU.clear();
+		m_lCachedSize	= 0;
+		m_lNrHits		= 0;
+		m_lNrMisses		= 0;
+	};
+
+	void	GetStatistics(LONG & lNrHits, LONG & lNrMisses)
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		lNrHits		= m_lNrHits;
+		lNrMisses	= m_lNrMisses;
 	};
 
 	bool	GetTaskResult(CTaskInfo * pTaskInfo, CDSSProgress * pProgress, CMemoryBitmap ** ppBitmap)
@@ -141,78 +336,40 @@ public :
 		bool					bResult = false;
 
 		*ppBitmap = nullptr;
+		if (pTaskInfo && pTaskInfo->m_strOutputFile.GetLength())
+			bResult = Load(pTaskInfo->m_dwTaskID, pTaskInfo->m_strOutputFile, pTaskInfo->m_TaskType, pProgress, ppBitmap, false);
+
+		return bResult;
+	};
+
+	void	PreloadTaskResult(CTaskInfo * pTaskInfo)
+	{
+		ZFUNCTRACE_RUNTIME();
+
 		if (pTaskInfo && pTaskInfo->m_strOutputFile.GetLength())
 		{
-			switch (pTaskInfo->m_TaskType)
+			// The task may be gone when the thread runs: only its values are used
+			const DWORD			dwTaskID = pTaskInfo->m_dwTaskID;
+			const CString		strFileName = pTaskInfo->m_strOutputFile;
+			const PICTURETYPE	TaskType = pTaskInfo->m_TaskType;
+
+			std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+			if (m_mBitmaps.find(dwTaskID) == m_mBitmaps.end())
 			{
-			case PICTURETYPE_OFFSETFRAME :
-				if ((m_dwOffsetTaskID == pTaskInfo->m_dwTaskID) && m_pOffsetBitmap)
-					bResult = m_pOffsetBitmap.CopyTo(ppBitmap);
-				else
-				{
-					m_pOffsetBitmap.Release();
-					bResult = LoadFrame(pTaskInfo->m_strOutputFile, pTaskInfo->m_TaskType, pProgress, &m_pOffsetBitmap);
-					if (bResult)
-					{
-						m_dwOffsetTaskID = pTaskInfo->m_dwTaskID;
-						bResult = m_pOffsetBitmap.CopyTo(ppBitmap);
-					}
-					else
-						m_dwDarkTaskID = 0;
-				};
-				break;
-			case PICTURETYPE_DARKFRAME :
-				if ((m_dwDarkTaskID == pTaskInfo->m_dwTaskID) && m_pDarkBitmap)
-					bResult = m_pDarkBitmap.CopyTo(ppBitmap);
-				else
-				{
-					m_pDarkBitmap.Release();
-					bResult = LoadFrame(pTaskInfo->m_strOutputFile, pTaskInfo->m_TaskType, pProgress, &m_pDarkBitmap);
-					if (bResult)
-					{
-						m_dwDarkTaskID = pTaskInfo->m_dwTaskID;
-						bResult = m_pDarkBitmap.CopyTo(ppBitmap);
-					}
-					else
-						m_dwDarkTaskID = 0;
-				};
-				break;
-			case PICTURETYPE_DARKFLATFRAME :
-				if ((m_dwDarkFlatTaskID == pTaskInfo->m_dwTaskID) && m_pDarkFlatBitmap)
-					bResult = m_pDarkFlatBitmap.CopyTo(ppBitmap);
-				else
+				m_vPreloads.emplace_back([this, dwTaskID, strFileName, TaskType]()
 				{
-					m_pDarkFlatBitmap.Release();
-					bResult = LoadFrame(pTaskInfo->m_strOutputFile, pTaskInfo->m_TaskType, pProgress, &m_pDarkFlatBitmap);
-					if (bResult)
+					try
 					{
-						m_dwDarkFlatTaskID = pTaskInfo->m_dwTaskID;
-						bResult = m_pDarkFlatBitmap.CopyTo(ppBitmap);
+						Load(dwTaskID, strFileName, TaskType, nullptr, nullptr, true);
 					}
-					else
-						m_dwDarkFlatTaskID = 0;
-				};
-				break;
-			case PICTURETYPE_FLATFRAME :
-				if ((m_dwFlatTaskID == pTaskInfo->m_dwTaskID) && m_pFlatBitmap)
-					bResult = m_pFlatBitmap.CopyTo(ppBitmap);
-				else
-				{
-					m_pFlatBitmap.Release();
-					bResult = LoadFrame(pTaskInfo->m_strOutputFile, pTaskInfo->m_TaskType, pProgress, &m_pFlatBitmap);
-					if (bResult)
+					catch (...)
 					{
-						m_dwFlatTaskID = pTaskInfo->m_dwTaskID;
-						bResult = m_pFlatBitmap.CopyTo(ppBitmap);
-					}
-					else
-						m_dwFlatTaskID = 0;
-				};
-				break;
+						// Loaded (and reported) again when it is needed
+					};
+				});
 			};
 		};
-
-		return bResult;
 	};
 };
 
@@ -225,6 +382,22 @@ bool	GetTaskResult(CTaskInfo * pTaskInfo, CDSSProgress * pProgress, CMemoryBitma
 	return g_BitmapCache.GetTaskResult(pTaskInfo, pProgress, ppBitmap);
 };
 
+void	PreloadTaskResults(CStackingInfo * pStackingInfo)
+{
+	if (pStackingInfo)
+	{
+		g_BitmapCache.PreloadTaskResult(pStackingInfo->m_pOffsetTask);
+		g_BitmapCache.PreloadTaskResult(pStackingInfo->m_pDarkTask);
+		g_BitmapCache.PreloadTaskResult(pStackingInfo->m_pDarkFlatTask);
+		g_BitmapCache.PreloadTaskResult(pStackingInfo->m_pFlatTask);
+	};
+};
+
+void	GetTaskCacheStatistics(LONG & lNrHits, LONG & lNrMisses)
+{
+	g_BitmapCache.GetStatistics(lNrHits, lNrMisses);
+};
+
 void	ClearTaskCache()
 {
 	g_BitmapCache.ClearCache();
@@ -1692,6 +1865,7 @@ void CAllStackingTasks::UpdateTasksMethods()
 bool CAllStackingTasks::DoOffsetTasks(CDSSProgress * pProgress)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope		ReportScope("OffsetTasks");
 	bool				bResult = true;
 
 	// 1. create all the offset masters
@@ -1718,6 +1892,7 @@ bool CAllStackingTasks::DoOffsetTasks(CDSSProgress * pProgress)
 bool CAllStackingTasks::DoDarkTasks(CDSSProgress * pProgress)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope		ReportScope("DarkTasks");
 	bool				bResult = true;
 
 	// 2. create all the dark masters (using the offset master if necessary)
@@ -1753,6 +1928,7 @@ bool CAllStackingTasks::DoDarkTasks(CDSSProgress * pProgress)
 bool CAllStackingTasks::DoDarkFlatTasks(CDSSProgress * pProgress)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope		ReportScope("DarkFlatTasks");
 	bool				bResult = true;
 
 	// 2. create all the dark masters (using the offset master if necessary)
@@ -1788,6 +1964,7 @@ bool CAllStackingTasks::DoDarkFlatTasks(CDSSProgress * pProgress)
 bool CAllStackingTasks::DoFlatTasks(CDSSProgress * pProgress)
 {
 	ZFUNCTRACE_RUNTIME();
+	CRunReportScope		ReportScope("FlatTasks");
 	bool				bResult = true;
 
 	// 3. create all the flat masters (using the offset master if necessary)
@@ -2256,6 +2433,70 @@ COMETSTACKINGMODE CAllStackingTasks::GetCometStackingMode()
 
 /* ------------------------------------------------------------------- */
 
+LONG	CAllStackingTasks::GetPrefetchDepth()
+{
+	CWorkspace			workspace;
+
+	// Number of light frames loaded and calibrated ahead of the one being stacked
+	// 0 disables the prefetching (everything is done on the stacking thread)
+	const uint value = workspace.value("Stacking/PrefetchDepth", (uint)2).toUInt();
+
+	// Compared as unsigned so that huge values can't wrap to negative depths
+	return static_cast<LONG>(min(value, 4u));
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CAllStackingTasks::GetUseMappedTempFiles()
+{
+	CWorkspace			workspace;
+
+	// Use preallocated memory mapped temporary files (or memory only when the
+	// stack fits) instead of the appended temporary files for the rejection methods
+	return workspace.value("Stacking/MappedTempFiles", true).toBool();
+};
+
+/* ------------------------------------------------------------------- */
+
+LONG	CAllStackingTasks::GetMaxConcurrentFrames()
+{
+	CWorkspace			workspace;
+
+	// Maximum number of light frames registered at the same time
+	// 0 lets the registering engine decide from the processors and memory
+	const uint value = workspace.value("Register/MaxConcurrentFrames", (uint)0).toUInt();
+
+	return static_cast<LONG>(min(value, 256u));
+};
+
+/* ------------------------------------------------------------------- */
+
+size_t	CAllStackingTasks::GetMasterCacheSize()
+{
+	CWorkspace			workspace;
+
+	// Maximum size (in MB) of the master frames kept in memory between the groups
+	size_t value = workspace.value("Stacking/MasterCacheSize", (uint)2048).toUInt();
+
+	return max(value, size_t{ 64 }) * 1024 * 1024;
+};
+
+/* ------------------------------------------------------------------- */
+
+RESAMPLINGMODE CAllStackingTasks::GetResamplingMode()
+{
+	CWorkspace			workspace;
+
+	int value = workspace.value("Stacking/ResamplingMode", 0).toUInt();
+
+	if (value < RSM_PIXELDISPATCH || value > RSM_LANCZOS3)
+		value = RSM_PIXELDISPATCH;
+
+	return (RESAMPLINGMODE)value;
+};
+
+/* ------------------------------------------------------------------- */
+
 void CAllStackingTasks::GetPostCalibrationSettings(CPostCalibrationSettings & pcs)
 {
 	CWorkspace			workspace;
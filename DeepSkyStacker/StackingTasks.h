@@ -252,7 +252,12 @@ public :
 
 /* ------------------------------------------------------------------- */
 
+class CStackingInfo;
+
 bool	GetTaskResult(CTaskInfo * pTaskInfo, CDSSProgress * pProgress, CMemoryBitmap ** ppBitmap);
+// Starts loading the masters of a group on background threads
+void	PreloadTaskResults(CStackingInfo * pStackingInfo);
+void	GetTaskCacheStatistics(LONG & lNrHits, LONG & lNrMisses);
 void	ClearTaskCache();
 
 /* ------------------------------------------------------------------- */
@@ -594,6 +599,11 @@ public :
 	static  bool	GetApplyMedianFilterToCometImage();
 	static  INTERMEDIATEFILEFORMAT GetIntermediateFileFormat();
 	static	COMETSTACKINGMODE GetCometStackingMode();
+	static  LONG	GetPrefetchDepth();
+	static  bool	GetUseMappedTempFiles();
+	static  LONG	GetMaxConcurrentFrames();
+	static  size_t	GetMasterCacheSize();
+	static	RESAMPLINGMODE GetResamplingMode();
 };
 
 /* ------------------------------------------------------------------- */
@@ -1,8 +1,12 @@
 #include <stdafx.h>
 #include "TIFFUtil.h"
+#include "DSSPlatform.h"
 
 #include "zlib.h"
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <vector>
 #include <QSettings>
 
 #include <omp.h>
@@ -271,6 +275,174 @@ bool CTIFFReader::Open()
 
 /* ------------------------------------------------------------------- */
 
+// Same result as OnRead and SetPixel for a whole line of interleaved
+// samples, in loops simple enough to be vectorized by the compiler
+template <typename TType>
+static void	ConvertTIFFLine(const TType * pSource, LONG lNrSamples, TType * const (&pTargets)[3], LONG lNrPlanes, LONG lWidth, double fFactor, double fOffset)
+{
+	for (LONG c = 0;c<lNrPlanes;c++)
+	{
+		const TType *		pValue = pSource + c;
+		TType *				pTarget = pTargets[c];
+
+		if (fFactor == 1.0 && fOffset == 0.0)
+		{
+			// Same scale in the file and in the bitmap
+			for (LONG i = 0;i<lWidth;i++)
+				pTarget[i] = pValue[i * lNrSamples];
+		}
+		else
+		{
+			for (LONG i = 0;i<lWidth;i++)
+				pTarget[i] = static_cast<TType>(pValue[i * lNrSamples] * fFactor + fOffset);
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CTIFFReader::ReadInBlocks()
+{
+	CMemoryBitmap *		pBitmap = GetTargetBitmap();
+	double				fMultiplier = 1.0;
+
+	if (!pBitmap)
+		return false;
+
+	if (sampleformat == SAMPLEFORMAT_IEEEFP)
+	{
+		float *			pPlanes[3];
+
+		return (bps == 32) && GetBitmapPlanes(pBitmap, pPlanes, fMultiplier) && ReadInBlocks(pPlanes, fMultiplier);
+	}
+	else if (bps == 8)
+	{
+		BYTE *			pPlanes[3];
+
+		return GetBitmapPlanes(pBitmap, pPlanes, fMultiplier) && ReadInBlocks(pPlanes, fMultiplier);
+	}
+	else if (bps == 16)
+	{
+		WORD *			pPlanes[3];
+
+		return GetBitmapPlanes(pBitmap, pPlanes, fMultiplier) && ReadInBlocks(pPlanes, fMultiplier);
+	}
+	else if (bps == 32)
+	{
+		DWORD *			pPlanes[3];
+
+		return GetBitmapPlanes(pBitmap, pPlanes, fMultiplier) && ReadInBlocks(pPlanes, fMultiplier);
+	};
+
+	return false;
+};
+
+/* ------------------------------------------------------------------- */
+
+template <typename TType>
+bool CTIFFReader::ReadInBlocks(TType * const (&pPlanes)[3], double fMultiplier)
+{
+	ZFUNCTRACE_RUNTIME();
+	const bool			bTiled = (TIFFIsTiled(m_tiff) != 0);
+	uint32				blockWidth = w,
+						blockHeight = h;
+
+	if (bTiled)
+	{
+		TIFFGetField(m_tiff, TIFFTAG_TILEWIDTH, &blockWidth);
+		TIFFGetField(m_tiff, TIFFTAG_TILELENGTH, &blockHeight);
+	}
+	else if (!TIFFGetField(m_tiff, TIFFTAG_ROWSPERSTRIP, &blockHeight))
+		blockHeight = h;
+
+	const tmsize_t		blockSize = bTiled ? TIFFTileSize(m_tiff) : TIFFStripSize(m_tiff);
+	const LONG			lNrBlocks = bTiled ? TIFFNumberOfTiles(m_tiff) : TIFFNumberOfStrips(m_tiff);
+	const LONG			lBlocksAcross = (w + blockWidth - 1) / blockWidth;
+	const LONG			lNrPlanes = (spp == 1) ? 1 : 3;
+	const int			nrProcessors = CMultitask::GetNrProcessors(false);
+	const int			nrThreads = max(1, min(nrProcessors, static_cast<int>(lNrBlocks)));
+	double				fFactor = fMultiplier;
+	double				fOffset = 0.0;
+	std::atomic<bool>	bError = false;
+	std::atomic<LONG>	lNrDecoded = 0;
+
+	if (blockSize <= 0 || !blockWidth || !blockHeight)
+		return false;
+
+	if (sampleformat == SAMPLEFORMAT_IEEEFP)
+	{
+		constexpr double scaleFactor = double{ USHORT_MAX } / 256.0;
+
+		fFactor = fMultiplier * scaleFactor / (samplemax - samplemin);
+		fOffset = -samplemin * fFactor;
+	}
+	else if (bps == 16)
+		fFactor = fMultiplier / (1 + UCHAR_MAX);
+	else if (bps == 32)
+		fFactor = fMultiplier / ((1 + UCHAR_MAX) * double{ 1 + USHORT_MAX });
+
+	ZTRACE_RUNTIME("TIFF %s: %d blocks of %ux%u, %zd bytes", bTiled ? "tiles" : "strips", lNrBlocks, blockWidth, blockHeight, blockSize);
+
+	if (m_pProgress)
+		m_pProgress->Start2(nullptr, h);
+
+#pragma omp parallel num_threads(nrThreads)
+	{
+		// The strips (or tiles) are decompressed concurrently: a libtiff
+		// handle cannot be shared so each thread opens the file again.
+		// No more threads than blocks, so that no file is opened for nothing.
+		TIFF *				tiff = (omp_get_thread_num() == 0) ? m_tiff : TIFFOpen(CT2CA(m_strFileName, CP_ACP), "r");
+		std::vector<BYTE>	vBlock(tiff ? blockSize : 0);
+
+		if (!tiff)
+			bError = true;
+
+#pragma omp for schedule(dynamic, 1)
+		for (LONG lBlock = 0;lBlock<lNrBlocks;lBlock++)
+		{
+			if (bError)
+				continue;
+
+			const tmsize_t	count = bTiled ? TIFFReadEncodedTile(tiff, lBlock, vBlock.data(), blockSize)
+										   : TIFFReadEncodedStrip(tiff, lBlock, vBlock.data(), blockSize);
+			if (-1 == count)
+			{
+				ZTRACE_RUNTIME("TIFFReadEncoded%s returned an error", bTiled ? "Tile" : "Strip");
+				bError = true;
+				continue;
+			};
+
+			const LONG		lStartX = (lBlock % lBlocksAcross) * static_cast<LONG>(blockWidth);
+			const LONG		lStartY = (lBlock / lBlocksAcross) * static_cast<LONG>(blockHeight);
+			const LONG		lWidth = min(static_cast<LONG>(blockWidth), w - lStartX);
+			const LONG		lHeight = min(static_cast<LONG>(blockHeight), h - lStartY);
+			const TType *	pBlock = reinterpret_cast<const TType *>(vBlock.data());
+
+			for (LONG row = 0;row<lHeight;row++)
+			{
+				const size_t	lOffset = static_cast<size_t>(lStartY + row) * w + lStartX;
+				TType * const	pTargets[3] = { pPlanes[0] + lOffset, pPlanes[1] + lOffset, pPlanes[2] + lOffset };
+
+				ConvertTIFFLine(pBlock + static_cast<size_t>(row) * blockWidth * spp, spp, pTargets, lNrPlanes, lWidth, fFactor, fOffset);
+			};
+
+			const LONG		lDone = ++lNrDecoded;
+			if (m_pProgress && 0 == omp_get_thread_num())
+				m_pProgress->Progress2(nullptr, static_cast<LONG>(static_cast<double>(h) * lDone / lNrBlocks));
+		};
+
+		if (tiff && tiff != m_tiff)
+			TIFFClose(tiff);
+	}
+
+	if (m_pProgress)
+		m_pProgress->End2();
+
+	return !bError;
+};
+
+/* ------------------------------------------------------------------- */
+
 bool CTIFFReader::Read()
 {
 	constexpr double scaleFactorInt16 = double{ 1 + UCHAR_MAX };
@@ -281,6 +453,9 @@ bool CTIFFReader::Read()
 	if (!m_tiff)
 		return false;
 
+	if (ReadInBlocks())
+		return true;
+
 	try
 	{
 		tmsize_t		scanLineSize;
@@ -614,11 +789,269 @@ bool CTIFFWriter::Open()
 
 /* ------------------------------------------------------------------- */
 
+void CTIFFWriter::GetRowFromOnWrite(LONG row, BYTE * pScanLine)
+{
+	BYTE *  byteBuff = pScanLine;
+	WORD *	shortBuff = reinterpret_cast<WORD *>(pScanLine);
+	DWORD * longBuff = reinterpret_cast<DWORD *>(pScanLine);
+	float *	floatBuff = reinterpret_cast<float *>(pScanLine);
+
+	for (LONG col = 0; col < w; col++)
+	{
+		long index = col * spp;
+
+		double		fRed = 0, fGreen = 0, fBlue = 0, fGrey = 0;
+
+		OnWrite(col, row, fRed, fGreen, fBlue);
+
+		//
+		// If its a cfa bitmap, set grey level to maximum of RGB
+		// else convert from RGB to HSL and use Luminance.
+		// 
+		if (cfa)
+		{
+			fGrey = max(fRed, max(fGreen, fBlue));
+		}
+		else
+		{
+			double H, S, L;
+			ToHSL(fRed, fGreen, fBlue, H, S, L);
+			fGrey = L * 255.0;
+		}
+
+		switch (bps)	// Bits per sample
+		{
+		case 8:			// One byte 
+			switch (spp)
+			{
+			case 1:
+				byteBuff[index] = fGrey;
+				break;
+			case 3:
+			case 4:
+				byteBuff[index] = fRed;
+				byteBuff[index + 1] = fGreen;
+				byteBuff[index + 2] = fBlue;
+				break;
+			}
+			break;
+		case 16:		// Unsigned short == WORD 
+			switch (spp)
+			{
+			case 1:
+				shortBuff[index] = fGrey * UCHAR_MAX;
+				break;
+			case 3:
+			case 4:
+				shortBuff[index] = fRed * UCHAR_MAX;
+				shortBuff[index + 1] = fGreen * UCHAR_MAX;
+				shortBuff[index + 2] = fBlue * UCHAR_MAX;
+				break;
+			}
+			break;
+		case 32:		// Unsigned long or 32 bit floating point 
+			if (sampleformat == SAMPLEFORMAT_IEEEFP)
+				switch (spp)
+				{
+				case 1:
+					floatBuff[index] = fGrey / (1.0 + UCHAR_MAX) * (samplemax - samplemin) + samplemin;
+					break;
+				case 3:
+				case 4:
+					floatBuff[index] = fRed / (1.0 + UCHAR_MAX) * (samplemax - samplemin) + samplemin;
+					floatBuff[index + 1] = fGreen / (1.0 + UCHAR_MAX) * (samplemax - samplemin) + samplemin;
+					floatBuff[index + 2] = fBlue / (1.0 + UCHAR_MAX) * (samplemax - samplemin) + samplemin;
+					break;
+				}
+			else switch (spp)	// unsigned long == DWORD
+			{
+			case 1:
+				longBuff[index] = fGrey * UCHAR_MAX * USHRT_MAX;
+				break;
+			case 3:
+			case 4:
+				longBuff[index] = fRed * UCHAR_MAX * USHRT_MAX;
+				longBuff[index + 1] = fGreen * UCHAR_MAX * USHRT_MAX;
+				longBuff[index + 2] = fBlue * UCHAR_MAX * USHRT_MAX;
+				break;
+
+			}
+		}
+	}
+};
+
+/* ------------------------------------------------------------------- */
+
+template <typename TOut>
+static std::function<void(LONG, BYTE *)>	GetRowExporter(CMemoryBitmap * pBitmap, LONG lNrSamples, double fScale, double fOffset)
+{
+	PLANEEXPORTER<TOut>		Exporter;
+
+	if (!GetPlanesExporter(pBitmap, fScale, fOffset, Exporter))
+		return nullptr;
+
+	return [Exporter, lNrSamples](LONG lRow, BYTE * pScanLine)
+	{
+		for (LONG c = 0;c<lNrSamples;c++)
+			Exporter(lRow, c, reinterpret_cast<TOut *>(pScanLine) + c, lNrSamples);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+std::function<void(LONG, BYTE *)>	CTIFFWriter::GetRowFromPlanes()
+{
+	//
+	// Same values as GetRowFromOnWrite, straight from the planes of the
+	// bitmap when it is gray (written as gray) or color (written as RGB)
+	//
+	CMemoryBitmap *		pBitmap = GetSourceBitmap();
+
+	if (!pBitmap || (pBitmap->Width() != w) || (pBitmap->Height() != h) ||
+		((spp == 1) != pBitmap->IsMonochrome()) || ((spp != 1) && (spp != 3)))
+		return nullptr;
+
+	if (sampleformat == SAMPLEFORMAT_IEEEFP)
+		return GetRowExporter<float>(pBitmap, spp, (samplemax - samplemin) / (1.0 + UCHAR_MAX), samplemin);
+	else if (bps == 8)
+		return GetRowExporter<BYTE>(pBitmap, spp, 1.0, 0.0);
+	else if (bps == 16)
+		return GetRowExporter<WORD>(pBitmap, spp, UCHAR_MAX, 0.0);
+	else if (bps == 32)
+		return GetRowExporter<DWORD>(pBitmap, spp, static_cast<double>(UCHAR_MAX) * USHRT_MAX, 0.0);
+
+	return nullptr;
+};
+
+/* ------------------------------------------------------------------- */
+
+// In memory TIFF file used to compress the strips on several threads
+class CTIFFMemoryFile
+{
+public :
+	std::vector<BYTE>		m_vData;
+	size_t					m_lPosition;
+
+public :
+	CTIFFMemoryFile()
+	{
+		m_lPosition = 0;
+	};
+
+	static tmsize_t	Read(thandle_t hFile, void * pData, tmsize_t lSize)
+	{
+		CTIFFMemoryFile *	pFile = static_cast<CTIFFMemoryFile *>(hFile);
+		const size_t		lRead = min(static_cast<size_t>(lSize), pFile->m_vData.size() - min(pFile->m_lPosition, pFile->m_vData.size()));
+
+		if (lRead)
+			memcpy(pData, pFile->m_vData.data() + pFile->m_lPosition, lRead);
+		pFile->m_lPosition += lRead;
+
+		return static_cast<tmsize_t>(lRead);
+	};
+
+	static tmsize_t	Write(thandle_t hFile, void * pData, tmsize_t lSize)
+	{
+		CTIFFMemoryFile *	pFile = static_cast<CTIFFMemoryFile *>(hFile);
+
+		if (pFile->m_vData.size() < pFile->m_lPosition + lSize)
+			pFile->m_vData.resize(pFile->m_lPosition + lSize);
+		memcpy(pFile->m_vData.data() + pFile->m_lPosition, pData, lSize);
+		pFile->m_lPosition += lSize;
+
+		return lSize;
+	};
+
+	static toff_t	Seek(thandle_t hFile, toff_t lOffset, int nWhence)
+	{
+		CTIFFMemoryFile *	pFile = static_cast<CTIFFMemoryFile *>(hFile);
+
+		if (nWhence == SEEK_CUR)
+			lOffset += pFile->m_lPosition;
+		else if (nWhence == SEEK_END)
+			lOffset += pFile->m_vData.size();
+		pFile->m_lPosition = static_cast<size_t>(lOffset);
+
+		return lOffset;
+	};
+
+	static int	Close(thandle_t)
+	{
+		return 0;
+	};
+
+	static toff_t	Size(thandle_t hFile)
+	{
+		return static_cast<CTIFFMemoryFile *>(hFile)->m_vData.size();
+	};
+
+	static int	Map(thandle_t, void **, toff_t *)
+	{
+		return 0;
+	};
+
+	static void	Unmap(thandle_t, void *, toff_t)
+	{
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CTIFFWriter::CompressStrip(BYTE * pStrip, LONG lNrRows, tmsize_t lSize, std::vector<BYTE> & vCompressed)
+{
+	//
+	// libtiff compresses a strip when it is written to a file: the strip
+	// is written in a one strip TIFF file in memory, and the compressed
+	// bytes are then written as they are in the real file.
+	// Both files use the byte order of the machine.
+	//
+	bool				bResult = false;
+	CTIFFMemoryFile		File;
+	TIFF *				tiff;
+
+	tiff = TIFFClientOpen("DSSStrip", "w", &File,
+						  CTIFFMemoryFile::Read, CTIFFMemoryFile::Write, CTIFFMemoryFile::Seek, CTIFFMemoryFile::Close,
+						  CTIFFMemoryFile::Size, CTIFFMemoryFile::Map, CTIFFMemoryFile::Unmap);
+	if (tiff)
+	{
+		TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, w);
+		TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, lNrRows);
+		TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, bps);
+		TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, spp);
+		TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+		TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, (spp == 1) ? PHOTOMETRIC_MINISBLACK : PHOTOMETRIC_RGB);
+		TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, sampleformat);
+		TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, lNrRows);
+		TIFFSetField(tiff, TIFFTAG_COMPRESSION, compression);
+		if ((compression == COMPRESSION_DEFLATE) || (compression == COMPRESSION_ADOBE_DEFLATE))
+			TIFFSetField(tiff, TIFFTAG_ZIPQUALITY, Z_BEST_SPEED);
+
+		if (TIFFWriteEncodedStrip(tiff, 0, pStrip, lSize) != -1)
+		{
+			uint64 *		pOffsets = nullptr;
+			uint64 *		pByteCounts = nullptr;
+
+			if (TIFFGetField(tiff, TIFFTAG_STRIPOFFSETS, &pOffsets) && TIFFGetField(tiff, TIFFTAG_STRIPBYTECOUNTS, &pByteCounts) &&
+				pOffsets && pByteCounts && (pOffsets[0] + pByteCounts[0] <= File.m_vData.size()))
+			{
+				vCompressed.assign(File.m_vData.begin() + static_cast<size_t>(pOffsets[0]),
+								   File.m_vData.begin() + static_cast<size_t>(pOffsets[0] + pByteCounts[0]));
+				bResult = true;
+			};
+		};
+		TIFFClose(tiff);
+	};
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
 bool CTIFFWriter::Write()
 {
 	ZFUNCTRACE_RUNTIME();
-	bool		bResult = false;
-	bool		bError = false;
+	bool				bResult = false;
+	std::atomic<bool>	bError{ false };
 
 	//
     // Multipliers of 256.0 and 65536.0 were not correct and resulted in a fully saturated
@@ -628,185 +1061,93 @@ bool CTIFFWriter::Write()
 
 	if (m_tiff)
 	{
-		tmsize_t		scanLineSize;
-		tdata_t			buff;
-
-		scanLineSize = TIFFScanlineSize(m_tiff);
+		const tmsize_t	scanLineSize = TIFFScanlineSize(m_tiff);
 		ZTRACE_RUNTIME("TIFF Scan Line Size %zu", scanLineSize);
 		ZTRACE_RUNTIME("TIFF spp=%d, bps=%d, w=%d, h=%d", spp, bps, w, h);
 
 		//
-        // Allocate enough to hold the entire image
-        //
-		tmsize_t buffSize = scanLineSize * h;
-		ZTRACE_RUNTIME("Allocating buffer of %zu bytes", buffSize);
-		buff = (tdata_t)malloc(buffSize);
+		// Write the image out as Strips (i.e. not scanline by scanline)
+		// 
+		const unsigned long STRIP_SIZE_DEFAULT = 4'194'304UL;		// 4MB
 
-		if (buff)
-		{
-			if (m_pProgress)
-				m_pProgress->Start2(nullptr, h);
+		//
+		// Work out how many scanlines fit into the default strip
+		// (at least one when the scanline is longer the default strip size)
+		//
+		const LONG rowsPerStrip = max(1L, static_cast<LONG>(STRIP_SIZE_DEFAULT / scanLineSize));
+		TIFFSetField(m_tiff, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
 
-			BYTE *  byteBuff = (BYTE *)buff;
-			WORD *	shortBuff = (WORD *)buff;
-			DWORD * longBuff = (DWORD *)buff;
-			float *	floatBuff = (float *)buff;
+		//
+		// From that we derive the number of strips, plus one for the final
+		// (short) strip if it wasn't an exact division.
+		//
+		const LONG numStrips = (h + rowsPerStrip - 1) / rowsPerStrip;
+		ZTRACE_RUNTIME("Number of strips is %u", numStrips);
 
-			int	rowProgress = 0;
+		//
+		// Each strip is filled (straight from the planes of the bitmap when
+		// possible) and compressed by one of the threads, and the strips
+		// are written to the file in order as soon as they are ready.
+		// Only a few strips are in memory at the same time.
+		//
+		const std::function<void(LONG, BYTE *)>	GetRowFromPlanes = this->GetRowFromPlanes();
+		const int		nrProcessors = CMultitask::GetNrProcessors(false);
+		LONG			lNrWritten = 0;
 
-#if defined(_OPENMP)
-#pragma omp parallel for default(none)
-#endif
-			for (LONG row = 0; row < h; row++)
+		if (m_pProgress)
+			m_pProgress->Start2(nullptr, h);
+
+#pragma omp parallel for ordered schedule(dynamic, 1) if(nrProcessors - 1)
+		for (LONG strip = 0; strip < numStrips; strip++)
+		{
+			const LONG			lStartRow = strip * rowsPerStrip;
+			const LONG			lNrRows = min(rowsPerStrip, static_cast<LONG>(h - lStartRow));
+			const tmsize_t		lSize = scanLineSize * lNrRows;
+			std::vector<BYTE>	vStrip;
+			std::vector<BYTE>	vCompressed;
+			bool				bStripOk = !bError;
+
+			if (bStripOk)
 			{
-				for (LONG col = 0; col < w; col++)
+				vStrip.resize(lSize);
+				for (LONG row = 0;row<lNrRows;row++)
 				{
-					long index = (row * w * spp) + (col * spp);
-
-					double		fRed = 0, fGreen = 0, fBlue = 0, fGrey = 0;
-
-					OnWrite(col, row, fRed, fGreen, fBlue);
-
-					//
-					// If its a cfa bitmap, set grey level to maximum of RGB
-					// else convert from RGB to HSL and use Luminance.
-					// 
-					if (cfa)
-					{
-						fGrey = max(fRed, max(fGreen, fBlue));
-					}
+					if (GetRowFromPlanes)
+						GetRowFromPlanes(lStartRow + row, vStrip.data() + row * scanLineSize);
 					else
-					{
-						double H, S, L;
-						ToHSL(fRed, fGreen, fBlue, H, S, L);
-						fGrey = L * 255.0;
-					}
-
-					switch (bps)	// Bits per sample
-					{
-					case 8:			// One byte 
-						switch (spp)
-						{
-						case 1:
-							byteBuff[index] = fGrey;
-							break;
-						case 3:
-						case 4:
-							byteBuff[index] = fRed;
-							byteBuff[index + 1] = fGreen;
-							byteBuff[index + 2] = fBlue;
-							break;
-						}
-						break;
-					case 16:		// Unsigned short == WORD 
-						switch (spp)
-						{
-						case 1:
-							shortBuff[index] = fGrey * UCHAR_MAX;
-							break;
-						case 3:
-						case 4:
-							shortBuff[index] = fRed * UCHAR_MAX;
-							shortBuff[index + 1] = fGreen * UCHAR_MAX;
-							shortBuff[index + 2] = fBlue * UCHAR_MAX;
-							break;
-						}
-						break;
-					case 32:		// Unsigned long or 32 bit floating point 
-						if (sampleformat == SAMPLEFORMAT_IEEEFP)
-							switch (spp)
-							{
-							case 1:
-								floatBuff[index] = fGrey / (1.0 + UCHAR_MAX) * (samplemax - samplemin) + samplemin;
-								break;
-							case 3:
-							case 4:
-								floatBuff[index] = fRed / (1.0 + UCHAR_MAX) * (samplemax - samplemin) + samplemin;
-								floatBuff[index + 1] = fGreen / (1.0 + UCHAR_MAX) * (samplemax - samplemin) + samplemin;
-								floatBuff[index + 2] = fBlue / (1.0 + UCHAR_MAX) * (samplemax - samplemin) + samplemin;
-								break;
-							}
-						else switch (spp)	// unsigned long == DWORD
-						{
-						case 1:
-							longBuff[index] = fGrey * UCHAR_MAX * USHRT_MAX;
-							break;
-						case 3:
-						case 4:
-							longBuff[index] = fRed * UCHAR_MAX * USHRT_MAX;
-							longBuff[index + 1] = fGreen * UCHAR_MAX * USHRT_MAX;
-							longBuff[index + 2] = fBlue * UCHAR_MAX * USHRT_MAX;
-							break;
-
-						}
-					}
+						GetRowFromOnWrite(lStartRow + row, vStrip.data() + row * scanLineSize);
+				};
 
-				}
-#if defined (_OPENMP)
-				if (m_pProgress && 0 == omp_get_thread_num())	// Are we on the master thread?
-					m_pProgress->Progress2(nullptr, row / 2);
-#else
-				if (m_pProgress)
-					m_pProgress->Progress2(nullptr, row / 2);
-#endif
+				if (compression != COMPRESSION_NONE)
+					bStripOk = CompressStrip(vStrip.data(), lNrRows, lSize, vCompressed);
+				else
+					vCompressed.swap(vStrip);
 			};
 
-			//
-			// Write the image out as Strips (i.e. not scanline by scanline)
-			// 
-			const unsigned long STRIP_SIZE_DEFAULT = 4'194'304UL;		// 4MB
-
-			//
-			// Work out how many scanlines fit into the default strip
-			//
-			unsigned long rowsPerStrip = STRIP_SIZE_DEFAULT / scanLineSize;
-			
-			//
-			// Handle the case where the scanline is longer the default strip size
-			//
-			// if (0 == rowsPerStrip) rowsPerStrip = 1; 
-			TIFFSetField(m_tiff, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
-
-			//
-			// From that we derive the number of strips
-			//
-			long numStrips = h / rowsPerStrip;
-			//
-			// If it wasn't an exact division (IOW there's a remainder), add one
-			// for the final (short) strip.
-			//
-			if (0 != h % rowsPerStrip)
-				++numStrips;
-
-			ZTRACE_RUNTIME("Number of strips is %u", numStrips);
-
-			BYTE * curr = (BYTE *)buff;
-			tsize_t stripSize = rowsPerStrip * scanLineSize;
-			tsize_t bytesRemaining = h * scanLineSize;
-			tsize_t size = stripSize;
-			for (long strip = 0; strip < numStrips; strip++)
+#pragma omp ordered
 			{
-				if (bytesRemaining < stripSize)
-					size = bytesRemaining;
-
-				tsize_t result = TIFFWriteEncodedStrip(m_tiff, strip, curr, size);
-				if (-1 == result)
+				if (!bError && bStripOk)
 				{
-					ZTRACE_RUNTIME("TIFFWriteEncodedStrip() failed");
-					bError = true;
-					break;
+					if (-1 == TIFFWriteRawStrip(m_tiff, strip, vCompressed.data(), vCompressed.size()))
+					{
+						ZTRACE_RUNTIME("TIFFWriteRawStrip() failed");
+						bError = true;
+					};
 				}
-				curr += result;
-				bytesRemaining -= result;
-
-				if (m_pProgress != nullptr)
-					m_pProgress->Progress2(nullptr, h / 2 + (h * strip) / (2 * numStrips));
-			}
+				else if (!bError)
+				{
+					ZTRACE_RUNTIME("Compression of strip %d failed", strip);
+					bError = true;
+				};
 
-			free(buff);
-			if (m_pProgress)
-				m_pProgress->End2();
+				lNrWritten += lNrRows;
+				if (m_pProgress && 0 == omp_get_thread_num())	// Are we on the master thread?
+					m_pProgress->Progress2(nullptr, lNrWritten);
+			};
 		};
+
+		if (m_pProgress)
+			m_pProgress->End2();
 		bResult = (!bError) ? true : false;
 	};
 
@@ -861,6 +1202,12 @@ public :
 	virtual bool	OnOpen();
 	void	OnWrite(LONG lX, LONG lY, double & fRed, double & fGreen, double & fBlue) override;
 	virtual bool	OnClose();
+
+protected :
+	virtual CMemoryBitmap *	GetSourceBitmap()
+	{
+		return m_pMemoryBitmap;
+	};
 };
 
 /* ------------------------------------------------------------------- */
@@ -956,24 +1303,8 @@ void CTIFFWriteFromMemoryBitmap::OnWrite(LONG lX, LONG lY, double & fRed, double
 	}
 	catch (ZException e)
 	{
-		CString errorMessage;
-		CString name(CA2CT(e.name()));
-		CString fileName(CA2CT(e.locationAtIndex(0)->fileName()));
-		CString functionName(CA2CT(e.locationAtIndex(0)->functionName()));
-		CString text(CA2CT(e.text(0)));
-
-		errorMessage.Format(
-			_T("Exception %s thrown from %s Function: %s() Line: %lu\n\n%s"),
-			name,
-			fileName,
-			functionName,
-			e.locationAtIndex(0)->lineNumber(),
-			text);
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		CString errorMessage(FormatZException(e));
+		ReportEngineMessage(errorMessage);
 		exit(1);
 
 	}
@@ -1105,6 +1436,12 @@ public :
 	virtual bool	OnOpen();
 	void	OnRead(LONG lX, LONG lY, double fRed, double fGreen, double fBlue) override;
 	virtual bool	OnClose();
+
+protected :
+	virtual CMemoryBitmap *	GetTargetBitmap()
+	{
+		return m_pBitmap;
+	};
 };
 
 /* ------------------------------------------------------------------- */
@@ -1210,24 +1547,8 @@ void CTIFFReadInMemoryBitmap::OnRead(LONG lX, LONG lY, double fRed, double fGree
 	}
 	catch (ZException e)
 	{
-		CString errorMessage;
-		CString name(CA2CT(e.name()));
-		CString fileName(CA2CT(e.locationAtIndex(0)->fileName()));
-		CString functionName(CA2CT(e.locationAtIndex(0)->functionName()));
-		CString text(CA2CT(e.text(0)));
-
-		errorMessage.Format(
-			_T("Exception %s thrown from %s Function: %s() Line: %lu\n\n%s"),
-			name,
-			fileName,
-			functionName,
-			e.locationAtIndex(0)->lineNumber(),
-			text);
-#if defined(_CONSOLE)
-		std::cerr << errorMessage;
-#else
-		AfxMessageBox(errorMessage, MB_OK | MB_ICONSTOP);
-#endif
+		CString errorMessage(FormatZException(e));
+		ReportEngineMessage(errorMessage);
 		exit(1);
 
 	}
@@ -216,6 +216,17 @@ public :
 		Close();
 	};
 
+private :
+	bool	ReadInBlocks();
+	template <typename TType>
+	bool	ReadInBlocks(TType * const (&pPlanes)[3], double fMultiplier);
+
+protected :
+	// Bitmap in which Read() decodes the strips (or tiles) directly, on
+	// several threads (nullptr to get one OnRead call per pixel)
+	virtual CMemoryBitmap *	GetTargetBitmap() { return nullptr; };
+
+public :
 	bool	Open();
 	bool	Read();
 	bool	Close();
@@ -240,6 +251,17 @@ public :
 
 protected :
 	void	SetFormat(LONG lWidth, LONG lHeight, TIFFFORMAT TiffFormat, CFATYPE CFAType, bool bMaster);
+
+	// Bitmap from which Write() takes the pixels directly, row band by row
+	// band (nullptr to get one OnWrite call per pixel)
+	virtual CMemoryBitmap *	GetSourceBitmap() { return nullptr; };
+
+private :
+	void	GetRowFromOnWrite(LONG lRow, BYTE * pScanLine);
+	std::function<void(LONG, BYTE *)>	GetRowFromPlanes();
+	bool	CompressStrip(BYTE * pStrip, LONG lNrRows, tmsize_t lSize, std::vector<BYTE> & vCompressed);
+
+protected :
 	void	SetCompression(TIFFCOMPRESSION tiffcomp)
 	{
 		compression = COMPRESSION_NONE;
@@ -0,0 +1,301 @@
+#include <stdafx.h>
+#include "ThreadPool.h"
+#include "Multitask.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+
+/* ------------------------------------------------------------------- */
+
+// Index of the queue of the current thread (-1 for the threads not in the pool)
+static thread_local long	g_lWorkerIndex = -1;
+
+/* ------------------------------------------------------------------- */
+
+CThreadPool::CThreadPool() :
+	m_lNrQueuedTasks(0),
+	m_lNextQueue(0),
+	m_lNrActiveLoops(0),
+	m_bReducedPriority(false),
+	m_bStop(false)
+{
+	// The calling thread works too
+	StartWorkers(CMultitask::GetNrProcessors() - 1, CMultitask::GetReducedThreadsPriority());
+};
+
+/* ------------------------------------------------------------------- */
+
+CThreadPool::~CThreadPool()
+{
+	StopWorkers();
+};
+
+/* ------------------------------------------------------------------- */
+
+CThreadPool & CThreadPool::GetInstance()
+{
+	static CThreadPool		ThreadPool;
+
+	return ThreadPool;
+};
+
+/* ------------------------------------------------------------------- */
+
+void CThreadPool::StartWorkers(long lNrWorkers, bool bReducedPriority)
+{
+	lNrWorkers = std::max(0L, lNrWorkers);
+
+	m_bStop = false;
+	m_bReducedPriority = bReducedPriority;
+
+	// One queue per worker plus one for the threads outside of the pool
+	m_vQueues.clear();
+	for (long i = 0;i<=lNrWorkers;i++)
+		m_vQueues.push_back(std::make_unique<CWorkQueue>());
+
+	for (long i = 0;i<lNrWorkers;i++)
+	{
+		m_vThreads.emplace_back(&CThreadPool::WorkerLoop, this, i);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void CThreadPool::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex>		lock(m_Mutex);
+
+		m_bStop = true;
+	}
+	m_WakeUp.notify_all();
+
+	for (auto & Thread : m_vThreads)
+		Thread.join();
+	m_vThreads.clear();
+};
+
+/* ------------------------------------------------------------------- */
+
+long CThreadPool::GetNrThreads()
+{
+	return static_cast<long>(m_vThreads.size()) + 1;
+};
+
+/* ------------------------------------------------------------------- */
+
+void CThreadPool::Push(TASK && Task)
+{
+	size_t				lQueue;
+
+	// A worker keeps the tasks it creates (the others will steal them),
+	// the other threads spread them over all the queues
+	if (g_lWorkerIndex >= 0)
+		lQueue = g_lWorkerIndex;
+	else
+		lQueue = m_lNextQueue++ % m_vQueues.size();
+
+	{
+		std::lock_guard<std::mutex>		lock(m_vQueues[lQueue]->m_Mutex);
+
+		m_vQueues[lQueue]->m_Tasks.push_back(std::move(Task));
+	}
+
+	{
+		std::lock_guard<std::mutex>		lock(m_Mutex);
+
+		m_lNrQueuedTasks++;
+	}
+	m_WakeUp.notify_one();
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CThreadPool::PopTask(TASK & Task)
+{
+	const size_t		lNrQueues = m_vQueues.size();
+	const size_t		lOwnQueue = (g_lWorkerIndex >= 0) ? g_lWorkerIndex : lNrQueues - 1;
+
+	// Newest task of our own queue first (it is the most likely to be in the cache)
+	{
+		CWorkQueue &					Queue = *m_vQueues[lOwnQueue];
+		std::lock_guard<std::mutex>		lock(Queue.m_Mutex);
+
+		if (!Queue.m_Tasks.empty())
+		{
+			Task = std::move(Queue.m_Tasks.back());
+			Queue.m_Tasks.pop_back();
+			m_lNrQueuedTasks--;
+			return true;
+		};
+	}
+
+	// Then steal the oldest task of another queue
+	for (size_t i = 1;i<lNrQueues;i++)
+	{
+		CWorkQueue &					Queue = *m_vQueues[(lOwnQueue + i) % lNrQueues];
+		std::lock_guard<std::mutex>		lock(Queue.m_Mutex);
+
+		if (!Queue.m_Tasks.empty())
+		{
+			Task = std::move(Queue.m_Tasks.front());
+			Queue.m_Tasks.pop_front();
+			m_lNrQueuedTasks--;
+			return true;
+		};
+	};
+
+	return false;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CThreadPool::RunPendingTask()
+{
+	TASK				Task;
+	const bool			bResult = PopTask(Task);
+
+	if (bResult)
+		Task();
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
+
+void CThreadPool::WorkerLoop(long lIndex)
+{
+	g_lWorkerIndex = lIndex;
+	if (m_bReducedPriority)
+		ReduceCurrentThreadPriority();
+
+	for (;;)
+	{
+		if (RunPendingTask())
+			continue;
+
+		std::unique_lock<std::mutex>	lock(m_Mutex);
+
+		m_WakeUp.wait(lock, [this]() { return m_bStop || m_lNrQueuedTasks.load() > 0; });
+		if (m_bStop && !m_lNrQueuedTasks.load())
+			break;
+	};
+
+	g_lWorkerIndex = -1;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool CThreadPool::ParallelFor(long lStart, long lEnd, long lChunkSize,
+							  const std::function<void(long, long)> & Task,
+							  const std::function<bool(long)> & Progress)
+{
+	class CLoop
+	{
+	public :
+		std::mutex					m_Mutex;
+		std::condition_variable		m_Done;
+		std::atomic<long>			m_lNrRemainingChunks;
+		std::atomic<long>			m_lNrProcessed;
+		std::atomic<bool>			m_bCanceled;
+		std::exception_ptr			m_pException;
+
+		CLoop() : m_lNrRemainingChunks(0), m_lNrProcessed(0), m_bCanceled(false)
+		{
+		};
+	};
+
+	if (lEnd <= lStart)
+		return true;
+
+	{
+		std::lock_guard<std::mutex>		lock(m_LoopsMutex);
+
+		// Follow the changes of the settings when nothing is running
+		if (!m_lNrActiveLoops && g_lWorkerIndex < 0)
+		{
+			const long		lNrWorkers = CMultitask::GetNrProcessors() - 1;
+			const bool		bReducedPriority = CMultitask::GetReducedThreadsPriority();
+
+			if (lNrWorkers != static_cast<long>(m_vThreads.size()) || bReducedPriority != m_bReducedPriority)
+			{
+				StopWorkers();
+				StartWorkers(lNrWorkers, bReducedPriority);
+			};
+		};
+		m_lNrActiveLoops++;
+	}
+
+	if (lChunkSize <= 0)
+		lChunkSize = std::max(1L, (lEnd - lStart) / (GetNrThreads() * 8));
+
+	auto				pLoop = std::make_shared<CLoop>();
+	const long			lNrChunks = (lEnd - lStart + lChunkSize - 1) / lChunkSize;
+
+	pLoop->m_lNrRemainingChunks = lNrChunks;
+	for (long lChunkStart = lStart;lChunkStart<lEnd;lChunkStart += lChunkSize)
+	{
+		const long		lChunkEnd = std::min(lEnd, lChunkStart + lChunkSize);
+
+		Push([pLoop, &Task, lChunkStart, lChunkEnd]()
+		{
+			if (!pLoop->m_bCanceled)
+			{
+				try
+				{
+					Task(lChunkStart, lChunkEnd);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex>		lock(pLoop->m_Mutex);
+
+					if (!pLoop->m_pException)
+						pLoop->m_pException = std::current_exception();
+					pLoop->m_bCanceled = true;
+				};
+			};
+			pLoop->m_lNrProcessed += lChunkEnd - lChunkStart;
+			if (--pLoop->m_lNrRemainingChunks == 0)
+			{
+				std::lock_guard<std::mutex>		lock(pLoop->m_Mutex);
+
+				pLoop->m_Done.notify_all();
+			};
+		});
+	};
+
+	bool				bResult = true;
+
+	while (pLoop->m_lNrRemainingChunks.load() > 0)
+	{
+		if (Progress && bResult && !Progress(pLoop->m_lNrProcessed.load()))
+		{
+			bResult = false;
+			pLoop->m_bCanceled = true;
+		};
+
+		// Help the workers, or wait for them when there is nothing left to do
+		if (!RunPendingTask())
+		{
+			std::unique_lock<std::mutex>	lock(pLoop->m_Mutex);
+
+			pLoop->m_Done.wait_for(lock, std::chrono::milliseconds(50), [&pLoop]() { return pLoop->m_lNrRemainingChunks.load() == 0; });
+		};
+	};
+
+	if (Progress && bResult)
+		Progress(lEnd - lStart);
+
+	{
+		std::lock_guard<std::mutex>		lock(m_LoopsMutex);
+
+		m_lNrActiveLoops--;
+	}
+
+	if (pLoop->m_pException)
+		std::rethrow_exception(pLoop->m_pException);
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
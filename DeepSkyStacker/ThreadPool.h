@@ -0,0 +1,77 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* ------------------------------------------------------------------- */
+
+// Process wide pool of worker threads.
+// Each worker has its own queue of tasks and steals tasks from the other
+// queues when its own queue is empty. The thread calling ParallelFor
+// executes tasks too while it waits for the loop to be completed.
+
+class CThreadPool
+{
+private :
+	typedef std::function<void()>		TASK;
+
+	class CWorkQueue
+	{
+	public :
+		std::mutex						m_Mutex;
+		std::deque<TASK>				m_Tasks;
+	};
+
+	std::mutex								m_Mutex;
+	std::condition_variable					m_WakeUp;
+	std::mutex								m_LoopsMutex;
+	std::vector<std::unique_ptr<CWorkQueue>>	m_vQueues;
+	std::vector<std::thread>				m_vThreads;
+	std::atomic<long>						m_lNrQueuedTasks;
+	std::atomic<size_t>						m_lNextQueue;
+	long									m_lNrActiveLoops;
+	bool									m_bReducedPriority;
+	bool									m_bStop;
+
+private :
+	CThreadPool();
+
+	void	StartWorkers(long lNrWorkers, bool bReducedPriority);
+	void	StopWorkers();
+	void	WorkerLoop(long lIndex);
+	void	Push(TASK && Task);
+	bool	PopTask(TASK & Task);
+	bool	RunPendingTask();
+
+public :
+	~CThreadPool();
+
+	CThreadPool(const CThreadPool &) = delete;
+	CThreadPool & operator = (const CThreadPool &) = delete;
+
+	static CThreadPool &	GetInstance();
+
+	// Number of threads working on a loop (the workers and the calling thread)
+	long	GetNrThreads();
+
+	// Calls Task(lChunkStart, lChunkEnd) for each chunk of [lStart, lEnd[ and waits for
+	// all the chunks to be done. When lChunkSize is 0 the chunk size is computed from
+	// the number of threads.
+	// Progress is called from the calling thread with the number of processed items, if
+	// it returns false the remaining chunks are skipped and ParallelFor returns false.
+	// An exception thrown by a chunk is rethrown in the calling thread.
+	bool	ParallelFor(long lStart, long lEnd, long lChunkSize,
+						const std::function<void(long, long)> & Task,
+						const std::function<bool(long)> & Progress = nullptr);
+};
+
+/* ------------------------------------------------------------------- */
+
+#endif // __THREADPOOL_H__
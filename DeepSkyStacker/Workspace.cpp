@@ -196,6 +196,10 @@ void	CWorkspaceSettingsInternal::InitToDefault(WORKSPACESETTINGVECTOR & vSetting
 
 	vSettings.push_back(CWorkspaceSetting("Stacking/IntermediateFileFormat", (uint)1));
 
+	vSettings.push_back(CWorkspaceSetting("Stacking/PrefetchDepth", (uint)2));
+	vSettings.push_back(CWorkspaceSetting("Stacking/MappedTempFiles", true));
+	vSettings.push_back(CWorkspaceSetting("Stacking/ResamplingMode", (uint)0));
+
 	vSettings.push_back(CWorkspaceSetting("Stacking/PCS_DetectCleanHot", false));
 	vSettings.push_back(CWorkspaceSetting("Stacking/PCS_HotFilter", (uint)1));
 	vSettings.push_back(CWorkspaceSetting("Stacking/PCS_HotDetection", (uint)500));
@@ -210,6 +214,7 @@ void	CWorkspaceSettingsInternal::InitToDefault(WORKSPACESETTINGVECTOR & vSetting
   	vSettings.push_back(CWorkspaceSetting("Register/DetectHotPixels", true));
   	vSettings.push_back(CWorkspaceSetting("Register/DetectionThreshold", (uint)10));
 	vSettings.push_back(CWorkspaceSetting("Register/ApplyMedianFilter", false));
+	vSettings.push_back(CWorkspaceSetting("Register/MaxConcurrentFrames", (uint)0));
 
 	vSettings.push_back(CWorkspaceSetting("RawDDP/Brightness", 1.0));
 	vSettings.push_back(CWorkspaceSetting("RawDDP/RedScale", 1.0));
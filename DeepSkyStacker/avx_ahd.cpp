@@ -0,0 +1,161 @@
+#include "StdAfx.h"
+#include "avx_ahd.h"
+#include "avx.h"
+
+AvxAHD::AvxAHD() noexcept :
+	avxReady{ AvxSupport::checkSimdAvailability() }
+{
+}
+
+int AvxAHD::labLine(const WORD* const pRed, const WORD* const pGreen, const WORD* const pBlue,
+	float* const pL, float* const pa, float* const pb, const float* const pLUT, const double fMultiplier, const size_t width) const
+{
+	if (!avxReady)
+		return 1;
+
+	// Same operations as CRGBToLab::RGBToLab so that the result is identical.
+	constexpr size_t vectorLen = 4;
+	const size_t nrVectors = width / vectorLen;
+	const __m256d vMultiplier = _mm256_set1_pd(fMultiplier);
+	const __m256d vScale = _mm256_set1_pd(65535.0);
+	const __m128i vMaxIndex = _mm_set1_epi32(65535);
+
+	const auto toDouble = [vMultiplier](const WORD* const p) -> __m256d
+	{
+		return _mm256_div_pd(_mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)))), vMultiplier);
+	};
+	const auto cubeRoot = [pLUT, vScale, vMaxIndex](const __m256d value) -> __m256d
+	{
+		const __m128i index = _mm_min_epi32(_mm_max_epi32(_mm256_cvttpd_epi32(_mm256_floor_pd(_mm256_mul_pd(value, vScale))), _mm_setzero_si128()), vMaxIndex);
+		return _mm256_cvtps_pd(_mm_i32gather_ps(pLUT, index, 4));
+	};
+	const auto combine = [](const double c0, const double c1, const double c2, const __m256d r, const __m256d g, const __m256d b) -> __m256d
+	{
+		return _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(c0), r), _mm256_mul_pd(_mm256_set1_pd(c1), g)), _mm256_mul_pd(_mm256_set1_pd(c2), b));
+	};
+
+	for (size_t counter = 0, n = 0; counter < nrVectors; ++counter, n += vectorLen)
+	{
+		const __m256d r = toDouble(pRed + n);
+		const __m256d g = toDouble(pGreen + n);
+		const __m256d b = toDouble(pBlue + n);
+
+		const __m256d X = cubeRoot(combine(0.433953, 0.376219, 0.189828, r, g, b));
+		const __m256d Y = cubeRoot(combine(0.212671, 0.715160, 0.072169, r, g, b));
+		const __m256d Z = cubeRoot(combine(0.017758, 0.109477, 0.872766, r, g, b));
+
+		_mm_storeu_ps(pL + n, _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(116.0), Y), _mm256_set1_pd(16.0))));
+		_mm_storeu_ps(pa + n, _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_set1_pd(500.0), _mm256_sub_pd(X, Y))));
+		_mm_storeu_ps(pb + n, _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_set1_pd(200.0), _mm256_sub_pd(Y, Z))));
+	}
+	// Remaining pixels of line.
+	for (size_t n = nrVectors * vectorLen; n < width; ++n)
+	{
+		const double r = pRed[n] / fMultiplier;
+		const double g = pGreen[n] / fMultiplier;
+		const double b = pBlue[n] / fMultiplier;
+
+		const double X = pLUT[static_cast<int>(floor((0.433953 * r + 0.376219 * g + 0.189828 * b) * 65535.0))];
+		const double Y = pLUT[static_cast<int>(floor((0.212671 * r + 0.715160 * g + 0.072169 * b) * 65535.0))];
+		const double Z = pLUT[static_cast<int>(floor((0.017758 * r + 0.109477 * g + 0.872766 * b) * 65535.0))];
+
+		pL[n] = static_cast<float>(116.0 * Y - 16.0);
+		pa[n] = static_cast<float>(500.0 * (X - Y));
+		pb[n] = static_cast<float>(200.0 * (Y - Z));
+	}
+
+	return AvxSupport::zeroUpper(0);
+}
+
+int AvxAHD::homogeneityLine(const float* const pHL, const float* const pHa, const float* const pHb,
+	const float* const pVL, const float* const pVa, const float* const pVb,
+	BYTE* const pHHomo, BYTE* const pVHomo, const size_t stride, const size_t width) const
+{
+	if (!avxReady)
+		return 1;
+
+	// The differences are computed in single precision and the rest in double precision like the scalar code.
+	constexpr size_t vectorLen = 4;
+	const size_t nrVectors = width / vectorLen;
+	const ptrdiff_t dir[4] = { -1, 1, -static_cast<ptrdiff_t>(stride), static_cast<ptrdiff_t>(stride) };
+	const __m256d signMask = _mm256_set1_pd(-0.0);
+	const __m256d one = _mm256_set1_pd(1.0);
+
+	const auto difference = [](const float* const p, const ptrdiff_t d) -> __m256d
+	{
+		return _mm256_cvtps_pd(_mm_sub_ps(_mm_loadu_ps(p), _mm_loadu_ps(p + d)));
+	};
+	const auto storeCounts = [](BYTE* const p, const __m256d counts) -> void
+	{
+		const __m128i values = _mm256_cvttpd_epi32(counts);
+		const int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(values, values), _mm_setzero_si128()));
+		memcpy(p, &bytes, sizeof(bytes));
+	};
+
+	for (size_t counter = 0, n = 0; counter < nrVectors; ++counter, n += vectorLen)
+	{
+		__m256d lDiffH[4], lDiffV[4], abDiffH[4], abDiffV[4];
+
+		for (int i = 0; i < 4; ++i)
+		{
+			lDiffH[i] = _mm256_andnot_pd(signMask, difference(pHL + n, dir[i]));
+			lDiffV[i] = _mm256_andnot_pd(signMask, difference(pVL + n, dir[i]));
+
+			const __m256d aDiffH = difference(pHa + n, dir[i]);
+			const __m256d bDiffH = difference(pHb + n, dir[i]);
+			const __m256d aDiffV = difference(pVa + n, dir[i]);
+			const __m256d bDiffV = difference(pVb + n, dir[i]);
+			abDiffH[i] = _mm256_add_pd(_mm256_mul_pd(aDiffH, aDiffH), _mm256_mul_pd(bDiffH, bDiffH));
+			abDiffV[i] = _mm256_add_pd(_mm256_mul_pd(aDiffV, aDiffV), _mm256_mul_pd(bDiffV, bDiffV));
+		}
+
+		const __m256d lEpsilon = _mm256_min_pd(_mm256_max_pd(lDiffH[0], lDiffH[1]), _mm256_max_pd(lDiffV[2], lDiffV[3]));
+		const __m256d abEpsilon = _mm256_min_pd(_mm256_max_pd(abDiffH[0], abDiffH[1]), _mm256_max_pd(abDiffV[2], abDiffV[3]));
+
+		// The a/b differences skipped by the scalar code only count when the L difference is above the epsilon.
+		__m256d countH = _mm256_setzero_pd();
+		__m256d countV = _mm256_setzero_pd();
+		for (int i = 0; i < 4; ++i)
+		{
+			const __m256d homoH = _mm256_and_pd(_mm256_cmp_pd(lDiffH[i], lEpsilon, _CMP_LE_OQ), _mm256_cmp_pd(abDiffH[i], abEpsilon, _CMP_LE_OQ));
+			const __m256d homoV = _mm256_and_pd(_mm256_cmp_pd(lDiffV[i], lEpsilon, _CMP_LE_OQ), _mm256_cmp_pd(abDiffV[i], abEpsilon, _CMP_LE_OQ));
+			countH = _mm256_add_pd(countH, _mm256_and_pd(homoH, one));
+			countV = _mm256_add_pd(countV, _mm256_and_pd(homoV, one));
+		}
+
+		storeCounts(pHHomo + n, countH);
+		storeCounts(pVHomo + n, countV);
+	}
+	// Remaining pixels of line.
+	for (size_t n = nrVectors * vectorLen; n < width; ++n)
+	{
+		double lDiffH[4], lDiffV[4], abDiffH[4], abDiffV[4];
+
+		for (int i = 0; i < 4; ++i)
+		{
+			lDiffH[i] = fabs(pHL[n] - pHL[n + dir[i]]);
+			lDiffV[i] = fabs(pVL[n] - pVL[n + dir[i]]);
+
+			const double aDiffH = pHa[n] - pHa[n + dir[i]];
+			const double bDiffH = pHb[n] - pHb[n + dir[i]];
+			const double aDiffV = pVa[n] - pVa[n + dir[i]];
+			const double bDiffV = pVb[n] - pVb[n + dir[i]];
+			abDiffH[i] = aDiffH * aDiffH + bDiffH * bDiffH;
+			abDiffV[i] = aDiffV * aDiffV + bDiffV * bDiffV;
+		}
+
+		const double lEpsilon = std::min(std::max(lDiffH[0], lDiffH[1]), std::max(lDiffV[2], lDiffV[3]));
+		const double abEpsilon = std::min(std::max(abDiffH[0], abDiffH[1]), std::max(abDiffV[2], abDiffV[3]));
+
+		pHHomo[n] = pVHomo[n] = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (lDiffH[i] <= lEpsilon && abDiffH[i] <= abEpsilon)
+				++pHHomo[n];
+			if (lDiffV[i] <= lEpsilon && abDiffV[i] <= abEpsilon)
+				++pVHomo[n];
+		}
+	}
+
+	return AvxSupport::zeroUpper(0);
+}
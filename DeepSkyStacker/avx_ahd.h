@@ -0,0 +1,27 @@
+#pragma once
+
+#include "BitmapExt.h"
+
+// AVX2 parts of the AHD demosaicing (see CAHDTask::DoSubWindow) working on one line of a window.
+class AvxAHD
+{
+private:
+	bool avxReady;
+public:
+	AvxAHD() noexcept;
+	AvxAHD(const AvxAHD&) = delete;
+	AvxAHD(AvxAHD&&) = delete;
+	AvxAHD& operator=(const AvxAHD&) = delete;
+
+	// RGB to CIELab with the cube root lookup table of CRGBToLab (same operations in double precision).
+	// Return 0 if the line was converted, 1 if the scalar code must be used.
+	int labLine(const WORD* const pRed, const WORD* const pGreen, const WORD* const pBlue,
+		float* const pL, float* const pa, float* const pb, const float* const pLUT, const double fMultiplier, const size_t width) const;
+
+	// Homogeneity maps of the horizontal and vertical interpolations.
+	// The neighbors are at -1, +1, -stride and +stride.
+	// Return 0 if the line was processed, 1 if the scalar code must be used.
+	int homogeneityLine(const float* const pHL, const float* const pHa, const float* const pHb,
+		const float* const pVL, const float* const pVa, const float* const pVb,
+		BYTE* const pHHomo, BYTE* const pVHomo, const size_t stride, const size_t width) const;
+};
@@ -0,0 +1,71 @@
+#include "StdAfx.h"
+#include "avx_calibration.h"
+#include "avx.h"
+
+AvxCalibration::AvxCalibration() noexcept :
+	avxReady{ AvxSupport::checkSimdAvailability() }
+{
+}
+
+int AvxCalibration::calibrateLine(WORD* const pLine, const float* const pSubtract, const float* const pGain, const float maxValue, const size_t width) const
+{
+	if (!avxReady)
+		return 1;
+
+	constexpr size_t vectorLen = 16;
+	const size_t nrVectors = width / vectorLen;
+	const __m256 vMax = _mm256_set1_ps(maxValue);
+
+	const auto calibrate = [vMax](const __m128i words, const float* const pSub, const float* const pGn) -> __m256i
+	{
+		const __m256 value = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(words));
+		const __m256 subtracted = _mm256_max_ps(_mm256_sub_ps(value, _mm256_loadu_ps(pSub)), _mm256_setzero_ps());
+		// Truncation like the conversion of the scalar code
+		return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_mul_ps(subtracted, _mm256_loadu_ps(pGn)), vMax));
+	};
+
+	WORD* pValue = pLine;
+	const float* pSub = pSubtract;
+	const float* pGn = pGain;
+	for (size_t counter = 0; counter < nrVectors; ++counter, pValue += vectorLen, pSub += vectorLen, pGn += vectorLen)
+	{
+		const __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pValue));
+		const __m256i lo = calibrate(_mm256_castsi256_si128(words), pSub, pGn);
+		const __m256i hi = calibrate(_mm256_extracti128_si256(words, 1), pSub + 8, pGn + 8);
+		// packus works on 128 bit lanes -> restore the order of the 64 bit blocks.
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(pValue), packed);
+	}
+	// Remaining pixels of line.
+	for (size_t n = nrVectors * vectorLen; n < width; ++n, ++pValue, ++pSub, ++pGn)
+	{
+		const float value = std::min(std::max(static_cast<float>(*pValue) - *pSub, 0.0f) * *pGn, maxValue);
+		*pValue = static_cast<WORD>(value);
+	}
+
+	return AvxSupport::zeroUpper(0);
+}
+
+int AvxCalibration::calibrateLine(float* const pLine, const float* const pSubtract, const float* const pGain, const float maxValue, const size_t width) const
+{
+	if (!avxReady)
+		return 1;
+
+	constexpr size_t vectorLen = 8;
+	const size_t nrVectors = width / vectorLen;
+	const __m256 vMax = _mm256_set1_ps(maxValue);
+
+	float* pValue = pLine;
+	const float* pSub = pSubtract;
+	const float* pGn = pGain;
+	for (size_t counter = 0; counter < nrVectors; ++counter, pValue += vectorLen, pSub += vectorLen, pGn += vectorLen)
+	{
+		const __m256 subtracted = _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(pValue), _mm256_loadu_ps(pSub)), _mm256_setzero_ps());
+		_mm256_storeu_ps(pValue, _mm256_min_ps(_mm256_mul_ps(subtracted, _mm256_loadu_ps(pGn)), vMax));
+	}
+	// Remaining pixels of line.
+	for (size_t n = nrVectors * vectorLen; n < width; ++n, ++pValue, ++pSub, ++pGn)
+		*pValue = std::min(std::max(*pValue - *pSub, 0.0f) * *pGn, maxValue);
+
+	return AvxSupport::zeroUpper(0);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "BitmapExt.h"
+
+// AVX2 part of the fused calibration of the light frames (see CMasterFrames::ApplyAllMasters).
+// For each pixel: pLine[i] = min(max(0, pLine[i] - pSubtract[i]) * pGain[i], maxValue)
+class AvxCalibration
+{
+private:
+	bool avxReady;
+public:
+	AvxCalibration() noexcept;
+	AvxCalibration(const AvxCalibration&) = delete;
+	AvxCalibration(AvxCalibration&&) = delete;
+	AvxCalibration& operator=(const AvxCalibration&) = delete;
+
+	// Return 0 if the line was calibrated, 1 if the scalar code must be used.
+	int calibrateLine(WORD* const pLine, const float* const pSubtract, const float* const pGain, const float maxValue, const size_t width) const;
+	int calibrateLine(float* const pLine, const float* const pSubtract, const float* const pGain, const float maxValue, const size_t width) const;
+};
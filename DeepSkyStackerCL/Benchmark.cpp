@@ -0,0 +1,716 @@
+#include <stdafx.h>
+#include "Benchmark.h"
+
+#include "RegisterEngine.h"
+#include "MatchingStars.h"
+#include "DarkFrame.h"
+#include "PixelTransform.h"
+#include "EntropyInfo.h"
+#include "TIFFUtil.h"
+#include "FITSUtil.h"
+#include "ThreadPool.h"
+#include "DSSPlatform.h"
+#include "avx.h"
+#include <atomic>
+#include <chrono>
+#include <random>
+
+/* ------------------------------------------------------------------- */
+
+// Levels of the synthetic frames (1.0 is the full scale)
+static const double			DARKLEVEL		= 0.02;
+static const double			SKYLEVEL		= 0.05;
+static const double			NOISELEVEL		= 0.004;
+static const double			HOTPIXELLEVEL	= 0.8;
+
+// Maximum shift (pixels) and rotation (radians) of the frames
+static const double			MAXSHIFT		= 40.0;
+static const double			MAXANGLE		= 0.005;
+
+// The benchmark fails when a frame is not matched or when the mean distance
+// (pixels) between the registered and the true positions of the stars is
+// above this value
+static const double			MAXRESIDUAL		= 0.5;
+
+/* ------------------------------------------------------------------- */
+
+class CSyntheticStar
+{
+public :
+	double				m_fX,
+						m_fY;			// Position in the reference frame
+	double				m_fAmplitude;
+	double				m_fSigma;
+};
+
+typedef std::vector<CSyntheticStar>		SYNTHETICSTARVECTOR;
+
+/* ------------------------------------------------------------------- */
+
+// Star field seen through frames that are shifted and rotated around
+// the center of the reference frame (frame 0), with a sky background,
+// gaussian noise and the hot pixels of the sensor.
+class CStarFieldGenerator
+{
+private :
+	const CBenchmarkSettings &	m_Settings;
+	SYNTHETICSTARVECTOR			m_vStars;
+	std::vector<size_t>			m_vHotPixels;
+	std::vector<double>			m_vXShifts,
+								m_vYShifts,
+								m_vAngles;
+
+private :
+	void	CreateBitmap(CMemoryBitmap ** ppBitmap) const;
+	void	FillBitmap(CMemoryBitmap * pBitmap, const std::vector<float> & vStarPlane, LONG lFrame, double fSkyLevel, double fNoiseLevel) const;
+
+public :
+	CStarFieldGenerator(const CBenchmarkSettings & Settings);
+
+	CPointExt	FramePosition(LONG lFrame, double fX, double fY) const;
+	void	CreateLightFrame(LONG lFrame, CMemoryBitmap ** ppBitmap) const;
+	void	CreateMasterDark(CMemoryBitmap ** ppBitmap) const;
+
+	const SYNTHETICSTARVECTOR &	GetStars() const
+	{
+		return m_vStars;
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+CStarFieldGenerator::CStarFieldGenerator(const CBenchmarkSettings & Settings) :
+	m_Settings(Settings)
+{
+	std::mt19937							Generator(Settings.m_dwSeed);
+	std::uniform_real_distribution<double>	Uniform(0.0, 1.0);
+	const double							fMargin = MAXSHIFT + MAXANGLE * max(Settings.m_lWidth, Settings.m_lHeight);
+
+	// The stars are also placed around the reference frame so that the
+	// shifted frames are filled too
+	for (LONG i = 0;i<Settings.m_lNrStars;i++)
+	{
+		CSyntheticStar		Star;
+		double				fLuminancy;
+
+		Star.m_fX		= -fMargin + Uniform(Generator) * (Settings.m_lWidth + 2.0 * fMargin);
+		Star.m_fY		= -fMargin + Uniform(Generator) * (Settings.m_lHeight + 2.0 * fMargin);
+		Star.m_fSigma	= 0.9 + Uniform(Generator);
+		// Many more faint stars than bright ones
+		fLuminancy		= Uniform(Generator);
+		Star.m_fAmplitude = 0.05 + 0.85 * fLuminancy * fLuminancy * fLuminancy;
+		m_vStars.push_back(Star);
+	};
+
+	// Same hot pixels in all the frames (and in the master dark)
+	const size_t		lNrPixels = static_cast<size_t>(Settings.m_lWidth) * Settings.m_lHeight;
+
+	for (size_t i = 0;i<lNrPixels/20000+1;i++)
+		m_vHotPixels.push_back(static_cast<size_t>(Uniform(Generator) * (lNrPixels - 1)));
+
+	// Frame 0 is the reference frame
+	m_vXShifts.push_back(0);
+	m_vYShifts.push_back(0);
+	m_vAngles.push_back(0);
+	for (LONG i = 1;i<Settings.m_lNrFrames;i++)
+	{
+		m_vXShifts.push_back((Uniform(Generator) * 2.0 - 1.0) * MAXSHIFT);
+		m_vYShifts.push_back((Uniform(Generator) * 2.0 - 1.0) * MAXSHIFT);
+		m_vAngles.push_back((Uniform(Generator) * 2.0 - 1.0) * MAXANGLE);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+CPointExt	CStarFieldGenerator::FramePosition(LONG lFrame, double fX, double fY) const
+{
+	const double		fXCenter = m_Settings.m_lWidth / 2.0;
+	const double		fYCenter = m_Settings.m_lHeight / 2.0;
+	const double		fCos = cos(m_vAngles[lFrame]);
+	const double		fSin = sin(m_vAngles[lFrame]);
+
+	return CPointExt(fXCenter + fCos * (fX - fXCenter) - fSin * (fY - fYCenter) + m_vXShifts[lFrame],
+					 fYCenter + fSin * (fX - fXCenter) + fCos * (fY - fYCenter) + m_vYShifts[lFrame]);
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CStarFieldGenerator::CreateBitmap(CMemoryBitmap ** ppBitmap) const
+{
+	CSmartPtr<CMemoryBitmap>	pBitmap;
+
+	if (m_Settings.m_lBitDepth == 32)
+		pBitmap.Attach(new C32BitFloatGrayBitmap);
+	else
+	{
+		C16BitGrayBitmap *		pGray16Bitmap = new C16BitGrayBitmap;
+
+		pBitmap.Attach(pGray16Bitmap);
+		if (m_Settings.m_bCFA)
+		{
+			pGray16Bitmap->SetCFAType(CFATYPE_RGGB);
+			pGray16Bitmap->UseBilinear(true);
+		};
+	};
+
+	pBitmap->Init(m_Settings.m_lWidth, m_Settings.m_lHeight);
+	pBitmap.CopyTo(ppBitmap);
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CStarFieldGenerator::FillBitmap(CMemoryBitmap * pBitmap, const std::vector<float> & vStarPlane, LONG lFrame, double fSkyLevel, double fNoiseLevel) const
+{
+	const LONG			lWidth = m_Settings.m_lWidth;
+	const DWORD			dwSeed = m_Settings.m_dwSeed;
+	const bool			bCFA = m_Settings.m_bCFA;
+
+	// Each row has its own random generator so that the noise does not
+	// depend on the number of threads
+	CThreadPool::GetInstance().ParallelFor(0, m_Settings.m_lHeight, 0, [&](long lStart, long lEnd)
+	{
+		for (LONG j = lStart;j<lEnd;j++)
+		{
+			std::mt19937						Generator(static_cast<std::mt19937::result_type>(dwSeed + 7919 * (lFrame + 1) + 104729 * j));
+			std::normal_distribution<double>	Noise(0.0, fNoiseLevel);
+
+			for (LONG i = 0;i<lWidth;i++)
+			{
+				double			fSignal = fSkyLevel;
+				double			fValue;
+
+				if (!vStarPlane.empty())
+					fSignal += vStarPlane[static_cast<size_t>(j) * lWidth + i];
+				if (bCFA)
+				{
+					// Response of the color filters to white stars
+					const BAYERCOLOR	BayerColor = ::GetBayerColor(i, j, CFATYPE_RGGB);
+
+					if (BayerColor == BAYER_RED)
+						fSignal *= 0.7;
+					else if (BayerColor == BAYER_BLUE)
+						fSignal *= 0.5;
+				};
+
+				fValue = DARKLEVEL + fSignal + Noise(Generator);
+				pBitmap->SetPixel(i, j, max(0.0, min(fValue, 1.0)) * 255.0);
+			};
+		};
+	});
+
+	for (const auto lOffset : m_vHotPixels)
+		pBitmap->SetPixel(static_cast<LONG>(lOffset % lWidth), static_cast<LONG>(lOffset / lWidth), HOTPIXELLEVEL * 255.0);
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CStarFieldGenerator::CreateLightFrame(LONG lFrame, CMemoryBitmap ** ppBitmap) const
+{
+	const LONG					lWidth = m_Settings.m_lWidth;
+	const LONG					lHeight = m_Settings.m_lHeight;
+	std::vector<float>			vStarPlane(static_cast<size_t>(lWidth) * lHeight, 0.0f);
+	CSmartPtr<CMemoryBitmap>	pBitmap;
+
+	// Gaussian profiles
+	for (const auto & Star : m_vStars)
+	{
+		const CPointExt		pt = FramePosition(lFrame, Star.m_fX, Star.m_fY);
+		const LONG			lRadius = static_cast<LONG>(ceil(4.0 * Star.m_fSigma));
+		const LONG			lMinX = max(0L, static_cast<LONG>(floor(pt.X)) - lRadius);
+		const LONG			lMaxX = min(lWidth - 1, static_cast<LONG>(floor(pt.X)) + lRadius);
+		const LONG			lMinY = max(0L, static_cast<LONG>(floor(pt.Y)) - lRadius);
+		const LONG			lMaxY = min(lHeight - 1, static_cast<LONG>(floor(pt.Y)) + lRadius);
+		const double		fScale = 1.0 / (2.0 * Star.m_fSigma * Star.m_fSigma);
+
+		for (LONG j = lMinY;j<=lMaxY;j++)
+		{
+			for (LONG i = lMinX;i<=lMaxX;i++)
+			{
+				const double	fDX = i - pt.X;
+				const double	fDY = j - pt.Y;
+
+				vStarPlane[static_cast<size_t>(j) * lWidth + i] += static_cast<float>(Star.m_fAmplitude * exp(-(fDX * fDX + fDY * fDY) * fScale));
+			};
+		};
+	};
+
+	CreateBitmap(&pBitmap);
+	FillBitmap(pBitmap, vStarPlane, lFrame, SKYLEVEL, NOISELEVEL);
+	pBitmap.CopyTo(ppBitmap);
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CStarFieldGenerator::CreateMasterDark(CMemoryBitmap ** ppBitmap) const
+{
+	CSmartPtr<CMemoryBitmap>	pBitmap;
+
+	// Dark level and hot pixels with the noise of an averaged master
+	CreateBitmap(&pBitmap);
+	FillBitmap(pBitmap, std::vector<float>(), -1, 0.0, NOISELEVEL / 4.0);
+	pBitmap->SetMaster(true);
+	pBitmap.CopyTo(ppBitmap);
+};
+
+/* ------------------------------------------------------------------- */
+
+class CStageTimer
+{
+private :
+	std::chrono::steady_clock::time_point	m_Start;
+	double									m_fSeconds;
+
+public :
+	CStageTimer()
+	{
+		m_fSeconds = 0;
+	};
+
+	void	Start()
+	{
+		m_Start = std::chrono::steady_clock::now();
+	};
+
+	void	Stop()
+	{
+		m_fSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_Start).count();
+	};
+
+	double	GetSeconds() const
+	{
+		return m_fSeconds;
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+class CBenchmarkStage
+{
+public :
+	CString				m_strName;
+	bool				m_bDone;
+	LONG				m_lNrFrames;
+	double				m_fSeconds;
+	double				m_fMegaPixels;
+	std::vector<std::pair<CString, double>>	m_vCounters;
+
+public :
+	CBenchmarkStage(LPCTSTR szName, bool bDone, LONG lNrFrames, double fSeconds, double fMegaPixels) :
+		m_strName(szName),
+		m_bDone(bDone),
+		m_lNrFrames(lNrFrames),
+		m_fSeconds(fSeconds),
+		m_fMegaPixels(fMegaPixels)
+	{
+	};
+
+	double	GetMegaPixelsPerSecond() const
+	{
+		return (m_bDone && m_fSeconds > 0) ? m_fMegaPixels / m_fSeconds : 0.0;
+	};
+
+	double	GetFramesPerSecond() const
+	{
+		return (m_bDone && m_fSeconds > 0) ? m_lNrFrames / m_fSeconds : 0.0;
+	};
+};
+
+typedef std::vector<CBenchmarkStage>	BENCHMARKSTAGEVECTOR;
+
+/* ------------------------------------------------------------------- */
+
+// The peak memory is the high-water mark of the whole process (the OS
+// doesn't reset it between the stages), so it is reported once for the run
+
+static void	PrintReport(const BENCHMARKSTAGEVECTOR & vStages, std::uint64_t lPeakRSS)
+{
+	_tprintf(_T("%-16s %6s %10s %10s %10s\n"), _T("Stage"), _T("Frames"), _T("Seconds"), _T("MPix/s"), _T("Frames/s"));
+	for (const auto & Stage : vStages)
+	{
+		if (Stage.m_bDone)
+			_tprintf(_T("%-16s %6ld %10.3f %10.2f %10.2f\n"), (LPCTSTR)Stage.m_strName, Stage.m_lNrFrames, Stage.m_fSeconds,
+					 Stage.GetMegaPixelsPerSecond(), Stage.GetFramesPerSecond());
+		else
+			_tprintf(_T("%-16s %6ld %10s\n"), (LPCTSTR)Stage.m_strName, Stage.m_lNrFrames, _T("n/a"));
+	};
+	_tprintf(_T("Process peak RSS: %.1f MB\n"), lPeakRSS / 1048576.0);
+
+	_tprintf(_T("\n"));
+	for (const auto & Stage : vStages)
+	{
+		for (const auto & Counter : Stage.m_vCounters)
+			_tprintf(_T("%s: %s = %.3f\n"), (LPCTSTR)Stage.m_strName, (LPCTSTR)Counter.first, Counter.second);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+static bool	WriteJSONReport(LPCTSTR szFileName, const CBenchmarkSettings & Settings, const BENCHMARKSTAGEVECTOR & vStages, std::uint64_t lPeakRSS)
+{
+	FILE *				hFile;
+
+	hFile = _tfopen(szFileName, _T("wt"));
+	if (!hFile)
+		return false;
+
+	_ftprintf(hFile, _T("{\n"));
+	_ftprintf(hFile, _T("  \"version\": \"%s\",\n"), _T(VERSION_DEEPSKYSTACKER));
+	_ftprintf(hFile, _T("  \"width\": %ld,\n"), Settings.m_lWidth);
+	_ftprintf(hFile, _T("  \"height\": %ld,\n"), Settings.m_lHeight);
+	_ftprintf(hFile, _T("  \"frames\": %ld,\n"), Settings.m_lNrFrames);
+	_ftprintf(hFile, _T("  \"bitdepth\": %ld,\n"), Settings.m_lBitDepth);
+	_ftprintf(hFile, _T("  \"cfa\": %s,\n"), Settings.m_bCFA ? _T("true") : _T("false"));
+	_ftprintf(hFile, _T("  \"stars\": %ld,\n"), Settings.m_lNrStars);
+	_ftprintf(hFile, _T("  \"seed\": %lu,\n"), Settings.m_dwSeed);
+	_ftprintf(hFile, _T("  \"threads\": %ld,\n"), CThreadPool::GetInstance().GetNrThreads());
+	_ftprintf(hFile, _T("  \"peak_rss_bytes\": %llu,\n"), static_cast<unsigned long long>(lPeakRSS));
+	_ftprintf(hFile, _T("  \"stages\": [\n"));
+	for (size_t i = 0;i<vStages.size();i++)
+	{
+		const CBenchmarkStage &	Stage = vStages[i];
+
+		_ftprintf(hFile, _T("    {\n"));
+		_ftprintf(hFile, _T("      \"name\": \"%s\",\n"), (LPCTSTR)Stage.m_strName);
+		_ftprintf(hFile, _T("      \"done\": %s,\n"), Stage.m_bDone ? _T("true") : _T("false"));
+		_ftprintf(hFile, _T("      \"frames\": %ld,\n"), Stage.m_lNrFrames);
+		_ftprintf(hFile, _T("      \"seconds\": %.6f,\n"), Stage.m_fSeconds);
+		_ftprintf(hFile, _T("      \"mpix_per_second\": %.3f,\n"), Stage.GetMegaPixelsPerSecond());
+		for (const auto & Counter : Stage.m_vCounters)
+			_ftprintf(hFile, _T("      \"%s\": %.6f,\n"), (LPCTSTR)Counter.first, Counter.second);
+		_ftprintf(hFile, _T("      \"frames_per_second\": %.3f\n"), Stage.GetFramesPerSecond());
+		_ftprintf(hFile, _T("    }%s\n"), (i + 1 < vStages.size()) ? _T(",") : _T(""));
+	};
+	_ftprintf(hFile, _T("  ]\n"));
+	_ftprintf(hFile, _T("}\n"));
+
+	fclose(hFile);
+
+	return true;
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	RunBenchmark(const CBenchmarkSettings & Settings)
+{
+	ZFUNCTRACE_RUNTIME();
+	const LONG								lWidth = Settings.m_lWidth;
+	const LONG								lHeight = Settings.m_lHeight;
+	const LONG								lNrFrames = Settings.m_lNrFrames;
+	const double							fFrameMegaPixels = static_cast<double>(lWidth) * lHeight / 1000000.0;
+	const bool								bFloat = (Settings.m_lBitDepth == 32);
+	CStarFieldGenerator						Generator(Settings);
+	std::vector<CSmartPtr<CMemoryBitmap>>	vFrames(lNrFrames);
+	BENCHMARKSTAGEVECTOR					vStages;
+
+	_tprintf(_T("Benchmark on %ld synthetic frames of %ldx%ld pixels (%ld bits%s, %ld stars, seed %lu)\n\n"),
+			 lNrFrames, lWidth, lHeight, Settings.m_lBitDepth, Settings.m_bCFA ? _T(", RGGB") : _T(""), Settings.m_lNrStars, Settings.m_dwSeed);
+
+	// The generation of the frames is not measured
+	for (LONG k = 0;k<lNrFrames;k++)
+		Generator.CreateLightFrame(k, &vFrames[k]);
+
+	// Loaders - the frames are written in temporary files then read back
+	{
+		QString					strFolder(CAllStackingTasks::GetTemporaryFilesFolder());
+		CString					strTIFFFile;
+		CString					strFITSFile;
+		CStageTimer				TIFFTimer,
+								FITSTimer;
+		bool					bTIFFDone = true,
+								bFITSDone = true;
+
+		strTIFFFile.Format(_T("%sDSSBenchmark.tif"), (LPCTSTR)strFolder.utf16());
+		strFITSFile.Format(_T("%sDSSBenchmark.fts"), (LPCTSTR)strFolder.utf16());
+
+		for (LONG k = 0;k<lNrFrames;k++)
+		{
+			CSmartPtr<CMemoryBitmap>	pBitmap;
+
+			bTIFFDone = WriteTIFF(strTIFFFile, vFrames[k], nullptr, bFloat ? TF_32BITGRAYFLOAT : TF_16BITGRAY, TC_NONE, nullptr) && bTIFFDone;
+			TIFFTimer.Start();
+			bTIFFDone = LoadPicture(strTIFFFile, &pBitmap, nullptr) && bTIFFDone;
+			TIFFTimer.Stop();
+
+			bFITSDone = WriteFITS(strFITSFile, vFrames[k], nullptr, bFloat ? FF_32BITGRAYFLOAT : FF_16BITGRAY, nullptr) && bFITSDone;
+			FITSTimer.Start();
+			bFITSDone = LoadPicture(strFITSFile, &pBitmap, nullptr) && bFITSDone;
+			FITSTimer.Stop();
+		};
+		DeleteFile(strTIFFFile);
+		DeleteFile(strFITSFile);
+
+		vStages.push_back(CBenchmarkStage(_T("load_tiff"), bTIFFDone, lNrFrames, TIFFTimer.GetSeconds(), lNrFrames * fFrameMegaPixels));
+		vStages.push_back(CBenchmarkStage(_T("load_fits"), bFITSDone, lNrFrames, FITSTimer.GetSeconds(), lNrFrames * fFrameMegaPixels));
+	};
+
+	// Dark subtraction (the following stages work on the calibrated frames)
+	{
+		CSmartPtr<CMemoryBitmap>	pMasterDark;
+		CStageTimer					Timer;
+		bool						bDone = true;
+
+		Generator.CreateMasterDark(&pMasterDark);
+
+		CDarkFrame					DarkFrame(pMasterDark);
+
+		for (LONG k = 0;k<lNrFrames;k++)
+		{
+			Timer.Start();
+			bDone = DarkFrame.Subtract(vFrames[k]) && bDone;
+			Timer.Stop();
+		};
+
+		vStages.push_back(CBenchmarkStage(_T("dark_subtract"), bDone, lNrFrames, Timer.GetSeconds(), lNrFrames * fFrameMegaPixels));
+	};
+
+	// Registering
+	std::vector<STARVECTOR>		vStars(lNrFrames);
+	{
+		CStageTimer					Timer;
+		double						fNrStars = 0;
+
+		for (LONG k = 0;k<lNrFrames;k++)
+		{
+			CLightFrameInfo			lfi;
+
+			lfi.SetDetectionThreshold(0.10);
+			lfi.SetHotPixelRemoval(false);
+			lfi.m_bApplyMedianFilter = false;
+
+			Timer.Start();
+			lfi.RegisterPicture(vFrames[k]);
+			Timer.Stop();
+
+			lfi.GetStars(vStars[k]);
+			fNrStars += vStars[k].size();
+		};
+
+		CBenchmarkStage				Stage(_T("register"), true, lNrFrames, Timer.GetSeconds(), lNrFrames * fFrameMegaPixels);
+
+		Stage.m_vCounters.emplace_back(_T("stars_per_frame"), fNrStars / lNrFrames);
+		vStages.push_back(Stage);
+	};
+
+	// Star matching against the reference frame, the transformations are
+	// checked with the true positions of the stars
+	std::vector<CBilinearParameters>	vTransformations(lNrFrames);
+	bool								bRegistered = true;
+	{
+		CStageTimer					Timer;
+		CStarPatternIndex			RefIndex;
+		POINTEXTVECTOR				vRefPoints;
+		LONG						lNrMatched = 0;
+		double						fSumResiduals = 0;
+		LONG						lNrResiduals = 0;
+
+		Timer.Start();
+		std::sort(vStars[0].begin(), vStars[0].end(), CompareStarLuminancy);
+		for (size_t i = 0;i<min(vStars[0].size(), static_cast<size_t>(MAXINDEXEDSTARS));i++)
+			vRefPoints.emplace_back(vStars[0][i].m_fX, vStars[0][i].m_fY);
+		RefIndex.Build(vRefPoints);
+		Timer.Stop();
+
+		for (LONG k = 1;k<lNrFrames;k++)
+		{
+			CMatchingStars			MatchingStars;
+			size_t					lNrTgtStars = MAXINDEXEDSTARS;
+			bool					bMatched;
+
+			Timer.Start();
+			std::sort(vStars[k].begin(), vStars[k].end(), CompareStarLuminancy);
+			if (RefIndex.IsValid())
+				MatchingStars.SetReferenceIndex(&RefIndex);
+			else
+			{
+				for (size_t i = 0;i<min(vStars[0].size(), static_cast<size_t>(MAXCUBICSTARS));i++)
+					MatchingStars.AddReferenceStar(vStars[0][i].m_fX, vStars[0][i].m_fY);
+				lNrTgtStars = MAXCUBICSTARS;
+			};
+			for (size_t i = 0;i<min(vStars[k].size(), lNrTgtStars);i++)
+				MatchingStars.AddTargetedStar(vStars[k][i].m_fX, vStars[k][i].m_fY);
+			MatchingStars.SetSizes(lWidth, lHeight);
+			bMatched = MatchingStars.ComputeCoordinateTransformation(vTransformations[k]);
+			Timer.Stop();
+
+			if (bMatched)
+			{
+				lNrMatched++;
+				for (const auto & Star : Generator.GetStars())
+				{
+					const CPointExt		ptFrame = Generator.FramePosition(k, Star.m_fX, Star.m_fY);
+
+					if (Star.m_fX >= 0 && Star.m_fX < lWidth && Star.m_fY >= 0 && Star.m_fY < lHeight &&
+						ptFrame.X >= 0 && ptFrame.X < lWidth && ptFrame.Y >= 0 && ptFrame.Y < lHeight)
+					{
+						const CPointExt		ptRef = vTransformations[k].Transform(ptFrame);
+
+						fSumResiduals += sqrt((ptRef.X - Star.m_fX) * (ptRef.X - Star.m_fX) + (ptRef.Y - Star.m_fY) * (ptRef.Y - Star.m_fY));
+						lNrResiduals++;
+					};
+				};
+			}
+			else
+				vTransformations[k].Clear();
+		};
+
+		CBenchmarkStage				Stage(_T("match_stars"), true, lNrFrames - 1, Timer.GetSeconds(), (lNrFrames - 1) * fFrameMegaPixels);
+
+		const double				fMeanResidual = lNrResiduals ? fSumResiduals / lNrResiduals : 0.0;
+
+		Stage.m_vCounters.emplace_back(_T("matched_frames"), static_cast<double>(lNrMatched));
+		Stage.m_vCounters.emplace_back(_T("mean_residual_pixels"), fMeanResidual);
+		vStages.push_back(Stage);
+
+		bRegistered = (lNrMatched == lNrFrames - 1) && (fMeanResidual <= MAXRESIDUAL);
+	};
+
+	// Stacking (AVX code only) - the stacked frames are added to the
+	// multi bitmap used for the output composition
+	CSmartPtr<CMultiBitmap>		pMultiBitmap;
+	{
+		CStageTimer					Timer;
+		CTaskInfo					TaskInfo;
+		CBackgroundCalibration		BackgroundCalibration;
+		CEntropyInfo				EntropyInfo;
+		const LONG					lNrBands = CThreadPool::GetInstance().GetNrThreads();
+		// Output rows reached by a band beyond its own rows (the pixels
+		// are dispatched on two rows)
+		const LONG					lMargin = static_cast<LONG>(ceil(2.0 * (MAXSHIFT + MAXANGLE * max(lWidth, lHeight)))) + 2;
+		std::atomic<bool>			bDone(true);
+
+		TaskInfo.SetMethod(MBP_SIGMACLIP, 2.0, 5);
+		BackgroundCalibration.m_BackgroundCalibrationMode = BCM_NONE;
+
+		for (LONG k = 0;k<lNrFrames;k++)
+		{
+			CSmartPtr<CMemoryBitmap>	pTempBitmap;
+			const CPixelTransform		PixTransform(vTransformations[k]);
+			std::vector<CSmartPtr<CMemoryBitmap>>	vBandBitmaps(lNrBands);
+			std::vector<LONG>			vFirstRows(lNrBands);
+
+			if (Settings.m_bCFA)
+				pTempBitmap.Attach(new C48BitColorBitmap);
+			else if (bFloat)
+				pTempBitmap.Attach(new C32BitFloatGrayBitmap);
+			else
+				pTempBitmap.Attach(new C16BitGrayBitmap);
+			pTempBitmap->Init(lWidth, lHeight);
+
+			AvxEntropy				avxEntropy(*vFrames[k], EntropyInfo, nullptr);
+
+			// Each band of source rows is stacked in its own bitmap covering
+			// the output rows it can reach, then the bands are added to the
+			// temporary bitmap row by row
+			Timer.Start();
+			CThreadPool::GetInstance().ParallelFor(0, lNrBands, 1, [&](long lStart, long lEnd)
+			{
+				for (LONG b = lStart;b<lEnd;b++)
+				{
+					const LONG			lBandStart = lHeight * b / lNrBands;
+					const LONG			lBandEnd = lHeight * (b + 1) / lNrBands;
+					const LONG			lFirstRow = max(0L, lBandStart - lMargin);
+					const LONG			lBandHeight = min(lHeight, lBandEnd + lMargin) - lFirstRow;
+					CPixelTransform		BandTransform(PixTransform);
+
+					vFirstRows[b] = lFirstRow;
+					vBandBitmaps[b].Attach(pTempBitmap->Clone(true));
+					vBandBitmaps[b]->Init(lWidth, lBandHeight);
+					// The first row of the band bitmap is the first output row of the band
+					BandTransform.SetShift(PixTransform.m_fXShift, PixTransform.m_fYShift - lFirstRow);
+
+					AvxStacking avxStacking(lBandStart, lBandEnd, *vFrames[k], *vBandBitmaps[b], CRect(0, 0, lWidth, lBandHeight), avxEntropy);
+
+					if (avxStacking.stack(BandTransform, TaskInfo, BackgroundCalibration, 1) != 0)
+						bDone = false;
+				};
+			});
+			CThreadPool::GetInstance().ParallelFor(0, lHeight, 0, [&](long lStart, long lEnd)
+			{
+				for (LONG j = lStart;j<lEnd;j++)
+				{
+					for (LONG b = 0;b<lNrBands;b++)
+					{
+						const LONG		lRow = j - vFirstRows[b];
+
+						if (lRow >= 0 && lRow < vBandBitmaps[b]->Height())
+						{
+							for (LONG i = 0;i<lWidth;i++)
+							{
+								double		fRed, fGreen, fBlue;
+								double		fBandRed, fBandGreen, fBandBlue;
+
+								vBandBitmaps[b]->GetPixel(i, lRow, fBandRed, fBandGreen, fBandBlue);
+								if (fBandRed || fBandGreen || fBandBlue)
+								{
+									pTempBitmap->GetPixel(i, j, fRed, fGreen, fBlue);
+									pTempBitmap->SetPixel(i, j, min(fRed + fBandRed, 255.0), min(fGreen + fBandGreen, 255.0), min(fBlue + fBandBlue, 255.0));
+								};
+							};
+						};
+					};
+				};
+			});
+			Timer.Stop();
+
+			if (!pMultiBitmap)
+			{
+				pMultiBitmap.Attach(pTempBitmap->CreateEmptyMultiBitmap());
+				pMultiBitmap->SetNrBitmaps(lNrFrames);
+				pMultiBitmap->SetProcessingMethod(MBP_SIGMACLIP, 2.0, 5);
+			};
+			pMultiBitmap->AddBitmap(pTempBitmap);
+		};
+
+		vStages.push_back(CBenchmarkStage(_T("stack"), bDone, lNrFrames, Timer.GetSeconds(), lNrFrames * fFrameMegaPixels));
+	};
+
+	// The light frames are not needed anymore
+	vFrames.clear();
+
+	// Output composition (kappa-sigma clipping)
+	{
+		CStageTimer					Timer;
+		CSmartPtr<CMemoryBitmap>	pResult;
+		bool						bDone;
+
+		Timer.Start();
+		bDone = pMultiBitmap->GetResult(&pResult);
+		Timer.Stop();
+
+		vStages.push_back(CBenchmarkStage(_T("compose"), bDone, lNrFrames, Timer.GetSeconds(), lNrFrames * fFrameMegaPixels));
+	};
+
+	const std::uint64_t		lPeakRSS = GetPeakProcessMemory();
+
+	PrintReport(vStages, lPeakRSS);
+
+	bool					bResult = true;
+
+	if (Settings.m_strJSONFile.GetLength())
+	{
+		if (!WriteJSONReport(Settings.m_strJSONFile, Settings, vStages, lPeakRSS))
+		{
+			_tprintf(_T("Cannot write to %s\n"), (LPCTSTR)Settings.m_strJSONFile);
+			bResult = false;
+		};
+	};
+
+	if (!bRegistered)
+	{
+		_tprintf(_T("Benchmark failed: the frames are not all matched within %.2f pixels\n"), MAXRESIDUAL);
+		bResult = false;
+	};
+
+	for (const auto & Stage : vStages)
+	{
+		if (!Stage.m_bDone)
+		{
+			_tprintf(_T("Benchmark failed: stage %s was not run\n"), (LPCTSTR)Stage.m_strName);
+			bResult = false;
+		};
+	};
+
+	return bResult;
+};
+
+/* ------------------------------------------------------------------- */
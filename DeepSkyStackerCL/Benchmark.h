@@ -0,0 +1,45 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+/* ------------------------------------------------------------------- */
+
+// Settings of the benchmark mode (/BENCH) of the command line tool.
+// The frames are generated from the seed so that two runs with the
+// same settings process exactly the same pixels.
+class CBenchmarkSettings
+{
+public :
+	LONG				m_lWidth;
+	LONG				m_lHeight;
+	LONG				m_lNrFrames;
+	LONG				m_lBitDepth;		// 16 (integer) or 32 (float)
+	LONG				m_lNrStars;
+	bool				m_bCFA;				// RGGB Bayer mosaic (16 bits only)
+	DWORD				m_dwSeed;
+	CString				m_strJSONFile;		// Report also written in JSON when set
+
+public :
+	CBenchmarkSettings()
+	{
+		m_lWidth	= 3000;
+		m_lHeight	= 2000;
+		m_lNrFrames	= 10;
+		m_lBitDepth	= 16;
+		m_lNrStars	= 500;
+		m_bCFA		= false;
+		m_dwSeed	= 1;
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+// Generates the frames, runs the engine stages (loaders, dark subtraction,
+// registering, star matching, stacking and output composition) on them
+// and prints the throughput of each stage.
+// Returns false when a stage fails or when the star matching does not find
+// the true transformations of all the frames.
+bool	RunBenchmark(const CBenchmarkSettings & Settings);
+
+/* ------------------------------------------------------------------- */
+
+#endif // __BENCHMARK_H__
@@ -18,6 +18,7 @@ static	TIFFCOMPRESSION		g_TIFFCompression = TC_NONE;
 static  BOOL				g_bSaveIntermediate = FALSE;
 static  BOOL				g_bSaveCalibrated = FALSE;
 static  BOOL				g_bFITSOutput = FALSE;
+static	BOOL				g_bBenchmark = FALSE;
 
 #include "ProgressConsole.h"
 #include "FrameList.h"
@@ -25,6 +26,10 @@ static  BOOL				g_bFITSOutput = FALSE;
 #include "TIFFUtil.h"
 #include "FITSUtil.h"
 #include "SetUILanguage.h"
+#include "Benchmark.h"
+#include "RunReport.h"
+
+static	CBenchmarkSettings	g_BenchmarkSettings;
 
 /* ------------------------------------------------------------------- */
 
@@ -40,7 +45,8 @@ BOOL	DecodeCommandLine(int argc, _TCHAR* argv[])
 	};
 
 	// At least 2 arguments (registering and/or stacking + filename)
-	bResult = (vCommandLine.size() >= 2);
+	// or /BENCH alone
+	bResult = (vCommandLine.size() >= 1);
 	for (i = 0;i<vCommandLine.size() && bResult;i++)
 	{
 		if (!vCommandLine[i].CompareNoCase(_T("/s")))
@@ -131,6 +137,68 @@ BOOL	DecodeCommandLine(int argc, _TCHAR* argv[])
 				bResult = FALSE;
 			};
 		}
+		else if (!vCommandLine[i].CompareNoCase(_T("/BENCH")))
+		{
+			g_bBenchmark = TRUE;
+		}
+		else if (!vCommandLine[i].Left(4).CompareNoCase(_T("/BS:")))
+		{
+			CString			strSize;
+			int				nSeparator;
+
+			strSize = vCommandLine[i].Right(vCommandLine[i].GetLength()-4);
+			nSeparator = strSize.Find(_T('x'));
+			if (nSeparator > 0)
+			{
+				g_BenchmarkSettings.m_lWidth  = _ttol(strSize.Left(nSeparator));
+				g_BenchmarkSettings.m_lHeight = _ttol(strSize.Mid(nSeparator+1));
+			};
+			if (nSeparator <= 0 || g_BenchmarkSettings.m_lWidth < 256 || g_BenchmarkSettings.m_lHeight < 256)
+			{
+				_tprintf(_T("Invalid benchmark frame size %s\n"), (LPCTSTR)strSize);
+				bResult = FALSE;
+			};
+		}
+		else if (!vCommandLine[i].Left(4).CompareNoCase(_T("/BN:")))
+		{
+			g_BenchmarkSettings.m_lNrFrames = _ttol(vCommandLine[i].Mid(4));
+			if (g_BenchmarkSettings.m_lNrFrames < 2)
+			{
+				_tprintf(_T("The benchmark needs at least 2 frames\n"));
+				bResult = FALSE;
+			};
+		}
+		else if (!vCommandLine[i].Left(4).CompareNoCase(_T("/BD:")))
+		{
+			CString			strDepth;
+
+			strDepth = vCommandLine[i].Mid(4);
+			if (strDepth == _T("16"))
+				g_BenchmarkSettings.m_lBitDepth = 16;
+			else if (strDepth == _T("32"))
+				g_BenchmarkSettings.m_lBitDepth = 32;
+			else
+			{
+				_tprintf(_T("Unrecognized or unsupported bit depth %s\n"), (LPCTSTR)strDepth);
+				bResult = FALSE;
+			};
+		}
+		else if (!vCommandLine[i].CompareNoCase(_T("/BCFA")))
+		{
+			g_BenchmarkSettings.m_bCFA = true;
+		}
+		else if (!vCommandLine[i].Left(7).CompareNoCase(_T("/BSEED:")))
+		{
+			g_BenchmarkSettings.m_dwSeed = _tcstoul(vCommandLine[i].Mid(7), nullptr, 10);
+		}
+		else if (!vCommandLine[i].Left(7).CompareNoCase(_T("/BJSON:")))
+		{
+			g_BenchmarkSettings.m_strJSONFile = vCommandLine[i].Mid(7);
+		}
+		else if (!vCommandLine[i].Left(4).CompareNoCase(_T("/RR:")))
+		{
+			CRunReport::GetInstance().SetFileName(vCommandLine[i].Mid(4));
+		}
 		else
 		{
 			// Check that it is a file
@@ -147,10 +215,22 @@ BOOL	DecodeCommandLine(int argc, _TCHAR* argv[])
 		};
 	};
 
-	if (!g_bStacking && !g_bRegistering)
-		bResult = FALSE;
-	if (!g_strListFile.GetLength())
-		bResult = FALSE;
+	if (g_bBenchmark)
+	{
+		// The Bayer mosaic is only available with 16 bits frames
+		if (g_BenchmarkSettings.m_bCFA && g_BenchmarkSettings.m_lBitDepth != 16)
+		{
+			_tprintf(_T("The benchmark CFA frames are 16 bits frames\n"));
+			bResult = FALSE;
+		};
+	}
+	else
+	{
+		if (!g_bStacking && !g_bRegistering)
+			bResult = FALSE;
+		if (!g_strListFile.GetLength())
+			bResult = FALSE;
+	};
 
 	return bResult;
 };
@@ -276,6 +356,7 @@ int _tmain(int argc, _TCHAR* argv[])
 	#endif
 
 	std::vector<CString>	vCommandLine;
+	int						nResult = 0;
 
 	_tprintf(_T("DeepSkyStacker %s Command Line\n\n"), _T(VERSION_DEEPSKYSTACKER));
 
@@ -302,6 +383,16 @@ int _tmain(int argc, _TCHAR* argv[])
 		_tprintf(_T("           1: LZW compression\n"));
 		_tprintf(_T("           2: ZIP (Deflate) compression\n"));
 		_tprintf(_T(" /FITS     Output file format is FITS (default is TIFF)\n"));
+		_tprintf(_T(" /RR:<filename> - Write the time spent in each stage of the\n"));
+		_tprintf(_T("           registering and stacking in a JSON file (or in a CSV\n"));
+		_tprintf(_T("           file when the name ends with .csv)\n"));
+		_tprintf(_T(" /BENCH  - Run the benchmark on synthetic frames instead of a list\n"));
+		_tprintf(_T("           /BS:<width>x<height> - Frame size (default is 3000x2000)\n"));
+		_tprintf(_T("           /BN:<n> - Number of frames (default is 10)\n"));
+		_tprintf(_T("           /BD:xx  - Bit depth: 16 (default) or 32 (float)\n"));
+		_tprintf(_T("           /BCFA   - RGGB Bayer frames (16 bits only)\n"));
+		_tprintf(_T("           /BSEED:<n> - Seed of the synthetic frames (default is 1)\n"));
+		_tprintf(_T("           /BJSON:<filename> - Also write the results in a JSON file\n"));
 		_tprintf(_T("<ListFileName> is the name of a file list saved by DeepSkyStacker\n\n"));
 		_tprintf(_T("Exemples:\n"));
 		_tprintf(_T("DeepSkyStackerCL /r c:\\MyLists\\SampleList.txt\n"));
@@ -310,6 +401,15 @@ int _tmain(int argc, _TCHAR* argv[])
 		_tprintf(_T("  will register then stack all the checked light frames of the list\n"));
 		_tprintf(_T("  and save the result in a 16 bits integer TIFF file named\n"));
 		_tprintf(_T("  autosave.tif in the folder of the first light frame\n\n"));
+		_tprintf(_T("DeepSkyStackerCL /BENCH /BS:4000x3000 /BCFA /BJSON:c:\\Bench\\Results.json\n"));
+		_tprintf(_T("  will measure the speed of the engine stages on 10 synthetic RGGB\n"));
+		_tprintf(_T("  frames of 4000x3000 pixels\n\n"));
+	}
+	else if (g_bBenchmark)
+	{
+		// A failed benchmark is reported to the caller (CI scripts)
+		if (!RunBenchmark(g_BenchmarkSettings))
+			nResult = 1;
 	}
 	else
 	{
@@ -376,6 +476,6 @@ int _tmain(int argc, _TCHAR* argv[])
 
 	OleUninitialize();
 
-	return 0;
+	return nResult;
 }
 
@@ -148,7 +148,7 @@ void CImageListTab::AddImage(LPCTSTR szImage)
 	CBitmapInfo				bmpInfo;
 
 	GetPictureInfo(szImage, bmpInfo);
-	lfi.SetBitmap(szImage, FALSE, FALSE);
+	lfi.SetBitmap(szImage, FALSE, FALSE, FALSE);
 	if (lfi.IsRegistered() && bmpInfo.CanLoad())
 	{
 		// Add the file to the list
@@ -192,7 +192,7 @@ void CImageListTab::AddImage(LPCTSTR szImage)
 		strText.Format(_T("%.1f"), bmpInfo.m_fAperture);
 		m_ImageList.SetItemText(nItem, COLUMN_APERTURE, (LPCTSTR)strText);
 
-		strText.Format(_T("%ld"), lfi.m_vStars.size());
+		strText.Format(_T("%zu"), lfi.GetNrStars());
 		m_ImageList.SetItemText(nItem, COLUMN_STARS, (LPCTSTR)strText);
 
 		strText.Format(_T("%.2f"), lfi.m_fOverallQuality);
@@ -217,7 +217,7 @@ void CImageListTab::AddImage(LPCTSTR szImage)
 			strText.LoadString(IDS_YES);
 		m_ImageList.SetItemText(nItem, COLUMN_CFA, strText);
 
-		AddScoreFWHMStarsToGraph(lfi.m_strFileName, lfi.m_fOverallQuality, lfi.m_fFWHM, lfi.m_vStars.size(), lfi.m_SkyBackground.m_fLight*100.0);
+		AddScoreFWHMStarsToGraph(lfi.m_strFileName, lfi.m_fOverallQuality, lfi.m_fFWHM, lfi.GetNrStars(), lfi.m_SkyBackground.m_fLight*100.0);
 	};
 };
 
@@ -2,12 +2,17 @@
 #include "LiveEngine.h"
 #include "RegisterEngine.h"
 #include "TIFFUtil.h"
+#include "DSSPlatform.h"
 
 #define _USE_MATH_DEFINES
 #include <cmath>
+#include <chrono>
 
 const DWORD				WM_LE_MESSAGE		= WM_USER+1;
 
+// Maximum number of registered frames waiting to be stacked with their bitmap
+const size_t			MAXDECODEDFRAMES	= 4;
+
 #ifndef M_PI
 #define M_PI			3.141592654
 #endif
@@ -30,9 +35,9 @@ DWORD	WINAPI	LiveEngineThreadProc(LPVOID lpParameter)
 
 /* ------------------------------------------------------------------- */
 
-void	CLiveEngine::MoveImage(LPCTSTR szFileName)
+void	CLiveEngine::MoveImage(CLiveSettings & LiveSettings, LPCTSTR szFileName)
 {
-	if (m_LiveSettings.IsStack_Move())
+	if (LiveSettings.IsStack_Move())
 	{
 		// Move szFileName to the NonStackable subfolder
 		// (create it if necessary)
@@ -81,46 +86,55 @@ void	CLiveEngine::MoveImage(LPCTSTR szFileName)
 
 /* ------------------------------------------------------------------- */
 
-BOOL	CLiveEngine::IsImageStackable1(LPCTSTR szFile, double fStarCount, double fFWHM, double fScore, double fSkyBackground, CString & strError)
+void	CLiveEngine::GetLiveSettings(CLiveSettings & LiveSettings)
+{
+	std::lock_guard<std::mutex>		Lock(m_SettingsMutex);
+
+	LiveSettings = m_LiveSettings;
+};
+
+/* ------------------------------------------------------------------- */
+
+BOOL	CLiveEngine::IsImageStackable1(CLiveSettings & LiveSettings, LPCTSTR szFile, double fStarCount, double fFWHM, double fScore, double fSkyBackground, CString & strError)
 {
 	BOOL						bResult = TRUE;
 
-	if (m_LiveSettings.IsDontStack_Score())
+	if (LiveSettings.IsDontStack_Score())
 	{
-		if (fScore < m_LiveSettings.GetScore())
+		if (fScore < LiveSettings.GetScore())
 		{
 			bResult = FALSE;
-			strError.Format(IDS_NOSTACK_SCORE, fScore, m_LiveSettings.GetScore());
+			strError.Format(IDS_NOSTACK_SCORE, fScore, LiveSettings.GetScore());
 			PostChangeImageInfo(szFile, II_DONTSTACK_SCORE);
 		};
 	};
 
-	if (m_LiveSettings.IsDontStack_Stars())
+	if (LiveSettings.IsDontStack_Stars())
 	{
-		if (fStarCount < m_LiveSettings.GetStars())
+		if (fStarCount < LiveSettings.GetStars())
 		{
 			bResult = FALSE;
-			strError.Format(IDS_NOSTACK_STARS, fStarCount, (double)m_LiveSettings.GetStars());
+			strError.Format(IDS_NOSTACK_STARS, fStarCount, (double)LiveSettings.GetStars());
 			PostChangeImageInfo(szFile, II_DONTSTACK_STARS);
 		};
 	};
 
-	if (m_LiveSettings.IsDontStack_FWHM())
+	if (LiveSettings.IsDontStack_FWHM())
 	{
-		if (fFWHM > m_LiveSettings.GetFWHM())
+		if (fFWHM > LiveSettings.GetFWHM())
 		{
 			bResult = FALSE;
-			strError.Format(IDS_NOSTACK_FWHM, fFWHM, (double)m_LiveSettings.GetFWHM());
+			strError.Format(IDS_NOSTACK_FWHM, fFWHM, (double)LiveSettings.GetFWHM());
 			PostChangeImageInfo(szFile, II_DONTSTACK_FWHM);
 		};
 	};
 
-	if (m_LiveSettings.IsWarning_SkyBackground())
+	if (LiveSettings.IsWarning_SkyBackground())
 	{
-		if (fSkyBackground > m_LiveSettings.GetSkyBackground())
+		if (fSkyBackground > LiveSettings.GetSkyBackground())
 		{
 			bResult = TRUE;
-			strError.Format(IDS_NOSTACK_SKYBACKGROUND, fSkyBackground, (double)m_LiveSettings.GetSkyBackground());
+			strError.Format(IDS_NOSTACK_SKYBACKGROUND, fSkyBackground, (double)LiveSettings.GetSkyBackground());
 			PostChangeImageInfo(szFile, II_DONTSTACK_SKYBACKGROUND);
 		};
 	};
@@ -163,46 +177,46 @@ BOOL CLiveEngine::IsImageStackable2(LPCTSTR szFile, double fdX, double fdY, doub
 
 /* ------------------------------------------------------------------- */
 
-BOOL	CLiveEngine::IsImageWarning1(LPCTSTR szFile, double fStarCount, double fFWHM, double fScore, double fSkyBackground, CString & strWarning)
+BOOL	CLiveEngine::IsImageWarning1(CLiveSettings & LiveSettings, LPCTSTR szFile, double fStarCount, double fFWHM, double fScore, double fSkyBackground, CString & strWarning)
 {
 	BOOL						bResult = FALSE;
 
-	if (m_LiveSettings.IsWarning_Score())
+	if (LiveSettings.IsWarning_Score())
 	{
-		if (fScore < m_LiveSettings.GetScore())
+		if (fScore < LiveSettings.GetScore())
 		{
 			bResult = TRUE;
-			strWarning.Format(IDS_NOSTACK_SCORE, fScore, m_LiveSettings.GetScore());
+			strWarning.Format(IDS_NOSTACK_SCORE, fScore, LiveSettings.GetScore());
 			PostChangeImageInfo(szFile, II_WARNING_SCORE);
 		};
 	};
 
-	if (m_LiveSettings.IsWarning_Stars())
+	if (LiveSettings.IsWarning_Stars())
 	{
-		if (fStarCount < m_LiveSettings.GetStars())
+		if (fStarCount < LiveSettings.GetStars())
 		{
 			bResult = TRUE;
-			strWarning.Format(IDS_NOSTACK_STARS, fStarCount, (double)m_LiveSettings.GetStars());
+			strWarning.Format(IDS_NOSTACK_STARS, fStarCount, (double)LiveSettings.GetStars());
 			PostChangeImageInfo(szFile, II_WARNING_STARS);
 		};
 	};
 
-	if (m_LiveSettings.IsWarning_FWHM())
+	if (LiveSettings.IsWarning_FWHM())
 	{
-		if (fFWHM > m_LiveSettings.GetFWHM())
+		if (fFWHM > LiveSettings.GetFWHM())
 		{
 			bResult = TRUE;
-			strWarning.Format(IDS_NOSTACK_FWHM, fFWHM, (double)m_LiveSettings.GetFWHM());
+			strWarning.Format(IDS_NOSTACK_FWHM, fFWHM, (double)LiveSettings.GetFWHM());
 			PostChangeImageInfo(szFile, II_WARNING_FWHM);
 		};
 	};
 
-	if (m_LiveSettings.IsWarning_SkyBackground())
+	if (LiveSettings.IsWarning_SkyBackground())
 	{
-		if (fSkyBackground > m_LiveSettings.GetSkyBackground())
+		if (fSkyBackground > LiveSettings.GetSkyBackground())
 		{
 			bResult = TRUE;
-			strWarning.Format(IDS_NOSTACK_SKYBACKGROUND, fSkyBackground, (double)m_LiveSettings.GetSkyBackground());
+			strWarning.Format(IDS_NOSTACK_SKYBACKGROUND, fSkyBackground, (double)LiveSettings.GetSkyBackground());
 			PostChangeImageInfo(szFile, II_WARNING_SKYBACKGROUND);
 		};
 	};
@@ -252,22 +266,13 @@ BOOL	CLiveEngine::IsImageWarning2(LPCTSTR szFile, double fdX, double fdY, double
 
 BOOL CLiveEngine::IsFileAvailable(LPCTSTR szFileName)
 {
-	BOOL						bResult = FALSE;
-	HANDLE						hFile;
-
-	hFile = CreateFile(szFileName, GENERIC_READ, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
-	if (hFile)
-	{
-		bResult = TRUE;
-		CloseHandle(hFile);
-	};
-
-	return bResult;
+	// The file is still being written while another process has it open
+	return CanOpenFileExclusively(szFileName);
 };
 
 /* ------------------------------------------------------------------- */
 
-BOOL CLiveEngine::LoadFile(LPCTSTR szFileName)
+BOOL CLiveEngine::LoadFile(LPCTSTR szFileName, CLiveFrame & Frame, CDSSProgress * pProgress)
 {
 	BOOL						bResult = FALSE;
 
@@ -276,82 +281,39 @@ BOOL CLiveEngine::LoadFile(LPCTSTR szFileName)
 	if (GetPictureInfo(szFileName, bmpInfo) && bmpInfo.CanLoad())
 	{
 		CString						strText;
-		CString						strDescription;
-		BOOL						bOverrideRAW = TRUE;
-
-		bmpInfo.GetDescription(strDescription);
-		if (bmpInfo.m_lNrChannels==3)
-			strText.Format(IDS_LOADRGBLIGHT, bmpInfo.m_lBitPerChannel, (LPCTSTR)strDescription, szFileName);
-		else
-			strText.Format(IDS_LOADGRAYLIGHT, bmpInfo.m_lBitPerChannel, (LPCTSTR)strDescription, szFileName);
-
-		Start2(strText, 0);
-		CAllDepthBitmap				adb;
-		adb.SetDontUseAHD(TRUE);
+		CSmartPtr<CMemoryBitmap>	pBitmap;
 
-		bResult = LoadPicture(szFileName, adb, this);
-		End2();
+		// The frame is decoded once, like when it is stacked, so that all
+		// the frames of the session are registered and stacked from the
+		// same debayering
+		bResult = ::LoadFrame(szFileName, PICTURETYPE_LIGHTFRAME, pProgress, &pBitmap);
 		if (bResult)
 		{
-			PostFileLoaded(adb.m_pBitmap, adb.m_pWndBitmap, szFileName);
-			PostChangeImageStatus(szFileName, IS_LOADED);
+			// The user interface gets its own copy (the hot pixels of the
+			// frame are removed in place when it is stacked)
+			CSmartPtr<CMemoryBitmap>	pViewBitmap;
+			CSmartPtr<C32BitsBitmap>	pWndBitmap;
 
-			// Now register the image
-			CLightFrameInfo			lfi;
-
-			strText.Format(IDS_REGISTERINGNAME, (LPCTSTR)szFileName);
-			Start2(strText, 0);
-			lfi.SetBitmap(szFileName, FALSE, FALSE);
-			lfi.SetProgress(this);
-			lfi.RegisterPicture(adb.m_pBitmap);
-			lfi.SaveRegisteringInfo();
-			lfi.m_lISOSpeed = bmpInfo.m_lISOSpeed;
-			lfi.m_lGain = bmpInfo.m_lGain;
-			lfi.m_fExposure = bmpInfo.m_fExposure;
-			End2();
-			PostFileRegistered(szFileName);
-			PostChangeImageStatus(szFileName, IS_REGISTERED);
-
-			TCHAR					szName[_MAX_FNAME];
-			TCHAR					szExt[_MAX_EXT];
-			CString					strName;
-
-			_tsplitpath(szFileName, nullptr, nullptr, szName, szExt);
-			strName.Format(_T("%s%s"), szName, szExt);
-			strText.Format(IDS_LOG_REGISTERRESULTS, (LPCTSTR)strName, lfi.m_vStars.size(), lfi.m_fFWHM, lfi.m_fOverallQuality);
-			PostToLog(strText, TRUE);
+			if (!DebayerPicture(pBitmap, &pViewBitmap, nullptr))
+				pViewBitmap.Attach(pBitmap->Clone());
+			pWndBitmap.Create();
+			pWndBitmap->InitFrom(pViewBitmap);
 
-			CString					strError;
-			BOOL					bWarning;
-			CString					strWarning;
+			PostFileLoaded(pViewBitmap, pWndBitmap, szFileName);
+			PostChangeImageStatus(szFileName, IS_LOADED);
 
-			bWarning = IsImageWarning1(szFileName, lfi.m_vStars.size(), lfi.m_fFWHM, lfi.m_fOverallQuality, lfi.m_SkyBackground.m_fLight*100.0, strWarning);
-			PostChangeImageInfo(szFileName, II_DONTSTACK_NONE);
-			if (bWarning)
-			{
-				strText.Format(IDS_LOG_WARNING, (LPCTSTR)szFileName, (LPCTSTR) strWarning);
-				PostToLog(strText, TRUE, FALSE, TRUE, RGB(208, 127, 0));
-				PostWarning(strWarning);
-			};
-			if (IsImageStackable1(szFileName, lfi.m_vStars.size(), lfi.m_fFWHM, lfi.m_fOverallQuality, lfi.m_SkyBackground.m_fLight*100.0, strError))
-			{
-				// Check against stacking conditions before adding it to
-				// the stack list
-				m_qToStack.push_back(lfi);
-			}
-			else
-			{
-				strText.Format(IDS_LOG_IMAGENOTSTACKABLE1, (LPCTSTR)szFileName, (LPCTSTR) strError);
-				PostToLog(strText, TRUE, TRUE, FALSE, RGB(255, 0, 0));
-				PostChangeImageStatus(szFileName, IS_NOTSTACKABLE);
-				MoveImage(szFileName);
-			};
+			Frame.m_strFileName = szFileName;
+			Frame.m_BitmapInfo	= bmpInfo;
+			Frame.m_pBitmap		= pBitmap;
 		}
 		else
 		{
+			CLiveSettings				LiveSettings;
+
 			strText.Format(IDS_LOG_ERRORLOADINGFILE, szFileName);
 			PostToLog(strText, TRUE, TRUE, FALSE, RGB(255, 0, 0));
-			MoveImage(szFileName);
+			GetLiveSettings(LiveSettings);
+			MoveImage(LiveSettings, szFileName);
 		};
 	};
 
@@ -360,6 +322,167 @@ BOOL CLiveEngine::LoadFile(LPCTSTR szFileName)
 
 /* ------------------------------------------------------------------- */
 
+void CLiveEngine::RegisterFrame(CLiveFrame & Frame, CDSSProgress * pProgress)
+{
+	LPCTSTR					szFileName = Frame.m_strFileName;
+	CLightFrameInfo &		lfi = Frame.m_lfi;
+	CString					strText;
+	CLiveSettings			LiveSettings;
+
+	// The settings can be changed meanwhile by the engine thread
+	GetLiveSettings(LiveSettings);
+
+	strText.Format(IDS_REGISTERINGNAME, szFileName);
+	pProgress->Start2(strText, 0);
+	lfi.SetBitmap(szFileName, FALSE, FALSE);
+	lfi.SetProgress(pProgress);
+	lfi.RegisterPicture(Frame.m_pBitmap);
+	lfi.SaveRegisteringInfo();
+	lfi.SetProgress(nullptr);
+	lfi.m_lISOSpeed = Frame.m_BitmapInfo.m_lISOSpeed;
+	lfi.m_lGain = Frame.m_BitmapInfo.m_lGain;
+	lfi.m_fExposure = Frame.m_BitmapInfo.m_fExposure;
+	pProgress->End2();
+	PostFileRegistered(szFileName);
+	PostChangeImageStatus(szFileName, IS_REGISTERED);
+
+	TCHAR					szName[_MAX_FNAME];
+	TCHAR					szExt[_MAX_EXT];
+	CString					strName;
+
+	_tsplitpath(szFileName, nullptr, nullptr, szName, szExt);
+	strName.Format(_T("%s%s"), szName, szExt);
+	strText.Format(IDS_LOG_REGISTERRESULTS, (LPCTSTR)strName, lfi.m_vStars.size(), lfi.m_fFWHM, lfi.m_fOverallQuality);
+	PostToLog(strText, TRUE);
+
+	CString					strError;
+	BOOL					bWarning;
+	CString					strWarning;
+
+	bWarning = IsImageWarning1(LiveSettings, szFileName, lfi.m_vStars.size(), lfi.m_fFWHM, lfi.m_fOverallQuality, lfi.m_SkyBackground.m_fLight*100.0, strWarning);
+	PostChangeImageInfo(szFileName, II_DONTSTACK_NONE);
+	if (bWarning)
+	{
+		strText.Format(IDS_LOG_WARNING, szFileName, (LPCTSTR) strWarning);
+		PostToLog(strText, TRUE, FALSE, TRUE, RGB(208, 127, 0));
+		PostWarning(strWarning);
+	};
+	if (IsImageStackable1(LiveSettings, szFileName, lfi.m_vStars.size(), lfi.m_fFWHM, lfi.m_fOverallQuality, lfi.m_SkyBackground.m_fLight*100.0, strError))
+	{
+		// Check against stacking conditions before adding it to
+		// the stack list (with its bitmap)
+		if (m_qRegistered.Push(Frame))
+			PostThreadMessage(m_dwThreadID, WM_LE_MESSAGE, 0, 0);
+	}
+	else
+	{
+		strText.Format(IDS_LOG_IMAGENOTSTACKABLE1, szFileName, (LPCTSTR) strError);
+		PostToLog(strText, TRUE, TRUE, FALSE, RGB(255, 0, 0));
+		PostChangeImageStatus(szFileName, IS_NOTSTACKABLE);
+		MoveImage(LiveSettings, szFileName);
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void CLiveEngine::LoadingStage()
+{
+	CLiveStageProgress		Progress(this);
+	CString					strFileName;
+
+	while (m_qToRegister.Pop(strFileName))
+	{
+		PostUpdatePending();
+		if (IsFileAvailable(strFileName))
+		{
+			CLiveFrame			Frame;
+
+			// Wait for the registering stage when it is late
+			if (LoadFile(strFileName, Frame, &Progress))
+				m_qLoaded.Push(Frame);
+		}
+		else
+		{
+			// The file is not completely written - try again later
+			m_qToRegister.Push(strFileName);
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		};
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void CLiveEngine::RegisteringStage()
+{
+	CLiveStageProgress		Progress(this);
+	CLiveFrame				Frame;
+
+	while (m_qLoaded.Pop(Frame))
+	{
+		RegisterFrame(Frame, &Progress);
+		Frame = CLiveFrame();
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void CLiveEngine::StartPipeline()
+{
+	// The files are loaded, registered and stacked in three threads
+	// (stacking is done by the engine thread) so that the throughput
+	// is limited by the slowest stage only
+	m_qToRegister.Restart();
+	m_qLoaded.Restart();
+	m_qRegistered.Restart();
+
+	m_LoadingThread = std::thread([this]()
+		{
+			SetUILanguage();
+			ReduceCurrentThreadPriority();
+			LoadingStage();
+		});
+	m_RegisteringThread = std::thread([this]()
+		{
+			SetUILanguage();
+			ReduceCurrentThreadPriority();
+			RegisteringStage();
+		});
+};
+
+/* ------------------------------------------------------------------- */
+
+void CLiveEngine::StopPipeline()
+{
+	m_qToRegister.Stop();
+	m_qLoaded.Stop();
+	m_qRegistered.Stop();
+
+	if (m_LoadingThread.joinable())
+		m_LoadingThread.join();
+	if (m_RegisteringThread.joinable())
+		m_RegisteringThread.join();
+};
+
+/* ------------------------------------------------------------------- */
+
+void CLiveEngine::ClearPipeline()
+{
+	m_qToRegister.Clear();
+	m_qLoaded.Clear();
+	m_qRegistered.Clear();
+	m_qToStack.clear();
+};
+
+/* ------------------------------------------------------------------- */
+
+void CLiveEngine::EnableRegisteringStage(BOOL bEnable)
+{
+	m_bRegisteringOn = bEnable;
+	m_qToRegister.Enable(bEnable ? true : false);
+};
+
+/* ------------------------------------------------------------------- */
+
 void CLiveEngine::SaveStackedImage(CMemoryBitmap * pBitmap)
 {
 	CSmartPtr<CMemoryBitmap>	pStackedImage;
@@ -461,6 +584,25 @@ BOOL CLiveEngine::ProcessNext()
 {
 	// Returns FALSE is there is nothing to do
 	BOOL				bResult = FALSE;
+	CLiveFrame			Registered;
+
+	// Get the frames registered in the meantime.
+	// Once the reference frame is chosen and while the frames are stacked,
+	// only MAXDECODEDFRAMES frames wait here: when the stacking is late the
+	// registering and loading stages wait on their own queues instead of
+	// decoding frames that would be decoded again.
+	while ((!m_bReferenceFrameSet || !m_bStackingOn || m_qToStack.size() < MAXDECODEDFRAMES) &&
+		   m_qRegistered.TryPop(Registered))
+	{
+		// Only the bitmaps of the first waiting frames are kept in memory,
+		// the other frames (candidates for the reference frame, frames
+		// registered while the stacking is off) are loaded again with
+		// ::LoadFrame when they are stacked (same debayering as in LoadFile)
+		if (m_qToStack.size() >= MAXDECODEDFRAMES)
+			Registered.m_pBitmap.Release();
+		m_qToStack.push_back(Registered);
+		Registered = CLiveFrame();
+	};
 
 	if (m_qToStack.size() && m_bStackingOn)
 	{
@@ -474,26 +616,28 @@ BOOL CLiveEngine::ProcessNext()
 			{
 				// Select the best reference frame from all the available images
 				// (best score)
-				std::deque<CLightFrameInfo>::iterator	it,
+				std::deque<CLiveFrame>::iterator		it,
 														bestit = m_qToStack.end();
 				double									fMaxScore = 0;
 
 				for (it = m_qToStack.begin();it != m_qToStack.end();it++)
 				{
-					if ((*it).m_fOverallQuality > fMaxScore)
+					if ((*it).m_lfi.m_fOverallQuality > fMaxScore)
 					{
 						bestit = it;
-						fMaxScore = (*it).m_fOverallQuality;
+						fMaxScore = (*it).m_lfi.m_fOverallQuality;
 					};
 				};
 
 				if (bestit != m_qToStack.end())
 				{
-					m_RunningStackingEngine.ComputeOffset((*bestit));
-					PostUpdateImageOffsets((*bestit).m_strFileName, 0, 0, 0);
-					m_RunningStackingEngine.AddImage((*bestit), this);
-					PostChangeImageStatus((*bestit).m_strFileName, IS_STACKED);
-					PostChangeImageInfo((*bestit).m_strFileName, II_SETREFERENCE);
+					CLightFrameInfo &		lfi = (*bestit).m_lfi;
+
+					m_RunningStackingEngine.ComputeOffset(lfi);
+					PostUpdateImageOffsets(lfi.m_strFileName, 0, 0, 0);
+					m_RunningStackingEngine.AddImage(lfi, this, (*bestit).m_pBitmap);
+					PostChangeImageStatus(lfi.m_strFileName, IS_STACKED);
+					PostChangeImageInfo(lfi.m_strFileName, II_SETREFERENCE);
 					m_qToStack.erase(bestit);
 					m_bReferenceFrameSet = TRUE;
 					PostStackedImage();
@@ -505,7 +649,7 @@ BOOL CLiveEngine::ProcessNext()
 		}
 		else
 		{
-			CLightFrameInfo			lfi;
+			CLiveFrame				Frame;
 			double					fdX, fdY, fAngle;
 			CString					strError;
 			CString					strText;
@@ -513,8 +657,11 @@ BOOL CLiveEngine::ProcessNext()
 			BOOL					bWarning = FALSE;
 			CString					strWarning;
 
-			lfi = m_qToStack.front();
+			Frame = m_qToStack.front();
 			m_qToStack.pop_front();
+
+			CLightFrameInfo &		lfi = Frame.m_lfi;
+
 			if (m_RunningStackingEngine.ComputeOffset(lfi))
 			{
 				lfi.m_BilinearParameters.Offsets(fdX, fdY);
@@ -526,7 +673,7 @@ BOOL CLiveEngine::ProcessNext()
 					PostWarning(strWarning);
 				if (IsImageStackable2(lfi.m_strFileName, fdX, fdY, fAngle, strError))
 				{
-					m_RunningStackingEngine.AddImage(lfi, this);
+					m_RunningStackingEngine.AddImage(lfi, this, Frame.m_pBitmap);
 					PostChangeImageStatus(lfi.m_strFileName, IS_STACKED);
 
 					CPointExt		pt1, pt2, pt3, pt4;
@@ -557,25 +704,12 @@ BOOL CLiveEngine::ProcessNext()
 				strText.Format(IDS_LOG_IMAGENOTSTACKABLE1, (LPCTSTR)lfi.m_strFileName, (LPCTSTR) strError);
 				PostToLog(strText, TRUE, TRUE, FALSE, RGB(255, 0, 0));
 				PostChangeImageStatus(lfi.m_strFileName, IS_NOTSTACKABLE);
-				MoveImage(lfi.m_strFileName);
+				MoveImage(m_LiveSettings, lfi.m_strFileName);
 			};
 
 			bResult = TRUE;
 		};
 	}
-	if (m_bRegisteringOn && !bResult && m_qToRegister.size())
-	{
-		CString			strFileName;
-
-		strFileName = m_qToRegister.front();
-		m_qToRegister.pop_front();
-		PostUpdatePending();
-		if (IsFileAvailable(strFileName))
-			LoadFile(strFileName);
-		else
-			m_qToRegister.push_back(strFileName);
-		bResult = TRUE;
-	};
 
 	return bResult;
 };
@@ -588,6 +722,7 @@ void CLiveEngine::LiveEngine()
 	MSG					msg;
 
 	PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE);
+	StartPipeline();
 	SetEvent(m_hEvent);
 	while (!bEnd && ::GetMessage(&msg, nullptr, 0, 0))
 	{
@@ -607,29 +742,39 @@ void CLiveEngine::LiveEngine()
 						if (pMsg->GetNewFile(strFileName))
 						{
 							// Add the file to the to do list
-							m_qToRegister.push_back(strFileName);
+							m_qToRegister.Push(strFileName);
 							PostUpdatePending();
 						};
 					};
 					break;
 				case LEM_UPDATESETTINGS :
-					m_LiveSettings.LoadFromRegistry();
+					{
+						CLiveSettings		LiveSettings;
+
+						LiveSettings.LoadFromRegistry();
+						{
+							std::lock_guard<std::mutex>		Lock(m_SettingsMutex);
+
+							m_LiveSettings = LiveSettings;
+						};
+						m_RunningStackingEngine.SetStackingMode((RUNNINGSTACKINGMODE)m_LiveSettings.GetStackingMode(), m_LiveSettings.GetKappa(), m_LiveSettings.GetWindowSize());
+					};
 					break;
 				case LEM_SAVESTACKEDIMAGE :
 					SaveStackedImage();
 					break;
 				case LEM_ENABLESTACKING :
-					m_bRegisteringOn = TRUE;
+					EnableRegisteringStage(TRUE);
 					m_bStackingOn = TRUE;
 					break;
 				case LEM_DISABLESTACKING :
 					m_bStackingOn = FALSE;
 					break;
 				case LEM_ENABLEREGISTERING :
-					m_bRegisteringOn = TRUE;
+					EnableRegisteringStage(TRUE);
 					break;
 				case LEM_DISABLEREGISTERING :
-					m_bRegisteringOn = FALSE;
+					EnableRegisteringStage(FALSE);
 					m_bStackingOn    = FALSE;
 					break;
 				case LEM_CLEARSTACKEDIMAGE :
@@ -638,8 +783,7 @@ void CLiveEngine::LiveEngine()
 					PostStackedImage();
 					break;
 				case LEM_CLEARPENDINGIMAGES :
-					m_qToRegister.clear();
-					m_qToStack.clear();
+					ClearPipeline();
 					PostUpdatePending();
 					break;
 				case LEM_STOP :
@@ -654,6 +798,8 @@ void CLiveEngine::LiveEngine()
 			SetEvent(m_hEvent);
 		};
 	};
+
+	StopPipeline();
 };
 
 /* ------------------------------------------------------------------- */
@@ -840,13 +986,15 @@ void CLiveEngine::PostUpdatePending()
 	CSmartPtr<CLiveEngineMsg>	pMsg;
 
 	pMsg.Create();
-	pMsg->SetPending((LONG)(m_qToRegister.size()));
+	pMsg->SetPending((LONG)(m_qToRegister.Size()));
 	PostOutMessage(pMsg);
 };
 
 /* ------------------------------------------------------------------- */
 
-CLiveEngine::CLiveEngine()
+CLiveEngine::CLiveEngine() :
+	m_qLoaded(1),
+	m_qRegistered(2)
 {
 	m_hWndOut			= nullptr;
 	m_hThread			= nullptr;
@@ -857,6 +1005,7 @@ CLiveEngine::CLiveEngine()
 	m_bReferenceFrameSet = FALSE;
 	m_lNrUnsavedImages   = 0;
 	m_LiveSettings.LoadFromRegistry();
+	m_RunningStackingEngine.SetStackingMode((RUNNINGSTACKINGMODE)m_LiveSettings.GetStackingMode(), m_LiveSettings.GetKappa(), m_LiveSettings.GetWindowSize());
     m_lTotal1 = 0;
     m_lTotal2 = 0;
     m_lAchieved1 = 0;
@@ -1166,3 +1315,84 @@ BOOL	CLiveEngine::Warning(LPCTSTR szText)
 };
 
 /* ------------------------------------------------------------------- */
+
+/* ------------------------------------------------------------------- */
+// CLiveStageProgress methods
+
+void	CLiveStageProgress::Start(LPCTSTR szTitle, LONG lTotal1, bool bEnableCancel)
+{
+	CString			strText = szTitle;
+
+	if (strText.GetLength())
+	{
+		m_strProgress1 = szTitle;
+		strText.Replace(_T("\n"), _T(" "));
+		strText += "\n";
+		m_pLiveEngine->PostToLog(strText, TRUE);
+	};
+	if (lTotal1)
+		m_lTotal1      = lTotal1;
+	m_lAchieved1   = 0;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLiveStageProgress::Progress1(LPCTSTR szText, LONG lAchieved1)
+{
+	if (szText)
+		m_strProgress1 = szText;
+	if (((double)(lAchieved1-m_lAchieved1)/(double)m_lTotal1) > 0.10)
+	{
+		m_pLiveEngine->PostProgress(m_strProgress1, lAchieved1, m_lTotal1);
+		m_lAchieved1 = lAchieved1;
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLiveStageProgress::Start2(LPCTSTR szText, LONG lTotal2)
+{
+	CString			strText = szText;
+
+	if (strText.GetLength())
+	{
+		m_strProgress2 = szText;
+		strText.Replace(_T("\n"), _T(" "));
+		strText += "\n";
+		m_pLiveEngine->PostToLog(strText, TRUE);
+	};
+	if (lTotal2)
+		m_lTotal2      = lTotal2;
+	m_lAchieved2   = 0;
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLiveStageProgress::Progress2(LPCTSTR szText, LONG lAchieved2)
+{
+	if (szText)
+		m_strProgress2 = szText;
+	if ((((double)(lAchieved2-m_lAchieved2)/(double)m_lTotal2) > 0.10) ||
+		 (lAchieved2 == m_lTotal2))
+	{
+		m_pLiveEngine->PostProgress(m_strProgress2, lAchieved2, m_lTotal2);
+		m_lAchieved2 = lAchieved2;
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+void	CLiveStageProgress::End2()
+{
+	m_pLiveEngine->PostEndProgress();
+};
+
+/* ------------------------------------------------------------------- */
+
+bool	CLiveStageProgress::Close()
+{
+	m_pLiveEngine->PostEndProgress();
+	return true;
+};
+
+/* ------------------------------------------------------------------- */
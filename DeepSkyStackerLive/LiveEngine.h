@@ -3,6 +3,9 @@
 
 #include <queue>
 #include <list>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include "DSSProgress.h"
 #include "DSSTools.h"
 #include "BitmapExt.h"
@@ -474,8 +477,180 @@ typedef LIVEENGINEMSGLIST::iterator				LIVEENGINEMSGITERATOR;
 
 /* ------------------------------------------------------------------- */
 
+// Queue between two stages of the live pipeline.
+// Push waits while the queue is full (when it has a capacity) and Pop
+// waits while the queue is empty or disabled. Both return false once
+// the queue is stopped.
+template <typename TItem>
+class CLivePipelineQueue
+{
+private :
+	std::mutex					m_Mutex;
+	std::condition_variable		m_Changed;
+	std::deque<TItem>			m_qItems;
+	size_t						m_lCapacity;
+	bool						m_bEnabled;
+	bool						m_bStopped;
+
+public :
+	CLivePipelineQueue(size_t lCapacity = 0)
+	{
+		m_lCapacity = lCapacity;
+		m_bEnabled	= true;
+		m_bStopped	= false;
+	};
+
+	bool	Push(const TItem & Item)
+	{
+		std::unique_lock<std::mutex>	Lock(m_Mutex);
+
+		m_Changed.wait(Lock, [this]() { return m_bStopped || !m_lCapacity || m_qItems.size() < m_lCapacity; });
+		if (!m_bStopped)
+		{
+			m_qItems.push_back(Item);
+			m_Changed.notify_all();
+		};
+
+		return !m_bStopped;
+	};
+
+	bool	Pop(TItem & Item)
+	{
+		std::unique_lock<std::mutex>	Lock(m_Mutex);
+
+		m_Changed.wait(Lock, [this]() { return m_bStopped || (m_bEnabled && !m_qItems.empty()); });
+		if (!m_bStopped)
+		{
+			Item = m_qItems.front();
+			m_qItems.pop_front();
+			m_Changed.notify_all();
+		};
+
+		return !m_bStopped;
+	};
+
+	bool	TryPop(TItem & Item)
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+		bool							bResult = !m_bStopped && !m_qItems.empty();
+
+		if (bResult)
+		{
+			Item = m_qItems.front();
+			m_qItems.pop_front();
+			m_Changed.notify_all();
+		};
+
+		return bResult;
+	};
+
+	size_t	Size()
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		return m_qItems.size();
+	};
+
+	void	Clear()
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		m_qItems.clear();
+		m_Changed.notify_all();
+	};
+
+	void	Enable(bool bEnable)
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		m_bEnabled = bEnable;
+		m_Changed.notify_all();
+	};
+
+	void	Stop()
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		m_bStopped = true;
+		m_Changed.notify_all();
+	};
+
+	void	Restart()
+	{
+		std::lock_guard<std::mutex>		Lock(m_Mutex);
+
+		m_bStopped = false;
+	};
+};
+
+/* ------------------------------------------------------------------- */
+
+// Light frame going through the live pipeline (loading, registering
+// and stacking). The decoded bitmap is handed from one stage to the next
+// so that the file is decoded only once.
+class CLiveFrame
+{
+public :
+	CString						m_strFileName;
+	CBitmapInfo					m_BitmapInfo;
+	CSmartPtr<CMemoryBitmap>	m_pBitmap;
+	CLightFrameInfo				m_lfi;
+};
+
+/* ------------------------------------------------------------------- */
+
+class CLiveEngine;
+
+// Progress of one of the stages running in their own thread
+class CLiveStageProgress : public CDSSProgress
+{
+private :
+	CLiveEngine *				m_pLiveEngine;
+	CString						m_strProgress1;
+	CString						m_strProgress2;
+	LONG						m_lTotal1,
+								m_lTotal2;
+	LONG						m_lAchieved1,
+								m_lAchieved2;
+
+public :
+	CLiveStageProgress(CLiveEngine * pLiveEngine)
+	{
+		m_pLiveEngine = pLiveEngine;
+		m_lTotal1 = 0;
+		m_lTotal2 = 0;
+		m_lAchieved1 = 0;
+		m_lAchieved2 = 0;
+	};
+
+	virtual ~CLiveStageProgress() {};
+
+	virtual void	GetStartText(CString & strText)
+	{
+		strText = m_strProgress1;
+	};
+	virtual void	GetStart2Text(CString & strText)
+	{
+		strText = m_strProgress2;
+	};
+	virtual	void	Start(LPCTSTR szTitle, LONG lTotal1, bool bEnableCancel = true);
+	virtual void	Progress1(LPCTSTR szText, LONG lAchieved1);
+	virtual void	Start2(LPCTSTR szText, LONG lTotal2);
+	virtual void	Progress2(LPCTSTR szText, LONG lAchieved2);
+	virtual void	End2();
+	virtual bool	IsCanceled()
+	{
+		return false;
+	};
+	virtual bool	Close();
+};
+
+/* ------------------------------------------------------------------- */
+
 class CLiveEngine : public CDSSProgress
 {
+	friend class CLiveStageProgress;
+
 private :
 	CComAutoCriticalSection		m_CriticalSection;
 	LIVEENGINEMSGLIST			m_InMessages;
@@ -484,9 +659,16 @@ private :
 	HANDLE						m_hThread;
 	DWORD						m_dwThreadID;
 	HANDLE						m_hEvent;
+	// Only changed by the engine thread (which reads it directly), the
+	// loading and registering stages get copies from GetLiveSettings
 	CLiveSettings				m_LiveSettings;
-	std::deque<CString>			m_qToRegister;
-	std::deque<CLightFrameInfo>	m_qToStack;
+	std::mutex					m_SettingsMutex;
+	CLivePipelineQueue<CString>		m_qToRegister;
+	CLivePipelineQueue<CLiveFrame>	m_qLoaded;
+	CLivePipelineQueue<CLiveFrame>	m_qRegistered;
+	std::deque<CLiveFrame>		m_qToStack;
+	std::thread					m_LoadingThread;
+	std::thread					m_RegisteringThread;
 	BOOL						m_bStackingOn;
 	BOOL						m_bRegisteringOn;
 	BOOL						m_bReferenceFrameSet;
@@ -512,13 +694,21 @@ private :
 	void	PostStackedImage();
 	void	PostStackedImageSaved();
 	void	PostWarning(LPCTSTR szWarning);
-	BOOL	IsImageStackable1(LPCTSTR szFile, double fStarCount, double fFWHM, double fScore, double fSkyBackground, CString & strError);
+	BOOL	IsImageStackable1(CLiveSettings & LiveSettings, LPCTSTR szFile, double fStarCount, double fFWHM, double fScore, double fSkyBackground, CString & strError);
 	BOOL	IsImageStackable2(LPCTSTR szFile, double fdX, double fdY, double fAngle, CString & strError);
-	BOOL	IsImageWarning1(LPCTSTR szFile, double fStarCount, double fFWHM, double fScore, double fSkyBackground, CString & strWarning);
+	BOOL	IsImageWarning1(CLiveSettings & LiveSettings, LPCTSTR szFile, double fStarCount, double fFWHM, double fScore, double fSkyBackground, CString & strWarning);
 	BOOL	IsImageWarning2(LPCTSTR szFile, double fdX, double fdY, double fAngle, CString & strWarning);
-	BOOL	LoadFile(LPCTSTR szFileName);
+	BOOL	LoadFile(LPCTSTR szFileName, CLiveFrame & Frame, CDSSProgress * pProgress);
+	void	RegisterFrame(CLiveFrame & Frame, CDSSProgress * pProgress);
+	void	LoadingStage();
+	void	RegisteringStage();
+	void	StartPipeline();
+	void	StopPipeline();
+	void	ClearPipeline();
+	void	EnableRegisteringStage(BOOL bEnable);
 	BOOL	ProcessNext();
-	void	MoveImage(LPCTSTR szFileName);
+	void	MoveImage(CLiveSettings & LiveSettings, LPCTSTR szFileName);
+	void	GetLiveSettings(CLiveSettings & LiveSettings);
 
 public :
 	CLiveEngine();
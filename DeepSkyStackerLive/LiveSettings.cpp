@@ -20,6 +20,9 @@ void	CLiveSettings::LoadFromRegistry()
 	reg.LoadKey(REGENTRY_BASEKEY_LIVE, _T("Angle"), m_dwAngle);
 	reg.LoadKey(REGENTRY_BASEKEY_LIVE, _T("SkyBackground"), m_dwSkyBackground);
 	reg.LoadKey(REGENTRY_BASEKEY_LIVE, _T("SaveCount"), m_dwSaveCount);
+	reg.LoadKey(REGENTRY_BASEKEY_LIVE, _T("StackingMode"), m_dwStackingMode);
+	reg.LoadKey(REGENTRY_BASEKEY_LIVE, _T("Kappa"), m_dwKappa);
+	reg.LoadKey(REGENTRY_BASEKEY_LIVE, _T("WindowSize"), m_dwWindowSize);
 	reg.LoadKey(REGENTRY_BASEKEY_LIVE, _T("FileFolder"), m_strFileFolder);
 	reg.LoadKey(REGENTRY_BASEKEY_LIVE, _T("Email"), m_strEmail);
 	reg.LoadKey(REGENTRY_BASEKEY_LIVE, _T("WarningFileFolder"), m_strWarnFileFolder);
@@ -58,6 +61,9 @@ void	CLiveSettings::SaveToRegistry()
 	reg.SaveKey(REGENTRY_BASEKEY_LIVE, _T("Angle"), m_dwAngle);
 	reg.SaveKey(REGENTRY_BASEKEY_LIVE, _T("SkyBackground"), m_dwSkyBackground);
 	reg.SaveKey(REGENTRY_BASEKEY_LIVE, _T("SaveCount"), m_dwSaveCount);
+	reg.SaveKey(REGENTRY_BASEKEY_LIVE, _T("StackingMode"), m_dwStackingMode);
+	reg.SaveKey(REGENTRY_BASEKEY_LIVE, _T("Kappa"), m_dwKappa);
+	reg.SaveKey(REGENTRY_BASEKEY_LIVE, _T("WindowSize"), m_dwWindowSize);
 	reg.SaveKey(REGENTRY_BASEKEY_LIVE, _T("FileFolder"), m_strFileFolder);
 	reg.SaveKey(REGENTRY_BASEKEY_LIVE, _T("Email"), m_strEmail);
 	reg.SaveKey(REGENTRY_BASEKEY_LIVE, _T("WarningFileFolder"), m_strWarnFileFolder);
@@ -45,6 +45,9 @@ private :
 	DWORD				m_dwSaveCount;
 	DWORD				m_dwProcessFlags;
 	DWORD				m_dwSkyBackground;
+	DWORD				m_dwStackingMode;		// RUNNINGSTACKINGMODE
+	DWORD				m_dwKappa;
+	DWORD				m_dwWindowSize;
 	CString				m_strFileFolder;
 	CString				m_strWarnFileFolder;
 	CString				m_strStackedOutputFolder;
@@ -70,6 +73,9 @@ public :
 		m_dwAngle		  = 20;
 		m_dwSaveCount	  = 10;
 		m_dwSkyBackground = 20;
+		m_dwStackingMode  = 0;
+		m_dwKappa		  = 25;
+		m_dwWindowSize	  = 10;
 		m_dwProcessFlags  = LSPF_ALL;
 		m_bDarkMode = true;
 	};
@@ -247,6 +253,38 @@ public :
 		m_dwAngle = fAngle*10.0;
 	};
 
+	DWORD	GetStackingMode()
+	{
+		// Unknown values (from the registry) are read as the average
+		// (RUNNINGSTACKINGMODE: 0 to 2)
+		return (m_dwStackingMode <= 2) ? m_dwStackingMode : 0;
+	};
+
+	void	SetStackingMode(DWORD dwStackingMode)
+	{
+		m_dwStackingMode = dwStackingMode;
+	};
+
+	double	GetKappa()
+	{
+		return (double)m_dwKappa/10.0;
+	};
+
+	void	SetKappa(double fKappa)
+	{
+		m_dwKappa = fKappa*10.0;
+	};
+
+	DWORD	GetWindowSize()
+	{
+		return m_dwWindowSize;
+	};
+
+	void	SetWindowSize(DWORD dwWindowSize)
+	{
+		m_dwWindowSize = dwWindowSize;
+	};
+
 	void	GetFileFolder(CString & strFileFolder)
 	{
 		strFileFolder = m_strFileFolder;